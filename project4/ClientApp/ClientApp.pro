@@ -5,11 +5,19 @@ CONFIG += c++17
 TARGET = ClientApp
 TEMPLATE = app
 
+include(../Common/common.pri)
+
 SOURCES += \
+    filetransfers.cpp \
     main.cpp \
+    transcriptmodel.cpp \
+    userlistmodel.cpp \
     widget.cpp
 
 HEADERS += \
+    filetransfers.h \
+    transcriptmodel.h \
+    userlistmodel.h \
     widget.h
 
 RESOURCES += \
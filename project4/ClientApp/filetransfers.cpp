@@ -0,0 +1,279 @@
+#include "filetransfers.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include "wireformat.h"
+
+FileTransfers::FileTransfers(QObject *parent)
+    : QObject(parent), downloadDirectory(QDir::homePath()), nextId(1)
+{
+}
+
+FileTransfers::~FileTransfers()
+{
+    abortAll();
+}
+
+void FileTransfers::setDownloadDirectory(const QString &directory)
+{
+    downloadDirectory = directory;
+}
+
+bool FileTransfers::offer(const QString &peer, const QString &path)
+{
+    QSharedPointer<QFile> file(new QFile(path));
+    if (!file->open(QIODevice::ReadOnly)) {
+        emit status(QString("[文件] 无法打开 %1: %2").arg(path).arg(file->errorString()));
+        return false;
+    }
+
+    const qint64 id = nextId++;
+    Outgoing transfer;
+    transfer.peer = peer;
+    transfer.file = file;
+    transfer.size = file->size();
+    transfer.chunks = (transfer.size + Wire::FileChunkSize - 1) / Wire::FileChunkSize;
+    outgoing.insert(id, transfer);
+
+    QCborMap message;
+    message[QLatin1String("name")] = QFileInfo(path).fileName();
+    message[QLatin1String("size")] = transfer.size;
+    send(QStringLiteral("file_offer"), peer, id, message);
+    emit status(QString("[文件] 等待 %1 接收 %2（%3 字节）")
+                    .arg(peer).arg(QFileInfo(path).fileName()).arg(transfer.size));
+    return true;
+}
+
+void FileTransfers::accept(const QString &peer, qint64 id)
+{
+    auto it = incoming.find(incomingKey(peer, id));
+    if (it == incoming.end() || it->file)
+        return;
+
+    const QString path = uniquePath(it->name);
+    QSharedPointer<QSaveFile> file(new QSaveFile(path));
+    if (!file->open(QIODevice::WriteOnly)) {
+        const QString reason = file->errorString();
+        cancelIncoming(peer, id, QString("无法写入 %1: %2").arg(path).arg(reason));
+        return;
+    }
+    it->file = file;
+    send(QStringLiteral("file_accept"), peer, id);
+    emit status(QString("[文件] 开始接收 %1 的 %2").arg(peer).arg(it->name));
+}
+
+void FileTransfers::reject(const QString &peer, qint64 id)
+{
+    cancelIncoming(peer, id, QString());
+}
+
+void FileTransfers::handleMessage(const QString &type, const QCborMap &obj)
+{
+    const QString peer = obj[QLatin1String("peer")].toString();
+    const qint64 id = obj[QLatin1String("id")].toInteger();
+    if (peer.isEmpty())
+        return;
+
+    if (type == "file_offer") {
+        const QString key = incomingKey(peer, id);
+        if (incoming.contains(key))
+            return;
+        Incoming transfer;
+        // 只取文件名部分，不让对方决定保存到哪个目录
+        transfer.name = QFileInfo(obj[QLatin1String("name")].toString().replace('\\', '/')).fileName();
+        if (transfer.name.isEmpty())
+            transfer.name = QStringLiteral("file");
+        transfer.size = obj[QLatin1String("size")].toInteger();
+        incoming.insert(key, transfer);
+        emit offered(peer, id, transfer.name, transfer.size);
+    } else if (type == "file_chunk") {
+        auto it = incoming.find(incomingKey(peer, id));
+        if (it == incoming.end() || !it->file)
+            return;
+        const qint64 seq = obj[QLatin1String("seq")].toInteger();
+        if (seq != it->nextSeq) {
+            // 分块在服务器上被丢弃（接收方积压超限）时会出现缺口，无法续传
+            cancelIncoming(peer, id, QString("分块缺失（期望 %1，收到 %2）").arg(it->nextSeq).arg(seq));
+            return;
+        }
+        const QByteArray data = Wire::binaryValue(obj[QLatin1String("data")]);
+        if (it->received + data.size() > it->size) {
+            cancelIncoming(peer, id, "数据超出声明的大小");
+            return;
+        }
+        if (it->file->write(data) != data.size()) {
+            cancelIncoming(peer, id, QString("写入失败: %1").arg(it->file->errorString()));
+            return;
+        }
+        it->received += data.size();
+        ++it->nextSeq;
+        QCborMap ack;
+        ack[QLatin1String("seq")] = seq;
+        send(QStringLiteral("file_ack"), peer, id, ack);
+    } else if (type == "file_done") {
+        auto it = incoming.find(incomingKey(peer, id));
+        if (it == incoming.end() || !it->file)
+            return;
+        if (it->received != it->size) {
+            cancelIncoming(peer, id, QString("文件不完整（%1/%2 字节）").arg(it->received).arg(it->size));
+            return;
+        }
+        const QString path = it->file->fileName();
+        if (!it->file->commit()) {
+            const QString reason = it->file->errorString();
+            incoming.erase(it);
+            emit status(QString("[文件] 保存 %1 失败: %2").arg(path).arg(reason));
+            return;
+        }
+        incoming.erase(it);
+        emit status(QString("[文件] 已收到 %1 的文件，保存为 %2").arg(peer).arg(path));
+    } else if (type == "file_accept") {
+        auto it = outgoing.find(id);
+        if (it == outgoing.end() || it->peer != peer)
+            return;
+        it->accepted = true;
+        emit status(QString("[文件] %1 已接受，开始发送").arg(peer));
+        pump(id);
+    } else if (type == "file_ack") {
+        auto it = outgoing.find(id);
+        if (it == outgoing.end() || it->peer != peer)
+            return;
+        it->acked = qMax(it->acked, obj[QLatin1String("seq")].toInteger() + 1);
+        pump(id);
+    } else if (type == "file_cancel") {
+        const QString reason = obj[QLatin1String("reason")].toString();
+        // outgoing 为真表示取消的是对方发给自己的文件
+        if (obj[QLatin1String("outgoing")].toBool()) {
+            auto it = incoming.find(incomingKey(peer, id));
+            if (it == incoming.end())
+                return;
+            incoming.erase(it);
+        } else {
+            auto it = outgoing.find(id);
+            if (it == outgoing.end() || it->peer != peer)
+                return;
+            outgoing.erase(it);
+        }
+        emit status(reason.isEmpty() ? QString("[文件] %1 取消了传输").arg(peer)
+                                     : QString("[文件] 传输已取消: %1").arg(reason));
+    }
+}
+
+void FileTransfers::peerLeft(const QString &peer)
+{
+    for (auto it = incoming.begin(); it != incoming.end();) {
+        if (it.key().startsWith(peer + QLatin1Char('/'))
+            && it.key().indexOf(QLatin1Char('/'), peer.size() + 1) < 0) {
+            if (it->file)
+                it->file->cancelWriting();
+            emit status(QString("[文件] %1 已下线，放弃接收 %2").arg(peer).arg(it->name));
+            it = incoming.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = outgoing.begin(); it != outgoing.end();) {
+        if (it->peer == peer) {
+            emit status(QString("[文件] %1 已下线，停止发送").arg(peer));
+            it = outgoing.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FileTransfers::abortAll()
+{
+    for (auto it = incoming.begin(); it != incoming.end(); ++it) {
+        if (it->file)
+            it->file->cancelWriting();
+    }
+    incoming.clear();
+    outgoing.clear();
+}
+
+QString FileTransfers::incomingKey(const QString &peer, qint64 id)
+{
+    return peer + QLatin1Char('/') + QString::number(id);
+}
+
+// 在确认窗口内尽量多发；每收到一个 file_ack 窗口前移一块
+void FileTransfers::pump(qint64 id)
+{
+    auto it = outgoing.find(id);
+    if (it == outgoing.end() || !it->accepted)
+        return;
+
+    while (it->nextSeq < it->chunks && it->nextSeq - it->acked < Wire::FileWindow) {
+        const QByteArray data = it->file->read(Wire::FileChunkSize);
+        if (data.isEmpty()) {
+            cancelOutgoing(id, QString("读取失败: %1").arg(it->file->errorString()));
+            return;
+        }
+        QCborMap chunk;
+        chunk[QLatin1String("seq")] = it->nextSeq;
+        chunk[QLatin1String("data")] = data;
+        send(QStringLiteral("file_chunk"), it->peer, id, chunk);
+        ++it->nextSeq;
+    }
+
+    if (it->acked >= it->chunks) {
+        send(QStringLiteral("file_done"), it->peer, id);
+        emit status(QString("[文件] 已发送给 %1（%2 字节）").arg(it->peer).arg(it->size));
+        outgoing.erase(it);
+    }
+}
+
+void FileTransfers::send(const QString &type, const QString &peer, qint64 id, QCborMap message)
+{
+    message[QLatin1String("type")] = type;
+    message[QLatin1String("peer")] = peer;
+    message[QLatin1String("id")] = id;
+    emit sendRequested(message);
+}
+
+void FileTransfers::cancelIncoming(const QString &peer, qint64 id, const QString &reason)
+{
+    auto it = incoming.find(incomingKey(peer, id));
+    if (it == incoming.end())
+        return;
+    if (it->file)
+        it->file->cancelWriting();
+    incoming.erase(it);
+
+    QCborMap message;
+    if (!reason.isEmpty())
+        message[QLatin1String("reason")] = reason;
+    send(QStringLiteral("file_cancel"), peer, id, message);
+    if (!reason.isEmpty())
+        emit status(QString("[文件] 接收 %1 的文件失败: %2").arg(peer).arg(reason));
+}
+
+void FileTransfers::cancelOutgoing(qint64 id, const QString &reason)
+{
+    auto it = outgoing.find(id);
+    if (it == outgoing.end())
+        return;
+    const QString peer = it->peer;
+    outgoing.erase(it);
+
+    QCborMap message;
+    message[QLatin1String("outgoing")] = true;
+    message[QLatin1String("reason")] = reason;
+    send(QStringLiteral("file_cancel"), peer, id, message);
+    emit status(QString("[文件] 发送给 %1 失败: %2").arg(peer).arg(reason));
+}
+
+QString FileTransfers::uniquePath(const QString &name) const
+{
+    const QDir dir(downloadDirectory);
+    QString path = dir.filePath(name);
+    const QFileInfo info(name);
+    for (int n = 1; QFile::exists(path); ++n) {
+        const QString suffix = info.completeSuffix();
+        path = dir.filePath(suffix.isEmpty() ? QString("%1 (%2)").arg(info.baseName()).arg(n)
+                                             : QString("%1 (%2).%3").arg(info.baseName()).arg(n).arg(suffix));
+    }
+    return path;
+}
@@ -0,0 +1,80 @@
+#ifndef FILETRANSFERS_H
+#define FILETRANSFERS_H
+
+#include <QObject>
+#include <QCborMap>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+class QFile;
+class QSaveFile;
+QT_END_NAMESPACE
+
+// 经服务器转发的点对点文件传输
+//   发送方：file_offer → 等 file_accept → file_chunk（seq 从 0 起）…… → 全部确认后 file_done
+//   接收方：file_accept → 每写完一块回 file_ack → file_done 时提交文件
+// 任一方可随时 file_cancel。发送方未确认的分块不超过 Wire::FileWindow 个，
+// 所以分块与聊天消息交错出现在连接上，大文件不会把聊天消息堵在后面
+class FileTransfers : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileTransfers(QObject *parent = nullptr);
+    ~FileTransfers();
+
+    // 接收的文件保存在这里
+    void setDownloadDirectory(const QString &directory);
+
+    bool offer(const QString &peer, const QString &path);
+    void accept(const QString &peer, qint64 id);
+    void reject(const QString &peer, qint64 id);
+    // 处理 file_* 消息
+    void handleMessage(const QString &type, const QCborMap &obj);
+    // 对方下线时放弃与其相关的传输
+    void peerLeft(const QString &peer);
+    // 断线时放弃所有未完成的传输
+    void abortAll();
+
+signals:
+    void sendRequested(const QCborMap &message);
+    void offered(const QString &peer, qint64 id, const QString &name, qint64 size);
+    void status(const QString &message);
+
+private:
+    struct Outgoing
+    {
+        QString peer;
+        QSharedPointer<QFile> file;
+        qint64 size = 0;
+        qint64 chunks = 0;
+        qint64 nextSeq = 0;
+        qint64 acked = 0;       // 已确认的块数
+        bool accepted = false;
+    };
+
+    struct Incoming
+    {
+        QString name;
+        QSharedPointer<QSaveFile> file;   // 未提交前写在临时文件里，取消时直接丢弃
+        qint64 size = 0;
+        qint64 received = 0;
+        qint64 nextSeq = 0;
+    };
+
+    QString downloadDirectory;
+    QHash<qint64, Outgoing> outgoing;
+    QHash<QString, Incoming> incoming;   // 键为 peer + '/' + id
+    qint64 nextId;
+
+    static QString incomingKey(const QString &peer, qint64 id);
+    void pump(qint64 id);
+    void send(const QString &type, const QString &peer, qint64 id, QCborMap message = QCborMap());
+    void cancelIncoming(const QString &peer, qint64 id, const QString &reason);
+    void cancelOutgoing(qint64 id, const QString &reason);
+    QString uniquePath(const QString &name) const;
+};
+
+#endif // FILETRANSFERS_H
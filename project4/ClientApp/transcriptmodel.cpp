@@ -0,0 +1,200 @@
+#include "transcriptmodel.h"
+#include <QDir>
+#include <QtEndian>
+
+TranscriptModel::TranscriptModel(QObject *parent)
+    : QAbstractListModel(parent), window(WindowCapacity), textEnd(0), total(0), cacheOk(false)
+{
+    textFile.setFileTemplate(QDir::tempPath() + "/transcript-XXXXXX.txt");
+    indexFile.setFileTemplate(QDir::tempPath() + "/transcript-XXXXXX.idx");
+    openCache();
+}
+
+void TranscriptModel::appendLine(const QString &line)
+{
+    appendLines(QStringList() << line);
+}
+
+void TranscriptModel::appendLines(const QStringList &lines)
+{
+    if (lines.isEmpty())
+        return;
+
+    const bool follow = atTail();
+    for (const QString &line : lines)
+        writeLine(line);
+    if (!follow)
+        return;
+
+    // 窗口放不下时先从头部淘汰，淘汰的行仍可从缓存文件读回
+    const int incoming = qMin(lines.size(), WindowCapacity);
+    const int overflow = window.count() + incoming - WindowCapacity;
+    if (overflow > 0)
+        trimFront(overflow);
+
+    // 按全局序号插入：一次追加超过窗口容量时，跳过的行不会让序号错位
+    beginInsertRows(QModelIndex(), window.count(), window.count() + incoming - 1);
+    for (int i = lines.size() - incoming; i < lines.size(); ++i)
+        window.insert(static_cast<int>(total - lines.size() + i), lines.at(i));
+    endInsertRows();
+}
+
+void TranscriptModel::clear()
+{
+    beginResetModel();
+    window.clear();
+    textEnd = 0;
+    total = 0;
+    openCache();
+    endResetModel();
+}
+
+bool TranscriptModel::atTail() const
+{
+    return window.isEmpty() ? true : window.lastIndex() + 1 >= total;
+}
+
+int TranscriptModel::loadOlder()
+{
+    if (window.isEmpty() || window.firstIndex() == 0)
+        return 0;
+    const qint64 first = qMax<qint64>(0, window.firstIndex() - PageSize);
+    const QStringList lines = readLines(first, static_cast<int>(window.firstIndex() - first));
+    if (lines.isEmpty())
+        return 0;
+
+    const int overflow = window.count() + lines.size() - WindowCapacity;
+    if (overflow > 0)
+        trimBack(overflow);
+    beginInsertRows(QModelIndex(), 0, lines.size() - 1);
+    for (int i = lines.size() - 1; i >= 0; --i)
+        window.insert(static_cast<int>(first + i), lines.at(i));
+    endInsertRows();
+    return lines.size();
+}
+
+int TranscriptModel::loadNewer()
+{
+    if (atTail())
+        return 0;
+    const qint64 first = window.lastIndex() + 1;
+    const QStringList lines = readLines(first, static_cast<int>(qMin<qint64>(PageSize, total - first)));
+    if (lines.isEmpty())
+        return 0;
+
+    const int overflow = window.count() + lines.size() - WindowCapacity;
+    if (overflow > 0)
+        trimFront(overflow);
+    beginInsertRows(QModelIndex(), window.count(), window.count() + lines.size() - 1);
+    for (int i = 0; i < lines.size(); ++i)
+        window.insert(static_cast<int>(first + i), lines.at(i));
+    endInsertRows();
+    return lines.size();
+}
+
+int TranscriptModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : window.count();
+}
+
+QVariant TranscriptModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= window.count())
+        return QVariant();
+    if (role == Qt::DisplayRole || role == Qt::ToolTipRole)
+        return window.at(window.firstIndex() + index.row());
+    return QVariant();
+}
+
+void TranscriptModel::openCache()
+{
+    textFile.close();
+    indexFile.close();
+    // 重新打开沿用同一对临时文件，截断为空；对象析构时删除
+    cacheOk = textFile.open() && indexFile.open()
+              && textFile.resize(0) && indexFile.resize(0);
+}
+
+bool TranscriptModel::writeLine(const QString &line)
+{
+    ++total;
+    if (!cacheOk)
+        return false;
+
+    // 读分页时移动过文件位置，写入前回到末尾
+    if (textFile.pos() != textEnd)
+        textFile.seek(textEnd);
+    if (indexFile.pos() != (total - 1) * 8)
+        indexFile.seek((total - 1) * 8);
+
+    char offset[8];
+    qToLittleEndian<qint64>(textEnd, offset);
+    QByteArray utf8 = line.toUtf8();
+    utf8.replace('\n', ' ');
+    utf8.append('\n');
+    if (indexFile.write(offset, sizeof(offset)) != sizeof(offset) || textFile.write(utf8) != utf8.size()) {
+        cacheOk = false;
+        return false;
+    }
+    textEnd += utf8.size();
+    return true;
+}
+
+QStringList TranscriptModel::readLines(qint64 first, int count)
+{
+    QStringList lines;
+    if (!cacheOk || count <= 0 || first < 0 || first + count > total)
+        return lines;
+    textFile.flush();
+    indexFile.flush();
+
+    if (!indexFile.seek(first * 8))
+        return lines;
+    const QByteArray offsets = indexFile.read(8);
+    if (offsets.size() != 8)
+        return lines;
+    const qint64 begin = qFromLittleEndian<qint64>(offsets.constData());
+    qint64 end = textEnd;
+    if (first + count < total) {
+        indexFile.seek((first + count) * 8);
+        const QByteArray next = indexFile.read(8);
+        if (next.size() != 8)
+            return lines;
+        end = qFromLittleEndian<qint64>(next.constData());
+    }
+
+    if (!textFile.seek(begin))
+        return lines;
+    QByteArray block = textFile.read(end - begin);
+    if (block.endsWith('\n'))
+        block.chop(1);
+    const QList<QByteArray> parts = block.split('\n');
+    if (parts.size() != count)
+        return lines;
+    lines.reserve(count);
+    for (const QByteArray &part : parts)
+        lines.append(QString::fromUtf8(part));
+    return lines;
+}
+
+void TranscriptModel::trimFront(int count)
+{
+    count = qMin(count, window.count());
+    if (count <= 0)
+        return;
+    beginRemoveRows(QModelIndex(), 0, count - 1);
+    for (int i = 0; i < count; ++i)
+        window.removeFirst();
+    endRemoveRows();
+}
+
+void TranscriptModel::trimBack(int count)
+{
+    count = qMin(count, window.count());
+    if (count <= 0)
+        return;
+    beginRemoveRows(QModelIndex(), window.count() - count, window.count() - 1);
+    for (int i = 0; i < count; ++i)
+        window.removeLast();
+    endRemoveRows();
+}
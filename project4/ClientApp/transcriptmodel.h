@@ -0,0 +1,53 @@
+#ifndef TRANSCRIPTMODEL_H
+#define TRANSCRIPTMODEL_H
+
+#include <QAbstractListModel>
+#include <QContiguousCache>
+#include <QStringList>
+#include <QTemporaryFile>
+
+// 聊天记录模型：全部记录追加写入本地缓存文件（正文 + 定长行偏移索引），
+// 内存里只保留一段连续的窗口（环形缓冲，最多 WindowCapacity 行）供视图显示。
+// 追加只写文件末尾并在窗口尾部插入一行，开销与记录总量无关；
+// 视图滚到窗口边缘时按页从缓存文件读入更早或更新的记录，窗口另一端相应淘汰
+class TranscriptModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    static const int WindowCapacity = 1000;
+    static const int PageSize = 200;
+
+    explicit TranscriptModel(QObject *parent = nullptr);
+
+    void appendLine(const QString &line);
+    // 一次插入多行，只通知视图一次
+    void appendLines(const QStringList &lines);
+    // 清空记录并换一个新的缓存文件
+    void clear();
+
+    // 窗口是否包含最新的记录；不包含时新记录只写入缓存文件
+    bool atTail() const;
+    // 从缓存文件读入窗口之前 / 之后的一页，返回读入的行数
+    int loadOlder();
+    int loadNewer();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    QContiguousCache<QString> window;   // 下标即该行在全部记录中的序号
+    QTemporaryFile textFile;            // 每行 UTF-8 文本，以 '\n' 结尾
+    QTemporaryFile indexFile;           // 每行 8 字节的起始偏移
+    qint64 textEnd;
+    qint64 total;
+    bool cacheOk;
+
+    void openCache();
+    bool writeLine(const QString &line);
+    QStringList readLines(qint64 first, int count);
+    void trimFront(int count);
+    void trimBack(int count);
+};
+
+#endif // TRANSCRIPTMODEL_H
@@ -0,0 +1,92 @@
+#include "userlistmodel.h"
+#include <QFont>
+#include <algorithm>
+
+UserListModel::UserListModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+void UserListModel::setSelf(const QString &nickname)
+{
+    const QString previous = self;
+    self = nickname;
+    for (const QString &name : {previous, self}) {
+        const int row = lowerBound(name);
+        if (!name.isEmpty() && row < users.size() && users.at(row) == name)
+            emit dataChanged(index(row), index(row));
+    }
+}
+
+void UserListModel::reset(const QStringList &nicknames)
+{
+    beginResetModel();
+    users = nicknames;
+    std::sort(users.begin(), users.end());
+    users.erase(std::unique(users.begin(), users.end()), users.end());
+    endResetModel();
+}
+
+bool UserListModel::insert(const QString &nickname)
+{
+    const int row = lowerBound(nickname);
+    if (row < users.size() && users.at(row) == nickname)
+        return false;
+    beginInsertRows(QModelIndex(), row, row);
+    users.insert(row, nickname);
+    endInsertRows();
+    return true;
+}
+
+bool UserListModel::remove(const QString &nickname)
+{
+    const int row = lowerBound(nickname);
+    if (row >= users.size() || users.at(row) != nickname)
+        return false;
+    beginRemoveRows(QModelIndex(), row, row);
+    users.removeAt(row);
+    endRemoveRows();
+    return true;
+}
+
+bool UserListModel::contains(const QString &nickname) const
+{
+    const int row = lowerBound(nickname);
+    return row < users.size() && users.at(row) == nickname;
+}
+
+void UserListModel::clear()
+{
+    reset(QStringList());
+}
+
+int UserListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : users.size();
+}
+
+QVariant UserListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= users.size())
+        return QVariant();
+
+    const QString &nickname = users.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+        return nickname == self ? QString("%1 (我)").arg(nickname) : nickname;
+    case Qt::FontRole:
+        if (nickname == self) {
+            QFont font;
+            font.setBold(true);
+            return font;
+        }
+        return QVariant();
+    default:
+        return QVariant();
+    }
+}
+
+int UserListModel::lowerBound(const QString &nickname) const
+{
+    return static_cast<int>(std::lower_bound(users.cbegin(), users.cend(), nickname) - users.cbegin());
+}
@@ -0,0 +1,37 @@
+#ifndef USERLISTMODEL_H
+#define USERLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QString>
+#include <QStringList>
+
+// 在线用户列表模型：昵称按字典序保存，二分查找定位，
+// 单个上线/下线只发出一次 beginInsertRows/beginRemoveRows，视图不需要整表重建
+class UserListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit UserListModel(QObject *parent = nullptr);
+
+    // 自己的昵称加粗并标注“(我)”
+    void setSelf(const QString &nickname);
+    // 整表替换（收到 user_list 快照时）
+    void reset(const QStringList &nicknames);
+    // 已存在 / 不存在时返回 false
+    bool insert(const QString &nickname);
+    bool remove(const QString &nickname);
+    bool contains(const QString &nickname) const;
+    void clear();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    QStringList users;
+    QString self;
+
+    int lowerBound(const QString &nickname) const;
+};
+
+#endif // USERLISTMODEL_H
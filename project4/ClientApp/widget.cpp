@@ -2,11 +2,10 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFormLayout>
-#include <QTextEdit>
 #include <QLineEdit>
 #include <QPushButton>
 #include <QLabel>
-#include <QListWidget>
+#include <QListView>
 #include <QStackedWidget>
 #include <QFile>
 #include <QTextStream>
@@ -15,13 +14,26 @@
 #include <QTcpSocket>
 #include <QApplication>
 #include <QScreen>
-#include <QJsonArray>
+#include <QCborArray>
+#include <QScrollBar>
+#include <QFileDialog>
+#include <QStandardPaths>
+#include <QRandomGenerator>
+#include <QTimer>
+#include "filetransfers.h"
+#include "transcriptmodel.h"
+#include "userlistmodel.h"
 
 Widget::Widget(QWidget *parent)
     : QMainWindow(parent), stackedWidget(nullptr), loginWidget(nullptr), chatWidget(nullptr),
     ipLineEdit(nullptr), nicknameLineEdit(nullptr), loginButton(nullptr),
-    chatTextEdit(nullptr), inputLineEdit(nullptr), sendButton(nullptr), exitButton(nullptr),
-    userListWidget(nullptr), tcpSocket(new QTcpSocket(this)), myNickname("")
+    transcriptView(nullptr), transcript(new TranscriptModel(this)), inputLineEdit(nullptr), sendButton(nullptr), exitButton(nullptr),
+    userListView(nullptr), userModel(new UserListModel(this)), tcpSocket(new QTcpSocket(this)),
+    connectionState(Offline), connectTimer(new QTimer(this)), reconnectTimer(new QTimer(this)),
+    reconnectAttempts(0), serverRetryDelayMs(-1), lastSeenId(0), nextPrivateId(0),
+    transfers(new FileTransfers(this)), myNickname(""),
+    currentRoom(QLatin1String(Wire::DefaultRoom)), wireFormat(Wire::Json), compressThreshold(0), batchLines(nullptr),
+    presenceVersion(0), presenceEpoch(0), chatEpoch(0), chatGapTimer(new QTimer(this))
 {
     setWindowTitle("聊天室客户端");
     resize(600, 600);
@@ -46,8 +58,21 @@ Widget::Widget(QWidget *parent)
     connect(tcpSocket, &QTcpSocket::connected, this, &Widget::onConnected);
     connect(tcpSocket, &QTcpSocket::disconnected, this, &Widget::onDisconnected);
     connect(tcpSocket, &QTcpSocket::readyRead, this, &Widget::onReadyRead);
+    connect(tcpSocket, &QTcpSocket::errorOccurred, this, &Widget::onErrorOccurred);
+    connectTimer->setSingleShot(true);
+    connect(connectTimer, &QTimer::timeout, this, &Widget::onConnectTimeout);
+    reconnectTimer->setSingleShot(true);
+    connect(reconnectTimer, &QTimer::timeout, this, &Widget::startConnect);
+    chatGapTimer->setSingleShot(true);
+    connect(chatGapTimer, &QTimer::timeout, this, &Widget::onChatGapTimeout);
     // 回车发送消息
     connect(inputLineEdit, &QLineEdit::returnPressed, this, &Widget::onSendButtonClicked);
+    // 文件传输
+    transfers->setDownloadDirectory(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation));
+    connect(transfers, &FileTransfers::sendRequested, this, &Widget::sendMessage);
+    connect(transfers, &FileTransfers::status, this,
+            static_cast<void (Widget::*)(const QString &)>(&Widget::appendChatMessage));
+    connect(transfers, &FileTransfers::offered, this, &Widget::onFileOffered);
 }
 
 Widget::~Widget()
@@ -81,12 +106,22 @@ void Widget::createChatInterface()
     QHBoxLayout *contentLayout = new QHBoxLayout();
     chatLayout->addLayout(contentLayout);
 
-    chatTextEdit = new QTextEdit(this);
-    chatTextEdit->setReadOnly(true);
-    contentLayout->addWidget(chatTextEdit, 3);
-
-    userListWidget = new QListWidget(this);
-    contentLayout->addWidget(userListWidget, 1);
+    // 只为可见行排版；行高一致，滚动按行计，滚动条的值就是首个可见行
+    transcriptView = new QListView(this);
+    transcriptView->setObjectName("transcriptView");
+    transcriptView->setModel(transcript);
+    transcriptView->setUniformItemSizes(true);
+    transcriptView->setVerticalScrollMode(QAbstractItemView::ScrollPerItem);
+    transcriptView->setSelectionMode(QAbstractItemView::NoSelection);
+    transcriptView->setTextElideMode(Qt::ElideRight);
+    contentLayout->addWidget(transcriptView, 3);
+    connect(transcriptView->verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &Widget::onTranscriptScrolled);
+
+    userListView = new QListView(this);
+    userListView->setModel(userModel);
+    userListView->setUniformItemSizes(true);
+    contentLayout->addWidget(userListView, 1);
 
     QHBoxLayout *inputLayout = new QHBoxLayout();
     chatLayout->addLayout(inputLayout);
@@ -110,34 +145,138 @@ void Widget::onLoginButtonClicked()
         return;
     }
 
+    if (connectionState != Offline)
+        return;
+
     myNickname = nickname;
+    userModel->setSelf(myNickname);
+    serverHost = ip;
+    sessionToken.clear();
+    lastSeenId = 0;
+    reconnectAttempts = 0;
+    connectionState = Connecting;
+    loginButton->setEnabled(false);
+    appendChatMessage("[系统] 正在连接服务器...");
+    startConnect();
+}
 
-    tcpSocket->connectToHost(ip, 8888);
-    if (!tcpSocket->waitForConnected(3000)) {
-        appendChatMessage("[系统] 连接服务器超时或失败。");
-    } else {
-        appendChatMessage("[系统] 正在尝试登录...");
+void Widget::startConnect()
+{
+    tcpSocket->abort();
+    tcpSocket->connectToHost(serverHost, 8888);
+    connectTimer->start(ConnectTimeoutMs);
+}
+
+void Widget::onConnectTimeout()
+{
+    // 连接阶段 abort 不会发出 disconnected
+    tcpSocket->abort();
+    connectFailed("连接服务器超时。");
+}
+
+// 未能建立连接：首次登录直接报错，重连中则排下一次
+void Widget::connectFailed(const QString &reason)
+{
+    if (connectionState == Connecting) {
+        goOffline(QString("[系统] %1").arg(reason));
+    } else if (connectionState == Reconnecting) {
+        appendChatMessage(QString("[系统] 重连失败：%1").arg(reason));
+        scheduleReconnect();
+    }
+}
+
+// 指数退避，上限 ReconnectMaxMs；在后一半区间随机取值，避免服务器重启后所有客户端同时涌入
+void Widget::scheduleReconnect()
+{
+    if (reconnectAttempts >= MaxReconnectAttempts) {
+        goOffline(QString("[系统] 重连 %1 次仍未成功，已放弃。").arg(reconnectAttempts));
+        return;
+    }
+    int delay = serverRetryDelayMs;
+    serverRetryDelayMs = -1;
+    if (delay < 0) {
+        const int ceiling = qMin(ReconnectMaxMs, ReconnectBaseMs << qMin(reconnectAttempts, 16));
+        delay = ceiling / 2 + static_cast<int>(QRandomGenerator::global()->bounded(ceiling / 2 + 1));
     }
+    ++reconnectAttempts;
+    connectionState = Reconnecting;
+    appendChatMessage(QString("[系统] %1 秒后第 %2 次重连...")
+                          .arg(delay / 1000.0, 0, 'f', 1).arg(reconnectAttempts));
+    reconnectTimer->start(delay);
+}
+
+// 结束本次会话回到登录页；聊天记录留着，下次登录接着显示
+void Widget::goOffline(const QString &message)
+{
+    connectionState = Offline;
+    connectTimer->stop();
+    reconnectTimer->stop();
+    serverRetryDelayMs = -1;
+    sessionToken.clear();
+    lastSeenId = 0;
+    appendChatMessage(message);
+    stackedWidget->setCurrentIndex(0);
+    loginButton->setEnabled(true);
+    transfers->abortAll();
+    resetPresence();
+    resetChat();
+    chatEpoch = 0;
+    myNickname.clear();
+    currentRoom = QLatin1String(Wire::DefaultRoom);
 }
 
 void Widget::onConnected()
 {
+    connectTimer->stop();
     appendChatMessage("[系统] 已连接到服务器。");
-    QJsonObject loginMsg;
-    loginMsg["type"] = "login";
-    loginMsg["nickname"] = myNickname;
-    QJsonDocument doc(loginMsg);
-    QByteArray dataToSend = doc.toJson(QJsonDocument::Compact) + "\n";
-    tcpSocket->write(dataToSend);
-    tcpSocket->flush();
+    // 每次连接都从 JSON 开始，并请求改用二进制帧；旧服务器会忽略 wire 字段
+    wireFormat = Wire::Json;
+    reader.reset();
+    reader.setFormat(Wire::Json);
+    compressThreshold = 0;
+    reader.setCompression(false);
+    QCborMap loginMsg;
+    loginMsg[QLatin1String("type")] = QStringLiteral("login");
+    loginMsg[QLatin1String("nickname")] = myNickname;
+    loginMsg[QLatin1String("wire")] = Wire::formatName(Wire::Cbor);
+    // 较长的帧压缩传输；不支持的服务器不会在 login_success 中回应
+    loginMsg[QLatin1String("compress")] = Wire::compressionName();
+    // 声明会回应服务器的 ping，空闲时不会被当作半开连接回收
+    loginMsg[QLatin1String("heartbeat")] = true;
+    // 能解开合批帧
+    loginMsg[QLatin1String("batch")] = true;
+    // 手里已有某个版本的用户列表时只要差量
+    if (presenceVersion != 0) {
+        loginMsg[QLatin1String("presence_epoch")] = static_cast<qint64>(presenceEpoch);
+        loginMsg[QLatin1String("presence_version")] = static_cast<qint64>(presenceVersion);
+    }
+    // 断线重连时凭令牌接续会话，服务器只补发 last_seen 之后的消息；
+    // 大厅的聊天序号仍有效时改为只补 chat_seq 之后的
+    if (!sessionToken.isEmpty()) {
+        loginMsg[QLatin1String("resume")] = QString::fromLatin1(sessionToken);
+        loginMsg[QLatin1String("last_seen")] = lastSeenId;
+        const QString lobby = QLatin1String(Wire::DefaultRoom);
+        if (chatEpoch != 0 && chatSeq.contains(lobby)) {
+            loginMsg[QLatin1String("chat_epoch")] = static_cast<qint64>(chatEpoch);
+            loginMsg[QLatin1String("chat_seq")] = static_cast<qint64>(chatSeq.value(lobby));
+        }
+    }
+    sendMessage(loginMsg);
 }
 
 void Widget::onDisconnected()
 {
+    // 主动退出或登录被拒绝时已是 Offline
+    if (connectionState == Offline)
+        return;
+    // 进行中的文件传输不能跨连接接续
+    transfers->abortAll();
+    if (connectionState == Connecting) {
+        goOffline("[系统] 与服务器断开连接。");
+        return;
+    }
     appendChatMessage("[系统] 与服务器断开连接。");
-    stackedWidget->setCurrentIndex(0);
-    userListWidget->clear();
-    myNickname.clear();
+    scheduleReconnect();
 }
 
 void Widget::onErrorOccurred(QAbstractSocket::SocketError socketError)
@@ -185,78 +324,206 @@ void Widget::onErrorOccurred(QAbstractSocket::SocketError socketError)
     default:
         errorStr = QString("未知错误 (%1)。").arg(socketError);
     }
-    appendChatMessage(QString("[错误] %1").arg(errorStr));
-    if (stackedWidget->currentIndex() == 1) {
-        stackedWidget->setCurrentIndex(0);
+    // 已建立的连接出错随后会收到 disconnected，由那里决定是否重连；这里只处理连接阶段的失败
+    if (connectTimer->isActive()) {
+        connectTimer->stop();
+        connectFailed(errorStr);
+    } else {
+        appendChatMessage(QString("[错误] %1").arg(errorStr));
     }
 }
 
 void Widget::onReadyRead()
 {
-    while (tcpSocket->canReadLine()) {
-        QByteArray jsonData = tcpSocket->readLine().trimmed();
-        QJsonParseError parseError;
-        QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData, &parseError);
-
-        if (parseError.error != QJsonParseError::NoError) {
-            appendChatMessage(QString("[错误] 解析服务器消息失败: %1").arg(parseError.errorString()));
-            appendChatMessage(QString("原始数据: %1").arg(QString(jsonData)));
-            continue;
+    QCborMap obj;
+    for (;;) {
+        const Wire::Reader::Status status = reader.read(tcpSocket, &obj);
+        if (status == Wire::Reader::NeedMore)
+            break;
+
+        if (status == Wire::Reader::Fatal) {
+            appendChatMessage(QString("[错误] 服务器数据无法解析: %1").arg(reader.errorString()));
+            tcpSocket->abort();
+            break;
         }
 
-        if (!jsonDoc.isObject()) {
-            appendChatMessage("[警告] 收到非JSON对象数据。");
+        if (status == Wire::Reader::Malformed) {
+            appendChatMessage(QString("[错误] 解析服务器消息失败: %1").arg(reader.errorString()));
+            appendChatMessage(QString("原始数据: %1").arg(QString(reader.rawFrame())));
             continue;
         }
 
-        QJsonObject obj = jsonDoc.object();
         handleServerMessage(obj);
     }
 }
 
-void Widget::handleServerMessage(const QJsonObject &obj)
+void Widget::handleServerMessage(const QCborMap &obj)
 {
-    QString type = obj["type"].toString();
+    QString type = obj[QLatin1String("type")].toString();
 
     if (type == "login_success") {
+        // 服务器接受协商后，下一帧起双向改用该格式
+        wireFormat = Wire::formatFromName(obj[QLatin1String("wire")].toString());
+        reader.setFormat(wireFormat);
+        const bool compress = obj[QLatin1String("compress")].toString() == Wire::compressionName();
+        compressThreshold = compress ? Wire::DefaultCompressThreshold : 0;
+        reader.setCompression(compress);
+        sessionToken = obj[QLatin1String("session")].toString().toLatin1();
+        const bool reconnected = connectionState == Reconnecting;
+        const bool resumed = obj[QLatin1String("resumed")].toBool();
+        connectionState = Online;
+        reconnectAttempts = 0;
         stackedWidget->setCurrentIndex(1);
-        appendChatMessage("[系统] 登录成功，欢迎来到聊天室！");
+        // 会话接上且纪元没变时手里的序号继续有效，服务器会补上缺的；否则从服务器给的起点重新开始，
+        // 命名房间的起点等 room_joined 再定
+        const quint32 epoch = static_cast<quint32>(obj[QLatin1String("chat_epoch")].toInteger());
+        if (!resumed || epoch != chatEpoch) {
+            resetChat();
+            chatEpoch = epoch;
+        }
+        if (chatEpoch != 0 && !chatSeq.contains(QLatin1String(Wire::DefaultRoom))) {
+            chatSeq.insert(QLatin1String(Wire::DefaultRoom),
+                           static_cast<quint64>(obj[QLatin1String("chat_seq")].toInteger()));
+        }
+        if (resumed) {
+            appendChatMessage("[系统] 已重新连接，会话已接续。");
+        } else if (reconnected) {
+            // 保留期已过，按新登录处理：原来加入的房间需要重新加入
+            currentRoom = QLatin1String(Wire::DefaultRoom);
+            appendChatMessage("[系统] 已重新连接。");
+        } else {
+            appendChatMessage("[系统] 登录成功，欢迎来到聊天室！");
+        }
     } else if (type == "login_failed") {
-        QString reason = obj["reason"].toString();
-        appendChatMessage(QString("[系统] 登录失败: %1").arg(reason));
+        QString reason = obj[QLatin1String("reason")].toString();
+        // 重连时被拒绝（昵称已被别人占用）同样放弃，不再重试
+        goOffline(QString("[系统] 登录失败: %1").arg(reason));
         tcpSocket->disconnectFromHost();
     } else if (type == "user_joined") {
-        QString nickname = obj["nickname"].toString();
+        QString nickname = obj[QLatin1String("nickname")].toString();
         appendChatMessage(QString("%1 加入了聊天室").arg(nickname));
-        if (userListWidget && !nickname.isEmpty()) {
-            QList<QListWidgetItem*> existingItems = userListWidget->findItems(nickname, Qt::MatchExactly);
-            if (existingItems.isEmpty()) {
-                userListWidget->addItem(nickname);
-            } else {
-                appendChatMessage(QString("【警告】尝试添加已存在的用户到列表: %1").arg(nickname));
-            }
-        }
+        handlePresence(obj);
     } else if (type == "user_left") {
-        QString nickname = obj["nickname"].toString();
+        QString nickname = obj[QLatin1String("nickname")].toString();
         appendChatMessage(QString("%1 离开了聊天室").arg(nickname));
-        if (userListWidget) {
-            QList<QListWidgetItem*> items = userListWidget->findItems(nickname, Qt::MatchExactly);
-            for (QListWidgetItem* item : items) {
-                delete userListWidget->takeItem(userListWidget->row(item));
-            }
-        }
+        handlePresence(obj);
+        transfers->peerLeft(nickname);
     } else if (type == "chat_message") {
-        QString sender = obj["sender"].toString();
-        QString message = obj["message"].toString();
-        QString displayMessage = QString("%1: %2").arg(sender).arg(message);
-        appendChatMessage(displayMessage);
+        handleChat(obj);
+    } else if (type == "chat_range") {
+        handleChatRange(obj);
+    } else if (type == "private_message") {
+        appendChatMessage(QString("[私聊] %1 → 我: %2")
+                              .arg(obj[QLatin1String("from")].toString())
+                              .arg(obj[QLatin1String("message")].toString()),
+                          QDateTime::fromMSecsSinceEpoch(obj[QLatin1String("ts")].toInteger()));
+    } else if (type == "private_ack") {
+        // 直接送达的不再提示，只说明暂存、补送与失败
+        const QString recipient = obj[QLatin1String("to")].toString();
+        const QString status = obj[QLatin1String("status")].toString();
+        const qint64 id = obj[QLatin1String("id")].toInteger();
+        if (status == "queued") {
+            queuedPrivate.insert(id);
+            appendChatMessage(QString("[系统] %1 不在线，私聊已暂存，对方上线后送达。").arg(recipient));
+        } else if (status == "rejected") {
+            appendChatMessage(QString("[系统] 发给 %1 的私聊未能发送：%2")
+                                  .arg(recipient).arg(obj[QLatin1String("reason")].toString()));
+        } else if (status == "delivered" && queuedPrivate.remove(id)) {
+            appendChatMessage(QString("[系统] 发给 %1 的私聊已送达。").arg(recipient));
+        }
+    } else if (type == "room_joined") {
+        currentRoom = obj[QLatin1String("room")].toString();
+        QStringList members;
+        for (const QCborValue &value : obj[QLatin1String("members")].toArray()) {
+            members << value.toString();
+        }
+        appendChatMessage(QString("[系统] 已加入房间 %1，成员：%2").arg(currentRoom).arg(members.join("、")));
+        // 续连后服务器替我们重新加入的房间：手里已有序号，补上断线期间的；新加入的从此刻的序号开始
+        const quint64 seq = static_cast<quint64>(obj[QLatin1String("seq")].toInteger());
+        if (chatEpoch != 0) {
+            if (!chatSeq.contains(currentRoom))
+                chatSeq.insert(currentRoom, seq);
+            else if (seq > chatSeq.value(currentRoom))
+                requestChatRange(currentRoom);
+        }
+    } else if (type == "room_left") {
+        QString room = obj[QLatin1String("room")].toString();
+        appendChatMessage(QString("[系统] 已离开房间 %1").arg(room));
+        // 再次加入时按那时的序号重新开始，不补不在房间期间的消息
+        chatSeq.remove(room);
+        pendingChat.remove(room);
+        if (room == currentRoom)
+            currentRoom = QLatin1String(Wire::DefaultRoom);
+    } else if (type == "room_member_joined") {
+        appendChatMessage(QString("[%1] %2 加入了房间")
+                              .arg(obj[QLatin1String("room")].toString())
+                              .arg(obj[QLatin1String("nickname")].toString()));
+    } else if (type == "room_member_left") {
+        appendChatMessage(QString("[%1] %2 离开了房间")
+                              .arg(obj[QLatin1String("room")].toString())
+                              .arg(obj[QLatin1String("nickname")].toString()));
+    } else if (type == "batch") {
+        // 一帧多条消息：逐条处理，文字攒齐后只插入一次，只触发一次排版
+        QStringList lines;
+        batchLines = &lines;
+        for (const QCborValue &value : obj[QLatin1String("messages")].toArray()) {
+            handleServerMessage(value.toMap());
+        }
+        batchLines = nullptr;
+        appendChatLines(lines);
+    } else if (type.startsWith(QLatin1String("file_"))) {
+        transfers->handleMessage(type, obj);
+    } else if (type == "server_restart") {
+        // 服务器即将排空连接：按它分配的延迟重连，与其他客户端错开
+        serverRetryDelayMs = qBound(0, static_cast<int>(obj[QLatin1String("reconnect_after_ms")].toInteger()),
+                                    ReconnectMaxMs);
+        appendChatMessage("[系统] 服务器正在重启，稍后自动重连。");
+    } else if (type == "muted") {
+        appendChatMessage(QString("[系统] 发言过于频繁，已被禁言 %1 秒。")
+                              .arg(obj[QLatin1String("seconds")].toInteger()));
+    } else if (type == "ping") {
+        QCborMap pongMsg;
+        pongMsg[QLatin1String("type")] = QStringLiteral("pong");
+        sendMessage(pongMsg);
+    } else if (type == "pong") {
+        // 无需处理
+    } else if (type == "history") {
+        // 登录时服务器回放的最近消息，一帧里带多条；重连时跳过已经显示过的
+        const QCborArray messages = obj[QLatin1String("messages")].toArray();
+        for (const QCborValue &value : messages) {
+            const QCborMap item = value.toMap();
+            const qint64 id = item[QLatin1String("id")].toInteger();
+            if (id > 0 && id <= lastSeenId)
+                continue;
+            lastSeenId = qMax(lastSeenId, id);
+            appendChatMessage(QString("%1: %2")
+                                  .arg(item[QLatin1String("sender")].toString())
+                                  .arg(item[QLatin1String("message")].toString()),
+                              QDateTime::fromMSecsSinceEpoch(item[QLatin1String("ts")].toInteger()));
+        }
     } else if (type == "user_list") {
-        QJsonArray usersArray = obj["users"].toArray();
+        QCborArray usersArray = obj[QLatin1String("users")].toArray();
         QStringList users;
-        for (const QJsonValue &value : usersArray) {
+        for (const QCborValue &value : usersArray) {
             users << value.toString();
         }
-        updateUserList(users);
+        userModel->reset(users);
+        // 快照之前的暂存增量已包含在内，之后的接着应用
+        presenceVersion = static_cast<quint64>(obj[QLatin1String("version")].toInteger());
+        presenceEpoch = static_cast<quint32>(obj[QLatin1String("epoch")].toInteger());
+        drainPendingPresence();
+    } else if (type == "user_list_delta") {
+        const quint64 from = static_cast<quint64>(obj[QLatin1String("from")].toInteger());
+        const quint64 version = static_cast<quint64>(obj[QLatin1String("version")].toInteger());
+        if (from > presenceVersion || version <= presenceVersion)
+            return;
+        // 净变化可重复应用：已在列表里的不再插入，不在的不必删除
+        for (const QCborValue &value : obj[QLatin1String("left")].toArray())
+            userModel->remove(value.toString());
+        for (const QCborValue &value : obj[QLatin1String("joined")].toArray())
+            userModel->insert(value.toString());
+        presenceVersion = version;
+        drainPendingPresence();
     } else {
         appendChatMessage(QString("[警告] 收到未知类型服务器消息: %1").arg(type));
     }
@@ -265,30 +532,114 @@ void Widget::handleServerMessage(const QJsonObject &obj)
 void Widget::onSendButtonClicked()
 {
     QString message = inputLineEdit->text().trimmed();
-    if (message.isEmpty() || !tcpSocket || tcpSocket->state() != QAbstractSocket::ConnectedState) {
+    if (message.isEmpty() || !tcpSocket) {
+        return;
+    }
+    if (connectionState != Online) {
+        appendChatMessage("[系统] 正在重新连接，消息未发送。");
         return;
     }
 
-    QJsonObject chatMsg;
-    chatMsg["type"] = "chat_message";
-    chatMsg["message"] = message;
-    QJsonDocument doc(chatMsg);
-    QByteArray dataToSend = doc.toJson(QJsonDocument::Compact) + "\n";
-    tcpSocket->write(dataToSend);
-    tcpSocket->flush();
+    if (handleCommand(message)) {
+        inputLineEdit->clear();
+        return;
+    }
+
+    QCborMap chatMsg;
+    chatMsg[QLatin1String("type")] = QStringLiteral("chat_message");
+    chatMsg[QLatin1String("message")] = message;
+    if (currentRoom != QLatin1String(Wire::DefaultRoom))
+        chatMsg[QLatin1String("room")] = currentRoom;
+    sendMessage(chatMsg);
 
     inputLineEdit->clear();
 }
 
+// 输入框命令：/join 房间名、/leave [房间名]、/msg 昵称 内容、/send 昵称；不是命令时返回 false
+bool Widget::handleCommand(const QString &input)
+{
+    if (!input.startsWith('/'))
+        return false;
+
+    const QString command = input.section(' ', 0, 0);
+    const QString argument = input.section(' ', 1).trimmed();
+    if (command == "/join" && !argument.isEmpty()) {
+        QCborMap joinMsg;
+        joinMsg[QLatin1String("type")] = QStringLiteral("join");
+        joinMsg[QLatin1String("room")] = argument;
+        sendMessage(joinMsg);
+        return true;
+    }
+    if (command == "/leave") {
+        QCborMap leaveMsg;
+        leaveMsg[QLatin1String("type")] = QStringLiteral("leave");
+        leaveMsg[QLatin1String("room")] = argument.isEmpty() ? currentRoom : argument;
+        sendMessage(leaveMsg);
+        return true;
+    }
+    if (command == "/msg") {
+        const QString recipient = argument.section(' ', 0, 0);
+        const QString text = argument.section(' ', 1).trimmed();
+        if (recipient.isEmpty() || text.isEmpty())
+            return false;
+        QCborMap privateMsg;
+        privateMsg[QLatin1String("type")] = QStringLiteral("private_message");
+        privateMsg[QLatin1String("to")] = recipient;
+        privateMsg[QLatin1String("message")] = text;
+        privateMsg[QLatin1String("id")] = ++nextPrivateId;
+        sendMessage(privateMsg);
+        appendChatMessage(QString("[私聊] 我 → %1: %2").arg(recipient).arg(text));
+        return true;
+    }
+    if (command == "/send" && !argument.isEmpty()) {
+        const QString path = QFileDialog::getOpenFileName(this, QString("发送文件给 %1").arg(argument));
+        if (!path.isEmpty())
+            transfers->offer(argument, path);
+        return true;
+    }
+    return false;
+}
+
+// 非模态询问，不在读数据的过程中开嵌套事件循环
+void Widget::onFileOffered(const QString &peer, qint64 id, const QString &name, qint64 size)
+{
+    QMessageBox *box = new QMessageBox(QMessageBox::Question, "接收文件",
+                                       QString("%1 想发送文件 %2（%3 字节），是否接收？")
+                                           .arg(peer).arg(name).arg(size),
+                                       QMessageBox::Yes | QMessageBox::No, this);
+    box->setAttribute(Qt::WA_DeleteOnClose);
+    connect(box, &QMessageBox::finished, this, [this, box, peer, id](int) {
+        if (box->clickedButton() == box->button(QMessageBox::Yes))
+            transfers->accept(peer, id);
+        else
+            transfers->reject(peer, id);
+    });
+    box->open();
+}
+
 void Widget::onExitButtonClicked()
 {
+    // 先置为 Offline，随后的 disconnected 不再触发重连
+    connectionState = Offline;
+    connectTimer->stop();
+    reconnectTimer->stop();
+    serverRetryDelayMs = -1;
+    sessionToken.clear();
+    lastSeenId = 0;
     if (tcpSocket->state() == QAbstractSocket::ConnectedState) {
         tcpSocket->disconnectFromHost();
+    } else {
+        tcpSocket->abort();
     }
     stackedWidget->setCurrentIndex(0);
-    chatTextEdit->clear();
-    userListWidget->clear();
+    loginButton->setEnabled(true);
+    transcript->clear();
+    transfers->abortAll();
+    resetPresence();
+    resetChat();
+    chatEpoch = 0;
     myNickname.clear();
+    currentRoom = QLatin1String(Wire::DefaultRoom);
 }
 
 void Widget::loadStyleSheet(const QString &sheetName)
@@ -303,22 +654,269 @@ void Widget::loadStyleSheet(const QString &sheetName)
     }
 }
 
-void Widget::updateUserList(const QStringList &users)
+void Widget::resetPresence()
+{
+    userModel->clear();
+    presenceVersion = 0;
+    presenceEpoch = 0;
+    pendingPresence.clear();
+}
+
+// user_joined / user_left：版本号紧接当前版本时立即应用，否则按版本号暂存
+void Widget::handlePresence(const QCborMap &obj)
+{
+    const quint64 version = static_cast<quint64>(obj[QLatin1String("version")].toInteger());
+    if (version == 0) {
+        // 旧服务器不带版本号，收到即应用
+        applyPresence(obj);
+        return;
+    }
+    if (presenceVersion != 0 && version <= presenceVersion)
+        return;
+    pendingPresence.insert(version, obj);
+    drainPendingPresence();
+}
+
+void Widget::applyPresence(const QCborMap &obj)
+{
+    const QString nickname = obj[QLatin1String("nickname")].toString();
+    if (nickname.isEmpty())
+        return;
+    if (obj[QLatin1String("type")].toString() == "user_joined")
+        userModel->insert(nickname);
+    else
+        userModel->remove(nickname);
+}
+
+void Widget::drainPendingPresence()
+{
+    // 还没收到快照时只暂存，快照到达后再应用
+    if (presenceVersion == 0)
+        return;
+
+    while (!pendingPresence.isEmpty()) {
+        const quint64 version = pendingPresence.firstKey();
+        if (version > presenceVersion + 1)
+            break;
+        const QCborMap obj = pendingPresence.take(version);
+        if (version == presenceVersion + 1) {
+            applyPresence(obj);
+            presenceVersion = version;
+        }
+    }
+
+    // 缺的版本迟迟不到（例如被服务器的积压合并丢掉），请求从当前版本补齐
+    if (pendingPresence.size() > MaxPendingPresence) {
+        pendingPresence.clear();
+        QCborMap syncMsg;
+        syncMsg[QLatin1String("type")] = QStringLiteral("user_list_sync");
+        syncMsg[QLatin1String("epoch")] = static_cast<qint64>(presenceEpoch);
+        syncMsg[QLatin1String("since")] = static_cast<qint64>(presenceVersion);
+        sendMessage(syncMsg);
+    }
+}
+
+void Widget::resetChat()
+{
+    chatSeq.clear();
+    pendingChat.clear();
+    chatGapTimer->stop();
+}
+
+// chat_message：序号紧接已显示的立即显示，否则按序号暂存；重复的丢弃
+void Widget::handleChat(const QCborMap &obj)
+{
+    const quint64 seq = static_cast<quint64>(obj[QLatin1String("seq")].toInteger());
+    const QString room = obj[QLatin1String("room")].toString(QLatin1String(Wire::DefaultRoom));
+    if (seq == 0 || chatEpoch == 0) {
+        // 旧服务器不编号
+        showChat(obj);
+        return;
+    }
+    const auto current = chatSeq.constFind(room);
+    if (current == chatSeq.cend()) {
+        // 不知道起点（例如旧服务器的 room_joined 不带序号）：收到的第一条就是起点
+        chatSeq.insert(room, seq);
+        showChat(obj);
+        return;
+    }
+    if (seq <= current.value())
+        return;
+    pendingChat[room].insert(seq, obj);
+    drainPendingChat(room);
+}
+
+void Widget::showChat(const QCborMap &obj)
+{
+    const QString sender = obj[QLatin1String("sender")].toString();
+    const QString message = obj[QLatin1String("message")].toString();
+    const QString room = obj[QLatin1String("room")].toString(QLatin1String(Wire::DefaultRoom));
+    lastSeenId = qMax(lastSeenId, obj[QLatin1String("id")].toInteger());
+    QString displayMessage = QString("%1: %2").arg(sender).arg(message);
+    if (room != QLatin1String(Wire::DefaultRoom))
+        displayMessage = QString("[%1] %2").arg(room).arg(displayMessage);
+    // 带服务器时间戳的按服务器收到的时刻显示，补来的旧消息也不会显示成现在
+    const qint64 timestamp = obj[QLatin1String("ts")].toInteger();
+    appendChatMessage(displayMessage, timestamp > 0 ? QDateTime::fromMSecsSinceEpoch(timestamp)
+                                                    : QDateTime::currentDateTime());
+}
+
+void Widget::drainPendingChat(const QString &room)
+{
+    const auto found = pendingChat.find(room);
+    if (found == pendingChat.end())
+        return;
+    QMap<quint64, QCborMap> &pending = found.value();
+    quint64 &current = chatSeq[room];
+    while (!pending.isEmpty() && pending.firstKey() <= current + 1) {
+        const quint64 seq = pending.firstKey();
+        const QCborMap obj = pending.take(seq);
+        if (seq == current + 1) {
+            showChat(obj);
+            current = seq;
+        }
+    }
+    if (pending.isEmpty()) {
+        pendingChat.erase(found);
+        return;
+    }
+
+    // 其他分片的消息多半稍后就到，先等一会儿；积压太多说明确实丢了，立即去要
+    if (pending.size() == MaxPendingChat)
+        requestChatRange(room);
+    else if (!chatGapTimer->isActive())
+        chatGapTimer->start(ChatGapWaitMs);
+}
+
+void Widget::onChatGapTimeout()
+{
+    if (connectionState != Online)
+        return;
+    for (auto it = pendingChat.cbegin(); it != pendingChat.cend(); ++it)
+        requestChatRange(it.key());
+    // 回应被积压合并丢掉时过一会儿再要
+    if (!pendingChat.isEmpty())
+        chatGapTimer->start(ChatSyncRetryMs);
+}
+
+// 只要已显示的序号与第一条暂存消息之间缺的那一段；没有暂存时要到最新
+void Widget::requestChatRange(const QString &room)
+{
+    QCborMap syncMsg;
+    syncMsg[QLatin1String("type")] = QStringLiteral("chat_sync");
+    syncMsg[QLatin1String("room")] = room;
+    syncMsg[QLatin1String("after")] = static_cast<qint64>(chatSeq.value(room));
+    const auto pending = pendingChat.constFind(room);
+    if (pending != pendingChat.cend() && !pending->isEmpty())
+        syncMsg[QLatin1String("until")] = static_cast<qint64>(pending->firstKey() - 1);
+    sendMessage(syncMsg);
+}
+
+// chat_range：补来的消息与暂存的一起按序号显示
+void Widget::handleChatRange(const QCborMap &obj)
 {
-    userListWidget->clear();
-    for (const QString &user : users) {
-        QListWidgetItem *item = new QListWidgetItem(user, userListWidget);
-        if (user == myNickname) {
-            QFont font = item->font();
-            font.setBold(true);
-            item->setFont(font);
-            item->setText(QString("%1 (我)").arg(user));
+    if (static_cast<quint32>(obj[QLatin1String("epoch")].toInteger()) != chatEpoch)
+        return;
+    const QString room = obj[QLatin1String("room")].toString(QLatin1String(Wire::DefaultRoom));
+    if (!chatSeq.contains(room))
+        return;
+    const QCborArray messages = obj[QLatin1String("messages")].toArray();
+    const quint64 last = static_cast<quint64>(obj[QLatin1String("last")].toInteger());
+
+    // 缺口的开头已被服务器淘汰：说明丢了几条，从还留着的第一条接着排
+    if (!obj[QLatin1String("complete")].toBool()) {
+        const quint64 first = messages.isEmpty()
+                                  ? last + 1
+                                  : static_cast<quint64>(messages.first().toMap()[QLatin1String("seq")].toInteger());
+        const quint64 current = chatSeq.value(room);
+        if (first > current + 1) {
+            appendChatMessage(QString("[系统] 断线期间 %1 有 %2 条消息已无法补齐。")
+                                  .arg(room).arg(first - current - 1));
+            chatSeq.insert(room, first - 1);
         }
     }
+
+    // 与 batch 一样攒齐后一次插入
+    const quint64 before = chatSeq.value(room);
+    QStringList lines;
+    QStringList *outer = batchLines;
+    if (!outer)
+        batchLines = &lines;
+    for (const QCborValue &value : messages)
+        handleChat(value.toMap());
+    drainPendingChat(room);
+    batchLines = outer;
+    appendChatLines(lines);
+
+    // 一次回应有条数上限：有进展但还没补到最新或第一条暂存消息时接着要
+    const auto pending = pendingChat.constFind(room);
+    const quint64 target = pending != pendingChat.cend() && !pending->isEmpty() ? pending->firstKey() - 1 : last;
+    const quint64 reached = chatSeq.value(room);
+    if (reached > before && reached < target)
+        requestChatRange(room);
+}
+
+void Widget::sendMessage(const QCborMap &obj)
+{
+    tcpSocket->write(Wire::encode(obj, wireFormat, compressThreshold));
+    tcpSocket->flush();
 }
 
 void Widget::appendChatMessage(const QString &message)
 {
-    QString timestamp = QDateTime::currentDateTime().toString("hh:mm:ss");
-    chatTextEdit->append(QString("[%1] %2").arg(timestamp).arg(message));
+    appendChatMessage(message, QDateTime::currentDateTime());
+}
+
+void Widget::appendChatMessage(const QString &message, const QDateTime &time)
+{
+    QString timestamp = time.toString("hh:mm:ss");
+    QString line = QString("[%1] %2").arg(timestamp).arg(message);
+    if (batchLines) {
+        batchLines->append(line);
+        return;
+    }
+    appendChatLines(QStringList(line));
+}
+
+void Widget::appendChatLines(const QStringList &lines)
+{
+    if (lines.isEmpty())
+        return;
+    QScrollBar *bar = transcriptView->verticalScrollBar();
+    const bool follow = transcript->atTail() && bar->value() == bar->maximum();
+    const int before = transcript->rowCount();
+    transcript->appendLines(lines);
+    if (follow) {
+        transcriptView->scrollToBottom();
+        return;
+    }
+
+    // 正在往回翻看时，窗口头部淘汰的行不应让视图跟着跳动
+    const int trimmed = before + lines.size() - transcript->rowCount();
+    if (transcript->atTail() && trimmed > 0) {
+        transcriptView->doItemsLayout();
+        bar->setValue(bar->value() - trimmed);
+    }
+}
+
+// 滚到窗口顶端时读入更早的一页，滚到底端且窗口不含最新记录时读入更新的一页；
+// 读入后调整滚动位置，让原先可见的行留在原处
+void Widget::onTranscriptScrolled(int value)
+{
+    QScrollBar *bar = transcriptView->verticalScrollBar();
+    if (value == bar->minimum()) {
+        const int loaded = transcript->loadOlder();
+        if (loaded > 0) {
+            transcriptView->doItemsLayout();
+            bar->setValue(value + loaded);
+        }
+    } else if (value == bar->maximum() && !transcript->atTail()) {
+        const int before = transcript->rowCount();
+        const int loaded = transcript->loadNewer();
+        const int trimmed = before + loaded - transcript->rowCount();
+        if (trimmed > 0) {
+            transcriptView->doItemsLayout();
+            bar->setValue(value - trimmed);
+        }
+    }
 }
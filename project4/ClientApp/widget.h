@@ -2,19 +2,27 @@
 #define WIDGET_H
 
 #include <QMainWindow>
+#include <QMap>
+#include <QSet>
 #include <QStringList>
 #include <QTcpSocket>
-#include <QJsonObject>
-#include <QJsonDocument>
+#include <QCborMap>
+#include <QDateTime>
+#include <QHash>
 #include <QMessageBox>
+#include "wirecompression.h"
+#include "wireformat.h"
 
 // 前向声明
 class QStackedWidget;
 class QWidget;
 class QLineEdit;
 class QPushButton;
-class QTextEdit;
-class QListWidget;
+class QListView;
+class QTimer;
+class UserListModel;
+class TranscriptModel;
+class FileTransfers;
 
 class Widget : public QMainWindow
 {
@@ -34,12 +42,28 @@ private slots:
     void onDisconnected();
     void onErrorOccurred(QAbstractSocket::SocketError socketError);
     void onReadyRead();
+    void onTranscriptScrolled(int value);
+    void onFileOffered(const QString &peer, qint64 id, const QString &name, qint64 size);
+    void onConnectTimeout();
+    void startConnect();
+    void onChatGapTimeout();
 
 private:
+    // 连接状态：连接与重连都是异步的，界面线程不再阻塞等待
+    enum ConnectionState {
+        Offline,        // 未登录，或已放弃重连
+        Connecting,     // 首次连接并登录中，失败即回到登录页
+        Online,
+        Reconnecting    // 连接中断后按退避间隔重连，聊天记录与用户列表保持不变
+    };
+
     void createLoginInterface();
     void createChatInterface();
     void loadStyleSheet(const QString &sheetName);
-    void updateUserList(const QStringList &users);
+    void resetPresence();
+    void connectFailed(const QString &reason);
+    void scheduleReconnect();
+    void goOffline(const QString &message);
 
     // 界面组件指针
     QStackedWidget *stackedWidget;
@@ -52,16 +76,68 @@ private:
     QPushButton *loginButton;
 
     // 聊天界面控件
-    QTextEdit *chatTextEdit;
+    QListView *transcriptView;
+    TranscriptModel *transcript;
     QLineEdit *inputLineEdit;
     QPushButton *sendButton;
     QPushButton *exitButton;
-    QListWidget *userListWidget;
+    QListView *userListView;
+    UserListModel *userModel;
 
     // 网络相关
     QTcpSocket *tcpSocket;
+    ConnectionState connectionState;
+    QString serverHost;
+    QTimer *connectTimer;       // 单次连接的超时
+    QTimer *reconnectTimer;
+    int reconnectAttempts;
+    int serverRetryDelayMs;     // 服务器在 server_restart 中指定的重连延迟，-1 表示按退避计算
+    // 续连：服务器发的会话令牌与收到的最后一条大厅消息序号，重连时带上以接续会话、只补缺失的消息
+    QByteArray sessionToken;
+    qint64 lastSeenId;
+    qint64 nextPrivateId;       // 私聊消息编号，服务器回执按它对应
+    QSet<qint64> queuedPrivate; // 已被服务器暂存、尚未送达的私聊
+    static const int ConnectTimeoutMs = 5000;
+    static const int ReconnectBaseMs = 500;
+    static const int ReconnectMaxMs = 30000;
+    static const int MaxReconnectAttempts = 10;
+    FileTransfers *transfers;
     QString myNickname;
+    QString currentRoom;        // 输入框发出的消息所属的房间
+    Wire::Reader reader;
+    Wire::Format wireFormat;    // 发往服务器的帧格式，登录成功后按协商结果切换
+    int compressThreshold;      // 协商了压缩时发出的帧达到该大小即压缩，0 表示不压缩
     void appendChatMessage(const QString &message);
-    void handleServerMessage(const QJsonObject &obj);
+    void appendChatMessage(const QString &message, const QDateTime &time);
+    void appendChatLines(const QStringList &lines);
+    QStringList *batchLines;    // 解 batch 帧期间非空，消息先攒在这里最后一次性插入
+    void handleServerMessage(const QCborMap &obj);
+    void sendMessage(const QCborMap &obj);
+    bool handleCommand(const QString &input);
+
+    // 在线状态按服务器版本号增量维护：乱序到达的先暂存，缺口太大时请求同步
+    static const int MaxPendingPresence = 64;
+    quint64 presenceVersion;    // 0 表示还没收到带版本号的快照
+    quint32 presenceEpoch;
+    QMap<quint64, QCborMap> pendingPresence;
+    void handlePresence(const QCborMap &obj);
+    void applyPresence(const QCborMap &obj);
+    void drainPendingPresence();
+
+    // 聊天消息按房间内序号显示：乱序到达的先暂存，缺口等 ChatGapWaitMs 仍没补上，
+    // 或暂存得太多，就发 chat_sync 只要缺的那一段
+    static const int MaxPendingChat = 64;
+    static const int ChatGapWaitMs = 500;
+    static const int ChatSyncRetryMs = 2000;
+    quint32 chatEpoch;          // 0 表示服务器不给聊天消息编号，收到即显示
+    QHash<QString, quint64> chatSeq;    // 各房间已显示到的序号；没有条目表示还不知道起点
+    QHash<QString, QMap<quint64, QCborMap>> pendingChat;
+    QTimer *chatGapTimer;
+    void resetChat();
+    void handleChat(const QCborMap &obj);
+    void showChat(const QCborMap &obj);
+    void drainPendingChat(const QString &room);
+    void handleChatRange(const QCborMap &obj);
+    void requestChatRange(const QString &room);
 };
 #endif // WIDGET_H
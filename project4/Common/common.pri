@@ -0,0 +1,17 @@
+# 客户端与服务器共用的线路协议代码
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/jsonview.cpp \
+    $$PWD/wirecompression.cpp \
+    $$PWD/wireformat.cpp
+
+HEADERS += \
+    $$PWD/jsonview.h \
+    $$PWD/wirecompression.h \
+    $$PWD/wireformat.h
+
+# zlib：Windows 上用 Qt 自带、由 QtCore 导出的 zlib，其它平台包含系统的 <zlib.h> 并链接 libz
+win32: DEFINES += WIRE_BUNDLED_ZLIB
+else: LIBS += -lz
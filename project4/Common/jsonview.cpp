@@ -0,0 +1,530 @@
+#include "jsonview.h"
+#include <QCborArray>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace Wire
+{
+
+// 数字文本转成整数；带小数或指数时按 double 解析，值恰为整数时同样算作整数（与 QCborValue::fromJsonValue 一致）
+static bool parseNumber(const char *text, int length, qint64 *integer, double *real)
+{
+    int pos = 0;
+    const bool negative = length > 0 && text[0] == '-';
+    if (negative)
+        ++pos;
+    // 逐位累加前先确认结果不超过 qint64 的上限；超出的交给下面的 strtod，那里超过范围时解析失败
+    const quint64 limit = static_cast<quint64>(std::numeric_limits<qint64>::max());
+    quint64 magnitude = 0;
+    bool plain = pos < length;
+    for (; pos < length; ++pos) {
+        const char c = text[pos];
+        const quint64 digit = static_cast<quint64>(c - '0');
+        if (c < '0' || c > '9' || magnitude > (limit - digit) / 10) {
+            plain = false;
+            break;
+        }
+        magnitude = magnitude * 10 + digit;
+    }
+    if (plain) {
+        *integer = negative ? -static_cast<qint64>(magnitude) : static_cast<qint64>(magnitude);
+        *real = static_cast<double>(*integer);
+        return true;
+    }
+
+    char buffer[64];
+    if (length >= static_cast<int>(sizeof(buffer))) {
+        *real = 0;
+        return false;
+    }
+    std::memcpy(buffer, text, static_cast<size_t>(length));
+    buffer[length] = '\0';
+    *real = std::strtod(buffer, nullptr);
+    if (std::floor(*real) == *real && std::fabs(*real) < 9.2e18) {
+        *integer = static_cast<qint64>(*real);
+        return true;
+    }
+    return false;
+}
+
+static void appendUtf8(QByteArray &out, uint codePoint)
+{
+    if (codePoint < 0x80) {
+        out.append(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+        out.append(static_cast<char>(0xC0 | (codePoint >> 6)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else if (codePoint < 0x10000) {
+        out.append(static_cast<char>(0xE0 | (codePoint >> 12)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else {
+        out.append(static_cast<char>(0xF0 | (codePoint >> 18)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+}
+
+// UTF-8 解码成 UTF-16 写进 out（至少能放 length 个码元），返回写入的码元数；非法序列逐字节换成 U+FFFD
+static int decodeUtf8(const char *text, int length, QChar *out)
+{
+    int written = 0;
+    for (int i = 0; i < length;) {
+        const uchar lead = static_cast<uchar>(text[i]);
+        if (lead < 0x80) {
+            out[written++] = QChar(static_cast<char16_t>(lead));
+            ++i;
+            continue;
+        }
+        int extra = 0;
+        uint codePoint = 0;
+        uint minimum = 0;
+        if ((lead & 0xe0) == 0xc0) {
+            extra = 1;
+            codePoint = lead & 0x1f;
+            minimum = 0x80;
+        } else if ((lead & 0xf0) == 0xe0) {
+            extra = 2;
+            codePoint = lead & 0x0f;
+            minimum = 0x800;
+        } else if ((lead & 0xf8) == 0xf0) {
+            extra = 3;
+            codePoint = lead & 0x07;
+            minimum = 0x10000;
+        }
+        bool valid = extra > 0 && i + extra < length;
+        for (int k = 1; valid && k <= extra; ++k) {
+            const uchar next = static_cast<uchar>(text[i + k]);
+            if ((next & 0xc0) != 0x80)
+                valid = false;
+            else
+                codePoint = (codePoint << 6) | (next & 0x3f);
+        }
+        if (!valid || codePoint < minimum || codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint < 0xe000)) {
+            out[written++] = QChar(QChar::ReplacementCharacter);
+            ++i;
+            continue;
+        }
+        if (QChar::requiresSurrogates(codePoint)) {
+            out[written++] = QChar(QChar::highSurrogate(codePoint));
+            out[written++] = QChar(QChar::lowSurrogate(codePoint));
+        } else {
+            out[written++] = QChar(static_cast<char16_t>(codePoint));
+        }
+        i += extra + 1;
+    }
+    return written;
+}
+
+static int hexValue(const char *text)
+{
+    int value = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char c = text[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return value;
+}
+
+JsonView::JsonView()
+    : data(nullptr), size(0)
+{
+}
+
+bool JsonView::parse(const char *data, int size)
+{
+    this->data = data;
+    this->size = size;
+    fields.clear();
+    error.clear();
+
+    int pos = 0;
+    skipSpace(&pos);
+    if (pos >= size || data[pos] != '{')
+        return fail("不是 JSON 对象", pos);
+    ++pos;
+    skipSpace(&pos);
+    if (pos < size && data[pos] == '}') {
+        ++pos;
+    } else {
+        for (;;) {
+            skipSpace(&pos);
+            if (pos >= size || data[pos] != '"')
+                return fail("缺少字段名", pos);
+            Field field;
+            field.keyBegin = pos + 1;
+            if (!skipString(&pos, &field.keyEscaped))
+                return fail("字符串未结束", pos);
+            field.keyLength = pos - 1 - field.keyBegin;
+            skipSpace(&pos);
+            if (pos >= size || data[pos] != ':')
+                return fail("缺少冒号", pos);
+            ++pos;
+            skipSpace(&pos);
+            if (pos >= size)
+                return fail("缺少字段值", pos);
+
+            field.valueBegin = pos;
+            field.valueEscaped = false;
+            bool ok = false;
+            switch (data[pos]) {
+            case '"':
+                field.kind = String;
+                field.valueBegin = pos + 1;
+                ok = skipString(&pos, &field.valueEscaped);
+                field.valueLength = pos - 1 - field.valueBegin;
+                break;
+            case '{':
+            case '[':
+                field.kind = data[pos] == '{' ? Object : Array;
+                ok = skipNested(&pos);
+                field.valueLength = pos - field.valueBegin;
+                break;
+            case 't':
+                field.kind = True;
+                ok = skipLiteral(&pos, "true");
+                field.valueLength = 4;
+                break;
+            case 'f':
+                field.kind = False;
+                ok = skipLiteral(&pos, "false");
+                field.valueLength = 5;
+                break;
+            case 'n':
+                field.kind = Null;
+                ok = skipLiteral(&pos, "null");
+                field.valueLength = 4;
+                break;
+            default:
+                field.kind = Number;
+                ok = skipNumber(&pos);
+                field.valueLength = pos - field.valueBegin;
+                break;
+            }
+            if (!ok)
+                return fail("无效的字段值", field.valueBegin);
+            fields.append(field);
+
+            skipSpace(&pos);
+            if (pos < size && data[pos] == ',') {
+                ++pos;
+                continue;
+            }
+            if (pos < size && data[pos] == '}') {
+                ++pos;
+                break;
+            }
+            return fail("缺少逗号或右花括号", pos);
+        }
+    }
+    skipSpace(&pos);
+    if (pos != size)
+        return fail("对象之后有多余内容", pos);
+    return true;
+}
+
+QString JsonView::errorString() const
+{
+    return error;
+}
+
+JsonView::Kind JsonView::kind(QLatin1String key) const
+{
+    const Field *field = find(key);
+    return field ? field->kind : Missing;
+}
+
+QLatin1String JsonView::latin1(QLatin1String key) const
+{
+    const Field *field = find(key);
+    if (!field || field->kind != String || field->valueEscaped)
+        return QLatin1String();
+    const char *text = data + field->valueBegin;
+    for (int i = 0; i < field->valueLength; ++i) {
+        if (static_cast<unsigned char>(text[i]) >= 0x80)
+            return QLatin1String();
+    }
+    return QLatin1String(text, field->valueLength);
+}
+
+QString JsonView::string(QLatin1String key, const QString &defaultValue) const
+{
+    const Field *field = find(key);
+    if (!field || field->kind != String)
+        return defaultValue;
+    return decodeString(field->valueBegin, field->valueLength, field->valueEscaped);
+}
+
+bool JsonView::readString(QLatin1String key, QString *out) const
+{
+    const Field *field = find(key);
+    if (!field || field->kind != String) {
+        out->truncate(0);
+        return false;
+    }
+    if (field->valueEscaped) {
+        *out = decodeString(field->valueBegin, field->valueLength, true);
+        return true;
+    }
+    if (field->valueLength == 0) {
+        out->truncate(0);
+        return true;
+    }
+    // UTF-16 码元数不会超过 UTF-8 字节数：先按字节数放大，解码后截到实际长度
+    out->resize(field->valueLength);
+    out->truncate(decodeUtf8(data + field->valueBegin, field->valueLength, out->data()));
+    return true;
+}
+
+qint64 JsonView::integer(QLatin1String key, qint64 defaultValue) const
+{
+    const Field *field = find(key);
+    if (!field || field->kind != Number)
+        return defaultValue;
+    qint64 integer = 0;
+    double real = 0;
+    return parseNumber(data + field->valueBegin, field->valueLength, &integer, &real) ? integer : defaultValue;
+}
+
+bool JsonView::boolean(QLatin1String key, bool defaultValue) const
+{
+    const Field *field = find(key);
+    if (!field || (field->kind != True && field->kind != False))
+        return defaultValue;
+    return field->kind == True;
+}
+
+QCborValue JsonView::value(QLatin1String key) const
+{
+    const Field *field = find(key);
+    return field ? fieldValue(*field) : QCborValue();
+}
+
+QCborMap JsonView::toMap() const
+{
+    QCborMap map;
+    for (const Field &field : fields)
+        map.insert(decodeString(field.keyBegin, field.keyLength, field.keyEscaped), fieldValue(field));
+    return map;
+}
+
+// 重复的键以最后一个为准，与 QJsonDocument 相同
+const JsonView::Field *JsonView::find(QLatin1String key) const
+{
+    for (int i = fields.size() - 1; i >= 0; --i) {
+        const Field &field = fields.at(i);
+        if (field.keyEscaped) {
+            if (decodeString(field.keyBegin, field.keyLength, true) == key)
+                return &field;
+        } else if (field.keyLength == key.size()
+                   && std::memcmp(data + field.keyBegin, key.data(), static_cast<size_t>(key.size())) == 0) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+QCborValue JsonView::fieldValue(const Field &field) const
+{
+    switch (field.kind) {
+    case String:
+        return decodeString(field.valueBegin, field.valueLength, field.valueEscaped);
+    case Number: {
+        qint64 integer = 0;
+        double real = 0;
+        if (parseNumber(data + field.valueBegin, field.valueLength, &integer, &real))
+            return integer;
+        return real;
+    }
+    case True:
+        return true;
+    case False:
+        return false;
+    case Null:
+        return QCborValue(nullptr);
+    case Object:
+    case Array: {
+        const QJsonDocument document = QJsonDocument::fromJson(
+            QByteArray::fromRawData(data + field.valueBegin, field.valueLength));
+        if (document.isObject())
+            return QCborMap::fromJsonObject(document.object());
+        if (document.isArray())
+            return QCborArray::fromJsonArray(document.array());
+        return QCborValue();
+    }
+    case Missing:
+        break;
+    }
+    return QCborValue();
+}
+
+QString JsonView::decodeString(int begin, int length, bool escaped) const
+{
+    if (!escaped)
+        return QString::fromUtf8(data + begin, length);
+
+    QByteArray out;
+    out.reserve(length);
+    const char *text = data + begin;
+    for (int i = 0; i < length; ++i) {
+        if (text[i] != '\\') {
+            out.append(text[i]);
+            continue;
+        }
+        if (++i >= length)
+            break;
+        switch (text[i]) {
+        case 'b': out.append('\b'); break;
+        case 'f': out.append('\f'); break;
+        case 'n': out.append('\n'); break;
+        case 'r': out.append('\r'); break;
+        case 't': out.append('\t'); break;
+        case 'u': {
+            int unit = i + 4 < length ? hexValue(text + i + 1) : -1;
+            if (unit < 0) {
+                appendUtf8(out, 0xFFFD);
+                break;
+            }
+            i += 4;
+            uint codePoint = static_cast<uint>(unit);
+            // 代理对
+            if (unit >= 0xD800 && unit < 0xDC00 && i + 6 < length && text[i + 1] == '\\' && text[i + 2] == 'u') {
+                const int low = hexValue(text + i + 3);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    codePoint = 0x10000 + ((static_cast<uint>(unit) - 0xD800) << 10) + (static_cast<uint>(low) - 0xDC00);
+                    i += 6;
+                }
+            }
+            if (codePoint >= 0xD800 && codePoint < 0xE000)
+                codePoint = 0xFFFD;
+            appendUtf8(out, codePoint);
+            break;
+        }
+        default:    // \" \\ \/
+            out.append(text[i]);
+            break;
+        }
+    }
+    return QString::fromUtf8(out);
+}
+
+// 调用时 *pos 指向左引号，成功时停在右引号之后
+bool JsonView::skipString(int *pos, bool *escaped) const
+{
+    *escaped = false;
+    int p = *pos + 1;
+    while (p < size) {
+        const char c = data[p];
+        if (c == '"') {
+            *pos = p + 1;
+            return true;
+        }
+        if (c == '\\') {
+            *escaped = true;
+            p += 2;
+            continue;
+        }
+        if (static_cast<unsigned char>(c) < 0x20)
+            return false;
+        ++p;
+    }
+    *pos = p;
+    return false;
+}
+
+// 嵌套的对象或数组只匹配括号，内容留到取值时再校验
+bool JsonView::skipNested(int *pos) const
+{
+    int depth = 0;
+    int p = *pos;
+    while (p < size) {
+        const char c = data[p];
+        if (c == '"') {
+            bool escaped;
+            if (!skipString(&p, &escaped))
+                return false;
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            ++depth;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                *pos = p + 1;
+                return true;
+            }
+        }
+        ++p;
+    }
+    return false;
+}
+
+bool JsonView::skipLiteral(int *pos, const char *literal) const
+{
+    const int length = static_cast<int>(std::strlen(literal));
+    if (size - *pos < length || std::memcmp(data + *pos, literal, static_cast<size_t>(length)) != 0)
+        return false;
+    *pos += length;
+    return true;
+}
+
+// -?数字(.数字)?([eE][+-]?数字)?
+bool JsonView::skipNumber(int *pos) const
+{
+    int p = *pos;
+    auto digits = [this, &p]() {
+        const int start = p;
+        while (p < size && data[p] >= '0' && data[p] <= '9')
+            ++p;
+        return p > start;
+    };
+    if (p < size && data[p] == '-')
+        ++p;
+    if (!digits())
+        return false;
+    if (p < size && data[p] == '.') {
+        ++p;
+        if (!digits())
+            return false;
+    }
+    if (p < size && (data[p] == 'e' || data[p] == 'E')) {
+        ++p;
+        if (p < size && (data[p] == '+' || data[p] == '-'))
+            ++p;
+        if (!digits())
+            return false;
+    }
+    *pos = p;
+    return true;
+}
+
+void JsonView::skipSpace(int *pos) const
+{
+    while (*pos < size) {
+        const char c = data[*pos];
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            return;
+        ++*pos;
+    }
+}
+
+bool JsonView::fail(const char *reason, int pos)
+{
+    error = QString("%1（第 %2 字节）").arg(QString::fromUtf8(reason)).arg(pos);
+    return false;
+}
+
+}
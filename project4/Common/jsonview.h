@@ -0,0 +1,84 @@
+#ifndef JSONVIEW_H
+#define JSONVIEW_H
+
+#include <QByteArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QLatin1String>
+#include <QString>
+#include <QVarLengthArray>
+
+// 一行 JSON 对象的就地索引：parse() 只扫描一遍，记下顶层每个字段的键与值在缓冲区中的位置，
+// 不构造 QJsonDocument / QJsonObject。处理函数按需取字段，只有取出的字符串才分配 QString；
+// 嵌套的对象与数组只做括号匹配，取值时（value / toMap）才交给 QJsonDocument 解析。
+//
+// 视图直接引用传入的缓冲区，缓冲区的内容须在视图使用期间保持不变
+namespace Wire
+{
+class JsonView
+{
+public:
+    enum Kind {
+        Missing,
+        String,
+        Number,
+        True,
+        False,
+        Null,
+        Object,
+        Array
+    };
+
+    JsonView();
+
+    // data 为一行完整的 JSON 文本（可带首尾空白），顶层须是对象；失败时 errorString() 给出原因
+    bool parse(const char *data, int size);
+    QString errorString() const;
+
+    Kind kind(QLatin1String key) const;
+    bool contains(QLatin1String key) const { return kind(key) != Missing; }
+
+    // 不含转义的 ASCII 字符串直接引用缓冲区，不分配；其余情况返回空串
+    QLatin1String latin1(QLatin1String key) const;
+    // 以下取值规则与 QCborValue 的 toString / toInteger / toBool 一致：类型不符时返回默认值
+    QString string(QLatin1String key, const QString &defaultValue = QString()) const;
+    // 与 string() 相同，但解码进 out 已有的存储：out 独占且容量够用时不分配
+    // 字段缺失或不是字符串时返回 false，out 置为空串
+    bool readString(QLatin1String key, QString *out) const;
+    qint64 integer(QLatin1String key, qint64 defaultValue = 0) const;
+    bool boolean(QLatin1String key, bool defaultValue = false) const;
+    QCborValue value(QLatin1String key) const;
+    // 整条消息转成 QCborMap，供需要整体转发或保存的场合使用
+    QCborMap toMap() const;
+
+private:
+    struct Field
+    {
+        int keyBegin;
+        int keyLength;
+        int valueBegin;     // 字符串不含两侧引号
+        int valueLength;
+        Kind kind;
+        bool keyEscaped;
+        bool valueEscaped;
+    };
+
+    const char *data;
+    int size;
+    // 协议消息的字段都不多，16 个以内不上堆
+    QVarLengthArray<Field, 16> fields;
+    QString error;
+
+    const Field *find(QLatin1String key) const;
+    QCborValue fieldValue(const Field &field) const;
+    QString decodeString(int begin, int length, bool escaped) const;
+    bool skipString(int *pos, bool *escaped) const;
+    bool skipNested(int *pos) const;
+    bool skipLiteral(int *pos, const char *literal) const;
+    bool skipNumber(int *pos) const;
+    void skipSpace(int *pos) const;
+    bool fail(const char *reason, int pos);
+};
+}
+
+#endif // JSONVIEW_H
@@ -0,0 +1,125 @@
+#include "wirecompression.h"
+#include "wireformat.h"
+#include <QCborValue>
+#include <QStringList>
+#include <QtEndian>
+#ifdef WIRE_BUNDLED_ZLIB
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+namespace Wire
+{
+
+// 预置字典：协议中反复出现的 CBOR 文本串；越常见的放得越靠后，离压缩数据越近
+static const QByteArray &dictionary()
+{
+    static const QByteArray dict = [] {
+        const QStringList words = {
+            QStringLiteral("file_offer"), QStringLiteral("file_accept"), QStringLiteral("file_done"),
+            QStringLiteral("file_cancel"), QStringLiteral("file_ack"), QStringLiteral("file_chunk"),
+            QStringLiteral("peer"), QStringLiteral("seq"), QStringLiteral("data"), QStringLiteral("id"),
+            QStringLiteral("room_joined"), QStringLiteral("room_left"), QStringLiteral("members"),
+            QStringLiteral("room_member_joined"), QStringLiteral("room_member_left"),
+            QStringLiteral("user_list_delta"), QStringLiteral("joined"), QStringLiteral("left"),
+            QStringLiteral("from"), QStringLiteral("epoch"), QStringLiteral("users"),
+            QStringLiteral("user_list"), QStringLiteral("user_joined"), QStringLiteral("user_left"),
+            QStringLiteral("nickname"), QStringLiteral("version"), QStringLiteral("history"),
+            QStringLiteral("ts"), QStringLiteral("batch"), QStringLiteral("messages"),
+            QStringLiteral("lobby"), QStringLiteral("room"), QStringLiteral("sender"),
+            QStringLiteral("message"), QStringLiteral("chat_message"), QStringLiteral("type")
+        };
+        QByteArray bytes;
+        for (const QString &word : words)
+            bytes.append(QCborValue(word).toCbor());
+        return bytes;
+    }();
+    return dict;
+}
+
+// 每个线程复用一份 deflate / inflate 状态，只做 reset，避免每帧重新分配
+namespace
+{
+struct Deflater
+{
+    z_stream stream{};
+    bool ok;
+    Deflater() { ok = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK; }
+    ~Deflater() { if (ok) deflateEnd(&stream); }
+};
+
+struct Inflater
+{
+    z_stream stream{};
+    bool ok;
+    Inflater() { ok = inflateInit2(&stream, -MAX_WBITS) == Z_OK; }
+    ~Inflater() { if (ok) inflateEnd(&stream); }
+};
+}
+
+QLatin1String compressionName()
+{
+    return QLatin1String("deflate");
+}
+
+QByteArray compressFrame(const QByteArray &frame, int threshold)
+{
+    const int payloadSize = frame.size() - HeaderSize;
+    if (threshold <= 0 || payloadSize < threshold)
+        return QByteArray();
+
+    thread_local Deflater deflater;
+    if (!deflater.ok)
+        return QByteArray();
+    z_stream &stream = deflater.stream;
+    deflateReset(&stream);
+    const QByteArray &dict = dictionary();
+    deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dict.constData()),
+                         static_cast<uInt>(dict.size()));
+
+    const int bound = static_cast<int>(deflateBound(&stream, static_cast<uLong>(payloadSize)));
+    QByteArray out(HeaderSize * 2 + bound, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(payloadSize), out.data() + HeaderSize);
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(frame.constData() + HeaderSize));
+    stream.avail_in = static_cast<uInt>(payloadSize);
+    stream.next_out = reinterpret_cast<Bytef *>(out.data() + HeaderSize * 2);
+    stream.avail_out = static_cast<uInt>(bound);
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        return QByteArray();
+
+    const int compressedPayload = HeaderSize + static_cast<int>(stream.total_out);
+    if (compressedPayload >= payloadSize)
+        return QByteArray();
+    out.truncate(HeaderSize + compressedPayload);
+    qToBigEndian<quint32>(static_cast<quint32>(compressedPayload) | CompressedFlag, out.data());
+    return out;
+}
+
+bool decompressPayload(const QByteArray &payload, QByteArray *out)
+{
+    if (payload.size() < HeaderSize)
+        return false;
+    const quint32 originalSize = qFromBigEndian<quint32>(payload.constData());
+    if (originalSize > static_cast<quint32>(MaxFrameSize))
+        return false;
+
+    thread_local Inflater inflater;
+    if (!inflater.ok)
+        return false;
+    z_stream &stream = inflater.stream;
+    inflateReset(&stream);
+    const QByteArray &dict = dictionary();
+    inflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dict.constData()),
+                         static_cast<uInt>(dict.size()));
+
+    out->resize(static_cast<int>(originalSize));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(payload.constData() + HeaderSize));
+    stream.avail_in = static_cast<uInt>(payload.size() - HeaderSize);
+    stream.next_out = reinterpret_cast<Bytef *>(out->data());
+    stream.avail_out = originalSize;
+    return inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out == originalSize;
+}
+
+}
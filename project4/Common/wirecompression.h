@@ -0,0 +1,25 @@
+#ifndef WIRECOMPRESSION_H
+#define WIRECOMPRESSION_H
+
+#include <QByteArray>
+
+// Cbor 线路上的可选压缩：
+//   客户端在 login 中带 "compress":"deflate"，服务器在 login_success 中回以相同字段后启用，
+//   此后任一方向上负载不小于阈值的帧可以压缩发出：长度前缀最高位置 1，
+//   负载为 4 字节大端原始长度 + raw deflate 数据。
+// 压缩使用双方内置的同一份预置字典（常见字段名与取值），每帧独立压缩、互不依赖，
+// 因此广播帧只需压缩一次，所有接收者共用压缩结果，短消息也能借字典压缩
+namespace Wire
+{
+const quint32 CompressedFlag = 0x80000000u;
+const int DefaultCompressThreshold = 128;
+
+QLatin1String compressionName();
+
+// 压缩一个完整的 Cbor 帧（含长度前缀）；负载小于 threshold 或压缩后不更小时返回空
+QByteArray compressFrame(const QByteArray &frame, int threshold);
+// 解压带 CompressedFlag 的帧的负载；数据损坏或超过 MaxFrameSize 时返回 false
+bool decompressPayload(const QByteArray &payload, QByteArray *out);
+}
+
+#endif // WIRECOMPRESSION_H
@@ -0,0 +1,289 @@
+#include "wireformat.h"
+#include "wirecompression.h"
+#include <QCborParserError>
+#include <QCborValue>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+#include <cstring>
+
+namespace Wire
+{
+
+QLatin1String formatName(Format format)
+{
+    return format == Cbor ? QLatin1String("cbor") : QLatin1String("json");
+}
+
+Format formatFromName(const QString &name, Format defaultValue)
+{
+    if (name == QLatin1String("cbor"))
+        return Cbor;
+    if (name == QLatin1String("json"))
+        return Json;
+    return defaultValue;
+}
+
+QByteArray encode(const QCborMap &message, Format format, int compressThreshold)
+{
+    if (format == Cbor) {
+        const QByteArray frame = cborFrame(message.toCborValue().toCbor());
+        if (compressThreshold > 0) {
+            const QByteArray compressed = compressFrame(frame, compressThreshold);
+            if (!compressed.isEmpty())
+                return compressed;
+        }
+        return frame;
+    }
+
+    QByteArray line = QJsonDocument(message.toJsonObject()).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    return line;
+}
+
+QByteArray cborFrame(const QByteArray &payload)
+{
+    QByteArray frame(HeaderSize, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()), frame.data());
+    frame.append(payload);
+    return frame;
+}
+
+QByteArray binaryValue(const QCborValue &value)
+{
+    if (value.isByteArray())
+        return value.toByteArray();
+    return QByteArray::fromBase64(value.toString().toLatin1(), QByteArray::Base64UrlEncoding);
+}
+
+// 每次从设备读入的上限；缓冲区只按需增长，空闲连接只占一小块
+static const int ReadChunkSize = 64 * 1024;
+// 缓冲区清空时超过这个容量就还给系统，偶尔的大帧不会让连接一直占着大缓冲
+static const int RetainedBufferSize = 16 * 1024;
+
+Message::Message()
+    : isJson(false)
+{
+}
+
+Message::Message(const QCborMap &map)
+    : isJson(false)
+    , map(map)
+    , cborType(map.value(QLatin1String("type")).toString().toLatin1())
+{
+}
+
+QLatin1String Message::type() const
+{
+    if (isJson)
+        return json.latin1(QLatin1String("type"));
+    return QLatin1String(cborType.constData(), cborType.size());
+}
+
+QString Message::string(QLatin1String key, const QString &defaultValue) const
+{
+    return isJson ? json.string(key, defaultValue) : map.value(key).toString(defaultValue);
+}
+
+bool Message::readString(QLatin1String key, QString *out) const
+{
+    if (isJson)
+        return json.readString(key, out);
+    const QCborValue value = map.value(key);
+    if (!value.isString()) {
+        out->truncate(0);
+        return false;
+    }
+    *out = value.toString();
+    return true;
+}
+
+qint64 Message::integer(QLatin1String key, qint64 defaultValue) const
+{
+    return isJson ? json.integer(key, defaultValue) : map.value(key).toInteger(defaultValue);
+}
+
+bool Message::boolean(QLatin1String key, bool defaultValue) const
+{
+    return isJson ? json.boolean(key, defaultValue) : map.value(key).toBool(defaultValue);
+}
+
+QCborValue Message::value(QLatin1String key) const
+{
+    return isJson ? json.value(key) : map.value(key);
+}
+
+QCborMap Message::toMap() const
+{
+    return isJson ? json.toMap() : map;
+}
+
+Reader::Reader(Format format)
+    : wireFormat(format), compression(false), begin(0), scanned(0)
+{
+}
+
+Format Reader::format() const
+{
+    return wireFormat;
+}
+
+void Reader::setFormat(Format format)
+{
+    wireFormat = format;
+    scanned = 0;
+}
+
+void Reader::setCompression(bool enabled)
+{
+    compression = enabled;
+}
+
+void Reader::reset()
+{
+    buffer = QByteArray();
+    begin = 0;
+    scanned = 0;
+}
+
+Reader::Status Reader::next(QIODevice *device, Wire::Message *message)
+{
+    error.clear();
+    raw.clear();
+    // 上一条消息到此失效，全部消费完的缓冲区可以从头复用
+    if (begin == buffer.size()) {
+        begin = 0;
+        scanned = 0;
+        if (buffer.capacity() > RetainedBufferSize)
+            buffer = QByteArray();
+        else
+            buffer.resize(0);
+    }
+    return wireFormat == Cbor ? nextCbor(device, message) : nextJson(device, message);
+}
+
+Reader::Status Reader::read(QIODevice *device, QCborMap *message)
+{
+    Wire::Message view;
+    const Status status = next(device, &view);
+    if (status == Message)
+        *message = view.toMap();
+    return status;
+}
+
+QString Reader::errorString() const
+{
+    return error;
+}
+
+QByteArray Reader::rawFrame() const
+{
+    return raw;
+}
+
+// 把设备中已到的数据读进缓冲尾部；已消费的部分先挪走。设备中没有数据时返回 false
+bool Reader::fill(QIODevice *device)
+{
+    const qint64 available = device->bytesAvailable();
+    if (available <= 0)
+        return false;
+    if (begin > 0) {
+        buffer.remove(0, begin);
+        begin = 0;
+    }
+    const int old = buffer.size();
+    const int room = static_cast<int>(qMin<qint64>(available, ReadChunkSize));
+    buffer.resize(old + room);
+    const qint64 got = device->read(buffer.data() + old, room);
+    buffer.resize(old + static_cast<int>(qMax<qint64>(got, 0)));
+    return got > 0;
+}
+
+// 找换行时只看上次没扫过的部分；一行在缓冲区里就地解析，不拷贝
+Reader::Status Reader::nextJson(QIODevice *device, Wire::Message *message)
+{
+    for (;;) {
+        const int pending = buffer.size() - begin;
+        const char *start = buffer.constData() + begin;
+        const char *newline = static_cast<const char*>(
+            std::memchr(start + scanned, '\n', static_cast<size_t>(pending - scanned)));
+        if (newline) {
+            const int length = static_cast<int>(newline - start);
+            begin += length + 1;
+            scanned = 0;
+            message->isJson = true;
+            message->map = QCborMap();
+            message->cborType.clear();
+            if (!message->json.parse(start, length)) {
+                error = message->json.errorString();
+                raw = QByteArray(start, length).trimmed();
+                return Malformed;
+            }
+            return Message;
+        }
+        scanned = pending;
+        if (pending > MaxFrameSize) {
+            error = QStringLiteral("一行超过 %1 字节").arg(MaxFrameSize);
+            return Fatal;
+        }
+        if (!fill(device))
+            return NeedMore;
+    }
+}
+
+Reader::Status Reader::nextCbor(QIODevice *device, Wire::Message *message)
+{
+    for (;;) {
+        const int pending = buffer.size() - begin;
+        if (pending >= HeaderSize) {
+            const quint32 prefix = qFromBigEndian<quint32>(buffer.constData() + begin);
+            const bool compressed = prefix & CompressedFlag;
+            const quint32 length = prefix & ~CompressedFlag;
+            if (compressed && !compression) {
+                error = QStringLiteral("未协商压缩却收到压缩帧");
+                return Fatal;
+            }
+            if (length > static_cast<quint32>(MaxFrameSize)) {
+                error = QStringLiteral("帧长度 %1 超过上限").arg(length);
+                return Fatal;
+            }
+            if (pending >= HeaderSize + static_cast<int>(length))
+                return decodeCbor(compressed, static_cast<int>(length), message);
+        }
+        if (!fill(device))
+            return NeedMore;
+    }
+}
+
+Reader::Status Reader::decodeCbor(bool compressed, int length, Wire::Message *message)
+{
+    QByteArray payload(buffer.constData() + begin + HeaderSize, length);
+    begin += HeaderSize + length;
+    if (compressed) {
+        QByteArray plain;
+        if (!decompressPayload(payload, &plain)) {
+            error = QStringLiteral("解压失败");
+            raw = payload.toHex();
+            return Malformed;
+        }
+        payload = plain;
+    }
+    QCborParserError parseError;
+    QCborValue value = QCborValue::fromCbor(payload, &parseError);
+    if (parseError.error != QCborError::NoError) {
+        error = parseError.errorString();
+        raw = payload.toHex();
+        return Malformed;
+    }
+    if (!value.isMap()) {
+        error = QStringLiteral("不是 CBOR map");
+        raw = payload.toHex();
+        return Malformed;
+    }
+
+    *message = Wire::Message(value.toMap());
+    return Message;
+}
+
+}
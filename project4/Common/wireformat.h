@@ -0,0 +1,124 @@
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include <QByteArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QString>
+#include "jsonview.h"
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+// 线路格式：
+//   Json —— 每行一条紧凑 JSON 对象，以 '\n' 结尾（旧客户端使用的格式）
+//   Cbor —— 4 字节大端长度 + CBOR 编码的 map，字段与 JSON 相同
+// 连接一律以 Json 开始；客户端在 login 中带上 "wire":"cbor"，
+// 服务器在 login_success 中回以相同字段后，双方从下一帧起改用 Cbor
+namespace Wire
+{
+enum Format {
+    Json,
+    Cbor
+};
+
+const int HeaderSize = 4;
+// 默认房间：所有连接都在其中，不带 room 字段的 chat_message 也发到这里
+const char DefaultRoom[] = "lobby";
+const int MaxRoomNameLength = 64;
+// 聊天与私聊正文的字符数上限；服务器要在内存里留着最近的消息，更长的直接拒绝
+const int MaxMessageLength = 8 * 1024;
+const int MaxFrameSize = 1 << 20;
+
+// 文件传输：每块 FileChunkSize 字节，发送方最多 FileWindow 块未被接收方确认，
+// 服务器只转发，不缓存整文件，单个传输占用的转发缓冲不超过二者之积
+const int FileChunkSize = 32 * 1024;
+const int FileWindow = 8;
+
+QLatin1String formatName(Format format);
+Format formatFromName(const QString &name, Format defaultValue = Json);
+
+// 把一条消息编码成完整的帧（含换行或长度前缀）
+// compressThreshold 大于 0 时，Cbor 帧负载达到该大小就尝试压缩（见 wirecompression.h）
+QByteArray encode(const QCborMap &message, Format format, int compressThreshold = 0);
+// 给已编码好的 CBOR 负载加上长度前缀
+QByteArray cborFrame(const QByteArray &payload);
+// 二进制字段：Cbor 中是字节串，Json 中是 base64url 文本，两种都接受
+QByteArray binaryValue(const QCborValue &value);
+
+// 收到的一条消息。Json 线路上是 JsonView：字段就地引用 Reader 的接收缓冲，只在取值时解码，
+// 在下一次 Reader::next() 之前有效；Cbor 线路上是解析好的 QCborMap
+// 取值规则与 QCborValue 的 toString / toInteger / toBool 一致
+class Message
+{
+public:
+    Message();
+    // 由已有的 QCborMap 构造，例如暂存后再处理的消息
+    explicit Message(const QCborMap &map);
+
+    // 不含转义的 ASCII 类型名直接引用缓冲区；分发消息不需要分配
+    QLatin1String type() const;
+    QString string(QLatin1String key, const QString &defaultValue = QString()) const;
+    // 解码进调用方复用的 out，见 JsonView::readString
+    bool readString(QLatin1String key, QString *out) const;
+    qint64 integer(QLatin1String key, qint64 defaultValue = 0) const;
+    bool boolean(QLatin1String key, bool defaultValue = false) const;
+    QCborValue value(QLatin1String key) const;
+    QCborMap toMap() const;
+
+private:
+    friend class Reader;
+
+    bool isJson;
+    JsonView json;
+    QCborMap map;
+    QByteArray cborType;
+};
+
+// 从设备中逐帧读取消息：每次把设备中已到的数据整块读进自己的接收缓冲，在缓冲上就地分帧，
+// 半帧留在缓冲里等下次，已扫描过的部分不再重扫。缓冲区随连接复用，稳定后 Json 线路上的
+// 分帧与解析不再分配内存。Json 与 Cbor 共用同一缓冲，协商后切换格式时已读入的后续帧照常解析
+class Reader
+{
+public:
+    enum Status {
+        Message,    // 取到一条消息
+        NeedMore,   // 缓冲区中没有完整的帧
+        Malformed,  // 帧已被消费但内容无法解析，errorString() 给出原因
+        Fatal       // 帧头非法，流已无法继续解析，调用方应断开连接
+    };
+
+    explicit Reader(Format format = Json);
+
+    Format format() const;
+    void setFormat(Format format);
+    // 协商启用压缩后才接受带压缩标志的帧
+    void setCompression(bool enabled);
+    // 换了新连接：丢弃接收缓冲中上一个连接剩下的数据
+    void reset();
+
+    // 取到的消息在下一次调用前有效
+    Status next(QIODevice *device, Wire::Message *message);
+    Status read(QIODevice *device, QCborMap *message);
+    QString errorString() const;
+    // 出错帧的原始内容，便于记录日志
+    QByteArray rawFrame() const;
+
+private:
+    Format wireFormat;
+    bool compression;
+    QString error;
+    QByteArray raw;
+    QByteArray buffer;      // 接收缓冲，begin 之后是尚未消费的数据
+    int begin;
+    int scanned;            // Json：begin 之后已确认没有换行的字节数
+
+    bool fill(QIODevice *device);
+    Status nextJson(QIODevice *device, Wire::Message *message);
+    Status nextCbor(QIODevice *device, Wire::Message *message);
+    Status decodeCbor(bool compressed, int length, Wire::Message *message);
+};
+}
+
+#endif // WIREFORMAT_H
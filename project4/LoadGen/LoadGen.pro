@@ -0,0 +1,21 @@
+QT       += core network
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = LoadGen
+TEMPLATE = app
+
+include(../Common/common.pri)
+
+SOURCES += \
+    latencyhistogram.cpp \
+    loadclient.cpp \
+    loadgenerator.cpp \
+    main.cpp
+
+HEADERS += \
+    latencyhistogram.h \
+    loadclient.h \
+    loadgenerator.h
@@ -0,0 +1,85 @@
+#include "latencyhistogram.h"
+#include <limits>
+
+LatencyHistogram::LatencyHistogram()
+    : buckets(64 * SubBuckets, 0)
+{
+    clear();
+}
+
+void LatencyHistogram::record(qint64 value)
+{
+    if (value < 0)
+        value = 0;
+    ++buckets[bucketFor(value)];
+    ++total;
+    sum += value;
+    minValue = qMin(minValue, value);
+    maxValue = qMax(maxValue, value);
+}
+
+void LatencyHistogram::clear()
+{
+    buckets.fill(0);
+    total = 0;
+    minValue = std::numeric_limits<qint64>::max();
+    maxValue = 0;
+    sum = 0;
+}
+
+quint64 LatencyHistogram::count() const
+{
+    return total;
+}
+
+qint64 LatencyHistogram::min() const
+{
+    return total ? minValue : 0;
+}
+
+qint64 LatencyHistogram::max() const
+{
+    return maxValue;
+}
+
+double LatencyHistogram::mean() const
+{
+    return total ? sum / total : 0.0;
+}
+
+qint64 LatencyHistogram::quantile(double q) const
+{
+    if (total == 0)
+        return 0;
+    const quint64 rank = qMax<quint64>(1, static_cast<quint64>(q * total + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < buckets.size(); ++i) {
+        seen += buckets.at(i);
+        if (seen >= rank)
+            return qMin(upperBound(i), maxValue);
+    }
+    return maxValue;
+}
+
+// 小于 SubBuckets 的值各占一个桶，更大的值按最高位所在的 2 的幂区间再细分
+int LatencyHistogram::bucketFor(qint64 value)
+{
+    if (value < SubBuckets)
+        return static_cast<int>(value);
+    int exponent = 63;
+    while (!(value >> exponent))
+        --exponent;
+    const int shift = exponent - 4;  // 保留最高位之后的 4 位
+    const int sub = static_cast<int>((value >> shift) & (SubBuckets - 1));
+    return (exponent - 3) * SubBuckets + sub;
+}
+
+qint64 LatencyHistogram::upperBound(int bucket)
+{
+    if (bucket < SubBuckets)
+        return bucket;
+    const int exponent = bucket / SubBuckets + 3;
+    const int sub = bucket % SubBuckets;
+    const int shift = exponent - 4;
+    return ((static_cast<qint64>(SubBuckets + sub) + 1) << shift) - 1;
+}
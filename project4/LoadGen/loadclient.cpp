@@ -0,0 +1,100 @@
+#include "loadclient.h"
+#include "loadgenerator.h"
+#include <QCborArray>
+#include <QCborMap>
+
+LoadClient::LoadClient(LoadGenerator *generator, const QString &nickname, Wire::Format wire,
+                       QObject *parent)
+    : QObject(parent)
+    , generator(generator)
+    , socket(new QTcpSocket(this))
+    , nickname(nickname)
+    , requestedWire(wire)
+    , wire(Wire::Json)
+    , ready(false)
+{
+    connect(socket, &QTcpSocket::connected, this, &LoadClient::onConnected);
+    connect(socket, &QTcpSocket::readyRead, this, &LoadClient::onReadyRead);
+    connect(socket, &QTcpSocket::errorOccurred, this, &LoadClient::onErrorOccurred);
+    // 关闭 Nagle，避免小消息被攒包而扭曲延迟
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+}
+
+void LoadClient::start(const QString &host, quint16 port)
+{
+    socket->connectToHost(host, port);
+}
+
+bool LoadClient::isReady() const
+{
+    return ready;
+}
+
+void LoadClient::sendChat(const QByteArray &text)
+{
+    QCborMap chatMsg;
+    chatMsg[QLatin1String("type")] = QStringLiteral("chat_message");
+    chatMsg[QLatin1String("message")] = QString::fromLatin1(text);
+    socket->write(Wire::encode(chatMsg, wire));
+}
+
+void LoadClient::stop()
+{
+    ready = false;
+    socket->disconnectFromHost();
+}
+
+void LoadClient::onConnected()
+{
+    QCborMap loginMsg;
+    loginMsg[QLatin1String("type")] = QStringLiteral("login");
+    loginMsg[QLatin1String("nickname")] = nickname;
+    if (requestedWire != Wire::Json)
+        loginMsg[QLatin1String("wire")] = Wire::formatName(requestedWire);
+    loginMsg[QLatin1String("batch")] = true;
+    socket->write(Wire::encode(loginMsg, Wire::Json));
+}
+
+void LoadClient::onReadyRead()
+{
+    QCborMap obj;
+    for (;;) {
+        const Wire::Reader::Status status = reader.read(socket, &obj);
+        if (status == Wire::Reader::NeedMore)
+            break;
+        if (status == Wire::Reader::Fatal) {
+            generator->clientFailed(QString("协议错误：%1").arg(reader.errorString()));
+            socket->abort();
+            break;
+        }
+        generator->frameReceived();
+        if (status == Wire::Reader::Malformed)
+            continue;
+
+        const QString type = obj.value(QLatin1String("type")).toString();
+        if (type == "chat_message") {
+            generator->chatReceived(obj.value(QLatin1String("message")).toString());
+        } else if (type == "batch") {
+            const QCborArray messages = obj.value(QLatin1String("messages")).toArray();
+            for (const QCborValue &value : messages) {
+                const QCborMap item = value.toMap();
+                if (item.value(QLatin1String("type")).toString() == QLatin1String("chat_message"))
+                    generator->chatReceived(item.value(QLatin1String("message")).toString());
+            }
+        } else if (type == "login_success") {
+            wire = Wire::formatFromName(obj.value(QLatin1String("wire")).toString());
+            reader.setFormat(wire);
+            ready = true;
+            generator->clientReady();
+        } else if (type == "login_failed") {
+            generator->clientFailed(QString("登录失败：%1").arg(obj.value(QLatin1String("reason")).toString()));
+            socket->disconnectFromHost();
+        }
+    }
+}
+
+void LoadClient::onErrorOccurred(QAbstractSocket::SocketError)
+{
+    if (!ready)
+        generator->clientFailed(socket->errorString());
+}
@@ -0,0 +1,39 @@
+#ifndef LOADCLIENT_H
+#define LOADCLIENT_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include "wireformat.h"
+
+class LoadGenerator;
+
+// 一个模拟客户端：走真实的 login / chat_message 流程，把收到的压测消息交给 LoadGenerator 统计
+class LoadClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadClient(LoadGenerator *generator, const QString &nickname, Wire::Format wire,
+               QObject *parent = nullptr);
+
+    void start(const QString &host, quint16 port);
+    bool isReady() const;
+    void sendChat(const QByteArray &text);
+    void stop();
+
+private slots:
+    void onConnected();
+    void onReadyRead();
+    void onErrorOccurred(QAbstractSocket::SocketError socketError);
+
+private:
+    LoadGenerator *generator;
+    QTcpSocket *socket;
+    QString nickname;
+    Wire::Format requestedWire;
+    Wire::Format wire;
+    Wire::Reader reader;
+    bool ready;
+};
+
+#endif // LOADCLIENT_H
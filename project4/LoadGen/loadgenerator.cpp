@@ -0,0 +1,202 @@
+#include "loadgenerator.h"
+#include "loadclient.h"
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QRandomGenerator>
+#include <QTimer>
+
+// 发送节拍：每个节拍按累计的额度发送，总速率与客户端数无关地保持平滑
+static const int SendTickMs = 10;
+// 停止发送后等待在途消息到达的时间
+static const int DrainMs = 2000;
+// 所有连接发起后最多再等这么久
+static const int ConnectTimeoutMs = 10000;
+
+LoadGenerator::LoadGenerator(const LoadOptions &options, QObject *parent)
+    : QObject(parent)
+    , options(options)
+    , connectTimer(new QTimer(this))
+    , sendTimer(new QTimer(this))
+    , phase(Connecting)
+    , nextToConnect(0)
+    , connected(0)
+    , failed(0)
+    , nextSender(0)
+    , sendCredit(0)
+    , lastTickNs(0)
+    , measureStartNs(0)
+    , measureEndNs(0)
+    , sent(0)
+    , received(0)
+    , framesReceived(0)
+{
+    // 每次运行带一个随机标记，登录时回放的旧消息不会被算进延迟
+    runTag = "lg|" + QByteArray::number(QRandomGenerator::global()->generate(), 16) + "|";
+    padding = QByteArray(qMax(0, options.messageSize - 32), 'x');
+
+    connect(connectTimer, &QTimer::timeout, this, &LoadGenerator::connectBatch);
+    connect(sendTimer, &QTimer::timeout, this, &LoadGenerator::sendTick);
+    sendTimer->setTimerType(Qt::PreciseTimer);
+}
+
+void LoadGenerator::start()
+{
+    clock.start();
+    const QString prefix = QString("lg-%1-").arg(QCoreApplication::applicationPid());
+    for (int i = 0; i < options.clients; ++i) {
+        clients.append(new LoadClient(this, prefix + QString::number(i), options.wire, this));
+    }
+    connectTimer->start(100);
+    connectBatch();
+}
+
+void LoadGenerator::connectBatch()
+{
+    const int batch = qMax(1, options.connectRate / 10);
+    for (int i = 0; i < batch && nextToConnect < clients.size(); ++i, ++nextToConnect) {
+        clients.at(nextToConnect)->start(options.host, options.port);
+    }
+    if (nextToConnect >= clients.size()) {
+        connectTimer->stop();
+        // 迟迟连不上的客户端不再等待
+        QTimer::singleShot(ConnectTimeoutMs, this, [this]() {
+            if (phase == Connecting)
+                startWarmup();
+        });
+    }
+}
+
+// 全部连接建立（或失败）后先预热，再开始计量
+void LoadGenerator::startWarmup()
+{
+    if (connected == 0) {
+        phase = Draining;
+        emit finished();
+        return;
+    }
+    phase = Warmup;
+    lastTickNs = clock.nsecsElapsed();
+    sendTimer->start(SendTickMs);
+    QTimer::singleShot(options.warmupSeconds * 1000, this, &LoadGenerator::beginMeasurement);
+}
+
+void LoadGenerator::clientReady()
+{
+    ++connected;
+    if (phase == Connecting && connected + failed >= options.clients)
+        startWarmup();
+}
+
+void LoadGenerator::clientFailed(const QString &reason)
+{
+    ++failed;
+    if (failureSamples.size() < 10)
+        failureSamples.append(reason);
+    if (phase == Connecting && connected + failed >= options.clients)
+        startWarmup();
+}
+
+void LoadGenerator::beginMeasurement()
+{
+    phase = Measuring;
+    sent = 0;
+    received = 0;
+    framesReceived = 0;
+    latency.clear();
+    measureStartNs = clock.nsecsElapsed();
+    QTimer::singleShot(options.durationSeconds * 1000, this, &LoadGenerator::endMeasurement);
+}
+
+void LoadGenerator::endMeasurement()
+{
+    phase = Draining;
+    measureEndNs = clock.nsecsElapsed();
+    sendTimer->stop();
+    QTimer::singleShot(DrainMs, this, [this]() {
+        for (LoadClient *client : qAsConst(clients)) {
+            client->stop();
+        }
+        emit finished();
+    });
+}
+
+void LoadGenerator::sendTick()
+{
+    const qint64 now = clock.nsecsElapsed();
+    const double totalRate = options.messageRate * connected;
+    sendCredit += totalRate * (now - lastTickNs) / 1e9;
+    lastTickNs = now;
+
+    int budget = static_cast<int>(sendCredit);
+    sendCredit -= budget;
+    int attempts = 0;
+    while (budget > 0 && attempts < clients.size()) {
+        LoadClient *client = clients.at(nextSender);
+        nextSender = (nextSender + 1) % clients.size();
+        ++attempts;
+        if (!client->isReady())
+            continue;
+
+        client->sendChat(runTag + QByteArray::number(clock.nsecsElapsed()) + "|" + padding);
+        if (phase == Measuring)
+            ++sent;
+        --budget;
+        attempts = 0;
+    }
+}
+
+void LoadGenerator::frameReceived()
+{
+    if (phase == Measuring || phase == Draining)
+        ++framesReceived;
+}
+
+void LoadGenerator::chatReceived(const QString &message)
+{
+    if (!message.startsWith(QLatin1String(runTag)))
+        return;
+    const int end = message.indexOf('|', runTag.size());
+    const qint64 sentNs = message.mid(runTag.size(), end - runTag.size()).toLongLong();
+
+    // 只统计计量窗口内发出的消息，包括排空阶段才到达的那部分
+    if (sentNs < measureStartNs || measureStartNs == 0)
+        return;
+    if (measureEndNs != 0 && sentNs > measureEndNs)
+        return;
+    ++received;
+    latency.record((clock.nsecsElapsed() - sentNs) / 1000);
+}
+
+QJsonObject LoadGenerator::report() const
+{
+    const double seconds = measureEndNs > measureStartNs
+                               ? (measureEndNs - measureStartNs) / 1e9 : 0.0;
+
+    QJsonObject latencyObj;
+    latencyObj["samples"] = static_cast<qint64>(latency.count());
+    latencyObj["min"] = latency.min();
+    latencyObj["mean"] = latency.mean();
+    latencyObj["p50"] = latency.quantile(0.50);
+    latencyObj["p99"] = latency.quantile(0.99);
+    latencyObj["p999"] = latency.quantile(0.999);
+    latencyObj["max"] = latency.max();
+
+    QJsonObject result;
+    result["host"] = options.host;
+    result["port"] = options.port;
+    result["wire"] = QString(Wire::formatName(options.wire));
+    result["clients"] = options.clients;
+    result["clients_connected"] = connected;
+    result["clients_failed"] = failed;
+    result["failures"] = QJsonArray::fromStringList(failureSamples);
+    result["message_rate_per_client"] = options.messageRate;
+    result["message_size"] = options.messageSize;
+    result["duration_seconds"] = seconds;
+    result["messages_sent"] = static_cast<qint64>(sent);
+    result["messages_received"] = static_cast<qint64>(received);
+    result["frames_received"] = static_cast<qint64>(framesReceived);
+    result["sent_per_second"] = seconds > 0 ? sent / seconds : 0.0;
+    result["received_per_second"] = seconds > 0 ? received / seconds : 0.0;
+    result["latency_us"] = latencyObj;
+    return result;
+}
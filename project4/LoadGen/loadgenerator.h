@@ -0,0 +1,92 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QList>
+#include "latencyhistogram.h"
+#include "wireformat.h"
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+class LoadClient;
+
+struct LoadOptions
+{
+    QString host = "127.0.0.1";
+    quint16 port = 8888;
+    int clients = 100;
+    int connectRate = 500;          // 每秒新建连接数，避免一次性冲垮 accept 队列
+    double messageRate = 1.0;       // 每个客户端每秒发送的消息数
+    int warmupSeconds = 5;
+    int durationSeconds = 30;
+    int messageSize = 64;           // 消息正文的目标长度（字节）
+    Wire::Format wire = Wire::Json;
+};
+
+// 压测主控：分批建立连接、按总速率发送带时间戳的消息，统计吞吐与端到端延迟
+// 所有客户端共用一个事件循环和一个单调时钟，收到自己发出的消息时即可算出延迟
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LoadGenerator(const LoadOptions &options, QObject *parent = nullptr);
+
+    void start();
+    QJsonObject report() const;
+
+    // 由 LoadClient 回调
+    void clientReady();
+    void clientFailed(const QString &reason);
+    void frameReceived();
+    void chatReceived(const QString &message);
+
+signals:
+    void finished();
+
+private slots:
+    void connectBatch();
+    void sendTick();
+    void beginMeasurement();
+    void endMeasurement();
+
+private:
+    void startWarmup();
+
+    enum Phase {
+        Connecting,
+        Warmup,
+        Measuring,
+        Draining
+    };
+
+    LoadOptions options;
+    QList<LoadClient*> clients;
+    QTimer *connectTimer;
+    QTimer *sendTimer;
+    QElapsedTimer clock;
+    Phase phase;
+    QByteArray runTag;
+    QByteArray padding;
+
+    int nextToConnect;
+    int connected;
+    int failed;
+    QStringList failureSamples;
+    int nextSender;
+    double sendCredit;
+    qint64 lastTickNs;
+    qint64 measureStartNs;
+    qint64 measureEndNs;
+
+    quint64 sent;
+    quint64 received;
+    quint64 framesReceived;
+    LatencyHistogram latency;   // 微秒
+};
+
+#endif // LOADGENERATOR_H
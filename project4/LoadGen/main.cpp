@@ -0,0 +1,69 @@
+#include "loadgenerator.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonDocument>
+
+// 聊天协议压测工具：对 ServerApp / ServerDaemon 建立大量连接，输出 JSON 格式的吞吐与延迟结果
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("聊天室压测工具");
+    parser.addHelpOption();
+    QCommandLineOption hostOption("host", "服务器地址。", "host", "127.0.0.1");
+    QCommandLineOption portOption(QStringList() << "p" << "port", "服务器端口。", "port", "8888");
+    QCommandLineOption clientsOption(QStringList() << "c" << "clients", "并发客户端数。", "n", "100");
+    QCommandLineOption connectRateOption("connect-rate", "每秒新建连接数。", "n", "500");
+    QCommandLineOption rateOption(QStringList() << "r" << "rate", "每个客户端每秒发送的消息数。", "n", "1");
+    QCommandLineOption warmupOption("warmup", "预热时长（秒）。", "s", "5");
+    QCommandLineOption durationOption(QStringList() << "d" << "duration", "计量时长（秒）。", "s", "30");
+    QCommandLineOption sizeOption("size", "消息正文长度（字节）。", "bytes", "64");
+    QCommandLineOption wireOption("wire", "线路格式：json 或 cbor。", "format", "json");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "结果文件，缺省时写到标准输出。", "file");
+    parser.addOption(hostOption);
+    parser.addOption(portOption);
+    parser.addOption(clientsOption);
+    parser.addOption(connectRateOption);
+    parser.addOption(rateOption);
+    parser.addOption(warmupOption);
+    parser.addOption(durationOption);
+    parser.addOption(sizeOption);
+    parser.addOption(wireOption);
+    parser.addOption(outputOption);
+    parser.process(a);
+
+    LoadOptions options;
+    options.host = parser.value(hostOption);
+    options.port = static_cast<quint16>(parser.value(portOption).toUInt());
+    options.clients = qMax(1, parser.value(clientsOption).toInt());
+    options.connectRate = qMax(1, parser.value(connectRateOption).toInt());
+    options.messageRate = parser.value(rateOption).toDouble();
+    options.warmupSeconds = qMax(0, parser.value(warmupOption).toInt());
+    options.durationSeconds = qMax(1, parser.value(durationOption).toInt());
+    options.messageSize = qMax(0, parser.value(sizeOption).toInt());
+    options.wire = Wire::formatFromName(parser.value(wireOption));
+
+    LoadGenerator generator(options);
+    QObject::connect(&generator, &LoadGenerator::finished, &a, &QCoreApplication::quit, Qt::QueuedConnection);
+    generator.start();
+    const int rc = a.exec();
+
+    const QByteArray json = QJsonDocument(generator.report()).toJson(QJsonDocument::Indented);
+    const QString outputFile = parser.value(outputOption);
+    if (outputFile.isEmpty()) {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    } else {
+        QFile out(outputFile);
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCritical("无法写入结果文件: %s", qPrintable(out.errorString()));
+            return 1;
+        }
+        out.write(json);
+    }
+    return rc;
+}
@@ -5,6 +5,8 @@ CONFIG += c++17
 TARGET = ServerApp
 TEMPLATE = app
 
+include(../ServerCore/servercore.pri)
+
 SOURCES += \
     main.cpp \
     widget.cpp
@@ -1,11 +1,27 @@
 #include "widget.h"
+#include "serveroptions.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
-    Widget w;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("聊天室服务器");
+    parser.addHelpOption();
+    ServerOptions::addOptions(parser);
+    parser.process(a);
+
+    ServerOptions options;
+    QString errorMessage;
+    if (!options.parse(parser, &errorMessage)) {
+        qCritical("%s", qPrintable(errorMessage));
+        return 1;
+    }
+
+    Widget w(options);
     w.show();
     return a.exec();
 }
@@ -1,27 +1,31 @@
 #include "widget.h"
+#include "chatserver.h"
+#include "handoff.h"
+#include "serveroptions.h"
 #include <QFile>
-#include <QDateTime>
+#include <QTextDocument>
 #include <QDebug>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonArray>
-#include <QJsonParseError>
 #include <QApplication>
 #include <QScreen>
 #include <QLabel>
 #include <QTextEdit>
 #include <QPushButton>
+#include <QHBoxLayout>
 #include <QVBoxLayout>
-#include <QTcpSocket>
+#include <QTextCursor>
+#include <QTimer>
 #include <Qt>
-#include <QMetaMethod>
 
-Widget::Widget(QWidget *parent)
+Widget::Widget(const ServerOptions &options, QWidget *parent)
     : QMainWindow(parent)
-    , tcpServer(new QTcpServer(this))
+    , chatServer(new ChatServer(options.workerCount, this))
+    , logTimer(new QTimer(this))
     , infoLabel(nullptr)
+    , queueLabel(nullptr)
     , logTextEdit(nullptr)
     , stopButton(nullptr)
+    , restartButton(nullptr)
+    , restartPending(false)
 {
     // 设置窗口标题
     setWindowTitle("聊天室服务器");
@@ -39,21 +43,43 @@ Widget::Widget(QWidget *parent)
 
     logTextEdit = new QTextEdit(this);
     logTextEdit->setReadOnly(true);
+    // 只保留最近的日志，避免文档无限增长
+    logTextEdit->document()->setMaximumBlockCount(5000);
     layout->addWidget(logTextEdit);
 
+    // 出站队列状态，随日志定时刷新
+    queueLabel = new QLabel(this);
+    queueLabel->setObjectName("queueLabel");
+    layout->addWidget(queueLabel);
+    updateQueueLabel();
+
+    restartButton = new QPushButton("热重启", this);
     stopButton = new QPushButton("停止服务器", this);
-    layout->addWidget(stopButton, 0, Qt::AlignRight);
+    QHBoxLayout *buttonLayout = new QHBoxLayout();
+    buttonLayout->addStretch();
+    buttonLayout->addWidget(restartButton);
+    buttonLayout->addWidget(stopButton);
+    layout->addLayout(buttonLayout);
 
     loadStyleSheet(":/style.qss");
 
     connect(stopButton, &QPushButton::clicked, this, &Widget::onStopButtonClicked);
-    connect(tcpServer, &QTcpServer::newConnection, this, &Widget::onNewConnection);
-
-    // 启动 TCP 服务器，监听 8888 端口
-    if (!tcpServer->listen(QHostAddress::Any, 8888)) {
-        appendLog(QString("【错误】服务器启动失败：%1").arg(tcpServer->errorString()));
+    connect(restartButton, &QPushButton::clicked, this, &Widget::onRestartButtonClicked);
+    connect(chatServer, &ChatServer::drained, this, &Widget::onDrained);
+    // 日志先写入环形缓冲区，由定时器批量刷到界面，排版开销不再落在收发路径上
+    connect(logTimer, &QTimer::timeout, this, &Widget::drainLog);
+    logTimer->start(200);
+
+    // 启动 TCP 服务器，默认监听 8888 端口
+    QString errorMessage;
+    if (!options.applyTo(chatServer, &errorMessage)) {
+        appendLog(QString("【错误】服务器配置失败：%1").arg(errorMessage));
+    } else if (!options.listen(chatServer, &errorMessage)) {
+        appendLog(QString("【错误】服务器启动失败：%1").arg(errorMessage));
     } else {
-        appendLog(QString("【信息】服务器已启动，监听端口 %1").arg(tcpServer->serverPort()));
+        appendLog(QString("【信息】服务器已启动，监听端口 %1").arg(chatServer->serverPort()));
+        if (chatServer->workerCount() > 0)
+            appendLog(QString("【信息】连接分布在 %1 个工作线程上").arg(chatServer->workerCount()));
     }
 }
 
@@ -61,158 +87,42 @@ Widget::~Widget()
 {
 }
 
-void Widget::onNewConnection()
-{
-    QTcpSocket *clientSocket = tcpServer->nextPendingConnection();
-    if (clientSocket) {
-        appendLog(QString("【连接】新客户端连接来自 %1:%2")
-                      .arg(clientSocket->peerAddress().toString())
-                      .arg(clientSocket->peerPort()));
-
-        connect(clientSocket, &QTcpSocket::readyRead, this, &Widget::onReadyRead);
-        connect(clientSocket, &QTcpSocket::disconnected, this, &Widget::onClientDisconnected);
-        clientNicknames[clientSocket] = "";
-    }
-}
-
-void Widget::onClientDisconnected()
-{
-    QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
-    if (clientSocket) {
-        QString nickname = clientNicknames.value(clientSocket, "未知用户");
-
-        appendLog(QString("【断开】%1 断开连接").arg(nickname));
-
-        clientNicknames.remove(clientSocket);
-
-        clientSocket->deleteLater();
-
-        QJsonObject leaveMessage;
-        leaveMessage["type"] = "user_left";
-        leaveMessage["nickname"] = nickname;
-
-        sendMessageToAll(leaveMessage);
-    }
-}
-
-// --- 槽函数：处理客户端发来的数据 ---
-void Widget::onReadyRead()
+// 停止与热重启都先排空：客户端收到错开的重连延迟，积压的消息写完再断开
+void Widget::onStopButtonClicked()
 {
-    QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
-    if (!clientSocket)
+    if (chatServer->isDraining())
         return;
-    while (clientSocket->canReadLine()) {
-        QByteArray jsonData = clientSocket->readLine().trimmed();
-        QJsonParseError parseError;
-
-        QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData, &parseError);
-
-        if (parseError.error != QJsonParseError::NoError) {
-            appendLog(QString("【错误】JSON解析失败 (%1): %2")
-                          .arg(parseError.errorString())
-                          .arg(QString(jsonData)));
-            continue;
-        }
-
-        if (!jsonDoc.isObject()) {
-            appendLog(QString("【警告】收到非JSON对象数据: %1").arg(QString(jsonData)));
-            continue;
-        }
-
-        QJsonObject obj = jsonDoc.object();
-        QString type = obj["type"].toString();
-
-        if (type == "login") {
-            QString nickname = obj["nickname"].toString();
-            if (!nickname.isEmpty()) {
-                if (clientNicknames.values().contains(nickname)) {
-                    appendLog(QString("【警告】昵称 '%1' 已存在，拒绝登录").arg(nickname));
-
-                    QJsonObject errorMsg;
-                    errorMsg["type"] = "login_failed";
-                    errorMsg["reason"] = "昵称已存在";
-                    QJsonDocument errorDoc(errorMsg);
-                    QByteArray responseData = errorDoc.toJson(QJsonDocument::Compact) + "\n";
-
-                    clientSocket->write(responseData);
-                    clientSocket->flush();
-
-                } else {
-                    clientNicknames[clientSocket] = nickname;
-                    appendLog(QString("【登录】用户 '%1' 登录成功").arg(nickname));
-
-                    QJsonObject successMsg;
-                    successMsg["type"] = "login_success";
-                    QJsonDocument successDoc(successMsg);
-
-                    QByteArray successData = successDoc.toJson(QJsonDocument::Compact) + "\n";
-                    clientSocket->write(successData);
-                    clientSocket->flush();
-
-                    QJsonObject joinMessage;
-                    joinMessage["type"] = "user_joined";
-                    joinMessage["nickname"] = nickname;
-                    sendMessageToAll(joinMessage);
-
-                    QJsonObject userListMsg;
-                    userListMsg["type"] = "user_list";
-                    QJsonArray userArray;
-                    for (const QString& name : clientNicknames.values()) {
-                        if(!name.isEmpty())
-                            userArray.append(name);
-                    }
-                    userListMsg["users"] = userArray;
-                    QJsonDocument listDoc(userListMsg);
-                    QByteArray listData = listDoc.toJson(QJsonDocument::Compact) + "\n";
-                    clientSocket->write(listData);
-                    clientSocket->flush();
-                }
-            }
-        } else if (type == "chat_message") {
-            QString message = obj["message"].toString();
-            QString senderNickname = clientNicknames.value(clientSocket, "未知用户");
-            if (!message.isEmpty()) {
-                appendLog(QString("[%1]: %2").arg(senderNickname).arg(message));
-
-                QJsonObject chatMsg;
-                chatMsg["type"] = "chat_message";
-                chatMsg["sender"] = senderNickname;
-                chatMsg["message"] = message;
-
-                sendMessageToAll(chatMsg);
-            }
-        } else {
-            appendLog(QString("【警告】收到未知类型消息: %1").arg(type));
-        }
-    }
+    appendLog("【提示】服务器正在停止...");
+    restartPending = false;
+    stopButton->setEnabled(false);
+    restartButton->setEnabled(false);
+    chatServer->drain();
 }
 
-void Widget::sendMessageToAll(const QJsonObject &message)
+void Widget::onRestartButtonClicked()
 {
-    QByteArray data = QJsonDocument(message).toJson(QJsonDocument::Compact) + "\n";
-
-    for (auto it = clientNicknames.constBegin(); it != clientNicknames.constEnd(); ++it) {
-        QTcpSocket *socket = it.key();
-        if (socket && socket->state() == QAbstractSocket::ConnectedState) {
-            socket->write(data);
-            socket->flush();
-        }
-    }
+    if (chatServer->isDraining())
+        return;
+    appendLog("【提示】服务器正在热重启...");
+    restartPending = true;
+    stopButton->setEnabled(false);
+    restartButton->setEnabled(false);
+    chatServer->drain();
 }
 
-void Widget::onStopButtonClicked()
+void Widget::onDrained()
 {
-    appendLog("【提示】服务器正在停止...");
-
-    tcpServer->close();
-
-    for (auto it = clientNicknames.constBegin(); it != clientNicknames.constEnd(); ++it) {
-        QTcpSocket *socket = it.key();
-        if (socket) {
-            socket->disconnectFromHost();
+    if (restartPending) {
+        QString errorMessage;
+        if (Handoff::restart(chatServer, &errorMessage)) {
+            appendLog("【提示】新进程已接管监听端口，本进程退出。");
+            drainLog();
+            QCoreApplication::quit();
+            return;
         }
+        appendLog(QString("【错误】热重启失败：%1").arg(errorMessage));
     }
-
+    chatServer->close();
     appendLog("【提示】服务器已停止。");
 }
 
@@ -230,6 +140,37 @@ void Widget::loadStyleSheet(const QString &sheetName)
 
 void Widget::appendLog(const QString &message)
 {
-    QString timestamp = QDateTime::currentDateTime().toString("hh:mm:ss");
-    logTextEdit->append(QString("[%1] %2").arg(timestamp).arg(message));
+    chatServer->logSink()->append(message);
+}
+
+void Widget::updateQueueLabel()
+{
+    const QueueStats stats = chatServer->queueStats();
+    queueLabel->setText(QString("出站积压：%1 KB　拥塞连接：%2　丢弃帧：%3　断开慢连接：%4")
+                            .arg(stats.queuedBytes / 1024)
+                            .arg(stats.congestedConnections)
+                            .arg(stats.droppedFrames)
+                            .arg(stats.evictedConnections));
+}
+
+void Widget::drainLog()
+{
+    updateQueueLabel();
+
+    const QVector<LogEntry> batch = chatServer->logSink()->takeAll();
+    if (batch.isEmpty())
+        return;
+
+    QStringList lines;
+    lines.reserve(batch.size());
+    for (const LogEntry &entry : batch) {
+        lines.append(LogSink::format(entry));
+    }
+
+    QTextCursor cursor(logTextEdit->document());
+    cursor.movePosition(QTextCursor::End);
+    if (!logTextEdit->document()->isEmpty())
+        cursor.insertBlock();
+    cursor.insertText(lines.join('\n'));
+    logTextEdit->moveCursor(QTextCursor::End);
 }
@@ -2,40 +2,44 @@
 #define WIDGET_H
 
 #include <QMainWindow>
-#include <QTcpServer>
 
 QT_BEGIN_NAMESPACE
 class QLabel;
 class QTextEdit;
 class QPushButton;
-class QTcpSocket;
+class QTimer;
 QT_END_NAMESPACE
 
+class ChatServer;
+struct ServerOptions;
+
 class Widget : public QMainWindow
 {
     Q_OBJECT
 
 public:
-    Widget(QWidget *parent = nullptr);
+    explicit Widget(const ServerOptions &options, QWidget *parent = nullptr);
     ~Widget();
 
 private slots:
-    void onNewConnection();
-    void onClientDisconnected();
-    void onReadyRead();
     void onStopButtonClicked();
+    void onRestartButtonClicked();
+    void onDrained();
+    void drainLog();
 
 private:
-    QTcpServer *tcpServer;
+    ChatServer *chatServer;
+    QTimer *logTimer;
     QTextEdit *logTextEdit;
     QLabel *infoLabel;
+    QLabel *queueLabel;
     QPushButton *stopButton;
-
-    QMap<QTcpSocket*, QString> clientNicknames;
+    QPushButton *restartButton;
+    bool restartPending;        // 排空完成后交给新进程，而不是直接停止
 
     void loadStyleSheet(const QString &sheetName);
     void appendLog(const QString &message);
-    void sendMessageToAll(const QJsonObject &message);
+    void updateQueueLabel();
 };
 
 #endif
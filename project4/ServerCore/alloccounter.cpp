@@ -0,0 +1,84 @@
+#include "alloccounter.h"
+
+#if defined(CHAT_ALLOC_COUNTER) && defined(__GLIBC__)
+#include <atomic>
+#include <cstddef>
+
+// 可执行文件里定义的同名函数优先于 libc 中的版本，Qt 库里的分配也会走到这里
+// free 不必接管：内存仍由 glibc 分配
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t elements, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+}
+
+static thread_local quint64 threadCount __attribute__((tls_model("initial-exec"))) = 0;
+static std::atomic<quint64> totalCount{0};
+
+static inline void countAllocation()
+{
+    ++threadCount;
+    totalCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t elements, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(elements, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+namespace AllocCounter
+{
+
+bool isEnabled()
+{
+    return true;
+}
+
+quint64 threadAllocations()
+{
+    return threadCount;
+}
+
+quint64 totalAllocations()
+{
+    return totalCount.load(std::memory_order_relaxed);
+}
+
+}
+
+#else
+
+namespace AllocCounter
+{
+
+bool isEnabled()
+{
+    return false;
+}
+
+quint64 threadAllocations()
+{
+    return 0;
+}
+
+quint64 totalAllocations()
+{
+    return 0;
+}
+
+}
+
+#endif
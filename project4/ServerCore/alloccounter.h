@@ -0,0 +1,19 @@
+#ifndef ALLOCCOUNTER_H
+#define ALLOCCOUNTER_H
+
+#include <QtGlobal>
+
+// 堆分配计数模式：以 CONFIG+=alloc_counter 构建时（仅 Linux/glibc）接管 malloc、calloc 与 realloc，
+// 按线程累计分配次数；operator new 与 Qt 容器的分配最终都经过这几个函数
+// 处理消息的代码在前后各取一次本线程的计数，差值记进指标，用来确认稳定状态下每条消息不再分配
+// 普通构建中 isEnabled() 为 false，其余函数返回 0，没有任何开销
+namespace AllocCounter
+{
+bool isEnabled();
+// 本线程累计的分配次数
+quint64 threadAllocations();
+// 全进程累计的分配次数
+quint64 totalAllocations();
+}
+
+#endif // ALLOCCOUNTER_H
@@ -0,0 +1,78 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QtGlobal>
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QVector>
+#include <atomic>
+#include "metrics.h"
+
+// 帧编码用的 QByteArray 缓冲池
+// take() 取出一块独占的缓冲写入内容，写完用 give() 交回：池里留一份隐式共享的引用，帧照常发给各个接收者。
+// 等所有接收者都写完、其余引用都释放（池里这份又变成独占）后，下次 take() 原样复用这块内存，
+// 稳定状态下编码广播帧不再向系统申请缓冲
+// 只在所属线程使用，不加锁；统计值可从其他线程读取
+class BufferPool
+{
+public:
+    explicit BufferPool(int maxBuffers = 256, int maxRetainedCapacity = 64 * 1024)
+        : maxBuffers(maxBuffers), maxRetainedCapacity(maxRetainedCapacity), cursor(0)
+    {
+        buffers.reserve(maxBuffers);
+    }
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // 返回长度为 0、容量至少为 capacity 的独占缓冲
+    QByteArray take(int capacity)
+    {
+        // 只看几块：刚交回的帧多半还在出站队列里，没必要把整个池扫一遍
+        const int probes = qMin(buffers.size(), 8);
+        for (int i = 0; i < probes; ++i) {
+            if (cursor >= buffers.size())
+                cursor = 0;
+            QByteArray &candidate = buffers[cursor];
+            if (candidate.isDetached()) {
+                // 与其他线程释放最后一个引用前的读取建立先后关系，之后才能改写内容
+                std::atomic_thread_fence(std::memory_order_acquire);
+                QByteArray buffer;
+                buffer.swap(candidate);
+                buffers[cursor].swap(buffers.last());
+                buffers.removeLast();
+                // 先 reserve 过的缓冲 resize(0) 保留容量
+                buffer.resize(0);
+                if (buffer.capacity() < capacity)
+                    buffer.reserve(capacity);
+                Metrics::bump(reusedCount);
+                return buffer;
+            }
+            ++cursor;
+        }
+        QByteArray buffer;
+        buffer.reserve(qMax(capacity, 256));
+        Metrics::bump(allocatedCount);
+        return buffer;
+    }
+
+    // 交回编码好的缓冲；池满或缓冲过大时不保留，由最后一个引用释放
+    void give(const QByteArray &buffer)
+    {
+        if (buffers.size() < maxBuffers && buffer.capacity() <= maxRetainedCapacity)
+            buffers.append(buffer);
+    }
+
+    quint64 reused() const { return reusedCount.loadRelaxed(); }
+    quint64 allocated() const { return allocatedCount.loadRelaxed(); }
+
+private:
+    int maxBuffers;
+    int maxRetainedCapacity;
+    int cursor;
+    QVector<QByteArray> buffers;
+    QAtomicInteger<quint64> reusedCount{0};
+    QAtomicInteger<quint64> allocatedCount{0};
+};
+
+#endif // BUFFERPOOL_H
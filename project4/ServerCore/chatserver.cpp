@@ -0,0 +1,639 @@
+#include "chatserver.h"
+#include "chatworker.h"
+#include "clusterbus.h"
+#include "historystore.h"
+#include "metricsendpoint.h"
+#include <QCborValue>
+#include <QDateTime>
+#include <QThread>
+#include <QTimer>
+
+// 排空最长等待时间，超过后不再等仍未断开的连接
+static const qint64 DrainTimeoutNs = 10LL * 1000 * 1000 * 1000;
+
+bool QueueStats::operator==(const QueueStats &other) const
+{
+    return queuedBytes == other.queuedBytes
+           && congestedConnections == other.congestedConnections
+           && droppedFrames == other.droppedFrames
+           && evictedConnections == other.evictedConnections;
+}
+
+ChatServer::ChatServer(int workerCount, QObject *parent)
+    : QTcpServer(parent)
+    , nextWorker(0)
+    , maxQueuedBytes(1024 * 1024)
+    , policy(DropOldest)
+    , idleTimeoutSeconds(60)
+    , logChat(true)
+    , resumeGraceSeconds(60)
+    , drainSpreadSeconds(10)
+    , draining(false)
+    , drainDeadlineNs(0)
+    , batchWindowMs(5)
+    , batchBytes(16 * 1024)
+    , compressBytes(Wire::DefaultCompressThreshold)
+    , perConnectionRate(5)
+    , perConnectionBurst(10)
+    , globalMessageRate(0)
+    , flood(Mute)
+    , statsTimer(new QTimer(this))
+    , sessionTimer(new QTimer(this))
+    , drainTimer(new QTimer(this))
+    , historyStore(nullptr)
+    , metricsEndpoint(nullptr)
+    , cluster(nullptr)
+    , clusterBus(nullptr)
+{
+    // 队列情况有变化时定期写一行日志
+    connect(statsTimer, &QTimer::timeout, this, &ChatServer::logQueueStats);
+    statsTimer->start(10000);
+    // 断线保留到期的会话每秒清理一次，补发它们的下线
+    connect(sessionTimer, &QTimer::timeout, this, &ChatServer::expireSessions);
+    sessionTimer->start(1000);
+    connect(drainTimer, &QTimer::timeout, this, &ChatServer::checkDrained);
+
+    if (workerCount <= 0) {
+        ChatWorker *worker = new ChatWorker(this, &registry, this);
+        workers.append(worker);
+        return;
+    }
+
+    for (int i = 0; i < workerCount; ++i) {
+        QThread *thread = new QThread(this);
+        thread->setObjectName(QString("ChatWorker-%1").arg(i));
+
+        // 工作对象不能有父对象才能移动到其他线程，由线程结束时释放
+        ChatWorker *worker = new ChatWorker(this, &registry);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+
+        threads.append(thread);
+        workers.append(worker);
+        thread->start();
+    }
+}
+
+ChatServer::~ChatServer()
+{
+    close();
+    for (QThread *thread : qAsConst(threads)) {
+        thread->quit();
+        thread->wait();
+    }
+    // 工作线程都已停止，不会再有新的追加，也不会再有调用排到集群总线上
+    delete historyStore;
+    delete clusterBus;
+}
+
+int ChatServer::workerCount() const
+{
+    return threads.size();
+}
+
+ClientRegistry *ChatServer::clientRegistry()
+{
+    return &registry;
+}
+
+LogSink *ChatServer::logSink()
+{
+    return &sink;
+}
+
+void ChatServer::setOutboundLimit(qint64 maxQueuedBytes, SlowConsumerPolicy policy)
+{
+    this->maxQueuedBytes = maxQueuedBytes;
+    this->policy = policy;
+}
+
+qint64 ChatServer::outboundLimit() const
+{
+    return maxQueuedBytes;
+}
+
+ChatServer::SlowConsumerPolicy ChatServer::slowConsumerPolicy() const
+{
+    return policy;
+}
+
+bool ChatServer::enableHistory(const QString &directory, int replayCount, QString *errorMessage)
+{
+    HistoryStore *store = new HistoryStore;
+    if (!store->open(directory, replayCount, errorMessage)) {
+        delete store;
+        return false;
+    }
+    store->start();
+    historyStore = store;
+    return true;
+}
+
+bool ChatServer::enableMetrics(quint16 port, QString *errorMessage)
+{
+    MetricsEndpoint *endpoint = new MetricsEndpoint([this]() { return metricsText(); }, this);
+    if (!endpoint->listen(QHostAddress::LocalHost, port)) {
+        *errorMessage = QString("指标端口 %1 监听失败：%2").arg(port).arg(endpoint->errorString());
+        delete endpoint;
+        return false;
+    }
+    metricsEndpoint = endpoint;
+    sink.append(QString("【信息】指标端点 http://127.0.0.1:%1/metrics").arg(endpoint->serverPort()));
+    return true;
+}
+
+HistoryStore *ChatServer::history() const
+{
+    return historyStore;
+}
+
+RoomLog *ChatServer::roomLog()
+{
+    return &chatLog;
+}
+
+void ChatServer::setBatching(int windowMs, int maxBytes)
+{
+    batchWindowMs = qMax(windowMs, 0);
+    batchBytes = qMax(maxBytes, 1);
+}
+
+int ChatServer::batchWindow() const
+{
+    return batchWindowMs;
+}
+
+int ChatServer::batchMaxBytes() const
+{
+    return batchBytes;
+}
+
+void ChatServer::setCompressThreshold(int bytes)
+{
+    compressBytes = qMax(bytes, 0);
+}
+
+int ChatServer::compressThreshold() const
+{
+    return compressBytes;
+}
+
+void ChatServer::compressedConnectionChanged(int delta)
+{
+    compressedConnections.fetchAndAddRelaxed(delta);
+}
+
+bool ChatServer::hasCompressedConnections() const
+{
+    return compressedConnections.loadRelaxed() > 0;
+}
+
+void ChatServer::setResumeGrace(int seconds)
+{
+    resumeGraceSeconds = qMax(seconds, 0);
+}
+
+int ChatServer::resumeGrace() const
+{
+    return resumeGraceSeconds;
+}
+
+void ChatServer::setDrainSpread(int seconds)
+{
+    drainSpreadSeconds = qMax(seconds, 0);
+}
+
+int ChatServer::drainSpread() const
+{
+    return drainSpreadSeconds;
+}
+
+void ChatServer::setIdleTimeout(int seconds)
+{
+    idleTimeoutSeconds = qMax(seconds, 0);
+}
+
+int ChatServer::idleTimeout() const
+{
+    return idleTimeoutSeconds;
+}
+
+void ChatServer::setChatLogging(bool enabled)
+{
+    logChat = enabled;
+}
+
+bool ChatServer::chatLogging() const
+{
+    return logChat;
+}
+
+void ChatServer::setRateLimit(double messageRate, double burst, double globalRate, FloodPolicy policy)
+{
+    perConnectionRate = messageRate;
+    perConnectionBurst = burst;
+    globalMessageRate = globalRate;
+    flood = policy;
+}
+
+double ChatServer::messageRate() const
+{
+    return perConnectionRate;
+}
+
+double ChatServer::messageBurst() const
+{
+    return perConnectionBurst;
+}
+
+double ChatServer::globalRate() const
+{
+    return globalMessageRate;
+}
+
+ChatServer::FloodPolicy ChatServer::floodPolicy() const
+{
+    return flood;
+}
+
+bool ChatServer::floodPolicyFromName(const QString &name, FloodPolicy *policy)
+{
+    if (name == QLatin1String("mute"))
+        *policy = Mute;
+    else if (name == QLatin1String("disconnect"))
+        *policy = DisconnectFlooder;
+    else
+        return false;
+    return true;
+}
+
+bool ChatServer::policyFromName(const QString &name, SlowConsumerPolicy *policy)
+{
+    if (name == QLatin1String("drop-oldest"))
+        *policy = DropOldest;
+    else if (name == QLatin1String("coalesce"))
+        *policy = Coalesce;
+    else if (name == QLatin1String("disconnect"))
+        *policy = Disconnect;
+    else
+        return false;
+    return true;
+}
+
+QueueStats ChatServer::queueStats() const
+{
+    QueueStats total;
+    for (ChatWorker *worker : workers) {
+        const QueueStats stats = worker->queueStats();
+        total.queuedBytes += stats.queuedBytes;
+        total.congestedConnections += stats.congestedConnections;
+        total.droppedFrames += stats.droppedFrames;
+        total.evictedConnections += stats.evictedConnections;
+    }
+    return total;
+}
+
+MetricsSnapshot ChatServer::metricsSnapshot() const
+{
+    MetricsSnapshot snapshot;
+    for (ChatWorker *worker : workers) {
+        snapshot.add(worker->metrics());
+    }
+    return snapshot;
+}
+
+QByteArray ChatServer::metricsText() const
+{
+    return metricsSnapshot().toPrometheus(queueStats());
+}
+
+void ChatServer::logQueueStats()
+{
+    // 限流计数有变化时也记一行
+    const MetricsSnapshot metrics = metricsSnapshot();
+    if (metrics.rateLimited != lastLoggedMetrics.rateLimited
+        || metrics.globalLimited != lastLoggedMetrics.globalLimited
+        || metrics.floodActions != lastLoggedMetrics.floodActions) {
+        lastLoggedMetrics = metrics;
+        sink.append(QString("【限流】超速丢弃 %1 条，入口上限丢弃 %2 条，禁言或断开 %3 次")
+                        .arg(metrics.rateLimited)
+                        .arg(metrics.globalLimited)
+                        .arg(metrics.floodActions));
+    }
+
+    const QueueStats stats = queueStats();
+    if (stats == lastLoggedStats)
+        return;
+    lastLoggedStats = stats;
+    sink.append(QString("【队列】积压 %1 字节，拥塞连接 %2，丢弃帧 %3，断开慢连接 %4")
+                    .arg(stats.queuedBytes)
+                    .arg(stats.congestedConnections)
+                    .arg(stats.droppedFrames)
+                    .arg(stats.evictedConnections));
+}
+
+void ChatServer::expireSessions()
+{
+    if (resumeGraceSeconds <= 0)
+        return;
+    QList<ClientRegistry::OfflineMessage> dropped;
+    const QList<QPair<QString, quint64>> expired = registry.expireSessions(Metrics::nowNs(), &dropped);
+    for (const auto &entry : expired) {
+        sink.append(QString("【断开】%1 的会话保留期已过，释放昵称").arg(entry.first));
+        presenceChanged(entry.first, false, entry.second);
+    }
+    // 对方没在保留期内回来，暂存的私聊作废
+    for (const ClientRegistry::OfflineMessage &message : qAsConst(dropped))
+        sendToClient(message.sender, Frames::privateAck(message.id, message.recipient, QStringLiteral("rejected"),
+                                                        "对方不在线"));
+}
+
+void ChatServer::incomingConnection(qintptr socketDescriptor)
+{
+    ChatWorker *worker = workers.at(nextWorker);
+    nextWorker = (nextWorker + 1) % workers.size();
+
+    QMetaObject::invokeMethod(worker, [worker, socketDescriptor]() {
+        worker->addConnection(socketDescriptor);
+    }, Qt::AutoConnection);
+}
+
+void ChatServer::sendMessageToAll(const Frame &frame)
+{
+    Frame stamped = frame;
+    stamped.createdNs = Metrics::nowNs();
+    // 每次广播只压缩一次，各分片、各接收者共用
+    if (hasCompressedConnections())
+        Frames::compress(stamped, compressBytes);
+    for (ChatWorker *worker : qAsConst(workers)) {
+        dispatch(worker, stamped);
+    }
+}
+
+void ChatServer::sendToRoom(const QString &room, const Frame &frame)
+{
+    if (room == QLatin1String(Wire::DefaultRoom)) {
+        sendMessageToAll(frame);
+        return;
+    }
+    Frame stamped = frame;
+    stamped.createdNs = Metrics::nowNs();
+    if (hasCompressedConnections())
+        Frames::compress(stamped, compressBytes);
+    for (ChatWorker *worker : qAsConst(workers)) {
+        dispatch(worker, stamped, room);
+    }
+}
+
+ChatServer::Delivery ChatServer::sendToClient(const QString &nickname, const Frame &frame)
+{
+    if (deliverLocal(nickname, frame))
+        return Delivered;
+    QString node;
+    ClusterBus *bus = cluster.loadAcquire();
+    if (!bus || !registry.remoteNode(nickname, &node))
+        return NotDelivered;
+    // 总线上转发的是消息本身，由对方节点按收件人协商的格式重新编码
+    const QCborMap message = QCborValue::fromCbor(frame.cbor.mid(Wire::HeaderSize)).toMap();
+    QMetaObject::invokeMethod(bus, [bus, node, nickname, message]() {
+        bus->forwardPrivate(node, nickname, message);
+    }, Qt::AutoConnection);
+    return Forwarded;
+}
+
+bool ChatServer::deliverLocal(const QString &nickname, const Frame &frame)
+{
+    ChatWorker *worker = nullptr;
+    QTcpSocket *socket = registry.socketFor(nickname, &worker);
+    if (!socket || !worker)
+        return false;
+
+    Frame stamped = frame;
+    stamped.createdNs = Metrics::nowNs();
+    if (worker->thread() == QThread::currentThread()) {
+        worker->deliverTo(socket, nickname, stamped);
+    } else {
+        // 套接字只在所属分片里解引用；排队期间对方可能已断开，由 deliverTo 核对
+        QMetaObject::invokeMethod(worker, [worker, socket, nickname, stamped]() {
+            worker->deliverTo(socket, nickname, stamped);
+        }, Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void ChatServer::presenceChanged(const QString &nickname, bool joined, quint64 version)
+{
+    sendMessageToAll(joined ? Frames::userJoined(nickname, version) : Frames::userLeft(nickname, version));
+    ClusterBus *bus = cluster.loadAcquire();
+    if (!bus)
+        return;
+    QMetaObject::invokeMethod(bus, [bus, nickname, joined]() {
+        bus->announce(nickname, joined);
+        if (!joined)
+            bus->release(nickname);
+    }, Qt::AutoConnection);
+}
+
+void ChatServer::forwardChat(const QString &sender, const QString &message, const QString &room)
+{
+    ClusterBus *bus = cluster.loadAcquire();
+    if (!bus)
+        return;
+    QMetaObject::invokeMethod(bus, [bus, sender, message, room]() {
+        bus->forwardChat(sender, message, room);
+    }, Qt::AutoConnection);
+}
+
+bool ChatServer::enableCluster(const QString &nodeId, const QHostAddress &bindAddress, quint16 port,
+                               const QStringList &peers, const QByteArray &secret, QString *errorMessage)
+{
+    ClusterBus *bus = new ClusterBus(nodeId, &sink, this);
+    bus->setSecret(secret);
+    for (const QString &text : peers) {
+        ClusterBus::Peer peer;
+        if (!ClusterBus::parsePeer(text, &peer)) {
+            *errorMessage = QString("无效的节点地址：%1（应为 id@host:port）").arg(text);
+            delete bus;
+            return false;
+        }
+        bus->addPeer(peer);
+    }
+    connect(bus, &ClusterBus::peerUp, this, &ChatServer::onPeerUp);
+    connect(bus, &ClusterBus::peerDown, this, &ChatServer::onPeerDown);
+    connect(bus, &ClusterBus::remotePresence, this, &ChatServer::onRemotePresence);
+    connect(bus, &ClusterBus::remoteChat, this, &ChatServer::onRemoteChat);
+    connect(bus, &ClusterBus::remotePrivate, this, &ChatServer::onRemotePrivate);
+    if (!bus->listen(bindAddress, port, errorMessage)) {
+        delete bus;
+        return false;
+    }
+    clusterBus = bus;
+    cluster.storeRelease(bus);
+    return true;
+}
+
+bool ChatServer::clusterEnabled() const
+{
+    return cluster.loadAcquire() != nullptr;
+}
+
+void ChatServer::reserveNickname(const QString &nickname, ChatWorker *worker, QTcpSocket *socket)
+{
+    ClusterBus *bus = cluster.loadAcquire();
+    if (!bus) {
+        // 集群总线已在交接中关闭：按归属节点不可达处理
+        QMetaObject::invokeMethod(worker, [worker, socket, nickname]() {
+            worker->finishReservation(socket, nickname, false);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    QMetaObject::invokeMethod(bus, [bus, nickname, worker, socket]() {
+        bus->reserve(nickname, [nickname, worker, socket](bool granted) {
+            QMetaObject::invokeMethod(worker, [worker, socket, nickname, granted]() {
+                worker->finishReservation(socket, nickname, granted);
+            }, Qt::QueuedConnection);
+        });
+    }, Qt::AutoConnection);
+}
+
+void ChatServer::releaseReservation(const QString &nickname)
+{
+    ClusterBus *bus = cluster.loadAcquire();
+    if (!bus)
+        return;
+    QMetaObject::invokeMethod(bus, [bus, nickname]() {
+        bus->release(nickname);
+    }, Qt::AutoConnection);
+}
+
+// 对端节点（重新）连上：先清掉它之前的昵称，等它发来快照再登记；同时把本节点的昵称发过去
+void ChatServer::onPeerUp(const QString &node)
+{
+    onPeerDown(node);
+    if (ClusterBus *bus = cluster.loadAcquire())
+        bus->sendSnapshot(node, registry.localNicknames());
+}
+
+void ChatServer::onPeerDown(const QString &node)
+{
+    const QList<QPair<QString, quint64>> removed = registry.removeNode(node);
+    for (const auto &entry : removed)
+        sendMessageToAll(Frames::userLeft(entry.first, entry.second));
+}
+
+void ChatServer::onRemotePresence(const QString &node, const QString &nickname, bool joined)
+{
+    const quint64 version = joined ? registry.addRemote(nickname, node) : registry.removeRemote(nickname, node);
+    if (version != 0)
+        sendMessageToAll(joined ? Frames::userJoined(nickname, version) : Frames::userLeft(nickname, version));
+}
+
+// 其他节点的聊天消息在本节点也登记进聊天记录与房间序号，序号都按本节点编，续连补发照常可用
+void ChatServer::onRemoteChat(const QString &sender, const QString &message, const QString &room)
+{
+    qint64 id = 0;
+    if (room == QLatin1String(Wire::DefaultRoom) && historyStore)
+        id = historyStore->append(sender, message, QDateTime::currentMSecsSinceEpoch());
+    sendToRoom(room, chatLog.append(room, sender, message, id));
+}
+
+void ChatServer::onRemotePrivate(const QString &node, const QString &recipient, const QCborMap &message)
+{
+    const bool delivered = deliverLocal(recipient, Frames::relay(message));
+    if (message.value(QLatin1String("type")).toString() != QLatin1String("private_message"))
+        return;
+    // 私聊的回执经总线发回发件人所在的节点，由它当作普通的点对点帧交给发件人
+    ClusterBus *bus = cluster.loadAcquire();
+    if (!bus)
+        return;
+    const qint64 id = message.value(QLatin1String("id")).toInteger();
+    const Frame ack = delivered ? Frames::privateAck(id, recipient, QStringLiteral("delivered"))
+                                : Frames::privateAck(id, recipient, QStringLiteral("rejected"), "对方不在线");
+    bus->forwardPrivate(node, message.value(QLatin1String("from")).toString(),
+                        QCborValue::fromCbor(ack.cbor.mid(Wire::HeaderSize)).toMap());
+}
+
+void ChatServer::disconnectAll()
+{
+    for (ChatWorker *worker : qAsConst(workers)) {
+        QMetaObject::invokeMethod(worker, &ChatWorker::disconnectAll, Qt::AutoConnection);
+    }
+}
+
+void ChatServer::drain()
+{
+    if (draining)
+        return;
+    draining = true;
+    // 监听套接字保持打开：热重启时排队中的连接留给新进程接受
+    pauseAccepting();
+    sink.append(QString("【提示】开始排空连接，客户端将在 %1 秒内陆续重连").arg(drainSpreadSeconds));
+
+    const int spreadMs = drainSpreadSeconds * 1000;
+    for (ChatWorker *worker : qAsConst(workers)) {
+        QMetaObject::invokeMethod(worker, [worker, spreadMs]() {
+            worker->drain(spreadMs);
+        }, Qt::AutoConnection);
+    }
+    drainDeadlineNs = Metrics::nowNs() + DrainTimeoutNs;
+    drainTimer->start(100);
+}
+
+bool ChatServer::isDraining() const
+{
+    return draining;
+}
+
+void ChatServer::checkDrained()
+{
+    const int remaining = registry.count();
+    if (remaining > 0 && Metrics::nowNs() < drainDeadlineNs)
+        return;
+    drainTimer->stop();
+    if (remaining > 0)
+        sink.append(QString("【警告】排空超时，仍有 %1 个连接未断开").arg(remaining));
+    else
+        sink.append("【提示】所有连接已断开");
+    emit drained();
+}
+
+QCborMap ChatServer::takeHandoffState()
+{
+    // 新进程启动时从磁盘载入聊天记录，先让记录线程写完
+    if (historyStore) {
+        historyStore->stop();
+        historyStore->wait();
+    }
+    // 指标端口让给新进程
+    if (metricsEndpoint)
+        metricsEndpoint->close();
+    // 集群端口同样让给新进程；对端节点看到链路断开，等新进程连上后重新同步昵称
+    // 先置空再关闭：分片线程之后不再取到它；已取到指针、排队中的调用落在关闭后的总线上只是空操作。
+    // 这里不删除总线，分片线程可能随时往它上面排调用，等析构中工作线程都停止后再删
+    if (ClusterBus *bus = cluster.fetchAndStoreOrdered(nullptr))
+        bus->shutdown();
+    QCborMap state = registry.exportState(Metrics::nowNs(), resumeGraceSeconds * 1000000000LL);
+    // 聊天序号随之交接，续连的客户端只需补排空期间缺的几条
+    state.insert(QStringLiteral("chat"), chatLog.exportState());
+    return state;
+}
+
+void ChatServer::restoreHandoffState(const QCborMap &state)
+{
+    registry.importState(state, Metrics::nowNs());
+    chatLog.importState(state.value(QLatin1String("chat")).toMap());
+    sink.append("【信息】已接管上一进程的在线状态、续连会话与聊天序号");
+}
+
+// 同线程直接调用以保持消息顺序（例如 user_joined 先于 user_list），跨线程排队
+// room 为空表示发给分片内全部连接
+void ChatServer::dispatch(ChatWorker *worker, const Frame &frame, const QString &room)
+{
+    if (worker->thread() == QThread::currentThread()) {
+        worker->deliver(frame, room);
+    } else {
+        QMetaObject::invokeMethod(worker, [worker, frame, room]() {
+            worker->deliver(frame, room);
+        }, Qt::QueuedConnection);
+    }
+}
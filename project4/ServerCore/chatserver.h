@@ -0,0 +1,215 @@
+#ifndef CHATSERVER_H
+#define CHATSERVER_H
+
+#include <QTcpServer>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QList>
+#include "clientregistry.h"
+#include "frames.h"
+#include "logsink.h"
+#include "metrics.h"
+#include "roomlog.h"
+
+QT_BEGIN_NAMESPACE
+class QHostAddress;
+class QThread;
+QT_END_NAMESPACE
+
+class ChatWorker;
+class ClusterBus;
+class HistoryStore;
+class MetricsEndpoint;
+class QTimer;
+
+// 各分片出站队列的汇总计数
+struct QueueStats
+{
+    qint64 queuedBytes = 0;         // 尚未交给套接字的积压字节
+    int congestedConnections = 0;   // 当前有积压的连接数
+    quint64 droppedFrames = 0;      // 因超限被丢弃或合并掉的帧
+    quint64 evictedConnections = 0; // 因超限被断开的慢连接
+
+    bool operator==(const QueueStats &other) const;
+    bool operator!=(const QueueStats &other) const { return !(*this == other); }
+};
+
+// 监听端口并把新连接轮流分配给各工作线程（分片）
+// workerCount 为 0 时只有一个分片，运行在服务器自身所在的线程
+class ChatServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    // 某个连接的出站积压超过上限时的处理方式
+    enum SlowConsumerPolicy {
+        DropOldest,     // 丢弃最旧的积压帧
+        Coalesce,       // 积压的上下线通知合并为一份最新的 user_list，仍超限再丢最旧
+        Disconnect      // 直接断开慢连接
+    };
+
+    // 单个连接持续超速时的处理方式
+    enum FloodPolicy {
+        Mute,           // 一段时间内丢弃该连接的全部聊天消息
+        DisconnectFlooder
+    };
+
+    explicit ChatServer(int workerCount = 0, QObject *parent = nullptr);
+    ~ChatServer();
+
+    int workerCount() const;
+    ClientRegistry *clientRegistry();
+    // 所有分片共用的日志缓冲区，由界面或后台写线程负责取出
+    LogSink *logSink();
+
+    // 线程安全：帧已由调用方编码好，各分片共享同一块缓冲区
+    void sendMessageToAll(const Frame &frame);
+    // 只发给房间成员：每个分片只遍历本地的房间成员表；默认房间等同于 sendMessageToAll
+    void sendToRoom(const QString &room, const Frame &frame);
+    // 点对点：经登记表找到对方所在分片直接投递，对方不在线时返回 NotDelivered；
+    // 集群模式下对方在其他节点时经中继总线转给那个节点并返回 Forwarded，
+    // 私聊是否送达由那个节点投递后经总线发回 private_ack
+    enum Delivery {
+        NotDelivered,
+        Delivered,
+        Forwarded
+    };
+    Delivery sendToClient(const QString &nickname, const Frame &frame);
+    // 线程安全：本节点的上下线广播给本地客户端，集群模式下同时通知其他节点
+    void presenceChanged(const QString &nickname, bool joined, quint64 version);
+    // 线程安全：本地聊天消息转给其他节点，每个节点一份
+    void forwardChat(const QString &sender, const QString &message, const QString &room);
+
+    // 须在 listen() 之前设置，之后各分片只读
+    void setOutboundLimit(qint64 maxQueuedBytes, SlowConsumerPolicy policy);
+    qint64 outboundLimit() const;
+    SlowConsumerPolicy slowConsumerPolicy() const;
+    // 聊天消息合批：windowMs 内或累计到 maxBytes 的消息合成一个 batch 帧，windowMs 为 0 表示关闭
+    void setBatching(int windowMs, int maxBytes);
+    int batchWindow() const;
+    int batchMaxBytes() const;
+
+    // 协商了压缩的连接上负载达到 bytes 的帧压缩发出，0 表示不接受压缩协商；须在 listen() 之前设置
+    void setCompressThreshold(int bytes);
+    int compressThreshold() const;
+    // 由各分片在连接启用/结束压缩时调用；没有这样的连接时广播不做压缩
+    void compressedConnectionChanged(int delta);
+    bool hasCompressedConnections() const;
+
+    // 断线续连的保留期（秒）：登录成功的连接拿到会话令牌，断开后昵称保留这么久，
+    // 期间凭令牌重连不广播上下线；0 表示不开会话。须在 listen() 之前设置
+    void setResumeGrace(int seconds);
+    int resumeGrace() const;
+
+    // 排空时客户端的重连在 seconds 秒内随机错开
+    void setDrainSpread(int seconds);
+    int drainSpread() const;
+
+    // 空闲超时（秒），0 表示不回收；须在 listen() 之前设置
+    void setIdleTimeout(int seconds);
+    int idleTimeout() const;
+
+    // 是否把每条聊天内容写进日志；关闭后聊天消息的处理路径上不再为日志格式化字符串
+    void setChatLogging(bool enabled);
+    bool chatLogging() const;
+    static bool policyFromName(const QString &name, SlowConsumerPolicy *policy);
+
+    // chat_message 限流：每连接 messageRate 条/秒、可突发 burst 条；
+    // globalRate 为全服务器入口上限（条/秒，0 表示不限），平均分给各分片，分片之间无需同步
+    void setRateLimit(double messageRate, double burst, double globalRate, FloodPolicy policy);
+    double messageRate() const;
+    double messageBurst() const;
+    double globalRate() const;
+    FloodPolicy floodPolicy() const;
+    static bool floodPolicyFromName(const QString &name, FloodPolicy *policy);
+
+    // 启用聊天记录持久化，须在 listen() 之前调用
+    bool enableHistory(const QString &directory, int replayCount, QString *errorMessage);
+    // 未启用时为 nullptr；HistoryStore 的追加与回放接口线程安全
+    HistoryStore *history() const;
+    // 各房间聊天消息的序号与最近消息，供广播编号与 chat_sync 补缺；线程安全
+    RoomLog *roomLog();
+
+    // 集群模式：本节点 nodeId，在 bindAddress:port 上接受其他节点的链路并连向 peers（id@host:port）；
+    // secret 非空时节点互连须凭它互相认证，为空时不认证，集群端口只能放在可信网络中。须在 listen() 之前调用
+    bool enableCluster(const QString &nodeId, const QHostAddress &bindAddress, quint16 port,
+                       const QStringList &peers, const QByteArray &secret, QString *errorMessage);
+    bool clusterEnabled() const;
+    // 线程安全：登录前向昵称的归属节点预留，结果回到 worker 的 finishReservation
+    void reserveNickname(const QString &nickname, ChatWorker *worker, QTcpSocket *socket);
+    void releaseReservation(const QString &nickname);
+
+    // 在本机 port 端口上提供 HTTP 指标端点
+    bool enableMetrics(quint16 port, QString *errorMessage);
+
+    // 可在任意线程调用，只读取各分片的原子计数
+    QueueStats queueStats() const;
+    MetricsSnapshot metricsSnapshot() const;
+    // Prometheus 文本格式的全部指标
+    QByteArray metricsText() const;
+    void disconnectAll();
+
+    // 优雅停机：暂停接受新连接，通知每个客户端错开重连，写完积压后断开；
+    // 全部断开或超时后发出 drained()。之后可以 close()，也可以交给新进程（见 Handoff）
+    void drain();
+    bool isDraining() const;
+
+    // 热重启交接：写完聊天记录、关闭指标端点，返回交给新进程的登记表状态与聊天序号；须在 drained() 之后调用
+    QCborMap takeHandoffState();
+    // 新进程在接受连接之前导入
+    void restoreHandoffState(const QCborMap &state);
+
+signals:
+    void drained();
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    ClientRegistry registry;
+    RoomLog chatLog;
+    LogSink sink;
+    QList<QThread*> threads;
+    QList<ChatWorker*> workers;
+    int nextWorker;
+    qint64 maxQueuedBytes;
+    SlowConsumerPolicy policy;
+    int idleTimeoutSeconds;
+    bool logChat;
+    int resumeGraceSeconds;
+    int drainSpreadSeconds;
+    bool draining;
+    qint64 drainDeadlineNs;
+    int batchWindowMs;
+    int batchBytes;
+    int compressBytes;
+    QAtomicInt compressedConnections;
+    double perConnectionRate;
+    double perConnectionBurst;
+    double globalMessageRate;
+    FloodPolicy flood;
+    MetricsSnapshot lastLoggedMetrics;
+    QTimer *statsTimer;
+    QTimer *sessionTimer;
+    QTimer *drainTimer;
+    HistoryStore *historyStore;
+    MetricsEndpoint *metricsEndpoint;
+    // 各分片线程读取，热重启交接时由服务器线程置空；每次使用先取出再判空
+    QAtomicPointer<ClusterBus> cluster;
+    // 总线的所有者：交接时 cluster 置空后总线仍留着，析构中等工作线程都停止后才删除
+    ClusterBus *clusterBus;
+    QueueStats lastLoggedStats;
+
+    void dispatch(ChatWorker *worker, const Frame &frame, const QString &room = QString());
+    void logQueueStats();
+    void expireSessions();
+    void checkDrained();
+    bool deliverLocal(const QString &nickname, const Frame &frame);
+    void onPeerUp(const QString &node);
+    void onPeerDown(const QString &node);
+    void onRemotePresence(const QString &node, const QString &nickname, bool joined);
+    void onRemoteChat(const QString &sender, const QString &message, const QString &room);
+    void onRemotePrivate(const QString &node, const QString &recipient, const QCborMap &message);
+};
+
+#endif // CHATSERVER_H
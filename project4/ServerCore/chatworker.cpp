@@ -0,0 +1,979 @@
+#include "chatworker.h"
+#include "alloccounter.h"
+#include "chatserver.h"
+#include "clientregistry.h"
+#include "frames.h"
+#include "historystore.h"
+#include "logsink.h"
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QPointer>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <limits>
+
+// 套接字自身写缓冲超过这个量就暂停交付，剩余帧留在出站队列里，可按策略丢弃或合并
+static const qint64 SocketHighWater = 64 * 1024;
+// 窗口内超速这么多次即视为刷屏
+static const int FloodOverruns = 20;
+static const qint64 FloodWindowNs = 10LL * 1000 * 1000 * 1000;
+static const int MuteSeconds = 30;
+
+ChatWorker::ChatWorker(ChatServer *server, ClientRegistry *registry, QObject *parent)
+    : QObject(parent)
+    , server(server)
+    , registry(registry)
+    , flushScheduled(false)
+    , batchTimer(new QTimer(this))
+    , rateLimitsConfigured(false)
+    , idleTimer(new QTimer(this))
+    , idleTicks(0)
+    , queuedBytes(0)
+    , congestedConnections(0)
+    , droppedFrames(0)
+    , evictedConnections(0)
+{
+    connect(idleTimer, &QTimer::timeout, this, &ChatWorker::onIdleTick);
+    batchTimer->setSingleShot(true);
+    connect(batchTimer, &QTimer::timeout, this, &ChatWorker::flushBatches);
+}
+
+ChatWorker::~ChatWorker()
+{
+}
+
+const MetricsShard &ChatWorker::metrics() const
+{
+    return metricsShard;
+}
+
+QueueStats ChatWorker::queueStats() const
+{
+    QueueStats stats;
+    stats.queuedBytes = queuedBytes.loadRelaxed();
+    stats.congestedConnections = congestedConnections.loadRelaxed();
+    stats.droppedFrames = droppedFrames.loadRelaxed();
+    stats.evictedConnections = evictedConnections.loadRelaxed();
+    return stats;
+}
+
+// 在工作线程中创建套接字，保证其事件都由本线程的事件循环分发
+void ChatWorker::addConnection(qintptr socketDescriptor)
+{
+    QTcpSocket *clientSocket = new QTcpSocket(this);
+    if (!clientSocket->setSocketDescriptor(socketDescriptor)) {
+        log(QString("【错误】无法接管客户端连接：%1").arg(clientSocket->errorString()));
+        clientSocket->deleteLater();
+        return;
+    }
+
+    log(QString("【连接】新客户端连接来自 %1:%2")
+            .arg(clientSocket->peerAddress().toString())
+            .arg(clientSocket->peerPort()));
+
+    connect(clientSocket, &QTcpSocket::readyRead, this, &ChatWorker::onReadyRead);
+    connect(clientSocket, &QTcpSocket::disconnected, this, &ChatWorker::onClientDisconnected);
+    connect(clientSocket, &QTcpSocket::bytesWritten, this, &ChatWorker::onBytesWritten);
+    // 限流参数在 listen() 之前已设置，第一个连接到来时读取
+    if (!rateLimitsConfigured) {
+        rateLimitsConfigured = true;
+        const double shareRate = server->globalRate() / qMax(1, server->workerCount());
+        globalBucket.configure(shareRate, qMax(1.0, shareRate));
+    }
+
+    const QSharedPointer<Connection> connection = QSharedPointer<Connection>::create();
+    connection->chatBucket.configure(server->messageRate(), server->messageBurst());
+    connections.insert(clientSocket, connection);
+    Metrics::bump<qint64>(metricsShard.connections);
+    Metrics::bump<quint64>(metricsShard.connectionsTotal);
+    registry->addClient(clientSocket, this);
+
+    // 时间轮在第一个连接到来时按超时时长建立，计时器也就在本线程启动
+    const int timeout = server->idleTimeout();
+    if (timeout > 0) {
+        if (idleWheel.isEmpty()) {
+            idleWheel.resize(timeout + 1);
+            idleTimer->start(1000);
+        }
+        connection->lastActivity = idleTicks;
+        // 迟迟不登录的连接同样按空闲超时回收
+        scheduleIdleCheck(clientSocket, *connection, idleTicks + timeout);
+    }
+}
+
+void ChatWorker::onClientDisconnected()
+{
+    QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
+    if (clientSocket) {
+        // 有会话的连接只是暂时离开：昵称保留到期满，期间凭令牌重连不算上下线
+        QString nickname;
+        quint64 presenceVersion = 0;
+        const int grace = server->resumeGrace();
+        const bool detached = grace > 0
+                              && registry->detachClient(clientSocket,
+                                                        Metrics::nowNs() + grace * 1000000000LL, &nickname);
+        if (detached) {
+            log(QString("【断开】%1 断开连接，保留会话 %2 秒").arg(nickname).arg(grace));
+        } else {
+            nickname = registry->removeClient(clientSocket, QString(), &presenceVersion);
+            log(QString("【断开】%1 断开连接").arg(nickname.isEmpty() ? QString("未登录客户端") : nickname));
+        }
+
+        const QSharedPointer<Connection> connection = connections.take(clientSocket);
+        if (connection) {
+            if (!idleWheel.isEmpty())
+                idleWheel[connection->scheduledTick % idleWheel.size()].remove(clientSocket);
+            Metrics::bump<qint64>(metricsShard.connections, -1);
+            if (connection->compress)
+                server->compressedConnectionChanged(-1);
+            queuedBytes.fetchAndAddRelaxed(-connection->outboxBytes);
+            setCongested(*connection, false);
+            // 全局的 user_left 已隐含离开所有房间，这里只清理本地成员表
+            for (const QString &room : qAsConst(connection->rooms)) {
+                auto it = localRooms.find(room);
+                if (it == localRooms.end())
+                    continue;
+                it->remove(clientSocket);
+                if (it->isEmpty())
+                    localRooms.erase(it);
+                // 保留期内仍在用户列表里，但已不在房间中，房间成员需要知道
+                if (detached)
+                    server->sendToRoom(room, Frames::roomMemberLeft(room, nickname));
+            }
+        }
+        pendingSockets.removeOne(clientSocket);
+
+        clientSocket->deleteLater();
+
+        // 未登录的连接不曾出现在用户列表里，不发 user_left；保留期满时由服务器补发
+        if (!nickname.isEmpty() && !detached)
+            server->presenceChanged(nickname, false, presenceVersion);
+    }
+}
+
+// --- 槽函数：处理客户端发来的数据 ---
+void ChatWorker::onReadyRead()
+{
+    QTcpSocket *clientSocket = qobject_cast<QTcpSocket*>(sender());
+    if (!clientSocket)
+        return;
+    QSharedPointer<Connection> connection = connections.value(clientSocket);
+    if (!connection)
+        return;
+
+    connection->lastActivity = idleTicks;
+    connection->pingSent = false;
+
+    const qint64 availableBefore = clientSocket->bytesAvailable();
+    const quint64 allocationsBefore = AllocCounter::threadAllocations();
+    Wire::Message obj;
+    for (;;) {
+        const Wire::Reader::Status status = connection->reader.next(clientSocket, &obj);
+        if (status == Wire::Reader::NeedMore)
+            break;
+
+        if (status == Wire::Reader::Fatal) {
+            Metrics::bump<quint64>(metricsShard.parseFailures);
+            log(QString("【错误】协议错误 (%1)，断开连接").arg(connection->reader.errorString()));
+            clientSocket->abort();
+            break;
+        }
+
+        Metrics::bump<quint64>(metricsShard.messagesIn);
+        if (status == Wire::Reader::Malformed) {
+            Metrics::bump<quint64>(metricsShard.parseFailures);
+            log(QString("【错误】消息解析失败 (%1): %2")
+                    .arg(connection->reader.errorString())
+                    .arg(QString(connection->reader.rawFrame())));
+            continue;
+        }
+
+        handleMessage(clientSocket, *connection, obj);
+    }
+    arena.reset();
+    Metrics::bump<quint64>(metricsShard.bytesIn,
+                           static_cast<quint64>(availableBefore - clientSocket->bytesAvailable()));
+    Metrics::bump<quint64>(metricsShard.handlerAllocations,
+                           AllocCounter::threadAllocations() - allocationsBefore);
+}
+
+void ChatWorker::handleMessage(QTcpSocket *clientSocket, Connection &connection, const Wire::Message &obj)
+{
+    // 类型名直接引用接收缓冲，分发不分配内存
+    const QLatin1String type = obj.type();
+
+    if (type == "login") {
+        login(clientSocket, connection, obj, false);
+    } else if (type == "chat_message") {
+        // 每条聊天都走这里：字段解码进本轮复用的字符串
+        QString &message = arena.string();
+        obj.readString(QLatin1String("message"), &message);
+        const QString senderNickname = registry->nickname(clientSocket, QStringLiteral("未知用户"));
+        QString &room = arena.string();
+        if (!obj.readString(QLatin1String("room"), &room))
+            room = QLatin1String(Wire::DefaultRoom);
+        const bool inDefaultRoom = room == QLatin1String(Wire::DefaultRoom);
+        if (!inDefaultRoom && !connection.rooms.contains(room)) {
+            log(QString("【警告】%1 不在房间 '%2' 中，消息被丢弃").arg(senderNickname).arg(room));
+            return;
+        }
+        if (message.size() > Wire::MaxMessageLength) {
+            log(QString("【警告】%1 的消息长 %2 字符，超过上限，已丢弃").arg(senderNickname).arg(message.size()));
+            return;
+        }
+        if (!message.isEmpty()) {
+            if (!admitChat(clientSocket, connection))
+                return;
+            if (server->chatLogging())
+                log(QString("[%1][%2]: %3").arg(room).arg(senderNickname).arg(message));
+
+            // 先登记拿到序号再广播，写盘由记录线程异步完成；只保存默认房间的记录
+            // 房间内序号与时间戳由 RoomLog 统一分配，各分片交错到达的消息由客户端按序号排好
+            qint64 id = 0;
+            if (inDefaultRoom && server->history())
+                id = server->history()->append(senderNickname, message, QDateTime::currentMSecsSinceEpoch());
+            server->sendToRoom(room, server->roomLog()->append(room, senderNickname, message, id));
+            server->forwardChat(senderNickname, message, room);
+        }
+    } else if (type == "private_message") {
+        sendPrivate(clientSocket, connection, obj);
+    } else if (type == "ping") {
+        sendTo(clientSocket, Frames::pong());
+    } else if (type == "pong") {
+        // 活动时间已在 onReadyRead 中更新
+    } else if (type == "file_offer" || type == "file_accept" || type == "file_chunk"
+               || type == "file_ack" || type == "file_done" || type == "file_cancel") {
+        relayFile(clientSocket, type, obj);
+    } else if (type == "user_list_sync") {
+        // 客户端发现在线状态版本号有缺口，补发差量或快照
+        if (registry->nickname(clientSocket).isEmpty())
+            return;
+        sendTo(clientSocket, registry->presenceSince(
+                                 static_cast<quint32>(obj.integer(QLatin1String("epoch"))),
+                                 static_cast<quint64>(obj.integer(QLatin1String("since"))),
+                                 compressThresholdFor(connection)));
+    } else if (type == "chat_sync") {
+        // 客户端发现某房间的聊天序号有缺口，只补 after 之后（到 until 为止）的那一段
+        if (registry->nickname(clientSocket).isEmpty())
+            return;
+        const QString room = obj.string(QLatin1String("room"), QLatin1String(Wire::DefaultRoom));
+        if (room != QLatin1String(Wire::DefaultRoom) && !connection.rooms.contains(room))
+            return;
+        sendTo(clientSocket, server->roomLog()->range(
+                                 room,
+                                 static_cast<quint64>(obj.integer(QLatin1String("after"))),
+                                 static_cast<quint64>(obj.integer(QLatin1String("until"))),
+                                 compressThresholdFor(connection)));
+    } else if (type == "join" || type == "leave") {
+        const QString room = obj.string(QLatin1String("room"));
+        if (room.isEmpty() || room.size() > Wire::MaxRoomNameLength
+            || room == QLatin1String(Wire::DefaultRoom)) {
+            log(QString("【警告】无效的房间名: %1").arg(room));
+            return;
+        }
+        if (registry->nickname(clientSocket).isEmpty()) {
+            log("【警告】未登录的连接请求进出房间，已忽略");
+            return;
+        }
+        if (type == "join")
+            joinRoom(clientSocket, connection, room);
+        else
+            leaveRoom(clientSocket, connection, room);
+    } else {
+        log(QString("【警告】收到未知类型消息: %1").arg(type));
+    }
+}
+
+// reserved 表示集群模式下已向归属节点预留到这个昵称
+void ChatWorker::login(QTcpSocket *clientSocket, Connection &connection, const Wire::Message &obj, bool reserved)
+{
+    const QString nickname = obj.string(QLatin1String("nickname"));
+    if (nickname.isEmpty())
+        return;
+
+    // 只有本线程会改这个连接的昵称，先取出旧昵称，换昵称时补发它的下线
+    const QString previous = registry->nickname(clientSocket);
+    quint64 presenceVersion = 0;
+
+    // 带着令牌来的先尝试续连，令牌失效则按普通登录处理
+    const QByteArray resumeToken = obj.string(QLatin1String("resume")).toLatin1();
+    QSet<QString> resumedRooms;
+    QByteArray session;
+    QTcpSocket *replaced = nullptr;
+    ChatWorker *replacedOwner = nullptr;
+    const bool resumed = !resumeToken.isEmpty()
+                         && registry->resumeSession(clientSocket, resumeToken, nickname, &resumedRooms,
+                                                    &session, &replaced, &replacedOwner);
+    // 集群模式下新占用的昵称先向归属节点预留，结果回来后经 finishReservation 再走一遍
+    if (!resumed && !reserved && server->clusterEnabled() && nickname != previous) {
+        if (connection.loginPending)
+            return;
+        connection.loginPending = true;
+        connection.pendingLogin = obj.toMap();
+        server->reserveNickname(nickname, this, clientSocket);
+        return;
+    }
+    if (!resumed && !registry->claimNickname(clientSocket, nickname, &presenceVersion)) {
+        log(QString("【警告】昵称 '%1' 已存在，拒绝登录").arg(nickname));
+        if (reserved)
+            server->releaseReservation(nickname);
+        Metrics::bump<quint64>(metricsShard.loginFailures);
+
+        sendTo(clientSocket, Frames::loginFailed("昵称已存在"));
+
+    } else {
+        if (resumed) {
+            log(QString("【续连】用户 '%1' 接续断线前的会话").arg(nickname));
+            // 旧连接半开着还没断：由它所在的分片断开，它的断开不再产生下线
+            if (replaced && replacedOwner) {
+                QMetaObject::invokeMethod(replacedOwner, [replacedOwner, replaced]() {
+                    replacedOwner->dropConnection(replaced);
+                }, Qt::QueuedConnection);
+            }
+        } else {
+            log(QString("【登录】用户 '%1' 登录成功").arg(nickname));
+            if (server->resumeGrace() > 0)
+                session = registry->openSession(clientSocket);
+        }
+        Metrics::bump<quint64>(metricsShard.logins);
+
+        // login_success 仍按旧格式发出，之后双向改用协商好的格式
+        const Wire::Format wire = Wire::formatFromName(obj.string(QLatin1String("wire")));
+        // 压缩只在 Cbor 线路上提供，JSON 行协议无法携带二进制负载
+        const bool compress = wire == Wire::Cbor && server->compressThreshold() > 0
+                              && obj.string(QLatin1String("compress")) == Wire::compressionName();
+        const quint32 chatEpoch = server->roomLog()->epoch();
+        sendTo(clientSocket, Frames::loginSuccess(wire, compress, session, resumed, chatEpoch,
+                                                  server->roomLog()->lastSeq(QLatin1String(Wire::DefaultRoom))));
+        connection.wire = wire;
+        connection.reader.setFormat(wire);
+        if (compress != connection.compress)
+            server->compressedConnectionChanged(compress ? 1 : -1);
+        connection.compress = compress;
+        connection.reader.setCompression(compress);
+
+        connection.batch = obj.boolean(QLatin1String("batch"));
+
+        // 声明支持心跳的客户端在空闲一半时收到 ping；其余的只靠 TCP keepalive
+        connection.heartbeat = obj.boolean(QLatin1String("heartbeat"));
+        if (!idleWheel.isEmpty()) {
+            if (connection.heartbeat) {
+                scheduleIdleCheck(clientSocket, connection,
+                                  connection.lastActivity + qMax(1, server->idleTimeout() / 2));
+            } else {
+                // 旧客户端不会回应 ping：从时间轮中摘掉，不再按空闲超时回收，交给 TCP keepalive
+                idleWheel[connection.scheduledTick % idleWheel.size()].remove(clientSocket);
+                clientSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+            }
+        }
+
+        if (!resumed) {
+            if (!previous.isEmpty())
+                server->presenceChanged(previous, false, presenceVersion - 1);
+            server->presenceChanged(nickname, true, presenceVersion);
+        }
+        // 重连的客户端带着上次的列表版本来，只需补差量
+        sendTo(clientSocket, registry->presenceSince(
+                                 static_cast<quint32>(obj.integer(QLatin1String("presence_epoch"))),
+                                 static_cast<quint64>(obj.integer(QLatin1String("presence_version"))),
+                                 compressThresholdFor(connection)));
+        // 续连的客户端报告收到的最后一条记录序号，只补发之后的；
+        // 手里的大厅聊天序号仍属于当前纪元时直接按序号补缺口，不再走聊天记录
+        const qint64 lastSeen = obj.integer(QLatin1String("last_seen"));
+        if (resumed && obj.integer(QLatin1String("chat_epoch")) == chatEpoch) {
+            sendTo(clientSocket, server->roomLog()->range(QLatin1String(Wire::DefaultRoom),
+                                                          static_cast<quint64>(obj.integer(QLatin1String("chat_seq"))),
+                                                          0, compressThresholdFor(connection)));
+        } else if (server->history()) {
+            const Frame replay = resumed && lastSeen > 0
+                                     ? server->history()->replaySince(lastSeen, compressThresholdFor(connection))
+                                     : server->history()->replayFrame(compressThresholdFor(connection));
+            if (!replay.json.isEmpty())
+                sendTo(clientSocket, replay);
+        }
+        for (const QString &room : qAsConst(resumedRooms))
+            joinRoom(clientSocket, connection, room);
+        // 暂存的私聊只交给凭令牌接续的本人；新登录同一昵称的人拿不到
+        if (resumed)
+            deliverOffline(clientSocket, nickname);
+    }
+}
+
+void ChatWorker::finishReservation(QTcpSocket *socket, const QString &nickname, bool granted)
+{
+    const QSharedPointer<Connection> connection = connections.value(socket);
+    // 等待期间连接断开或又换了别的昵称：预留不再需要
+    if (!connection || !connection->loginPending
+        || connection->pendingLogin.value(QLatin1String("nickname")).toString() != nickname) {
+        if (granted)
+            server->releaseReservation(nickname);
+        return;
+    }
+    const Wire::Message obj(connection->pendingLogin);
+    connection->loginPending = false;
+    connection->pendingLogin = QCborMap();
+
+    if (!granted) {
+        log(QString("【警告】昵称 '%1' 在集群中已被占用或归属节点不可达，拒绝登录").arg(nickname));
+        Metrics::bump<quint64>(metricsShard.loginFailures);
+        sendTo(socket, Frames::loginFailed("昵称已被集群中的其他节点使用"));
+        return;
+    }
+    login(socket, *connection, obj, true);
+}
+
+// 文件传输消息原样转给 peer，peer 字段改成发送者的昵称；
+// 服务器不保存传输状态也不缓存分块，流量由两端的确认窗口约束
+void ChatWorker::relayFile(QTcpSocket *socket, QLatin1String type, const Wire::Message &obj)
+{
+    const QString sender = registry->nickname(socket);
+    const QString peer = obj.string(QLatin1String("peer"));
+    if (sender.isEmpty() || peer.isEmpty() || peer == sender)
+        return;
+
+    if (type == "file_offer") {
+        log(QString("【文件】%1 向 %2 发送文件 '%3'（%4 字节）")
+                .arg(sender).arg(peer)
+                .arg(obj.string(QLatin1String("name")))
+                .arg(obj.integer(QLatin1String("size"))));
+    }
+
+    QCborMap relayed = obj.toMap();
+    relayed[QLatin1String("peer")] = sender;
+    if (server->sendToClient(peer, Frames::relay(relayed)) != ChatServer::NotDelivered)
+        return;
+
+    if (type != "file_cancel") {
+        QCborMap cancel;
+        cancel[QLatin1String("type")] = QStringLiteral("file_cancel");
+        cancel[QLatin1String("id")] = obj.value(QLatin1String("id"));
+        cancel[QLatin1String("peer")] = peer;
+        cancel[QLatin1String("reason")] = QStringLiteral("对方不在线");
+        sendTo(socket, Frames::relay(cancel));
+    }
+}
+
+// 私聊经登记表的昵称索引直接找到收件人所在分片，不经过广播；
+// 收件人不在线（包括断线保留期内）时暂存，等对方登录后送达并通知发件人
+void ChatWorker::sendPrivate(QTcpSocket *socket, Connection &connection, const Wire::Message &obj)
+{
+    const QString sender = registry->nickname(socket);
+    const QString recipient = obj.string(QLatin1String("to"));
+    const QString message = obj.string(QLatin1String("message"));
+    const qint64 id = obj.integer(QLatin1String("id"));
+    if (sender.isEmpty() || message.isEmpty())
+        return;
+    if (recipient.isEmpty() || recipient == sender) {
+        sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "无效的收件人"));
+        return;
+    }
+    if (message.size() > Wire::MaxMessageLength) {
+        sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "消息过长"));
+        return;
+    }
+    if (!admitChat(socket, connection)) {
+        sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "发言过于频繁"));
+        return;
+    }
+
+    const Frame frame = Frames::privateMessage(sender, message, id, QDateTime::currentMSecsSinceEpoch());
+    // 暂存时对方恰好上线，再直接投递一次
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        switch (server->sendToClient(recipient, frame)) {
+        case ChatServer::Delivered:
+            sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("delivered")));
+            return;
+        case ChatServer::Forwarded:
+            // 对方在其他节点：那个节点投递后经总线发回回执
+            return;
+        case ChatServer::NotDelivered:
+            break;
+        }
+        switch (registry->queueOffline(recipient, sender, id, frame)) {
+        case ClientRegistry::Queued:
+            log(QString("【私聊】%1 发给 %2 的消息已暂存，待对方上线").arg(sender).arg(recipient));
+            sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("queued")));
+            return;
+        case ClientRegistry::QueueFull:
+            sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "对方的离线消息已满"));
+            return;
+        case ClientRegistry::SenderQuotaFull:
+            sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "你暂存的离线消息过多"));
+            return;
+        case ClientRegistry::RecipientOffline:
+            sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "对方不在线"));
+            return;
+        case ClientRegistry::RecipientOnline:
+            break;
+        }
+    }
+    sendTo(socket, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "投递失败"));
+}
+
+// 续连成功后送出暂存的私聊，并告诉仍在线的发件人已送达
+void ChatWorker::deliverOffline(QTcpSocket *socket, const QString &nickname)
+{
+    const QList<ClientRegistry::OfflineMessage> queued = registry->takeOffline(nickname);
+    if (queued.isEmpty())
+        return;
+    log(QString("【私聊】向 %1 送出 %2 条离线消息").arg(nickname).arg(queued.size()));
+    for (const ClientRegistry::OfflineMessage &entry : queued) {
+        sendTo(socket, entry.frame);
+        server->sendToClient(entry.sender, Frames::privateAck(entry.id, nickname, QStringLiteral("delivered")));
+    }
+}
+
+void ChatWorker::joinRoom(QTcpSocket *socket, Connection &connection, const QString &room)
+{
+    if (!registry->joinRoom(socket, room))
+        return;
+    const QString nickname = registry->nickname(socket);
+    log(QString("【房间】%1 加入房间 '%2'").arg(nickname).arg(room));
+
+    // 先通知房间里已有的成员，再把自己加入本地成员表
+    server->sendToRoom(room, Frames::roomMemberJoined(room, nickname));
+    connection.rooms.insert(room);
+    localRooms[room].insert(socket);
+    // 此后分到序号的房间消息都会投递到这个连接，客户端从这个序号接着排
+    sendTo(socket, Frames::roomJoined(room, registry->roomMembers(room), server->roomLog()->lastSeq(room)));
+}
+
+void ChatWorker::leaveRoom(QTcpSocket *socket, Connection &connection, const QString &room)
+{
+    if (!registry->leaveRoom(socket, room))
+        return;
+    const QString nickname = registry->nickname(socket);
+    log(QString("【房间】%1 离开房间 '%2'").arg(nickname).arg(room));
+
+    connection.rooms.remove(room);
+    auto it = localRooms.find(room);
+    if (it != localRooms.end()) {
+        it->remove(socket);
+        if (it->isEmpty())
+            localRooms.erase(it);
+    }
+    sendTo(socket, Frames::roomLeft(room));
+    server->sendToRoom(room, Frames::roomMemberLeft(room, nickname));
+}
+
+// room 为空时遍历本分片全部连接，否则只遍历本分片中该房间的成员
+template <typename Visitor>
+void ChatWorker::forEachRecipient(const QString &room, Visitor visit)
+{
+    if (room.isEmpty()) {
+        for (auto it = connections.cbegin(); it != connections.cend(); ++it) {
+            if (it.key()->state() == QAbstractSocket::ConnectedState)
+                visit(it.key(), *it.value());
+        }
+        return;
+    }
+
+    const auto members = localRooms.constFind(room);
+    if (members == localRooms.cend())
+        return;
+    for (QTcpSocket *socket : *members) {
+        const QSharedPointer<Connection> connection = connections.value(socket);
+        if (connection && socket->state() == QAbstractSocket::ConnectedState)
+            visit(socket, *connection);
+    }
+}
+
+// 由 ChatServer 分发：同一线程内直接调用，跨线程经队列投递
+// 聊天帧在合批窗口内先暂存；其他帧发出前先清空暂存，保持与聊天消息的先后顺序
+void ChatWorker::deliver(const Frame &frame, const QString &room)
+{
+    const int window = server->batchWindow();
+    if (window > 0 && frame.kind == Frame::Chat) {
+        PendingBatch &pending = pendingBatches[room];
+        pending.frames.append(frame);
+        pending.bytes += frame.json.size();
+        if (pending.bytes >= server->batchMaxBytes())
+            flushBatches();
+        else if (!batchTimer->isActive())
+            batchTimer->start(window);
+        return;
+    }
+
+    if (!pendingBatches.isEmpty())
+        flushBatches();
+    deliverNow(frame, room);
+}
+
+// 点对点帧不参与合批，也不必等暂存的聊天帧：文件分块因此能与聊天消息交错发出
+void ChatWorker::deliverTo(QTcpSocket *socket, const QString &nickname, const Frame &frame)
+{
+    if (!connections.contains(socket) || registry->nickname(socket) != nickname)
+        return;
+    sendTo(socket, frame);
+}
+
+void ChatWorker::dropConnection(QTcpSocket *socket)
+{
+    if (!connections.contains(socket))
+        return;
+    log("【续连】旧连接被新连接接管，断开旧连接");
+    socket->abort();
+}
+
+void ChatWorker::flushBatches()
+{
+    batchTimer->stop();
+    QHash<QString, PendingBatch> batches;
+    batches.swap(pendingBatches);
+    for (auto it = batches.cbegin(); it != batches.cend(); ++it) {
+        if (it->frames.size() == 1)
+            deliverNow(it->frames.first(), it.key());
+        else
+            deliverBatch(it.key(), *it);
+    }
+}
+
+// 这里只登记帧的引用，真正的写出推迟到本轮事件循环末尾
+void ChatWorker::deliverNow(const Frame &frame, const QString &room)
+{
+    forEachRecipient(room, [this, &frame](QTcpSocket *socket, const Connection &) {
+        sendTo(socket, frame);
+    });
+}
+
+// batch 帧在本分片只编码一次；不认识 batch 的旧客户端仍逐条收到原来的帧
+void ChatWorker::deliverBatch(const QString &room, const PendingBatch &pending)
+{
+    Frame batch = Frames::batch(pending.frames);
+    if (server->hasCompressedConnections())
+        Frames::compress(batch, server->compressThreshold());
+    forEachRecipient(room, [this, &batch, &pending](QTcpSocket *socket, const Connection &connection) {
+        if (connection.batch) {
+            sendTo(socket, batch);
+        } else {
+            for (const Frame &frame : pending.frames)
+                sendTo(socket, frame);
+        }
+    });
+}
+
+// 停止前把暂存的聊天帧和出站队列全部交给套接字，再正常关闭
+void ChatWorker::disconnectAll()
+{
+    flushBatches();
+    const QList<QTcpSocket*> snapshot = connections.keys();
+    for (QTcpSocket *socket : snapshot) {
+        const QSharedPointer<Connection> connection = connections.value(socket);
+        if (connection && socket->state() == QAbstractSocket::ConnectedState)
+            writeOut(socket, *connection, std::numeric_limits<qint64>::max());
+        socket->disconnectFromHost();
+    }
+}
+
+void ChatWorker::drain(int spreadMs)
+{
+    flushBatches();
+    const QList<QTcpSocket*> snapshot = connections.keys();
+    for (QTcpSocket *socket : snapshot) {
+        const QSharedPointer<Connection> connection = connections.value(socket);
+        if (!connection)
+            continue;
+        const int delay = spreadMs > 0 ? static_cast<int>(QRandomGenerator::global()->bounded(spreadMs)) : 0;
+        sendTo(socket, Frames::serverRestart(delay));
+        if (socket->state() == QAbstractSocket::ConnectedState)
+            writeOut(socket, *connection, std::numeric_limits<qint64>::max());
+        socket->disconnectFromHost();
+    }
+}
+
+void ChatWorker::sendTo(QTcpSocket *socket, const Frame &frame)
+{
+    const QSharedPointer<Connection> connection = connections.value(socket);
+    if (!connection || connection->evicting)
+        return;
+
+    const QByteArray bytes = encodedFor(*connection, frame);
+    const qint64 limit = server->outboundLimit();
+    const qint64 inSocket = socket->bytesToWrite();
+
+    if (connection->outboxBytes + inSocket + bytes.size() > limit) {
+        switch (server->slowConsumerPolicy()) {
+        case ChatServer::Disconnect:
+            evict(socket, *connection);
+            return;
+        case ChatServer::Coalesce:
+            // 新的上下线通知已包含在放入的 user_list 快照里
+            coalescePresence(*connection, frame.kind == Frame::Presence);
+            if (frame.kind == Frame::Presence) {
+                dropOldest(*connection, limit - inSocket);
+                break;
+            }
+            Q_FALLTHROUGH();
+        case ChatServer::DropOldest:
+            dropOldest(*connection, limit - inSocket - bytes.size());
+            if (connection->outboxBytes + inSocket + bytes.size() > limit) {
+                // 套接字缓冲本身已占满额度，新帧也放不下
+                droppedFrames.fetchAndAddRelaxed(1);
+            } else {
+                enqueue(*connection, bytes, frame.kind, frame.createdNs);
+            }
+            break;
+        }
+    } else {
+        enqueue(*connection, bytes, frame.kind, frame.createdNs);
+    }
+
+    if (!connection->pending) {
+        connection->pending = true;
+        pendingSockets.append(socket);
+    }
+    if (!flushScheduled) {
+        flushScheduled = true;
+        QMetaObject::invokeMethod(this, &ChatWorker::flushPending, Qt::QueuedConnection);
+    }
+}
+
+// 协商了压缩的连接优先使用已缓存的压缩结果；单播帧没有预先压缩，在这里按需压缩
+QByteArray ChatWorker::encodedFor(const Connection &connection, const Frame &frame) const
+{
+    if (!connection.compress)
+        return frame.bytes(connection.wire);
+    if (!frame.deflated.isEmpty())
+        return frame.deflated;
+    const QByteArray compressed = Wire::compressFrame(frame.cbor, server->compressThreshold());
+    return compressed.isEmpty() ? frame.cbor : compressed;
+}
+
+int ChatWorker::compressThresholdFor(const Connection &connection) const
+{
+    return connection.compress ? server->compressThreshold() : 0;
+}
+
+void ChatWorker::enqueue(Connection &connection, const QByteArray &bytes, Frame::Kind kind, qint64 createdNs)
+{
+    connection.outbox.append(Outgoing{bytes, kind, createdNs});
+    connection.outboxBytes += bytes.size();
+    queuedBytes.fetchAndAddRelaxed(bytes.size());
+}
+
+// 从队首丢帧，直到积压不超过 room
+void ChatWorker::dropOldest(Connection &connection, qint64 room)
+{
+    int dropped = 0;
+    qint64 droppedBytes = 0;
+    while (dropped < connection.outbox.size() && connection.outboxBytes - droppedBytes > room)
+        droppedBytes += connection.outbox.at(dropped++).bytes.size();
+    connection.outbox.remove(0, dropped);
+    connection.outboxBytes -= droppedBytes;
+    queuedBytes.fetchAndAddRelaxed(-droppedBytes);
+    droppedFrames.fetchAndAddRelaxed(dropped);
+}
+
+// 去掉积压中的全部上下线帧，换成一份当前的 user_list；没有可去掉的帧且 force 为 false 时不放快照
+void ChatWorker::coalescePresence(Connection &connection, bool force)
+{
+    qint64 removedBytes = 0;
+    int kept = 0;
+    for (int i = 0; i < connection.outbox.size(); ++i) {
+        Outgoing &outgoing = connection.outbox[i];
+        if (outgoing.kind == Frame::Presence) {
+            removedBytes += outgoing.bytes.size();
+        } else {
+            if (kept != i)
+                connection.outbox[kept] = std::move(outgoing);
+            ++kept;
+        }
+    }
+    const int removed = connection.outbox.size() - kept;
+    connection.outbox.resize(kept);
+    connection.outboxBytes -= removedBytes;
+    queuedBytes.fetchAndAddRelaxed(-removedBytes);
+    droppedFrames.fetchAndAddRelaxed(removed);
+    if (removed == 0 && !force)
+        return;
+
+    const Frame snapshot = registry->userListFrame(compressThresholdFor(connection));
+    enqueue(connection, encodedFor(connection, snapshot), Frame::Presence);
+}
+
+void ChatWorker::evict(QTcpSocket *socket, Connection &connection)
+{
+    connection.evicting = true;
+    evictedConnections.fetchAndAddRelaxed(1);
+    log(QString("【警告】%1 出站积压超过 %2 字节，断开慢连接")
+            .arg(registry->nickname(socket, "未登录客户端"))
+            .arg(server->outboundLimit()));
+
+    queuedBytes.fetchAndAddRelaxed(-connection.outboxBytes);
+    connection.outbox.clear();
+    connection.outboxBytes = 0;
+    setCongested(connection, false);
+
+    // 推迟到下一轮事件循环再断开，避免在广播遍历连接表的过程中触发 disconnected
+    QPointer<QTcpSocket> guard(socket);
+    QMetaObject::invokeMethod(this, [guard]() {
+        if (guard)
+            guard->abort();
+    }, Qt::QueuedConnection);
+}
+
+void ChatWorker::onBytesWritten()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+    const QSharedPointer<Connection> connection = connections.value(socket);
+    if (connection && !connection->outbox.isEmpty())
+        writeOut(socket, *connection, SocketHighWater);
+}
+
+// 每个套接字每轮只写一次缓冲并尝试一次非阻塞发送，不再逐条 flush
+void ChatWorker::flushPending()
+{
+    flushScheduled = false;
+    const quint64 allocationsBefore = AllocCounter::threadAllocations();
+    flushingSockets.swap(pendingSockets);
+    for (QTcpSocket *socket : qAsConst(flushingSockets)) {
+        const QSharedPointer<Connection> connection = connections.value(socket);
+        if (!connection)
+            continue;
+        connection->pending = false;
+        if (socket->state() != QAbstractSocket::ConnectedState)
+            continue;
+        writeOut(socket, *connection, SocketHighWater);
+    }
+    flushingSockets.clear();
+    Metrics::bump<quint64>(metricsShard.handlerAllocations,
+                           AllocCounter::threadAllocations() - allocationsBefore);
+}
+
+// 把出站队列交给套接字，直到其写缓冲达到 highWater
+void ChatWorker::writeOut(QTcpSocket *socket, Connection &connection, qint64 highWater)
+{
+    qint64 written = 0;
+    quint64 frames = 0;
+    const qint64 now = Metrics::nowNs();
+    int sent = 0;
+    while (sent < connection.outbox.size() && socket->bytesToWrite() < highWater) {
+        const Outgoing &outgoing = connection.outbox.at(sent++);
+        socket->write(outgoing.bytes);
+        written += outgoing.bytes.size();
+        ++frames;
+        if (outgoing.createdNs != 0)
+            metricsShard.observeBroadcastLatency(now - outgoing.createdNs);
+    }
+    // 写出的帧一次移走，剩下的前移；缓冲不释放
+    connection.outbox.remove(0, sent);
+    Metrics::bump<quint64>(metricsShard.messagesOut, frames);
+    Metrics::bump<quint64>(metricsShard.bytesOut, static_cast<quint64>(written));
+    connection.outboxBytes -= written;
+    queuedBytes.fetchAndAddRelaxed(-written);
+    socket->flush();
+    setCongested(connection, !connection.outbox.isEmpty());
+}
+
+// chat_message 入口检查：禁言中、超出单连接速率或超出入口总上限的消息都丢弃
+bool ChatWorker::admitChat(QTcpSocket *socket, Connection &connection)
+{
+    const qint64 now = Metrics::nowNs();
+    if (connection.mutedUntilNs > now) {
+        Metrics::bump<quint64>(metricsShard.rateLimited);
+        return false;
+    }
+
+    if (!connection.chatBucket.tryTake(now)) {
+        Metrics::bump<quint64>(metricsShard.rateLimited);
+        if (now - connection.overrunWindowStartNs > FloodWindowNs) {
+            connection.overrunWindowStartNs = now;
+            connection.overruns = 0;
+        }
+        if (++connection.overruns < FloodOverruns)
+            return false;
+
+        connection.overruns = 0;
+        Metrics::bump<quint64>(metricsShard.floodActions);
+        const QString nickname = registry->nickname(socket);
+        if (server->floodPolicy() == ChatServer::DisconnectFlooder) {
+            log(QString("【刷屏】%1 持续超速，断开连接").arg(nickname));
+            // 推迟断开，当前仍在处理该连接的数据
+            QPointer<QTcpSocket> guard(socket);
+            QMetaObject::invokeMethod(this, [guard]() {
+                if (guard)
+                    guard->abort();
+            }, Qt::QueuedConnection);
+        } else {
+            log(QString("【刷屏】%1 持续超速，禁言 %2 秒").arg(nickname).arg(MuteSeconds));
+            connection.mutedUntilNs = now + MuteSeconds * 1000000000LL;
+            sendTo(socket, Frames::muted(MuteSeconds));
+        }
+        return false;
+    }
+
+    if (!globalBucket.tryTake(now)) {
+        Metrics::bump<quint64>(metricsShard.globalLimited);
+        return false;
+    }
+    return true;
+}
+
+// 把连接挪到时间轮的 tick 格；tick 距今不超过超时时长，轮子大小保证不会绕圈
+void ChatWorker::scheduleIdleCheck(QTcpSocket *socket, Connection &connection, qint64 tick)
+{
+    const int size = idleWheel.size();
+    idleWheel[connection.scheduledTick % size].remove(socket);
+    connection.scheduledTick = qMax(tick, idleTicks + 1);
+    idleWheel[connection.scheduledTick % size].insert(socket);
+}
+
+// 每秒一次：只检查本格到期的连接，代价与到期数成正比而不是与连接总数成正比
+void ChatWorker::onIdleTick()
+{
+    ++idleTicks;
+    QSet<QTcpSocket*> due;
+    due.swap(idleWheel[idleTicks % idleWheel.size()]);
+
+    const int timeout = server->idleTimeout();
+    const int half = qMax(1, timeout / 2);
+    for (QTcpSocket *socket : qAsConst(due)) {
+        const QSharedPointer<Connection> connection = connections.value(socket);
+        if (!connection || connection->evicting)
+            continue;
+
+        // 已登录的旧客户端不会回应 ping，交给 TCP keepalive，不再跟踪；须在超时判断之前，否则会被误回收
+        if (!connection->heartbeat && !registry->nickname(socket).isEmpty())
+            continue;
+
+        const qint64 idle = idleTicks - connection->lastActivity;
+        if (idle >= timeout) {
+            const QString nickname = registry->nickname(socket);
+            log(QString("【超时】%1 空闲 %2 秒，回收连接")
+                    .arg(nickname.isEmpty() ? QString("未登录客户端") : nickname)
+                    .arg(idle));
+            // disconnected 会同步触发 onClientDisconnected，由它发出唯一一条 user_left
+            socket->abort();
+            continue;
+        }
+
+        if (!connection->heartbeat) {
+            // 还没登录的连接按空闲超时继续计时
+            scheduleIdleCheck(socket, *connection, connection->lastActivity + timeout);
+            continue;
+        }
+
+        if (idle >= half && !connection->pingSent) {
+            sendTo(socket, Frames::ping());
+            connection->pingSent = true;
+        }
+        scheduleIdleCheck(socket, *connection,
+                          connection->lastActivity + (connection->pingSent ? timeout : half));
+    }
+}
+
+void ChatWorker::setCongested(Connection &connection, bool congested)
+{
+    if (connection.congested == congested)
+        return;
+    connection.congested = congested;
+    congestedConnections.fetchAndAddRelaxed(congested ? 1 : -1);
+}
+
+void ChatWorker::log(const QString &message)
+{
+    server->logSink()->append(message);
+}
@@ -0,0 +1,166 @@
+#ifndef CHATWORKER_H
+#define CHATWORKER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QCborMap>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QSharedPointer>
+#include <QAtomicInteger>
+#include <QVector>
+#include "frames.h"
+#include "messagearena.h"
+#include "metrics.h"
+#include "tokenbucket.h"
+#include "wireformat.h"
+
+QT_BEGIN_NAMESPACE
+class QTcpSocket;
+class QTimer;
+QT_END_NAMESPACE
+
+class ChatServer;
+class ClientRegistry;
+struct QueueStats;
+
+// 一个连接分片：拥有自己的一组客户端套接字，在所属线程的事件循环中处理收发
+class ChatWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    ChatWorker(ChatServer *server, ClientRegistry *registry, QObject *parent = nullptr);
+    ~ChatWorker();
+
+    // 可在任意线程调用
+    QueueStats queueStats() const;
+    const MetricsShard &metrics() const;
+
+public slots:
+    void addConnection(qintptr socketDescriptor);
+    // room 为空时发给本分片全部连接，否则只发给本分片中该房间的成员
+    void deliver(const Frame &frame, const QString &room = QString());
+    // 点对点投递；socket 已断开或已换成别的昵称时丢弃
+    void deliverTo(QTcpSocket *socket, const QString &nickname, const Frame &frame);
+    // 续连接管了本分片的旧连接时由新连接所在分片调用；socket 已不在本分片时忽略
+    void dropConnection(QTcpSocket *socket);
+    void disconnectAll();
+    // 排空：每个连接收到带随机重连延迟（spreadMs 以内）的 server_restart，写完积压后断开
+    void drain(int spreadMs);
+    // 集群模式下昵称预留的结果回来了；连接已断开或不再等待时退还预留
+    void finishReservation(QTcpSocket *socket, const QString &nickname, bool granted);
+
+private slots:
+    void onClientDisconnected();
+    void onReadyRead();
+    void onBytesWritten();
+    void flushPending();
+    void onIdleTick();
+    void flushBatches();
+
+private:
+    struct Outgoing
+    {
+        QByteArray bytes;
+        Frame::Kind kind;
+        qint64 createdNs;
+    };
+
+    // 每个连接的协议状态与出站队列；以共享指针保存，处理过程中连接被移除也不会悬空
+    struct Connection
+    {
+        Wire::Reader reader;
+        Wire::Format wire = Wire::Json;   // 发往该连接的帧使用的格式
+        QVector<Outgoing> outbox;         // 尚未交给套接字的帧；出队时成批从头部移除，容量留着复用
+        qint64 outboxBytes = 0;
+        QSet<QString> rooms;              // 加入的命名房间
+        bool congested = false;
+        bool evicting = false;
+        bool pending = false;             // 已在 pendingSockets 中
+
+        // 空闲检测：收到数据只更新 lastActivity，时间轮到点时再决定是发心跳、回收还是重新排期
+        qint64 lastActivity = 0;    // 以 idleTicks 计
+        qint64 scheduledTick = 0;
+        bool heartbeat = false;     // 登录时声明支持 ping/pong
+        bool batch = false;         // 登录时声明能解开 batch 帧
+        bool compress = false;      // 已协商压缩（仅 Cbor 线路）
+        bool pingSent = false;
+
+        // 集群模式下等待归属节点预留昵称时暂存的 login 消息
+        bool loginPending = false;
+        QCborMap pendingLogin;
+
+        // 刷屏保护：超速的消息直接丢弃，窗口内超速次数过多则禁言或断开
+        TokenBucket chatBucket;
+        int overruns = 0;
+        qint64 overrunWindowStartNs = 0;
+        qint64 mutedUntilNs = 0;
+    };
+
+    ChatServer *server;
+    ClientRegistry *registry;
+    QHash<QTcpSocket*, QSharedPointer<Connection>> connections;
+    // 本分片内各命名房间的成员，房间广播只遍历这里
+    QHash<QString, QSet<QTcpSocket*>> localRooms;
+
+    // 本轮事件循环中有新帧入队的连接，统一在 flushPending 中写出；两个数组轮换使用，容量保留
+    QVector<QTcpSocket*> pendingSockets;
+    QVector<QTcpSocket*> flushingSockets;
+    bool flushScheduled;
+
+    // 本轮处理消息时解码出的字段，onReadyRead 结束时收回
+    MessageArena arena;
+
+    // 合批窗口内暂存的聊天帧，按目标房间分组（空字符串表示全体）
+    struct PendingBatch
+    {
+        QList<Frame> frames;
+        int bytes = 0;
+    };
+    QHash<QString, PendingBatch> pendingBatches;
+    QTimer *batchTimer;
+
+    // 本分片分到的入口总上限
+    TokenBucket globalBucket;
+    bool rateLimitsConfigured;
+
+    // 空闲连接的时间轮：每秒前进一格，每格是在该秒需要检查的连接
+    QTimer *idleTimer;
+    QVector<QSet<QTcpSocket*>> idleWheel;
+    qint64 idleTicks;
+
+    // 供其他线程读取的计数
+    QAtomicInteger<qint64> queuedBytes;
+    QAtomicInt congestedConnections;
+    QAtomicInteger<quint64> droppedFrames;
+    QAtomicInteger<quint64> evictedConnections;
+    MetricsShard metricsShard;
+
+    void handleMessage(QTcpSocket *socket, Connection &connection, const Wire::Message &obj);
+    void login(QTcpSocket *socket, Connection &connection, const Wire::Message &obj, bool reserved);
+    void relayFile(QTcpSocket *socket, QLatin1String type, const Wire::Message &obj);
+    void sendPrivate(QTcpSocket *socket, Connection &connection, const Wire::Message &obj);
+    void deliverOffline(QTcpSocket *socket, const QString &nickname);
+    void deliverNow(const Frame &frame, const QString &room);
+    void deliverBatch(const QString &room, const PendingBatch &pending);
+    template <typename Visitor>
+    void forEachRecipient(const QString &room, Visitor visit);
+    void joinRoom(QTcpSocket *socket, Connection &connection, const QString &room);
+    void leaveRoom(QTcpSocket *socket, Connection &connection, const QString &room);
+    void sendTo(QTcpSocket *socket, const Frame &frame);
+    QByteArray encodedFor(const Connection &connection, const Frame &frame) const;
+    int compressThresholdFor(const Connection &connection) const;
+    void enqueue(Connection &connection, const QByteArray &bytes, Frame::Kind kind, qint64 createdNs = 0);
+    void dropOldest(Connection &connection, qint64 room);
+    void coalescePresence(Connection &connection, bool force);
+    void evict(QTcpSocket *socket, Connection &connection);
+    void writeOut(QTcpSocket *socket, Connection &connection, qint64 highWater);
+    void setCongested(Connection &connection, bool congested);
+    bool admitChat(QTcpSocket *socket, Connection &connection);
+    void scheduleIdleCheck(QTcpSocket *socket, Connection &connection, qint64 tick);
+    void log(const QString &message);
+};
+
+#endif // CHATWORKER_H
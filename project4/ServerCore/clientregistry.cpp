@@ -0,0 +1,492 @@
+#include "clientregistry.h"
+#include <QCborArray>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+
+ClientRegistry::ClientRegistry()
+    : userListDirty(true),
+      presenceEpoch(QRandomGenerator::global()->generate() | 1u),
+      presenceVersion(0),
+      offlineTotal(0)
+{
+}
+
+void ClientRegistry::addClient(QTcpSocket *socket, ChatWorker *owner)
+{
+    QMutexLocker locker(&mutex);
+    clientNicknames[socket] = "";
+    socketOwners[socket] = owner;
+}
+
+bool ClientRegistry::claimNickname(QTcpSocket *socket, const QString &nickname, quint64 *version)
+{
+    // 检查与写入在同一把锁内完成，避免两个线程同时登录同一昵称
+    QMutexLocker locker(&mutex);
+    if (nicknameIndex.contains(nickname))
+        return false;
+
+    // 同一连接重复登录时先释放旧昵称
+    releaseNickname(socket);
+    clientNicknames[socket] = nickname;
+
+    Entry entry;
+    entry.socket = socket;
+    entry.owner = socketOwners.value(socket);
+    entry.json = Frames::jsonString(nickname);
+    entry.cbor = Frames::cborString(nickname);
+    nicknameIndex.insert(nickname, entry);
+    userListDirty = true;
+    const quint64 joinedVersion = recordPresence(nickname, true);
+    if (version)
+        *version = joinedVersion;
+    return true;
+}
+
+QString ClientRegistry::nickname(QTcpSocket *socket, const QString &defaultValue) const
+{
+    QMutexLocker locker(&mutex);
+    return clientNicknames.value(socket, defaultValue);
+}
+
+QTcpSocket *ClientRegistry::socketFor(const QString &nickname, ChatWorker **owner) const
+{
+    QMutexLocker locker(&mutex);
+    const Entry entry = nicknameIndex.value(nickname);
+    if (owner)
+        *owner = entry.owner;
+    return entry.socket;
+}
+
+QString ClientRegistry::removeClient(QTcpSocket *socket, const QString &defaultValue,
+                                    quint64 *version)
+{
+    QMutexLocker locker(&mutex);
+    QString name = clientNicknames.value(socket, defaultValue);
+    const quint64 leftVersion = releaseNickname(socket) ? presenceVersion : 0;
+    if (version)
+        *version = leftVersion;
+    clientNicknames.remove(socket);
+    socketOwners.remove(socket);
+    leaveAllRooms(socket);
+    return name;
+}
+
+QByteArray ClientRegistry::openSession(QTcpSocket *socket)
+{
+    QMutexLocker locker(&mutex);
+    const QString name = clientNicknames.value(socket);
+    if (name.isEmpty())
+        return QByteArray();
+    sessions.remove(socketSessions.take(socket));
+    return newSessionToken(name, socket);
+}
+
+bool ClientRegistry::detachClient(QTcpSocket *socket, qint64 expiresNs, QString *nickname)
+{
+    QMutexLocker locker(&mutex);
+    auto tokenIt = socketSessions.find(socket);
+    if (tokenIt == socketSessions.end())
+        return false;
+    const QByteArray token = tokenIt.value();
+    socketSessions.erase(tokenIt);
+    auto it = sessions.find(token);
+    if (it == sessions.end())
+        return false;
+
+    *nickname = it->nickname;
+    it->socket = nullptr;
+    it->expiresNs = expiresNs;
+    it->rooms = leaveAllRooms(socket);
+    sessionExpiry.insert(expiresNs, token);
+
+    // 昵称仍占着，只是暂时没有连接：点对点消息投递不到，新登录也不能抢用
+    Entry &entry = nicknameIndex[it->nickname];
+    entry.socket = nullptr;
+    entry.owner = nullptr;
+    clientNicknames.remove(socket);
+    socketOwners.remove(socket);
+    return true;
+}
+
+bool ClientRegistry::resumeSession(QTcpSocket *socket, const QByteArray &token, const QString &nickname,
+                                   QSet<QString> *rooms, QByteArray *sessionToken,
+                                   QTcpSocket **replaced, ChatWorker **replacedOwner)
+{
+    QMutexLocker locker(&mutex);
+    auto it = sessions.find(token);
+    if (it == sessions.end() || it->nickname != nickname || !clientNicknames.value(socket).isEmpty())
+        return false;
+
+    const Session session = it.value();
+    sessions.erase(it);
+    *replaced = session.socket;
+    *replacedOwner = nullptr;
+    if (session.socket) {
+        // 旧连接半开着还没被发现：房间转给新连接，旧连接断开时不再产生下线
+        *replacedOwner = socketOwners.value(session.socket);
+        *rooms = leaveAllRooms(session.socket);
+        clientNicknames[session.socket] = QString();
+        socketSessions.remove(session.socket);
+    } else {
+        *rooms = session.rooms;
+        sessionExpiry.remove(session.expiresNs, token);
+    }
+
+    clientNicknames[socket] = nickname;
+    Entry &entry = nicknameIndex[nickname];
+    entry.socket = socket;
+    entry.owner = socketOwners.value(socket);
+    // 令牌不轮换：login_success 在路上丢了，客户端下次仍可用同一令牌接续
+    Session attached;
+    attached.nickname = nickname;
+    attached.socket = socket;
+    sessions.insert(token, attached);
+    socketSessions.insert(socket, token);
+    *sessionToken = token;
+    return true;
+}
+
+QList<QPair<QString, quint64>> ClientRegistry::expireSessions(qint64 nowNs, QList<OfflineMessage> *dropped)
+{
+    QMutexLocker locker(&mutex);
+    QList<QPair<QString, quint64>> expired;
+    while (!sessionExpiry.isEmpty() && sessionExpiry.firstKey() <= nowNs) {
+        auto first = sessionExpiry.begin();
+        const QByteArray token = first.value();
+        sessionExpiry.erase(first);
+        const Session session = sessions.take(token);
+        if (session.nickname.isEmpty() || session.socket)
+            continue;
+        nicknameIndex.remove(session.nickname);
+        userListDirty = true;
+        const QList<OfflineMessage> queue = dropOffline(session.nickname);
+        if (dropped)
+            dropped->append(queue);
+        expired.append(qMakePair(session.nickname, recordPresence(session.nickname, false)));
+    }
+    return expired;
+}
+
+quint64 ClientRegistry::addRemote(const QString &nickname, const QString &node)
+{
+    QMutexLocker locker(&mutex);
+    if (nickname.isEmpty() || nicknameIndex.contains(nickname))
+        return 0;
+    Entry entry;
+    entry.node = node;
+    entry.json = Frames::jsonString(nickname);
+    entry.cbor = Frames::cborString(nickname);
+    nicknameIndex.insert(nickname, entry);
+    userListDirty = true;
+    return recordPresence(nickname, true);
+}
+
+quint64 ClientRegistry::removeRemote(const QString &nickname, const QString &node)
+{
+    QMutexLocker locker(&mutex);
+    auto it = nicknameIndex.find(nickname);
+    if (it == nicknameIndex.end() || it->node.isEmpty() || it->node != node)
+        return 0;
+    nicknameIndex.erase(it);
+    userListDirty = true;
+    return recordPresence(nickname, false);
+}
+
+QList<QPair<QString, quint64>> ClientRegistry::removeNode(const QString &node)
+{
+    QMutexLocker locker(&mutex);
+    QList<QPair<QString, quint64>> removed;
+    for (auto it = nicknameIndex.begin(); it != nicknameIndex.end();) {
+        if (it->node != node) {
+            ++it;
+            continue;
+        }
+        const QString nickname = it.key();
+        it = nicknameIndex.erase(it);
+        removed.append(qMakePair(nickname, recordPresence(nickname, false)));
+    }
+    if (!removed.isEmpty())
+        userListDirty = true;
+    return removed;
+}
+
+bool ClientRegistry::remoteNode(const QString &nickname, QString *node) const
+{
+    QMutexLocker locker(&mutex);
+    const QString where = nicknameIndex.value(nickname).node;
+    if (where.isEmpty())
+        return false;
+    *node = where;
+    return true;
+}
+
+QStringList ClientRegistry::localNicknames() const
+{
+    QMutexLocker locker(&mutex);
+    QStringList local;
+    for (auto it = nicknameIndex.cbegin(); it != nicknameIndex.cend(); ++it) {
+        if (it->node.isEmpty())
+            local.append(it.key());
+    }
+    return local;
+}
+
+ClientRegistry::OfflineResult ClientRegistry::queueOffline(const QString &recipient, const QString &sender,
+                                                           qint64 id, const Frame &frame)
+{
+    // 与登录在同一把锁下判断：对方若已登记了连接，取出暂存的时机已过，不能再放进来
+    QMutexLocker locker(&mutex);
+    // 本节点的昵称没有连接时一定是断线保留中的会话
+    const auto current = nicknameIndex.constFind(recipient);
+    if (current == nicknameIndex.cend())
+        return RecipientOffline;
+    if (current->socket || !current->node.isEmpty())
+        return RecipientOnline;
+    if (offlineSenders.value(sender) >= MaxOfflinePerSender)
+        return SenderQuotaFull;
+    QList<OfflineMessage> &queue = offlineMessages[recipient];
+    if (queue.size() >= MaxOfflinePerRecipient || offlineTotal >= MaxOfflineTotal) {
+        if (queue.isEmpty())
+            offlineMessages.remove(recipient);
+        return QueueFull;
+    }
+    queue.append(OfflineMessage{sender, recipient, id, frame});
+    ++offlineSenders[sender];
+    ++offlineTotal;
+    return Queued;
+}
+
+QList<ClientRegistry::OfflineMessage> ClientRegistry::takeOffline(const QString &recipient)
+{
+    QMutexLocker locker(&mutex);
+    return dropOffline(recipient);
+}
+
+// 调用方须已持有锁
+QList<ClientRegistry::OfflineMessage> ClientRegistry::dropOffline(const QString &recipient)
+{
+    const QList<OfflineMessage> queue = offlineMessages.take(recipient);
+    offlineTotal -= queue.size();
+    for (const OfflineMessage &message : queue) {
+        auto it = offlineSenders.find(message.sender);
+        if (it != offlineSenders.end() && --it.value() <= 0)
+            offlineSenders.erase(it);
+    }
+    return queue;
+}
+
+QCborMap ClientRegistry::exportState(qint64 nowNs, qint64 graceNs) const
+{
+    QMutexLocker locker(&mutex);
+    QCborArray users;
+    for (auto it = nicknameIndex.cbegin(); it != nicknameIndex.cend(); ++it)
+        users.append(it.key());
+
+    QCborArray exported;
+    for (auto it = sessions.cbegin(); it != sessions.cend(); ++it) {
+        const Session &session = it.value();
+        const QSet<QString> joined = session.socket ? socketRooms.value(session.socket) : session.rooms;
+        const qint64 remainingNs = session.socket ? graceNs : session.expiresNs - nowNs;
+        if (remainingNs <= 0)
+            continue;
+        QCborArray roomList;
+        for (const QString &room : joined)
+            roomList.append(room);
+        exported.append(QCborMap{{QStringLiteral("token"), QString::fromLatin1(it.key())},
+                                 {QStringLiteral("nickname"), session.nickname},
+                                 {QStringLiteral("rooms"), roomList},
+                                 {QStringLiteral("remaining_ms"), remainingNs / 1000000}});
+    }
+
+    return QCborMap{{QStringLiteral("epoch"), static_cast<qint64>(presenceEpoch)},
+                    {QStringLiteral("version"), static_cast<qint64>(presenceVersion)},
+                    {QStringLiteral("users"), users},
+                    {QStringLiteral("sessions"), exported}};
+}
+
+void ClientRegistry::importState(const QCborMap &state, qint64 nowNs)
+{
+    const quint32 epoch = static_cast<quint32>(state.value(QLatin1String("epoch")).toInteger());
+    if (epoch == 0)
+        return;
+
+    QMutexLocker locker(&mutex);
+    presenceEpoch = epoch;
+    presenceVersion = static_cast<quint64>(state.value(QLatin1String("version")).toInteger());
+    presenceLog.clear();
+
+    // 会话照旧以断线保留的状态登记，昵称继续占着，等客户端凭令牌接续
+    for (const QCborValue &value : state.value(QLatin1String("sessions")).toArray()) {
+        const QCborMap map = value.toMap();
+        const QByteArray token = map.value(QLatin1String("token")).toString().toLatin1();
+        Session session;
+        session.nickname = map.value(QLatin1String("nickname")).toString();
+        if (token.isEmpty() || session.nickname.isEmpty() || nicknameIndex.contains(session.nickname))
+            continue;
+        for (const QCborValue &room : map.value(QLatin1String("rooms")).toArray())
+            session.rooms.insert(room.toString());
+        session.expiresNs = nowNs + map.value(QLatin1String("remaining_ms")).toInteger() * 1000000;
+
+        Entry entry;
+        entry.json = Frames::jsonString(session.nickname);
+        entry.cbor = Frames::cborString(session.nickname);
+        nicknameIndex.insert(session.nickname, entry);
+        sessions.insert(token, session);
+        sessionExpiry.insert(session.expiresNs, token);
+    }
+
+    // 客户端手里的列表还有这些人，补一条下线让差量把他们去掉
+    for (const QCborValue &value : state.value(QLatin1String("users")).toArray()) {
+        const QString nickname = value.toString();
+        if (!nickname.isEmpty() && !nicknameIndex.contains(nickname))
+            recordPresence(nickname, false);
+    }
+    userListDirty = true;
+}
+
+QStringList ClientRegistry::nicknames() const
+{
+    QMutexLocker locker(&mutex);
+    return nicknameIndex.keys();
+}
+
+bool ClientRegistry::joinRoom(QTcpSocket *socket, const QString &room)
+{
+    QMutexLocker locker(&mutex);
+    QSet<QTcpSocket*> &members = rooms[room];
+    if (members.contains(socket))
+        return false;
+    members.insert(socket);
+    socketRooms[socket].insert(room);
+    return true;
+}
+
+bool ClientRegistry::leaveRoom(QTcpSocket *socket, const QString &room)
+{
+    QMutexLocker locker(&mutex);
+    auto it = rooms.find(room);
+    if (it == rooms.end() || !it->remove(socket))
+        return false;
+    if (it->isEmpty())
+        rooms.erase(it);
+    socketRooms[socket].remove(room);
+    return true;
+}
+
+QStringList ClientRegistry::roomMembers(const QString &room) const
+{
+    QMutexLocker locker(&mutex);
+    QStringList members;
+    const QSet<QTcpSocket*> sockets = rooms.value(room);
+    members.reserve(sockets.size());
+    for (QTcpSocket *socket : sockets) {
+        const QString name = clientNicknames.value(socket);
+        if (!name.isEmpty())
+            members.append(name);
+    }
+    return members;
+}
+
+Frame ClientRegistry::userListFrame(int compressThreshold)
+{
+    QMutexLocker locker(&mutex);
+    if (userListDirty) {
+        QByteArrayList jsonItems;
+        QByteArrayList cborItems;
+        jsonItems.reserve(nicknameIndex.size());
+        cborItems.reserve(nicknameIndex.size());
+        for (const Entry &entry : qAsConst(nicknameIndex)) {
+            jsonItems.append(entry.json);
+            cborItems.append(entry.cbor);
+        }
+        userListCache = Frames::userList(jsonItems, cborItems, presenceVersion, presenceEpoch);
+        userListDirty = false;
+    }
+    Frames::compress(userListCache, compressThreshold);
+    return userListCache;
+}
+
+Frame ClientRegistry::presenceSince(quint32 epoch, quint64 version, int compressThreshold)
+{
+    QMutexLocker locker(&mutex);
+    const quint64 oldest = presenceLog.isEmpty() ? presenceVersion + 1 : presenceLog.first().version;
+    if (epoch != presenceEpoch || version == 0 || version > presenceVersion || version + 1 < oldest) {
+        locker.unlock();
+        return userListFrame(compressThreshold);
+    }
+
+    // 同一昵称在这段时间里可能上下线多次，只保留净变化
+    QHash<QString, int> net;
+    for (int i = static_cast<int>(version + 1 - oldest); i < presenceLog.size(); ++i) {
+        const PresenceDelta &delta = presenceLog.at(i);
+        net[delta.nickname] += delta.joined ? 1 : -1;
+    }
+    QStringList joined;
+    QStringList left;
+    for (auto it = net.cbegin(); it != net.cend(); ++it) {
+        if (it.value() > 0)
+            joined.append(it.key());
+        else if (it.value() < 0)
+            left.append(it.key());
+    }
+    return Frames::userListDelta(version, presenceVersion, joined, left);
+}
+
+int ClientRegistry::count() const
+{
+    QMutexLocker locker(&mutex);
+    return clientNicknames.size();
+}
+
+// 调用方须已持有锁；确有昵称被释放时返回 true
+bool ClientRegistry::releaseNickname(QTcpSocket *socket)
+{
+    const QString current = clientNicknames.value(socket);
+    if (current.isEmpty())
+        return false;
+    nicknameIndex.remove(current);
+    userListDirty = true;
+    recordPresence(current, false);
+    sessions.remove(socketSessions.take(socket));
+    return true;
+}
+
+// 调用方须已持有锁；返回连接原来所在的房间
+QSet<QString> ClientRegistry::leaveAllRooms(QTcpSocket *socket)
+{
+    const QSet<QString> joined = socketRooms.take(socket);
+    for (const QString &room : joined) {
+        auto it = rooms.find(room);
+        if (it == rooms.end())
+            continue;
+        it->remove(socket);
+        if (it->isEmpty())
+            rooms.erase(it);
+    }
+    return joined;
+}
+
+// 调用方须已持有锁
+QByteArray ClientRegistry::newSessionToken(const QString &nickname, QTcpSocket *socket)
+{
+    quint32 words[4];
+    QRandomGenerator::system()->fillRange(words);
+    const QByteArray token = QByteArray(reinterpret_cast<const char *>(words), sizeof(words)).toHex();
+    Session session;
+    session.nickname = nickname;
+    session.socket = socket;
+    sessions.insert(token, session);
+    socketSessions.insert(socket, token);
+    return token;
+}
+
+// 调用方须已持有锁
+quint64 ClientRegistry::recordPresence(const QString &nickname, bool joined)
+{
+    ++presenceVersion;
+    presenceLog.append(PresenceDelta{presenceVersion, nickname, joined});
+    if (presenceLog.size() > MaxPresenceLog)
+        presenceLog.removeFirst();
+    return presenceVersion;
+}
+
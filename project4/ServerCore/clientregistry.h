@@ -0,0 +1,178 @@
+#ifndef CLIENTREGISTRY_H
+#define CLIENTREGISTRY_H
+
+#include <QByteArray>
+#include <QCborMap>
+#include <QHash>
+#include <QList>
+#include <QMultiMap>
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include "frames.h"
+
+QT_BEGIN_NAMESPACE
+class QTcpSocket;
+QT_END_NAMESPACE
+
+class ChatWorker;
+
+// 所有工作线程共享的昵称登记表，内部加锁，可在任意线程调用
+// 套接字→昵称、昵称→套接字双向散列索引，登录查重为 O(1)；
+// user_list 帧按版本缓存，昵称变化之间的所有登录共用同一帧
+//
+// 每次上线/下线都让在线状态版本号加一，user_joined / user_left 带上该版本号；
+// 最近 MaxPresenceLog 条变化留在日志里，客户端断线重连时只补发差量，
+// 更早的版本（或服务器重启换了纪元）退回完整快照
+//
+// 续连会话：登录成功后可为连接开一个会话并发放令牌。连接断开时昵称不立即释放，
+// 在保留期内凭令牌重连即可接续（不广播上下线，重新加入原来的房间）；
+// 过期未接续的会话由 expireSessions 释放昵称
+//
+// 集群模式下其他节点的在线昵称也登记在这里（没有本地连接，记下所在节点），
+// 用户列表、查重与私聊路由都把它们算在内
+//
+// 私聊的收件人不在线时消息暂存在这里，对方登录或续连时一次取出
+//
+// 热重启时旧进程导出纪元、版本号与会话，新进程导入后沿用同一纪元，客户端续连照常只补差量
+class ClientRegistry
+{
+public:
+    ClientRegistry();
+
+    // owner 是套接字所在的分片，点对点消息据此投递
+    void addClient(QTcpSocket *socket, ChatWorker *owner);
+    // 昵称已被占用时返回 false；成功时 version 得到这次上线的版本号
+    // （同一连接换昵称时旧昵称的下线占用 version - 1）
+    bool claimNickname(QTcpSocket *socket, const QString &nickname, quint64 *version = nullptr);
+    QString nickname(QTcpSocket *socket, const QString &defaultValue = QString()) const;
+    // 不在线时返回 nullptr；owner 得到该连接所在的分片
+    QTcpSocket *socketFor(const QString &nickname, ChatWorker **owner = nullptr) const;
+    // 移除客户端并返回其昵称（未登记时返回 defaultValue）；已登录时 version 得到下线的版本号
+    QString removeClient(QTcpSocket *socket, const QString &defaultValue = QString(),
+                         quint64 *version = nullptr);
+    QStringList nicknames() const;
+
+    // 为已登录的连接开会话，返回令牌；同一连接之前的会话作废
+    QByteArray openSession(QTcpSocket *socket);
+    // 有会话的连接断开：移除连接但保留昵称到 expiresNs，返回 true 并给出昵称；
+    // 没有会话时返回 false，调用方按 removeClient 处理
+    bool detachClient(QTcpSocket *socket, qint64 expiresNs, QString *nickname);
+    // 凭令牌接续：令牌有效且昵称相符时把会话转到 socket 上，给出原来的房间与会话令牌（令牌不变）。
+    // 旧连接还没被发现断开时由新连接接管，replaced / replacedOwner 给出旧连接，由调用方断开
+    bool resumeSession(QTcpSocket *socket, const QByteArray &token, const QString &nickname,
+                       QSet<QString> *rooms, QByteArray *sessionToken,
+                       QTcpSocket **replaced, ChatWorker **replacedOwner);
+    struct OfflineMessage;
+    // 释放 nowNs 之前到期的会话，返回昵称与对应的下线版本号；
+    // 这些昵称暂存的离线私聊随之丢弃，放进 dropped 供调用方通知发件人
+    QList<QPair<QString, quint64>> expireSessions(qint64 nowNs, QList<OfflineMessage> *dropped = nullptr);
+
+    // 集群：其他节点上的昵称上下线；昵称已被本节点占用或并不在该节点时返回 0，否则返回版本号
+    quint64 addRemote(const QString &nickname, const QString &node);
+    quint64 removeRemote(const QString &nickname, const QString &node);
+    // 与节点断开时移除它的全部昵称，返回昵称与对应的下线版本号
+    QList<QPair<QString, quint64>> removeNode(const QString &node);
+    // 昵称在其他节点上时返回 true 并给出节点
+    bool remoteNode(const QString &nickname, QString *node) const;
+    // 本节点占用的昵称（含断线保留中的会话）
+    QStringList localNicknames() const;
+
+    // 离线私聊暂存的结果；RecipientOnline 表示对方恰好上线了，调用方应改为直接投递
+    enum OfflineResult {
+        Queued,
+        RecipientOnline,
+        QueueFull,
+        SenderQuotaFull,
+        RecipientOffline
+    };
+    struct OfflineMessage
+    {
+        QString sender;
+        QString recipient;
+        qint64 id;          // 发件人的消息编号，送达后据此回执
+        Frame frame;
+    };
+    // 没有账号，昵称谁都能登录：只暂存给仍有会话可接续的收件人，并且只在凭令牌续连时由 takeOffline 交出；
+    // 会话保留期一过暂存即丢弃，所以一条消息最多留一个保留期
+    // 每个收件人最多 MaxOfflinePerRecipient 条，每个发件人最多 MaxOfflinePerSender 条，
+    // 全部合计最多 MaxOfflineTotal 条
+    OfflineResult queueOffline(const QString &recipient, const QString &sender, qint64 id, const Frame &frame);
+    QList<OfflineMessage> takeOffline(const QString &recipient);
+
+    // 热重启交接：仍连着的会话按 graceNs 的完整保留期导出
+    QCborMap exportState(qint64 nowNs, qint64 graceNs) const;
+    // 须在接受任何连接之前调用；导出时在线但没有会话的昵称记为下线
+    void importState(const QCborMap &state, qint64 nowNs);
+
+    // 命名房间的成员表（默认房间包含所有连接，不在这里登记）
+    // 已在房间中 / 不在房间中时返回 false
+    bool joinRoom(QTcpSocket *socket, const QString &room);
+    bool leaveRoom(QTcpSocket *socket, const QString &room);
+    QStringList roomMembers(const QString &room) const;
+
+    // compressThreshold 大于 0 时附带压缩结果，随快照一起缓存
+    Frame userListFrame(int compressThreshold = 0);
+    // 客户端已有 epoch 纪元下 version 版本的列表时补发之后的净变化，否则给完整快照
+    Frame presenceSince(quint32 epoch, quint64 version, int compressThreshold = 0);
+    int count() const;
+
+    static const int MaxPresenceLog = 1024;
+    static const int MaxOfflinePerRecipient = 100;
+    static const int MaxOfflinePerSender = 200;
+    static const int MaxOfflineTotal = 10000;
+
+private:
+    // 每个昵称预先编码好的 JSON/CBOR 字符串，重建 user_list 时直接拼接
+    struct Entry
+    {
+        QTcpSocket *socket = nullptr;
+        ChatWorker *owner = nullptr;
+        QString node;           // 集群中其他节点的昵称；本节点的为空
+        QByteArray json;
+        QByteArray cbor;
+    };
+
+    struct Session
+    {
+        QString nickname;
+        QTcpSocket *socket = nullptr;   // 断线保留期间为 nullptr
+        QSet<QString> rooms;            // 断线时所在的命名房间
+        qint64 expiresNs = 0;
+    };
+
+    struct PresenceDelta
+    {
+        quint64 version;
+        QString nickname;
+        bool joined;
+    };
+
+    mutable QMutex mutex;
+    QHash<QTcpSocket*, QString> clientNicknames;
+    QHash<QTcpSocket*, ChatWorker*> socketOwners;
+    QHash<QString, Entry> nicknameIndex;
+    QHash<QString, QSet<QTcpSocket*>> rooms;
+    QHash<QTcpSocket*, QSet<QString>> socketRooms;
+    Frame userListCache;
+    bool userListDirty;
+    quint32 presenceEpoch;
+    quint64 presenceVersion;
+    QList<PresenceDelta> presenceLog;   // 版本号连续，最旧的在前
+    QHash<QByteArray, Session> sessions;
+    QHash<QTcpSocket*, QByteArray> socketSessions;
+    QMultiMap<qint64, QByteArray> sessionExpiry;   // 断线保留中的会话，按到期时间排序
+    QHash<QString, QList<OfflineMessage>> offlineMessages;
+    QHash<QString, int> offlineSenders;             // 各发件人暂存中的条数
+    int offlineTotal;
+
+    bool releaseNickname(QTcpSocket *socket);
+    QSet<QString> leaveAllRooms(QTcpSocket *socket);
+    QByteArray newSessionToken(const QString &nickname, QTcpSocket *socket);
+    quint64 recordPresence(const QString &nickname, bool joined);
+    QList<OfflineMessage> dropOffline(const QString &recipient);
+};
+
+#endif // CLIENTREGISTRY_H
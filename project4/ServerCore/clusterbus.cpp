@@ -0,0 +1,507 @@
+#include "clusterbus.h"
+#include "logsink.h"
+#include <QCborArray>
+#include <QHostAddress>
+#include <QMessageAuthenticationCode>
+#include <QPointer>
+#include <QRandomGenerator>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <algorithm>
+
+// 对端节点断开后多久重拨一次
+static const int DialIntervalMs = 2000;
+// 认证握手用的随机数长度（字节）
+static const int NonceSize = 16;
+// 链路建立后这么久还没握手完成就断开（例如两端密钥配置不一致），拨出方随后重拨
+static const int HandshakeTimeoutMs = 10000;
+// 一条链路出站积压超过这么多字节就断开：对端卡住时不让内存无限增长，链路断开后由拨出方重拨、重新同步
+static const qint64 MaxLinkQueuedBytes = 16 * 1024 * 1024;
+
+static QByteArray makeNonce()
+{
+    QByteArray nonce(NonceSize, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(nonce.data()), NonceSize / 4);
+    return nonce;
+}
+
+ClusterBus::ClusterBus(const QString &nodeId, LogSink *sink, QObject *parent)
+    : QObject(parent)
+    , self(nodeId)
+    , sink(sink)
+    , members(QStringList() << nodeId)
+    , listener(new QTcpServer(this))
+    , dialTimer(new QTimer(this))
+    , nextRequest(0)
+{
+    connect(listener, &QTcpServer::newConnection, this, &ClusterBus::onIncomingConnection);
+    connect(dialTimer, &QTimer::timeout, this, &ClusterBus::dialPeers);
+}
+
+ClusterBus::~ClusterBus()
+{
+}
+
+bool ClusterBus::parsePeer(const QString &text, Peer *peer)
+{
+    const int at = text.indexOf('@');
+    const int colon = text.lastIndexOf(':');
+    if (at <= 0 || colon <= at + 1)
+        return false;
+    bool ok = false;
+    peer->id = text.left(at);
+    peer->host = text.mid(at + 1, colon - at - 1);
+    peer->port = text.mid(colon + 1).toUShort(&ok);
+    return ok && peer->port != 0;
+}
+
+void ClusterBus::addPeer(const Peer &peer)
+{
+    if (peer.id == self || members.contains(peer.id))
+        return;
+    peers.append(peer);
+    members.append(peer.id);
+    std::sort(members.begin(), members.end());
+}
+
+void ClusterBus::setSecret(const QByteArray &key)
+{
+    secret = key;
+}
+
+bool ClusterBus::listen(const QHostAddress &address, quint16 port, QString *errorMessage)
+{
+    if (!listener->listen(address, port)) {
+        *errorMessage = QString("集群端口 %1:%2 监听失败：%3")
+                            .arg(address.toString()).arg(port).arg(listener->errorString());
+        return false;
+    }
+    log(QString("【集群】节点 %1 在 %2:%3 等待其他节点，共 %4 个节点")
+            .arg(self).arg(address.toString()).arg(listener->serverPort()).arg(members.size()));
+    if (secret.isEmpty())
+        log("【警告】集群未设置共享密钥，节点链路不做认证，集群端口只应开放给可信网络");
+    dialPeers();
+    dialTimer->start(DialIntervalMs);
+    return true;
+}
+
+QString ClusterBus::nodeId() const
+{
+    return self;
+}
+
+void ClusterBus::shutdown()
+{
+    listener->close();
+    dialTimer->stop();
+    peers.clear();
+    const QList<QTcpSocket*> sockets = links.keys();
+    links.clear();
+    nodeLinks.clear();
+    reservations.clear();
+    // 先断开信号再 abort，链路断开不再当作节点离开
+    for (QTcpSocket *socket : sockets) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+    const QList<std::function<void(bool)>> pending = pendingReservations.values();
+    pendingReservations.clear();
+    pendingNodes.clear();
+    for (const std::function<void(bool)> &done : pending) {
+        if (done)
+            done(false);
+    }
+    log("【集群】集群总线已关闭");
+}
+
+// 各进程的 qHash 种子不同，归属节点要用所有节点算出一致结果的散列（FNV-1a）
+QString ClusterBus::homeOf(const QString &nickname) const
+{
+    quint32 hash = 2166136261u;
+    for (const char byte : nickname.toUtf8()) {
+        hash ^= static_cast<quint8>(byte);
+        hash *= 16777619u;
+    }
+    return members.at(static_cast<int>(hash % static_cast<quint32>(members.size())));
+}
+
+bool ClusterBus::grant(const QString &nickname, const QString &node)
+{
+    if (reservations.contains(nickname))
+        return false;
+    reservations.insert(nickname, node);
+    return true;
+}
+
+void ClusterBus::reserve(const QString &nickname, const std::function<void(bool)> &done)
+{
+    const QString home = homeOf(nickname);
+    if (home == self) {
+        done(grant(nickname, self));
+        return;
+    }
+    if (!nodeLinks.contains(home)) {
+        log(QString("【集群】昵称 '%1' 的归属节点 %2 不可达").arg(nickname).arg(home));
+        done(false);
+        return;
+    }
+    const quint64 request = ++nextRequest;
+    pendingReservations.insert(request, done);
+    pendingNodes.insert(request, home);
+    sendToNode(home, QCborMap{{QStringLiteral("type"), QStringLiteral("reserve")},
+                              {QStringLiteral("nickname"), nickname},
+                              {QStringLiteral("request"), static_cast<qint64>(request)}});
+}
+
+void ClusterBus::release(const QString &nickname)
+{
+    const QString home = homeOf(nickname);
+    if (home == self) {
+        if (reservations.value(nickname) == self)
+            reservations.remove(nickname);
+        return;
+    }
+    // 归属节点此时不可达也无妨：链路断开时它会清掉本节点的全部预留
+    sendToNode(home, QCborMap{{QStringLiteral("type"), QStringLiteral("release")},
+                              {QStringLiteral("nickname"), nickname}});
+}
+
+void ClusterBus::announce(const QString &nickname, bool joined)
+{
+    broadcast(QCborMap{{QStringLiteral("type"), QStringLiteral("presence")},
+                       {QStringLiteral("nickname"), nickname},
+                       {QStringLiteral("joined"), joined}});
+}
+
+void ClusterBus::sendSnapshot(const QString &node, const QStringList &nicknames)
+{
+    QCborArray list;
+    for (const QString &nickname : nicknames)
+        list.append(nickname);
+    sendToNode(node, QCborMap{{QStringLiteral("type"), QStringLiteral("snapshot")},
+                              {QStringLiteral("users"), list}});
+}
+
+void ClusterBus::forwardChat(const QString &sender, const QString &message, const QString &room)
+{
+    broadcast(QCborMap{{QStringLiteral("type"), QStringLiteral("chat")},
+                       {QStringLiteral("sender"), sender},
+                       {QStringLiteral("message"), message},
+                       {QStringLiteral("room"), room}});
+}
+
+void ClusterBus::forwardPrivate(const QString &node, const QString &recipient, const QCborMap &message)
+{
+    sendToNode(node, QCborMap{{QStringLiteral("type"), QStringLiteral("private")},
+                              {QStringLiteral("to"), recipient},
+                              {QStringLiteral("message"), message}});
+}
+
+// HMAC-SHA256(密钥, 用途 | 节点 id | 随机数)：用途区分两个方向，节点 id 防止把别的节点的证明拿来冒用
+QByteArray ClusterBus::proof(const char *purpose, const QString &node, const QByteArray &nonce) const
+{
+    QMessageAuthenticationCode code(QCryptographicHash::Sha256, secret);
+    code.addData(purpose, static_cast<int>(qstrlen(purpose)));
+    code.addData("|", 1);
+    code.addData(node.toUtf8());
+    code.addData("|", 1);
+    code.addData(nonce);
+    return code.result();
+}
+
+// 逐字节比较完，耗时与在哪个字节不同无关
+bool ClusterBus::verify(const QCborMap &message, const char *purpose, const QString &node,
+                        const QByteArray &nonce) const
+{
+    const QByteArray received = message.value(QLatin1String("proof")).toByteArray();
+    const QByteArray expected = proof(purpose, node, nonce);
+    if (nonce.isEmpty() || received.size() != expected.size())
+        return false;
+    char diff = 0;
+    for (int i = 0; i < expected.size(); ++i)
+        diff |= static_cast<char>(received.at(i) ^ expected.at(i));
+    return diff == 0;
+}
+
+// 链路握手完成（拨出方收到 welcome 或无需认证时连上即算）
+void ClusterBus::linkUp(QTcpSocket *socket, const QString &node)
+{
+    nodeLinks.insert(node, socket);
+    log(QString("【集群】已连接节点 %1").arg(node));
+    emit peerUp(node);
+}
+
+// 只由 id 较小的一方主动连接，两个节点之间不会建出两条链路
+void ClusterBus::dialPeers()
+{
+    for (const Peer &peer : qAsConst(peers)) {
+        if (peer.id < self || nodeLinks.contains(peer.id))
+            continue;
+        bool dialing = false;
+        for (auto it = links.cbegin(); it != links.cend(); ++it) {
+            if (it->node == peer.id)
+                dialing = true;
+        }
+        if (dialing)
+            continue;
+
+        QTcpSocket *socket = new QTcpSocket(this);
+        attach(socket);
+        links[socket].node = peer.id;
+        connect(socket, &QTcpSocket::connected, this, [this, socket]() {
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            // 有密钥时等对方的 challenge 再发 hello
+            if (!secret.isEmpty()) {
+                QTimer::singleShot(HandshakeTimeoutMs, socket, [this, socket]() {
+                    if (nodeLinks.value(links.value(socket).node) != socket) {
+                        log(QString("【集群】与节点 %1 的认证握手超时").arg(links.value(socket).node));
+                        socket->abort();
+                    }
+                });
+                return;
+            }
+            send(socket, QCborMap{{QStringLiteral("type"), QStringLiteral("hello")},
+                                  {QStringLiteral("node"), self}});
+            linkUp(socket, links.value(socket).node);
+        });
+        connect(socket, &QTcpSocket::errorOccurred, this, [this, socket](QAbstractSocket::SocketError) {
+            // 拨号失败不会发出 disconnected，在这里丢掉，等下一轮重拨
+            if (nodeLinks.value(links.value(socket).node) == socket)
+                return;
+            links.remove(socket);
+            socket->deleteLater();
+        });
+        socket->connectToHost(peer.host, peer.port);
+    }
+}
+
+void ClusterBus::onIncomingConnection()
+{
+    while (QTcpSocket *socket = listener->nextPendingConnection()) {
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        attach(socket);
+        Link &link = links[socket];
+        QTimer::singleShot(HandshakeTimeoutMs, socket, [this, socket]() {
+            if (links.value(socket).node.isEmpty())
+                socket->abort();
+        });
+        if (!secret.isEmpty()) {
+            link.nonce = makeNonce();
+            send(socket, QCborMap{{QStringLiteral("type"), QStringLiteral("challenge")},
+                                  {QStringLiteral("nonce"), link.nonce}});
+        }
+    }
+}
+
+void ClusterBus::attach(QTcpSocket *socket)
+{
+    connect(socket, &QTcpSocket::readyRead, this, &ClusterBus::onLinkReadyRead);
+    connect(socket, &QTcpSocket::disconnected, this, &ClusterBus::onLinkDisconnected);
+}
+
+void ClusterBus::onLinkReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !links.contains(socket))
+        return;
+
+    QCborMap message;
+    for (;;) {
+        auto it = links.find(socket);
+        if (it == links.end())
+            return;
+        const Wire::Reader::Status status = it->reader.read(socket, &message);
+        if (status == Wire::Reader::NeedMore)
+            return;
+        if (status == Wire::Reader::Fatal) {
+            log(QString("【集群】节点链路协议错误 (%1)，断开").arg(it->reader.errorString()));
+            socket->abort();
+            return;
+        }
+        if (status == Wire::Reader::Malformed)
+            continue;
+        handle(socket, *it, message);
+    }
+}
+
+void ClusterBus::handle(QTcpSocket *socket, Link &link, const QCborMap &message)
+{
+    const QString type = message.value(QLatin1String("type")).toString();
+
+    // 拨出的链路：接受方发来 challenge，用密钥回 hello，并要求对方证明
+    if (type == "challenge") {
+        if (secret.isEmpty() || link.node.isEmpty() || !link.nonce.isEmpty())
+            return;
+        link.nonce = makeNonce();
+        send(socket, QCborMap{{QStringLiteral("type"), QStringLiteral("hello")},
+                              {QStringLiteral("node"), self},
+                              {QStringLiteral("proof"),
+                               proof("hello", self, message.value(QLatin1String("nonce")).toByteArray())},
+                              {QStringLiteral("nonce"), link.nonce}});
+        return;
+    }
+    if (type == "welcome") {
+        if (secret.isEmpty() || link.node.isEmpty() || link.nonce.isEmpty() || nodeLinks.value(link.node) == socket)
+            return;
+        if (!verify(message, "welcome", link.node, link.nonce)) {
+            log(QString("【集群】节点 %1 未通过认证，断开").arg(link.node));
+            socket->abort();
+            return;
+        }
+        linkUp(socket, link.node);
+        return;
+    }
+
+    if (type == "hello") {
+        const QString node = message.value(QLatin1String("node")).toString();
+        if (node.isEmpty() || node == self || !members.contains(node)) {
+            log(QString("【集群】拒绝未配置的节点 '%1'").arg(node));
+            socket->abort();
+            return;
+        }
+        // 只有接受的链路会收到 hello；认证失败的不能顶替已有链路
+        if (!link.node.isEmpty())
+            return;
+        if (!secret.isEmpty()) {
+            if (!verify(message, "hello", node, link.nonce)) {
+                log(QString("【集群】来自 %1 的节点 '%2' 未通过认证，断开")
+                        .arg(socket->peerAddress().toString()).arg(node));
+                socket->abort();
+                return;
+            }
+            const QByteArray peerNonce = message.value(QLatin1String("nonce")).toByteArray();
+            if (peerNonce.size() != NonceSize) {
+                socket->abort();
+                return;
+            }
+            send(socket, QCborMap{{QStringLiteral("type"), QStringLiteral("welcome")},
+                                  {QStringLiteral("proof"), proof("welcome", self, peerNonce)}});
+        }
+        // 对端重启后重新连入，旧链路作废；先换上新链路，旧链路的断开就不会当作节点离开
+        QTcpSocket *old = nodeLinks.value(node);
+        link.node = node;
+        nodeLinks.insert(node, socket);
+        log(QString("【集群】节点 %1 已连入").arg(node));
+        if (old)
+            old->abort();
+        emit peerUp(node);
+        return;
+    }
+    if (link.node.isEmpty() || nodeLinks.value(link.node) != socket)
+        return;     // 未握手的链路只接受 hello
+
+    const QString node = link.node;
+    if (type == "reserve") {
+        const QString nickname = message.value(QLatin1String("nickname")).toString();
+        const bool granted = !nickname.isEmpty() && homeOf(nickname) == self && grant(nickname, node);
+        send(socket, QCborMap{{QStringLiteral("type"), QStringLiteral("reserved")},
+                              {QStringLiteral("request"), message.value(QLatin1String("request"))},
+                              {QStringLiteral("granted"), granted}});
+    } else if (type == "reserved") {
+        const quint64 request = static_cast<quint64>(message.value(QLatin1String("request")).toInteger());
+        pendingNodes.remove(request);
+        const std::function<void(bool)> done = pendingReservations.take(request);
+        if (done)
+            done(message.value(QLatin1String("granted")).toBool());
+    } else if (type == "release") {
+        const QString nickname = message.value(QLatin1String("nickname")).toString();
+        if (reservations.value(nickname) == node)
+            reservations.remove(nickname);
+    } else if (type == "presence") {
+        emit remotePresence(node, message.value(QLatin1String("nickname")).toString(),
+                            message.value(QLatin1String("joined")).toBool());
+    } else if (type == "snapshot") {
+        for (const QCborValue &value : message.value(QLatin1String("users")).toArray())
+            emit remotePresence(node, value.toString(), true);
+    } else if (type == "chat") {
+        emit remoteChat(message.value(QLatin1String("sender")).toString(),
+                        message.value(QLatin1String("message")).toString(),
+                        message.value(QLatin1String("room")).toString());
+    } else if (type == "private") {
+        emit remotePrivate(node, message.value(QLatin1String("to")).toString(),
+                           message.value(QLatin1String("message")).toMap());
+    }
+}
+
+void ClusterBus::onLinkDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+    const Link link = links.take(socket);
+    socket->deleteLater();
+    if (link.node.isEmpty() || nodeLinks.value(link.node) != socket)
+        return;
+
+    const QString node = link.node;
+    nodeLinks.remove(node);
+    log(QString("【集群】与节点 %1 的链路断开").arg(node));
+
+    // 该节点持有的预留全部作废，发往它的预留请求按失败处理
+    for (auto it = reservations.begin(); it != reservations.end();) {
+        if (it.value() == node)
+            it = reservations.erase(it);
+        else
+            ++it;
+    }
+    for (auto it = pendingNodes.begin(); it != pendingNodes.end();) {
+        if (it.value() != node) {
+            ++it;
+            continue;
+        }
+        const std::function<void(bool)> done = pendingReservations.take(it.key());
+        it = pendingNodes.erase(it);
+        if (done)
+            done(false);
+    }
+    emit peerDown(node);
+}
+
+void ClusterBus::send(QTcpSocket *socket, const QCborMap &message)
+{
+    write(socket, Wire::encode(message, Wire::Cbor));
+}
+
+void ClusterBus::write(QTcpSocket *socket, const QByteArray &bytes)
+{
+    auto it = links.find(socket);
+    if (it == links.end() || it->dropping)
+        return;
+    if (socket->bytesToWrite() + bytes.size() > MaxLinkQueuedBytes) {
+        it->dropping = true;
+        log(QString("【警告】到节点 %1 的链路出站积压超过 %2 字节，断开链路")
+                .arg(it->node.isEmpty() ? QStringLiteral("（未认证）") : it->node)
+                .arg(MaxLinkQueuedBytes));
+        // 推迟到下一轮事件循环再断开，避免在遍历 nodeLinks 或处理该链路的消息时触发 disconnected
+        QPointer<QTcpSocket> guard(socket);
+        QMetaObject::invokeMethod(this, [guard]() {
+            if (guard)
+                guard->abort();
+        }, Qt::QueuedConnection);
+        return;
+    }
+    socket->write(bytes);
+}
+
+void ClusterBus::sendToNode(const QString &node, const QCborMap &message)
+{
+    if (QTcpSocket *socket = nodeLinks.value(node))
+        send(socket, message);
+}
+
+// 编码一次，每个对端节点一份
+void ClusterBus::broadcast(const QCborMap &message)
+{
+    if (nodeLinks.isEmpty())
+        return;
+    const QByteArray bytes = Wire::encode(message, Wire::Cbor);
+    for (QTcpSocket *socket : qAsConst(nodeLinks))
+        write(socket, bytes);
+}
+
+void ClusterBus::log(const QString &message)
+{
+    sink->append(message);
+}
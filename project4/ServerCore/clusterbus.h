@@ -0,0 +1,123 @@
+#ifndef CLUSTERBUS_H
+#define CLUSTERBUS_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QCborMap>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <functional>
+#include "wireformat.h"
+
+QT_BEGIN_NAMESPACE
+class QHostAddress;
+class QTcpServer;
+class QTcpSocket;
+class QTimer;
+QT_END_NAMESPACE
+
+class LogSink;
+
+// 集群模式下节点之间的中继总线：每对节点之间一条 TCP 连接，线路上是带长度前缀的 CBOR 帧
+// 聊天消息每个对端节点只发一份，由对端节点在本地扇出给自己的客户端
+//
+// 昵称的集群唯一性靠归属节点上的预留表保证：每个昵称按稳定散列固定归一个节点管，
+// 任何节点上的登录都要先向归属节点预留，归属节点不可达时拒绝登录
+//
+// 设置了共享密钥时链路要先互相认证：接受方发 challenge 随机数，拨号方在 hello 中回 HMAC 并附上自己的随机数，
+// 接受方验证后回 welcome 证明自己也持有密钥；未通过认证的链路收不到也发不出任何其他消息。
+// 没有密钥时任何能连上集群端口的人都能冒充节点，只能在可信网络中使用
+//
+// 只在所属线程（ChatServer 所在线程）使用
+class ClusterBus : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Peer
+    {
+        QString id;
+        QString host;
+        quint16 port = 0;
+    };
+
+    ClusterBus(const QString &nodeId, LogSink *sink, QObject *parent = nullptr);
+    ~ClusterBus();
+
+    // 解析 id@host:port
+    static bool parsePeer(const QString &text, Peer *peer);
+
+    // 成员固定：所有节点须配置相同的一组节点 id
+    void addPeer(const Peer &peer);
+    // 须在 listen() 之前设置，所有节点须相同；为空表示不认证
+    void setSecret(const QByteArray &secret);
+    bool listen(const QHostAddress &address, quint16 port, QString *errorMessage);
+    QString nodeId() const;
+    // 热重启交接时调用：立即让出集群端口、断开全部链路，等待中的预留按失败回调；
+    // 之后的调用都不再收发；分片线程可能仍有排队中的调用，对象由 ChatServer 在线程全部停止后删除
+    void shutdown();
+
+    // 向昵称的归属节点预留，结果经 done 回调（可能在本函数返回前就回调）
+    void reserve(const QString &nickname, const std::function<void(bool granted)> &done);
+    void release(const QString &nickname);
+    // 本节点的上下线告诉所有对端节点
+    void announce(const QString &nickname, bool joined);
+    // 新连上的对端节点需要本节点当前的全部在线昵称
+    void sendSnapshot(const QString &node, const QStringList &nicknames);
+    void forwardChat(const QString &sender, const QString &message, const QString &room);
+    // 私聊等点对点帧：只发给收件人所在的节点；私聊的回执也经它发回发件人所在的节点
+    void forwardPrivate(const QString &node, const QString &recipient, const QCborMap &message);
+
+signals:
+    void peerUp(const QString &node);
+    void peerDown(const QString &node);
+    void remotePresence(const QString &node, const QString &nickname, bool joined);
+    void remoteChat(const QString &sender, const QString &message, const QString &room);
+    void remotePrivate(const QString &node, const QString &recipient, const QCborMap &message);
+
+private slots:
+    void onIncomingConnection();
+    void onLinkReadyRead();
+    void onLinkDisconnected();
+    void dialPeers();
+
+private:
+    struct Link
+    {
+        QString node;       // 接受的链路收到 hello 之前为空；拨出的链路为对端 id
+        QByteArray nonce;   // 本端发给对方、等对方用密钥证明的随机数
+        Wire::Reader reader{Wire::Cbor};
+        bool dropping = false;  // 出站积压超限，已安排断开
+    };
+
+    QString self;
+    QByteArray secret;
+    LogSink *sink;
+    QList<Peer> peers;
+    QStringList members;    // 全部节点 id（含本节点），排序后用于计算归属节点
+    QTcpServer *listener;
+    QTimer *dialTimer;
+    QHash<QTcpSocket*, Link> links;
+    QHash<QString, QTcpSocket*> nodeLinks;          // 已握手的链路
+    QHash<QString, QString> reservations;            // 本节点作为归属节点时：昵称 → 持有的节点
+    QHash<quint64, std::function<void(bool)>> pendingReservations;
+    QHash<quint64, QString> pendingNodes;            // 预留请求发往的节点，链路断开时据此判失败
+    quint64 nextRequest;
+
+    QString homeOf(const QString &nickname) const;
+    QByteArray proof(const char *purpose, const QString &node, const QByteArray &nonce) const;
+    bool verify(const QCborMap &message, const char *purpose, const QString &node, const QByteArray &nonce) const;
+    void linkUp(QTcpSocket *socket, const QString &node);
+    bool grant(const QString &nickname, const QString &node);
+    void send(QTcpSocket *socket, const QCborMap &message);
+    void sendToNode(const QString &node, const QCborMap &message);
+    // 所有出站字节都经这里，积压超过上限的链路不再写入并断开
+    void write(QTcpSocket *socket, const QByteArray &bytes);
+    void broadcast(const QCborMap &message);
+    void handle(QTcpSocket *socket, Link &link, const QCborMap &message);
+    void attach(QTcpSocket *socket);
+    void log(const QString &message);
+};
+
+#endif // CLUSTERBUS_H
@@ -0,0 +1,721 @@
+#include "epollserver.h"
+#include "alloccounter.h"
+#include "chatserver.h"
+#include "historystore.h"
+#include "metricsendpoint.h"
+#include <QDateTime>
+#include <QHostAddress>
+#include <QRandomGenerator>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// 每次 epoll_wait 最多取回的事件数
+static const int MaxEvents = 256;
+// 一次 sendmsg 最多带的帧数
+static const int MaxIovecs = 64;
+// 每个 slab 切出的块数：读缓冲 64 × 4 KB = 256 KB，连接状态按同样块数申请
+static const int BlocksPerSlab = 64;
+static const int StatsIntervalMs = 10000;
+
+// 监听套接字与唤醒用的 eventfd 在 epoll_event.data.ptr 中用这两个地址标识，其余都是 Connection*
+static char listenTag;
+static char wakeTag;
+
+EpollServer::EpollServer(QObject *parent)
+    : QThread(parent)
+    , listenFd(-1)
+    , epollFd(-1)
+    , wakeFd(-1)
+    , stopping(0)
+    , maxQueuedBytes(1024 * 1024)
+    , messageRate(0)
+    , messageBurst(1)
+    , logChat(true)
+    , historyStore(nullptr)
+    , metricsEndpoint(nullptr)
+    , connectionPool(BlocksPerSlab)
+    , chunkPool(ReadChunkSize, BlocksPerSlab)
+    , connections(nullptr)
+    , userListDirty(true)
+    , presenceEpoch(QRandomGenerator::global()->generate() | 1u)
+    , presenceVersion(0)
+    , queuedBytes(0)
+    , congestedConnections(0)
+    , evictedConnections(0)
+{
+    setObjectName("EpollServer");
+}
+
+EpollServer::~EpollServer()
+{
+    stop();
+    wait();
+    if (listenFd >= 0)
+        ::close(listenFd);
+    if (wakeFd >= 0)
+        ::close(wakeFd);
+    if (epollFd >= 0)
+        ::close(epollFd);
+    delete historyStore;
+}
+
+void EpollServer::setOutboundLimit(qint64 maxQueuedBytes)
+{
+    this->maxQueuedBytes = maxQueuedBytes;
+}
+
+void EpollServer::setRateLimit(double messageRate, double messageBurst)
+{
+    this->messageRate = messageRate;
+    this->messageBurst = messageBurst;
+}
+
+void EpollServer::setChatLogging(bool enabled)
+{
+    logChat = enabled;
+}
+
+bool EpollServer::enableHistory(const QString &directory, int replayCount, QString *errorMessage)
+{
+    HistoryStore *store = new HistoryStore;
+    if (!store->open(directory, replayCount, errorMessage)) {
+        delete store;
+        return false;
+    }
+    store->start();
+    historyStore = store;
+    return true;
+}
+
+bool EpollServer::enableMetrics(quint16 port, QString *errorMessage)
+{
+    MetricsEndpoint *endpoint = new MetricsEndpoint([this]() { return metricsText(); }, this);
+    if (!endpoint->listen(QHostAddress::LocalHost, port)) {
+        *errorMessage = QString("指标端口 %1 监听失败：%2").arg(port).arg(endpoint->errorString());
+        delete endpoint;
+        return false;
+    }
+    metricsEndpoint = endpoint;
+    sink.append(QString("【信息】指标端点 http://127.0.0.1:%1/metrics").arg(endpoint->serverPort()));
+    return true;
+}
+
+// 与 QTcpServer::listen(QHostAddress::Any) 一样优先监听双栈，系统不支持 IPv6 时退回 IPv4
+bool EpollServer::listen(quint16 port, QString *errorMessage)
+{
+    const int on = 1;
+    const int off = 0;
+    listenFd = ::socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd >= 0) {
+        sockaddr_in6 address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        ::setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            ::close(listenFd);
+            listenFd = -1;
+        }
+    }
+    if (listenFd < 0) {
+        listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (listenFd < 0) {
+            *errorMessage = QString("无法创建监听套接字：%1").arg(QString::fromLocal8Bit(std::strerror(errno)));
+            return false;
+        }
+        ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            *errorMessage = QString("端口 %1 绑定失败：%2").arg(port).arg(QString::fromLocal8Bit(std::strerror(errno)));
+            return false;
+        }
+    }
+    if (::listen(listenFd, SOMAXCONN) != 0) {
+        *errorMessage = QString("监听失败：%1").arg(QString::fromLocal8Bit(std::strerror(errno)));
+        return false;
+    }
+
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) {
+        *errorMessage = QString("无法创建 epoll：%1").arg(QString::fromLocal8Bit(std::strerror(errno)));
+        return false;
+    }
+    // 监听套接字用水平触发：文件描述符耗尽时 accept 会提前停下，边沿触发就再也收不到通知了
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &listenTag;
+    ::epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.ptr = &wakeTag;
+    ::epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    start();
+    return true;
+}
+
+quint16 EpollServer::serverPort() const
+{
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (listenFd < 0 || ::getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+        return 0;
+    if (address.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port);
+    return ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+}
+
+void EpollServer::stop()
+{
+    stopping.storeRelease(1);
+    if (wakeFd >= 0) {
+        const quint64 one = 1;
+        (void)!::write(wakeFd, &one, sizeof(one));
+    }
+}
+
+LogSink *EpollServer::logSink()
+{
+    return &sink;
+}
+
+QByteArray EpollServer::metricsText() const
+{
+    MetricsSnapshot snapshot;
+    snapshot.add(metricsShard);
+    QueueStats queue;
+    queue.queuedBytes = queuedBytes.loadRelaxed();
+    queue.congestedConnections = congestedConnections.loadRelaxed();
+    queue.evictedConnections = evictedConnections.loadRelaxed();
+    QByteArray text = snapshot.toPrometheus(queue);
+    text.append("# HELP chat_slab_bytes_in_use Connection state and read buffers handed out by the slab allocators.\n"
+                "# TYPE chat_slab_bytes_in_use gauge\n"
+                "chat_slab_bytes_in_use ");
+    text.append(QByteArray::number(connectionPool.stats().bytesInUse() + chunkPool.bytesInUse())).append('\n');
+    text.append("# HELP chat_slab_bytes_reserved Memory the slab allocators have taken from the system.\n"
+                "# TYPE chat_slab_bytes_reserved gauge\n"
+                "chat_slab_bytes_reserved ");
+    text.append(QByteArray::number(connectionPool.stats().bytesReserved() + chunkPool.bytesReserved()))
+        .append('\n');
+    return text;
+}
+
+void EpollServer::run()
+{
+    epoll_event events[MaxEvents];
+    qint64 lastStatsMs = QDateTime::currentMSecsSinceEpoch();
+    qint64 lastLoggedConnections = -1;
+
+    while (!stopping.loadAcquire()) {
+        const int ready = ::epoll_wait(epollFd, events, MaxEvents, 1000);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            log(QString("【错误】epoll_wait 失败：%1").arg(QString::fromLocal8Bit(std::strerror(errno))));
+            break;
+        }
+        const quint64 allocationsBefore = AllocCounter::threadAllocations();
+
+        for (int i = 0; i < ready; ++i) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listenTag) {
+                acceptAll();
+                continue;
+            }
+            if (tag == &wakeTag) {
+                quint64 value;
+                (void)!::read(wakeFd, &value, sizeof(value));
+                continue;
+            }
+            // 本轮中已关闭的连接要到 releaseClosed 才释放，这里的指针仍然有效
+            Connection *connection = static_cast<Connection*>(tag);
+            if (connection->closing)
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                readAll(connection);
+            if ((events[i].events & EPOLLOUT) && !connection->closing)
+                writeOut(connection);
+        }
+
+        // 本轮产生的帧统一写出；断开连接广播的 user_left 又会产生新的帧，直到没有连接待释放
+        for (;;) {
+            dirtyRound.swap(dirtyConnections);
+            for (Connection *connection : qAsConst(dirtyRound)) {
+                connection->dirty = false;
+                if (!connection->closing)
+                    writeOut(connection);
+            }
+            dirtyRound.clear();
+            if (closingConnections.isEmpty())
+                break;
+            releaseClosed();
+        }
+        arena.reset();
+        Metrics::bump<quint64>(metricsShard.handlerAllocations,
+                               AllocCounter::threadAllocations() - allocationsBefore);
+
+        const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+        const qint64 openConnections = metricsShard.connections.loadRelaxed();
+        if (nowMs - lastStatsMs >= StatsIntervalMs && openConnections != lastLoggedConnections) {
+            lastStatsMs = nowMs;
+            lastLoggedConnections = openConnections;
+            const qint64 slabBytes = connectionPool.stats().bytesInUse() + chunkPool.bytesInUse();
+            log(QString("【epoll】连接 %1 个，slab 已分出 %2 KB（每连接 %3 字节），向系统申请 %4 KB")
+                    .arg(openConnections)
+                    .arg(slabBytes / 1024)
+                    .arg(openConnections > 0 ? slabBytes / openConnections : 0)
+                    .arg((connectionPool.stats().bytesReserved() + chunkPool.bytesReserved()) / 1024));
+        }
+    }
+
+    // 停止：积压尽量写出后关闭全部连接
+    for (Connection *connection = connections; connection; connection = connection->next) {
+        if (!connection->closing) {
+            writeOut(connection);
+            closeConnection(connection);
+        }
+    }
+    while (!closingConnections.isEmpty())
+        releaseClosed();
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        listenFd = -1;
+    }
+}
+
+void EpollServer::acceptAll()
+{
+    for (;;) {
+        sockaddr_storage address;
+        socklen_t length = sizeof(address);
+        const int fd = ::accept4(listenFd, reinterpret_cast<sockaddr*>(&address), &length,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log(QString("【错误】接受连接失败：%1").arg(QString::fromLocal8Bit(std::strerror(errno))));
+            return;
+        }
+
+        Connection *connection = connectionPool.create();
+        char *input = connection ? static_cast<char*>(chunkPool.allocate()) : nullptr;
+        if (!input) {
+            log("【错误】内存不足，拒绝新连接");
+            connectionPool.destroy(connection);
+            ::close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->input = input;
+        connection->chatBucket.configure(messageRate, messageBurst);
+
+        const int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = connection;
+        if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            log(QString("【错误】无法接管客户端连接：%1").arg(QString::fromLocal8Bit(std::strerror(errno))));
+            chunkPool.release(input);
+            connectionPool.destroy(connection);
+            ::close(fd);
+            continue;
+        }
+
+        connection->next = connections;
+        if (connections)
+            connections->previous = connection;
+        connections = connection;
+        Metrics::bump<qint64>(metricsShard.connections);
+        Metrics::bump<quint64>(metricsShard.connectionsTotal);
+
+        const QHostAddress peer(reinterpret_cast<sockaddr*>(&address));
+        const quint16 peerPort = address.ss_family == AF_INET6
+                                     ? ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port)
+                                     : ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+        log(QString("【连接】新客户端连接来自 %1:%2").arg(peer.toString()).arg(peerPort));
+    }
+}
+
+// 边沿触发：一直读到 EAGAIN，否则剩下的数据不会再有通知
+void EpollServer::readAll(Connection *connection)
+{
+    qint64 received = 0;
+    for (;;) {
+        const ssize_t n = ::read(connection->fd, connection->input + connection->inputLength,
+                                 ReadChunkSize - connection->inputLength);
+        if (n > 0) {
+            received += n;
+            connection->inputLength += static_cast<int>(n);
+            if (!splitLines(connection)) {
+                Metrics::bump<quint64>(metricsShard.parseFailures);
+                log(QString("【错误】协议错误 (一行超过 %1 字节)，断开连接").arg(Wire::MaxFrameSize));
+                closeConnection(connection);
+                break;
+            }
+            if (connection->closing)
+                break;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        closeConnection(connection);    // 对方关闭或出错
+        break;
+    }
+    Metrics::bump<quint64>(metricsShard.bytesIn, static_cast<quint64>(received));
+}
+
+// 读缓冲中的完整行逐条处理，半行移到缓冲区开头；整块都没有换行时挪到堆上继续拼
+bool EpollServer::splitLines(Connection *connection)
+{
+    char *input = connection->input;
+    int start = 0;
+    while (!connection->closing) {
+        const char *newline = static_cast<const char*>(
+            std::memchr(input + start, '\n', static_cast<size_t>(connection->inputLength - start)));
+        if (!newline)
+            break;
+        const int end = static_cast<int>(newline - input);
+        if (connection->longLine.isEmpty()) {
+            // 不拷贝，直接在读缓冲上解析
+            handleLine(connection, QByteArray::fromRawData(input + start, end - start));
+        } else {
+            connection->longLine.append(input + start, end - start);
+            const QByteArray line = connection->longLine;
+            connection->longLine.clear();
+            handleLine(connection, line);
+        }
+        start = end + 1;
+    }
+
+    const int remaining = connection->inputLength - start;
+    if (remaining == ReadChunkSize) {
+        connection->longLine.append(input, remaining);
+        connection->inputLength = 0;
+        return connection->longLine.size() <= Wire::MaxFrameSize;
+    }
+    if (start > 0 && remaining > 0)
+        std::memmove(input, input + start, static_cast<size_t>(remaining));
+    connection->inputLength = remaining;
+    return true;
+}
+
+void EpollServer::handleLine(Connection *connection, const QByteArray &line)
+{
+    if (line.trimmed().isEmpty())
+        return;
+    Metrics::bump<quint64>(metricsShard.messagesIn);
+    // 在读缓冲上就地索引字段，不建 QJsonDocument
+    Wire::JsonView view;
+    if (!view.parse(line.constData(), line.size())) {
+        Metrics::bump<quint64>(metricsShard.parseFailures);
+        log(QString("【错误】消息解析失败 (%1): %2")
+                .arg(view.errorString())
+                .arg(QString::fromUtf8(line)));
+        return;
+    }
+    handleMessage(connection, view);
+}
+
+void EpollServer::handleMessage(Connection *connection, const Wire::JsonView &obj)
+{
+    const QLatin1String type = obj.latin1(QLatin1String("type"));
+
+    if (type == "login") {
+        const QString nickname = obj.string(QLatin1String("nickname"));
+        if (!nickname.isEmpty())
+            login(connection, nickname);
+    } else if (type == "chat_message") {
+        // 每条聊天都走这里：字段解码进本轮复用的字符串
+        QString &message = arena.string();
+        obj.readString(QLatin1String("message"), &message);
+        QString &room = arena.string();
+        if (!obj.readString(QLatin1String("room"), &room))
+            room = QLatin1String(Wire::DefaultRoom);
+        const QString sender = connection->nickname.isEmpty() ? QStringLiteral("未知用户") : connection->nickname;
+        if (room != QLatin1String(Wire::DefaultRoom)) {
+            log(QString("【警告】%1 不在房间 '%2' 中，消息被丢弃").arg(sender).arg(room));
+            return;
+        }
+        if (message.size() > Wire::MaxMessageLength) {
+            log(QString("【警告】%1 的消息长 %2 字符，超过上限，已丢弃").arg(sender).arg(message.size()));
+            return;
+        }
+        if (message.isEmpty())
+            return;
+        if (!connection->chatBucket.tryTake(Metrics::nowNs())) {
+            Metrics::bump<quint64>(metricsShard.rateLimited);
+            return;
+        }
+        if (logChat)
+            log(QString("[%1][%2]: %3").arg(room).arg(sender).arg(message));
+        qint64 id = 0;
+        if (historyStore)
+            id = historyStore->append(sender, message, QDateTime::currentMSecsSinceEpoch());
+        broadcast(chatLog.append(room, sender, message, id));
+    } else if (type == "private_message") {
+        sendPrivate(connection, obj);
+    } else if (type == "ping") {
+        sendTo(connection, Frames::pong());
+    } else if (type == "pong") {
+        // 本后端不做空闲回收
+    } else if (type == "chat_sync") {
+        // 只有大厅，其他房间名一律回空段
+        if (!connection->nickname.isEmpty()) {
+            sendTo(connection, chatLog.range(obj.string(QLatin1String("room"), QLatin1String(Wire::DefaultRoom)),
+                                             static_cast<quint64>(obj.integer(QLatin1String("after"))),
+                                             static_cast<quint64>(obj.integer(QLatin1String("until")))));
+        }
+    } else if (type == "user_list_sync") {
+        // 不保留变化日志，客户端发现缺口时一律给完整快照
+        if (!connection->nickname.isEmpty())
+            sendTo(connection, userListFrame());
+    } else {
+        log(QString("【警告】收到未知类型消息: %1").arg(type));
+    }
+}
+
+void EpollServer::login(Connection *connection, const QString &nickname)
+{
+    if (nicknameIndex.contains(nickname)) {
+        log(QString("【警告】昵称 '%1' 已存在，拒绝登录").arg(nickname));
+        Metrics::bump<quint64>(metricsShard.loginFailures);
+        sendTo(connection, Frames::loginFailed("昵称已存在"));
+        return;
+    }
+
+    log(QString("【登录】用户 '%1' 登录成功").arg(nickname));
+    Metrics::bump<quint64>(metricsShard.logins);
+    sendTo(connection, Frames::loginSuccess(Wire::Json, false, QByteArray(), false, chatLog.epoch(),
+                                             chatLog.lastSeq(QLatin1String(Wire::DefaultRoom))));
+
+    // 同一连接换昵称：先补发旧昵称的下线
+    const QString previous = connection->nickname;
+    if (!previous.isEmpty()) {
+        nicknameIndex.remove(previous);
+        broadcast(Frames::userLeft(previous, ++presenceVersion));
+    }
+    connection->nickname = nickname;
+    Entry entry;
+    entry.connection = connection;
+    entry.json = Frames::jsonString(nickname);
+    entry.cbor = Frames::cborString(nickname);
+    nicknameIndex.insert(nickname, entry);
+    userListDirty = true;
+    broadcast(Frames::userJoined(nickname, ++presenceVersion));
+
+    sendTo(connection, userListFrame());
+    if (historyStore) {
+        const Frame replay = historyStore->replayFrame();
+        if (!replay.json.isEmpty())
+            sendTo(connection, replay);
+    }
+}
+
+// 没有离线暂存：收件人不在线时直接拒绝
+void EpollServer::sendPrivate(Connection *connection, const Wire::JsonView &obj)
+{
+    const QString sender = connection->nickname;
+    const QString recipient = obj.string(QLatin1String("to"));
+    const QString message = obj.string(QLatin1String("message"));
+    const qint64 id = obj.integer(QLatin1String("id"));
+    if (sender.isEmpty() || message.isEmpty())
+        return;
+    if (recipient.isEmpty() || recipient == sender) {
+        sendTo(connection, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "无效的收件人"));
+        return;
+    }
+    if (message.size() > Wire::MaxMessageLength) {
+        sendTo(connection, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "消息过长"));
+        return;
+    }
+    if (!connection->chatBucket.tryTake(Metrics::nowNs())) {
+        Metrics::bump<quint64>(metricsShard.rateLimited);
+        sendTo(connection, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "发言过于频繁"));
+        return;
+    }
+    Connection *target = nicknameIndex.value(recipient).connection;
+    if (!target || target->closing) {
+        sendTo(connection, Frames::privateAck(id, recipient, QStringLiteral("rejected"), "对方不在线"));
+        return;
+    }
+    sendTo(target, Frames::privateMessage(sender, message, id, QDateTime::currentMSecsSinceEpoch()));
+    sendTo(connection, Frames::privateAck(id, recipient, QStringLiteral("delivered")));
+}
+
+// 入队即可，本轮结束时统一写出；积压超过上限的连接直接断开
+void EpollServer::sendTo(Connection *connection, const Frame &frame)
+{
+    if (connection->closing)
+        return;
+    const QByteArray &bytes = frame.json;
+    if (connection->outboxBytes + bytes.size() > maxQueuedBytes) {
+        log(QString("【警告】%1 出站积压超过 %2 字节，断开慢连接")
+                .arg(connection->nickname.isEmpty() ? QString("未登录客户端") : connection->nickname)
+                .arg(maxQueuedBytes));
+        Metrics::bump<quint64>(evictedConnections);
+        closeConnection(connection);
+        return;
+    }
+    connection->outbox.append(Outgoing{bytes, frame.createdNs});
+    connection->outboxBytes += bytes.size();
+    queuedBytes.fetchAndAddRelaxed(bytes.size());
+    if (!connection->dirty) {
+        connection->dirty = true;
+        dirtyConnections.append(connection);
+    }
+}
+
+void EpollServer::broadcast(const Frame &frame)
+{
+    Frame stamped = frame;
+    stamped.createdNs = Metrics::nowNs();
+    for (Connection *connection = connections; connection; connection = connection->next)
+        sendTo(connection, stamped);
+}
+
+// 积压的帧用一次 sendmsg 聚集写出（MSG_NOSIGNAL：对方已关闭时不触发 SIGPIPE），写不完的等 EPOLLOUT
+void EpollServer::writeOut(Connection *connection)
+{
+    qint64 written = 0;
+    quint64 frames = 0;
+    // 已完整写出的帧数；循环结束后一次从队首移走
+    int sent = 0;
+    const qint64 now = Metrics::nowNs();
+    const int queued = connection->outbox.size();
+    while (sent < queued) {
+        iovec vectors[MaxIovecs];
+        int count = 0;
+        for (int i = sent; i < queued && count < MaxIovecs; ++i, ++count) {
+            const QByteArray &bytes = connection->outbox.at(i).bytes;
+            const int skip = count == 0 ? connection->outboxOffset : 0;
+            vectors[count].iov_base = const_cast<char*>(bytes.constData()) + skip;
+            vectors[count].iov_len = static_cast<size_t>(bytes.size() - skip);
+        }
+        msghdr header;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_iov = vectors;
+        header.msg_iovlen = static_cast<size_t>(count);
+        const ssize_t n = ::sendmsg(connection->fd, &header, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                closeConnection(connection);
+            break;
+        }
+
+        written += n;
+        qint64 remaining = n;
+        while (remaining > 0) {
+            const Outgoing &front = connection->outbox.at(sent);
+            const qint64 left = front.bytes.size() - connection->outboxOffset;
+            if (remaining < left) {
+                connection->outboxOffset += static_cast<int>(remaining);
+                break;
+            }
+            remaining -= left;
+            if (front.createdNs != 0)
+                metricsShard.observeBroadcastLatency(now - front.createdNs);
+            ++sent;
+            connection->outboxOffset = 0;
+            ++frames;
+        }
+    }
+    connection->outbox.remove(0, sent);
+    Metrics::bump<quint64>(metricsShard.messagesOut, frames);
+    Metrics::bump<quint64>(metricsShard.bytesOut, static_cast<quint64>(written));
+    connection->outboxBytes -= written;
+    queuedBytes.fetchAndAddRelaxed(-written);
+
+    // 写到一半停下的连接算作拥塞
+    const bool congested = !connection->outbox.isEmpty();
+    if (congested != connection->congested) {
+        connection->congested = congested;
+        congestedConnections.fetchAndAddRelaxed(congested ? 1 : -1);
+    }
+}
+
+// 推迟到本轮结束再释放：事件数组与广播遍历中可能还引用着它
+void EpollServer::closeConnection(Connection *connection)
+{
+    if (connection->closing)
+        return;
+    connection->closing = true;
+    closingConnections.append(connection);
+}
+
+void EpollServer::releaseClosed()
+{
+    closingRound.swap(closingConnections);
+    for (Connection *connection : qAsConst(closingRound)) {
+        ::epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+        ::close(connection->fd);
+
+        if (connection->previous)
+            connection->previous->next = connection->next;
+        else
+            connections = connection->next;
+        if (connection->next)
+            connection->next->previous = connection->previous;
+
+        Metrics::bump<qint64>(metricsShard.connections, -1);
+        queuedBytes.fetchAndAddRelaxed(-connection->outboxBytes);
+        if (connection->congested)
+            congestedConnections.fetchAndAddRelaxed(-1);
+        if (connection->dirty)
+            dirtyConnections.removeOne(connection);
+
+        const QString nickname = connection->nickname;
+        log(QString("【断开】%1 断开连接").arg(nickname.isEmpty() ? QString("未登录客户端") : nickname));
+        chunkPool.release(connection->input);
+        connectionPool.destroy(connection);
+
+        if (!nickname.isEmpty() && nicknameIndex.value(nickname).connection == connection) {
+            nicknameIndex.remove(nickname);
+            userListDirty = true;
+            broadcast(Frames::userLeft(nickname, ++presenceVersion));
+        }
+    }
+    closingRound.clear();
+}
+
+Frame EpollServer::userListFrame()
+{
+    if (userListDirty) {
+        QByteArrayList jsonItems;
+        QByteArrayList cborItems;
+        jsonItems.reserve(nicknameIndex.size());
+        cborItems.reserve(nicknameIndex.size());
+        for (const Entry &entry : qAsConst(nicknameIndex)) {
+            jsonItems.append(entry.json);
+            cborItems.append(entry.cbor);
+        }
+        userListCache = Frames::userList(jsonItems, cborItems, presenceVersion, presenceEpoch);
+        userListDirty = false;
+    }
+    return userListCache;
+}
+
+void EpollServer::log(const QString &message)
+{
+    sink.append(message);
+}
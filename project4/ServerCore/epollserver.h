@@ -0,0 +1,153 @@
+#ifndef EPOLLSERVER_H
+#define EPOLLSERVER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QByteArrayList>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include "frames.h"
+#include "jsonview.h"
+#include "logsink.h"
+#include "messagearena.h"
+#include "metrics.h"
+#include "roomlog.h"
+#include "slaballocator.h"
+#include "tokenbucket.h"
+
+class HistoryStore;
+class MetricsEndpoint;
+
+// 无界面服务器的另一种后端（仅 Linux）：不用 QTcpSocket，直接在原始套接字上跑边沿触发的 epoll 循环
+// 每个连接只是一个从 slab 中分出的 Connection 加一块定长读缓冲区，没有 QObject、信号槽与 QIODevice 缓冲，
+// 用来与 Qt 后端对比每连接内存与消息吞吐
+//
+// 线路上只有 JSON 行协议，与 ClientApp 的 onReadyRead 收发的完全相同：
+// login / chat_message / private_message / ping / pong / user_list_sync；
+// 登录应答不带 wire 字段，协商 CBOR 的客户端会留在 JSON。
+// 房间、续连、离线私聊、合批与压缩只在 Qt 后端提供
+//
+// 所有连接都在本线程处理，每轮 epoll_wait 产生的帧在本轮结束时按连接聚集写出
+class EpollServer : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit EpollServer(QObject *parent = nullptr);
+    ~EpollServer();
+
+    // 以下须在 listen() 之前调用
+    void setOutboundLimit(qint64 maxQueuedBytes);
+    void setRateLimit(double messageRate, double messageBurst);
+    void setChatLogging(bool enabled);
+    bool enableHistory(const QString &directory, int replayCount, QString *errorMessage);
+    bool enableMetrics(quint16 port, QString *errorMessage);
+
+    // 监听并启动事件循环线程
+    bool listen(quint16 port, QString *errorMessage);
+    quint16 serverPort() const;
+    // 可在任意线程或信号处理函数里调用（只有原子写与 write(2)）：唤醒事件循环，关闭全部连接后线程结束
+    void stop();
+
+    LogSink *logSink();
+    // 可在任意线程调用
+    QByteArray metricsText() const;
+
+    // 每个连接的读缓冲区大小；一行超过它时才另外在堆上拼接
+    static const int ReadChunkSize = 4096;
+
+protected:
+    void run() override;
+
+private:
+    struct Outgoing
+    {
+        QByteArray bytes;       // 与所有接收者共享同一块缓冲
+        qint64 createdNs;
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        char *input = nullptr;          // ReadChunkSize 字节，来自 chunkPool
+        int inputLength = 0;
+        QByteArray longLine;            // 超过一块的半行
+        QVector<Outgoing> outbox;       // 写出的帧成批从头部移除，容量留着复用
+        int outboxOffset = 0;           // 第一帧已写出的字节数
+        qint64 outboxBytes = 0;
+        bool dirty = false;             // 本轮有新帧入队，已在 dirtyConnections 中
+        bool closing = false;           // 已在 closingConnections 中，本轮结束时释放
+        bool congested = false;         // 上次写到一半停下，等 EPOLLOUT
+        QString nickname;
+        TokenBucket chatBucket;
+        Connection *previous = nullptr; // 全部连接串成的双向链表，广播时遍历
+        Connection *next = nullptr;
+    };
+
+    LogSink sink;
+    int listenFd;
+    int epollFd;
+    int wakeFd;
+    QAtomicInt stopping;
+
+    qint64 maxQueuedBytes;
+    double messageRate;
+    double messageBurst;
+    bool logChat;
+    HistoryStore *historyStore;
+    MetricsEndpoint *metricsEndpoint;
+
+    // 以下只在事件循环线程中使用
+    SlabPool<Connection> connectionPool;
+    SlabAllocator chunkPool;
+    Connection *connections;
+    // 与 ClientRegistry 相同，昵称预先编码好，user_list 快照按版本缓存
+    struct Entry
+    {
+        Connection *connection = nullptr;
+        QByteArray json;
+        QByteArray cbor;
+    };
+    QHash<QString, Entry> nicknameIndex;
+    // 以下几个数组每轮清空后容量保留，与对应的 *Round 轮换使用
+    QVector<Connection*> dirtyConnections;
+    QVector<Connection*> dirtyRound;
+    QVector<Connection*> closingConnections;
+    QVector<Connection*> closingRound;
+    // 本轮处理消息时解码出的字段，每轮 epoll_wait 处理完收回
+    MessageArena arena;
+
+    // 只有大厅一个房间；序号与缓冲同 Qt 后端，chat_sync 按序号补缺口
+    RoomLog chatLog;
+
+    Frame userListCache;
+    bool userListDirty;
+    quint32 presenceEpoch;
+    quint64 presenceVersion;
+
+    // 供其他线程读取的计数
+    MetricsShard metricsShard;
+    QAtomicInteger<qint64> queuedBytes;
+    QAtomicInt congestedConnections;
+    QAtomicInteger<quint64> evictedConnections;
+
+    void acceptAll();
+    void readAll(Connection *connection);
+    bool splitLines(Connection *connection);
+    void handleLine(Connection *connection, const QByteArray &line);
+    void handleMessage(Connection *connection, const Wire::JsonView &obj);
+    void login(Connection *connection, const QString &nickname);
+    void sendPrivate(Connection *connection, const Wire::JsonView &obj);
+    void sendTo(Connection *connection, const Frame &frame);
+    void broadcast(const Frame &frame);
+    void writeOut(Connection *connection);
+    void closeConnection(Connection *connection);
+    void releaseClosed();
+    Frame userListFrame();
+    void log(const QString &message);
+};
+
+#endif // EPOLLSERVER_H
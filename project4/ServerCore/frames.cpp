@@ -0,0 +1,648 @@
+#include "frames.h"
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QtEndian>
+
+namespace Frames
+{
+
+// 非 ASCII 的 UTF-16 码元（及其后的低代理项）编码成 UTF-8，返回消耗的码元数；孤立的代理项换成 U+FFFD
+static int appendUtf8(QByteArray &out, QStringView value, int index)
+{
+    const char16_t unit = value.at(index).unicode();
+    uint codePoint = unit;
+    int consumed = 1;
+    if (QChar::isHighSurrogate(unit) && index + 1 < value.size()
+        && QChar::isLowSurrogate(value.at(index + 1).unicode())) {
+        codePoint = QChar::surrogateToUcs4(unit, value.at(index + 1).unicode());
+        consumed = 2;
+    } else if (QChar::isSurrogate(unit)) {
+        codePoint = QChar::ReplacementCharacter;
+    }
+
+    if (codePoint < 0x80) {
+        out.append(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+        out.append(static_cast<char>(0xc0 | (codePoint >> 6)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    } else if (codePoint < 0x10000) {
+        out.append(static_cast<char>(0xe0 | (codePoint >> 12)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    } else {
+        out.append(static_cast<char>(0xf0 | (codePoint >> 18)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+        out.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (codePoint & 0x3f)));
+    }
+    return consumed;
+}
+
+// 与 appendUtf8 的编码结果等长
+static quint64 utf8Length(QStringView value)
+{
+    quint64 length = 0;
+    const int size = static_cast<int>(value.size());
+    for (int i = 0; i < size; ++i) {
+        const char16_t unit = value.at(i).unicode();
+        if (unit < 0x80) {
+            length += 1;
+        } else if (unit < 0x800) {
+            length += 2;
+        } else if (QChar::isHighSurrogate(unit) && i + 1 < size
+                   && QChar::isLowSurrogate(value.at(i + 1).unicode())) {
+            length += 4;
+            ++i;
+        } else {
+            length += 3;
+        }
+    }
+    return length;
+}
+
+void appendJsonString(QByteArray &out, QStringView value)
+{
+    out.append('"');
+    const int size = static_cast<int>(value.size());
+    for (int i = 0; i < size;) {
+        const char16_t unit = value.at(i).unicode();
+        if (unit >= 0x80) {
+            i += appendUtf8(out, value, i);
+            continue;
+        }
+        const char ch = static_cast<char>(unit);
+        switch (ch) {
+        case '"':  out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            if (unit < 0x20) {
+                char escaped[7];
+                qsnprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(unit));
+                out.append(escaped, 6);
+            } else {
+                out.append(ch);
+            }
+        }
+        ++i;
+    }
+    out.append('"');
+}
+
+void appendCborHead(QByteArray &out, int majorType, quint64 value)
+{
+    const char major = static_cast<char>(majorType << 5);
+    if (value < 24) {
+        out.append(static_cast<char>(major | value));
+    } else if (value <= 0xff) {
+        out.append(static_cast<char>(major | 24));
+        out.append(static_cast<char>(value));
+    } else if (value <= 0xffff) {
+        out.append(static_cast<char>(major | 25));
+        out.append(static_cast<char>(value >> 8));
+        out.append(static_cast<char>(value));
+    } else if (value <= 0xffffffffULL) {
+        out.append(static_cast<char>(major | 26));
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.append(static_cast<char>(value >> shift));
+    } else {
+        out.append(static_cast<char>(major | 27));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out.append(static_cast<char>(value >> shift));
+    }
+}
+
+void appendCborString(QByteArray &out, QStringView value)
+{
+    appendCborHead(out, 3, utf8Length(value));
+    const int size = static_cast<int>(value.size());
+    for (int i = 0; i < size;) {
+        const char16_t unit = value.at(i).unicode();
+        if (unit < 0x80) {
+            out.append(static_cast<char>(unit));
+            ++i;
+        } else {
+            i += appendUtf8(out, value, i);
+        }
+    }
+}
+
+QByteArray jsonString(const QString &value)
+{
+    QByteArray out;
+    out.reserve(value.size() + 2);
+    appendJsonString(out, value);
+    return out;
+}
+
+QByteArray cborHead(int majorType, quint64 value)
+{
+    QByteArray head;
+    appendCborHead(head, majorType, value);
+    return head;
+}
+
+QByteArray cborString(const QString &value)
+{
+    QByteArray out;
+    appendCborString(out, value);
+    return out;
+}
+
+BufferPool &bufferPool()
+{
+    thread_local BufferPool pool;
+    return pool;
+}
+
+// 以下几个帧在每条消息的路径上，两种编码都直接写进池里取出的缓冲，不经过 QCborMap
+// 估算容量时每个 UTF-16 码元按 3 字节计，转义多出来的部分由 append 自行扩容
+static QByteArray takeJson(int capacity)
+{
+    return bufferPool().take(capacity);
+}
+
+// 先留出长度前缀，finishCbor 时回填
+static QByteArray takeCbor(int capacity)
+{
+    QByteArray out = bufferPool().take(capacity + Wire::HeaderSize);
+    out.resize(Wire::HeaderSize);
+    return out;
+}
+
+static void finishJson(QByteArray &json)
+{
+    bufferPool().give(json);
+}
+
+static void finishCbor(QByteArray &cbor)
+{
+    qToBigEndian<quint32>(static_cast<quint32>(cbor.size() - Wire::HeaderSize), cbor.data());
+    bufferPool().give(cbor);
+}
+
+static void appendNumber(QByteArray &out, qint64 value)
+{
+    char digits[24];
+    const int length = qsnprintf(digits, sizeof(digits), "%lld", static_cast<long long>(value));
+    out.append(digits, length);
+}
+
+// 协议里的键都是 ASCII
+static void appendCborKey(QByteArray &out, const char *key)
+{
+    const int length = static_cast<int>(qstrlen(key));
+    appendCborHead(out, 3, static_cast<quint64>(length));
+    out.append(key, length);
+}
+
+static void appendCborInteger(QByteArray &out, qint64 value)
+{
+    if (value >= 0)
+        appendCborHead(out, 0, static_cast<quint64>(value));
+    else
+        appendCborHead(out, 1, static_cast<quint64>(-1 - value));
+}
+
+static Frame make(const QByteArray &json, const QCborMap &map, Frame::Kind kind = Frame::Control)
+{
+    return Frame{json, Wire::cborFrame(map.toCborValue().toCbor()), kind};
+}
+
+// login_success 携带协商结果，总是按连接协商前的格式发出
+Frame loginSuccess(Wire::Format format, bool compress, const QByteArray &session, bool resumed,
+                   quint32 chatEpoch, quint64 chatSeq)
+{
+    if (format == Wire::Json && !compress && session.isEmpty() && chatEpoch == 0) {
+        static const Frame plain = make("{\"type\":\"login_success\"}\n",
+                                        QCborMap{{QStringLiteral("type"), QStringLiteral("login_success")}});
+        return plain;
+    }
+
+    QCborMap map{{QStringLiteral("type"), QStringLiteral("login_success")}};
+    if (format != Wire::Json)
+        map.insert(QStringLiteral("wire"), Wire::formatName(format));
+    if (compress)
+        map.insert(QStringLiteral("compress"), Wire::compressionName());
+    if (!session.isEmpty())
+        map.insert(QStringLiteral("session"), QString::fromLatin1(session));
+    if (resumed)
+        map.insert(QStringLiteral("resumed"), true);
+    if (chatEpoch != 0)
+        map.insert(QStringLiteral("chat_epoch"), static_cast<qint64>(chatEpoch));
+    if (chatSeq != 0)
+        map.insert(QStringLiteral("chat_seq"), static_cast<qint64>(chatSeq));
+    return Frame{Wire::encode(map, Wire::Json), Wire::encode(map, Wire::Cbor), Frame::Control};
+}
+
+Frame loginFailed(const QString &reason)
+{
+    return make("{\"type\":\"login_failed\",\"reason\":" + jsonString(reason) + "}\n",
+                QCborMap{{QStringLiteral("type"), QStringLiteral("login_failed")},
+                         {QStringLiteral("reason"), reason}});
+}
+
+static Frame presenceChange(const char *type, const QString &nickname, quint64 version)
+{
+    const int capacity = nickname.size() * 3 + 64;
+    QByteArray json = takeJson(capacity);
+    json.append("{\"type\":\"").append(type).append("\",\"nickname\":");
+    appendJsonString(json, nickname);
+    json.append(",\"version\":");
+    appendNumber(json, static_cast<qint64>(version));
+    json.append("}\n");
+    finishJson(json);
+
+    QByteArray cbor = takeCbor(capacity);
+    appendCborHead(cbor, 5, 3);
+    appendCborKey(cbor, "type");
+    appendCborKey(cbor, type);
+    appendCborKey(cbor, "nickname");
+    appendCborString(cbor, nickname);
+    appendCborKey(cbor, "version");
+    appendCborHead(cbor, 0, version);
+    finishCbor(cbor);
+    return Frame{json, cbor, Frame::Presence};
+}
+
+Frame userJoined(const QString &nickname, quint64 version)
+{
+    return presenceChange("user_joined", nickname, version);
+}
+
+Frame userLeft(const QString &nickname, quint64 version)
+{
+    return presenceChange("user_left", nickname, version);
+}
+
+Frame userList(const QStringList &users)
+{
+    QByteArray json("{\"type\":\"user_list\",\"users\":[");
+    QCborArray array;
+    for (int i = 0; i < users.size(); ++i) {
+        if (i > 0)
+            json.append(',');
+        json.append(jsonString(users.at(i)));
+        array.append(users.at(i));
+    }
+    json.append("]}\n");
+    return make(json, QCborMap{{QStringLiteral("type"), QStringLiteral("user_list")},
+                               {QStringLiteral("users"), array}},
+                Frame::Presence);
+}
+
+Frame userList(const QByteArrayList &jsonItems, const QByteArrayList &cborItems,
+               quint64 version, quint32 epoch)
+{
+    QByteArray json("{\"type\":\"user_list\",\"version\":");
+    json.append(QByteArray::number(version));
+    json.append(",\"epoch\":");
+    json.append(QByteArray::number(epoch));
+    json.append(",\"users\":[");
+    json.append(jsonItems.join(','));
+    json.append("]}\n");
+
+    // {"type":"user_list","version":n,"epoch":n,"users":[...]}，map 与 array 头部手工写出，元素直接拼接
+    QByteArray cbor = cborHead(5, 4);
+    cbor.append(cborString(QStringLiteral("type")));
+    cbor.append(cborString(QStringLiteral("user_list")));
+    cbor.append(cborString(QStringLiteral("version")));
+    cbor.append(cborHead(0, version));
+    cbor.append(cborString(QStringLiteral("epoch")));
+    cbor.append(cborHead(0, epoch));
+    cbor.append(cborString(QStringLiteral("users")));
+    cbor.append(cborHead(4, static_cast<quint64>(cborItems.size())));
+    cbor.append(cborItems.join());
+    return Frame{json, Wire::cborFrame(cbor), Frame::Presence};
+}
+
+Frame userListDelta(quint64 from, quint64 version, const QStringList &joined, const QStringList &left)
+{
+    QByteArray json("{\"type\":\"user_list_delta\",\"from\":");
+    json.append(QByteArray::number(from));
+    json.append(",\"version\":");
+    json.append(QByteArray::number(version));
+    QCborArray joinedArray;
+    QCborArray leftArray;
+    json.append(",\"joined\":[");
+    for (int i = 0; i < joined.size(); ++i) {
+        if (i > 0)
+            json.append(',');
+        json.append(jsonString(joined.at(i)));
+        joinedArray.append(joined.at(i));
+    }
+    json.append("],\"left\":[");
+    for (int i = 0; i < left.size(); ++i) {
+        if (i > 0)
+            json.append(',');
+        json.append(jsonString(left.at(i)));
+        leftArray.append(left.at(i));
+    }
+    json.append("]}\n");
+    return make(json, QCborMap{{QStringLiteral("type"), QStringLiteral("user_list_delta")},
+                               {QStringLiteral("from"), static_cast<qint64>(from)},
+                               {QStringLiteral("version"), static_cast<qint64>(version)},
+                               {QStringLiteral("joined"), joinedArray},
+                               {QStringLiteral("left"), leftArray}},
+                Frame::Presence);
+}
+
+Frame chatMessage(const QString &sender, const QString &message, const QString &room, qint64 id,
+                  quint64 seq, qint64 timestamp)
+{
+    const int capacity = (sender.size() + message.size() + room.size()) * 3 + 128;
+    QByteArray json = takeJson(capacity);
+    json.append("{\"type\":\"chat_message\",\"sender\":");
+    appendJsonString(json, sender);
+    json.append(",\"message\":");
+    appendJsonString(json, message);
+    json.append(",\"room\":");
+    appendJsonString(json, room);
+    if (id > 0) {
+        json.append(",\"id\":");
+        appendNumber(json, id);
+    }
+    if (seq > 0) {
+        json.append(",\"seq\":");
+        appendNumber(json, static_cast<qint64>(seq));
+        json.append(",\"ts\":");
+        appendNumber(json, timestamp);
+    }
+    json.append("}\n");
+    finishJson(json);
+
+    QByteArray cbor = takeCbor(capacity);
+    appendCborHead(cbor, 5, 4 + (id > 0 ? 1 : 0) + (seq > 0 ? 2 : 0));
+    appendCborKey(cbor, "type");
+    appendCborKey(cbor, "chat_message");
+    appendCborKey(cbor, "sender");
+    appendCborString(cbor, sender);
+    appendCborKey(cbor, "message");
+    appendCborString(cbor, message);
+    appendCborKey(cbor, "room");
+    appendCborString(cbor, room);
+    if (id > 0) {
+        appendCborKey(cbor, "id");
+        appendCborInteger(cbor, id);
+    }
+    if (seq > 0) {
+        appendCborKey(cbor, "seq");
+        appendCborHead(cbor, 0, seq);
+        appendCborKey(cbor, "ts");
+        appendCborInteger(cbor, timestamp);
+    }
+    finishCbor(cbor);
+    return Frame{json, cbor, Frame::Chat};
+}
+
+Frame chatRange(const QString &room, quint32 epoch, quint64 after, quint64 last, bool complete,
+                const QByteArrayList &jsonItems, const QByteArrayList &cborItems)
+{
+    QByteArray json("{\"type\":\"chat_range\",\"room\":");
+    appendJsonString(json, room);
+    json.append(",\"epoch\":");
+    appendNumber(json, epoch);
+    json.append(",\"after\":");
+    appendNumber(json, static_cast<qint64>(after));
+    json.append(",\"last\":");
+    appendNumber(json, static_cast<qint64>(last));
+    json.append(complete ? ",\"complete\":true" : ",\"complete\":false");
+    json.append(",\"messages\":[");
+    json.append(jsonItems.join(','));
+    json.append("]}\n");
+
+    QByteArray cbor = cborHead(5, 7);
+    appendCborKey(cbor, "type");
+    appendCborKey(cbor, "chat_range");
+    appendCborKey(cbor, "room");
+    appendCborString(cbor, room);
+    appendCborKey(cbor, "epoch");
+    appendCborHead(cbor, 0, epoch);
+    appendCborKey(cbor, "after");
+    appendCborHead(cbor, 0, after);
+    appendCborKey(cbor, "last");
+    appendCborHead(cbor, 0, last);
+    appendCborKey(cbor, "complete");
+    // CBOR 简单值 true / false
+    appendCborHead(cbor, 7, complete ? 21 : 20);
+    appendCborKey(cbor, "messages");
+    appendCborHead(cbor, 4, static_cast<quint64>(cborItems.size()));
+    cbor.append(cborItems.join());
+    return Frame{json, Wire::cborFrame(cbor), Frame::Chat};
+}
+
+Frame privateMessage(const QString &sender, const QString &message, qint64 id, qint64 timestamp)
+{
+    const int capacity = (sender.size() + message.size()) * 3 + 128;
+    QByteArray json = takeJson(capacity);
+    json.append("{\"type\":\"private_message\",\"from\":");
+    appendJsonString(json, sender);
+    json.append(",\"message\":");
+    appendJsonString(json, message);
+    json.append(",\"id\":");
+    appendNumber(json, id);
+    json.append(",\"ts\":");
+    appendNumber(json, timestamp);
+    json.append("}\n");
+    finishJson(json);
+
+    QByteArray cbor = takeCbor(capacity);
+    appendCborHead(cbor, 5, 5);
+    appendCborKey(cbor, "type");
+    appendCborKey(cbor, "private_message");
+    appendCborKey(cbor, "from");
+    appendCborString(cbor, sender);
+    appendCborKey(cbor, "message");
+    appendCborString(cbor, message);
+    appendCborKey(cbor, "id");
+    appendCborInteger(cbor, id);
+    appendCborKey(cbor, "ts");
+    appendCborInteger(cbor, timestamp);
+    finishCbor(cbor);
+    return Frame{json, cbor, Frame::Chat};
+}
+
+Frame privateAck(qint64 id, const QString &recipient, const QString &status, const QString &reason)
+{
+    QByteArray json = "{\"type\":\"private_ack\",\"id\":" + QByteArray::number(id)
+                      + ",\"to\":" + jsonString(recipient)
+                      + ",\"status\":" + jsonString(status);
+    QCborMap map{{QStringLiteral("type"), QStringLiteral("private_ack")},
+                 {QStringLiteral("id"), id},
+                 {QStringLiteral("to"), recipient},
+                 {QStringLiteral("status"), status}};
+    if (!reason.isEmpty()) {
+        json.append(",\"reason\":" + jsonString(reason));
+        map.insert(QStringLiteral("reason"), reason);
+    }
+    json.append("}\n");
+    return make(json, map);
+}
+
+Frame serverRestart(int reconnectAfterMs)
+{
+    return make("{\"type\":\"server_restart\",\"reconnect_after_ms\":" + QByteArray::number(reconnectAfterMs) + "}\n",
+                QCborMap{{QStringLiteral("type"), QStringLiteral("server_restart")},
+                         {QStringLiteral("reconnect_after_ms"), reconnectAfterMs}});
+}
+
+Frame muted(int seconds)
+{
+    return make("{\"type\":\"muted\",\"seconds\":" + QByteArray::number(seconds) + "}\n",
+                QCborMap{{QStringLiteral("type"), QStringLiteral("muted")},
+                         {QStringLiteral("seconds"), seconds}});
+}
+
+Frame ping()
+{
+    static const Frame frame = make("{\"type\":\"ping\"}\n",
+                                    QCborMap{{QStringLiteral("type"), QStringLiteral("ping")}});
+    return frame;
+}
+
+Frame pong()
+{
+    static const Frame frame = make("{\"type\":\"pong\"}\n",
+                                    QCborMap{{QStringLiteral("type"), QStringLiteral("pong")}});
+    return frame;
+}
+
+Frame roomJoined(const QString &room, const QStringList &members, quint64 seq)
+{
+    QByteArray json("{\"type\":\"room_joined\",\"room\":" + jsonString(room) + ",\"members\":[");
+    QCborArray array;
+    for (int i = 0; i < members.size(); ++i) {
+        if (i > 0)
+            json.append(',');
+        json.append(jsonString(members.at(i)));
+        array.append(members.at(i));
+    }
+    json.append("]");
+    QCborMap map{{QStringLiteral("type"), QStringLiteral("room_joined")},
+                 {QStringLiteral("room"), room},
+                 {QStringLiteral("members"), array}};
+    if (seq > 0) {
+        json.append(",\"seq\":" + QByteArray::number(seq));
+        map.insert(QStringLiteral("seq"), static_cast<qint64>(seq));
+    }
+    json.append("}\n");
+    return make(json, map);
+}
+
+Frame roomLeft(const QString &room)
+{
+    return make("{\"type\":\"room_left\",\"room\":" + jsonString(room) + "}\n",
+                QCborMap{{QStringLiteral("type"), QStringLiteral("room_left")},
+                         {QStringLiteral("room"), room}});
+}
+
+Frame roomMemberJoined(const QString &room, const QString &nickname)
+{
+    return make("{\"type\":\"room_member_joined\",\"room\":" + jsonString(room)
+                    + ",\"nickname\":" + jsonString(nickname) + "}\n",
+                QCborMap{{QStringLiteral("type"), QStringLiteral("room_member_joined")},
+                         {QStringLiteral("room"), room},
+                         {QStringLiteral("nickname"), nickname}});
+}
+
+Frame roomMemberLeft(const QString &room, const QString &nickname)
+{
+    return make("{\"type\":\"room_member_left\",\"room\":" + jsonString(room)
+                    + ",\"nickname\":" + jsonString(nickname) + "}\n",
+                QCborMap{{QStringLiteral("type"), QStringLiteral("room_member_left")},
+                         {QStringLiteral("room"), room},
+                         {QStringLiteral("nickname"), nickname}});
+}
+
+QByteArray historyItemJson(qint64 id, const QString &sender, const QString &message, qint64 timestamp)
+{
+    return "{\"id\":" + QByteArray::number(id) + ",\"sender\":" + jsonString(sender) + ",\"message\":" + jsonString(message)
+           + ",\"ts\":" + QByteArray::number(timestamp) + "}";
+}
+
+QByteArray historyItemCbor(qint64 id, const QString &sender, const QString &message, qint64 timestamp)
+{
+    QByteArray item = cborHead(5, 4);
+    item.append(cborString(QStringLiteral("id")));
+    item.append(cborHead(0, static_cast<quint64>(qMax<qint64>(id, 0))));
+    item.append(cborString(QStringLiteral("sender")));
+    item.append(cborString(sender));
+    item.append(cborString(QStringLiteral("message")));
+    item.append(cborString(message));
+    item.append(cborString(QStringLiteral("ts")));
+    // 时间戳总是正数，用无符号整数（主类型 0）编码
+    item.append(cborHead(0, static_cast<quint64>(qMax<qint64>(timestamp, 0))));
+    return item;
+}
+
+Frame history(const QByteArrayList &jsonItems, const QByteArrayList &cborItems)
+{
+    QByteArray json("{\"type\":\"history\",\"messages\":[");
+    json.append(jsonItems.join(','));
+    json.append("]}\n");
+
+    QByteArray cbor = cborHead(5, 2);
+    cbor.append(cborString(QStringLiteral("type")));
+    cbor.append(cborString(QStringLiteral("history")));
+    cbor.append(cborString(QStringLiteral("messages")));
+    cbor.append(cborHead(4, static_cast<quint64>(cborItems.size())));
+    cbor.append(cborItems.join());
+    return Frame{json, Wire::cborFrame(cbor), Frame::Chat};
+}
+
+void compress(Frame &frame, int threshold)
+{
+    if (threshold <= 0 || !frame.deflated.isEmpty() || frame.cbor.isEmpty())
+        return;
+    const QByteArray compressed = Wire::compressFrame(frame.cbor, threshold);
+    frame.deflated = compressed.isEmpty() ? frame.cbor : compressed;
+}
+
+Frame relay(const QCborMap &message)
+{
+    return Frame{Wire::encode(message, Wire::Json), Wire::encode(message, Wire::Cbor), Frame::Control};
+}
+
+Frame batch(const QList<Frame> &frames)
+{
+    int jsonCapacity = 64;
+    int cborCapacity = 64;
+    for (const Frame &frame : frames) {
+        jsonCapacity += frame.json.size();
+        cborCapacity += frame.cbor.size();
+    }
+
+    QByteArray json = takeJson(jsonCapacity);
+    json.append("{\"type\":\"batch\",\"messages\":[");
+    QByteArray cbor = takeCbor(cborCapacity);
+    appendCborHead(cbor, 5, 2);
+    appendCborKey(cbor, "type");
+    appendCborKey(cbor, "batch");
+    appendCborKey(cbor, "messages");
+    appendCborHead(cbor, 4, static_cast<quint64>(frames.size()));
+
+    qint64 createdNs = 0;
+    for (int i = 0; i < frames.size(); ++i) {
+        const Frame &frame = frames.at(i);
+        if (i > 0)
+            json.append(',');
+        json.append(frame.json.constData(), frame.json.size() - 1);
+        cbor.append(frame.cbor.constData() + Wire::HeaderSize, frame.cbor.size() - Wire::HeaderSize);
+        if (createdNs == 0 || (frame.createdNs != 0 && frame.createdNs < createdNs))
+            createdNs = frame.createdNs;
+    }
+    json.append("]}\n");
+    finishJson(json);
+    finishCbor(cbor);
+
+    Frame result{json, cbor, Frame::Chat};
+    result.createdNs = createdNs;
+    return result;
+}
+
+}
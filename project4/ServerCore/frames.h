@@ -0,0 +1,115 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <QByteArray>
+#include <QByteArrayList>
+#include <QCborMap>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+#include "bufferpool.h"
+#include "wirecompression.h"
+#include "wireformat.h"
+
+// 同一条消息的两种线路编码，广播前各编码一次
+// 两个 QByteArray 都隐式共享，所有分片、所有接收者共用同一块缓冲区
+struct Frame
+{
+    // 慢消费者合并策略据此决定哪些积压帧可以被新的快照取代
+    enum Kind {
+        Control,    // 登录应答等，只发给单个连接
+        Presence,   // user_joined / user_left / user_list
+        Chat
+    };
+
+    QByteArray json;
+    QByteArray cbor;
+    Kind kind = Control;
+    qint64 createdNs = 0;   // 广播发出时刻（Metrics::nowNs），用于统计广播延迟
+    // 协商了压缩的连接使用的 Cbor 帧；非空表示已尝试过压缩，压缩无益时与 cbor 共享同一缓冲
+    QByteArray deflated;
+
+    const QByteArray &bytes(Wire::Format format) const
+    {
+        return format == Wire::Cbor ? cbor : json;
+    }
+};
+
+// JSON 直接拼接紧凑文本，避免每个事件都构造 QJsonObject/QJsonDocument
+namespace Frames
+{
+QByteArray jsonString(const QString &value);
+// CBOR 数据项头部（主类型 + 长度/数值）与文本串编码
+QByteArray cborHead(int majorType, quint64 value);
+QByteArray cborString(const QString &value);
+// 直接追加到 out 末尾，不产生中间的 QByteArray 与 UTF-8 临时串
+void appendJsonString(QByteArray &out, QStringView value);
+void appendCborHead(QByteArray &out, int majorType, quint64 value);
+void appendCborString(QByteArray &out, QStringView value);
+
+// 本线程的帧缓冲池：聊天、私聊、上下线与合批帧都从这里取缓冲，接收者写完后复用
+BufferPool &bufferPool();
+
+// 协商结果：线路格式与是否启用压缩；session 为续连令牌，resumed 表示接续了断线前的会话
+// chatEpoch 为聊天序号的纪元，客户端据此判断手里的房间序号是否还有效；chatSeq 为此刻大厅的最新序号
+Frame loginSuccess(Wire::Format format, bool compress = false,
+                   const QByteArray &session = QByteArray(), bool resumed = false,
+                   quint32 chatEpoch = 0, quint64 chatSeq = 0);
+Frame loginFailed(const QString &reason);
+// 在线状态增量：version 为登记表中这次变化的版本号，客户端按版本号顺序应用
+Frame userJoined(const QString &nickname, quint64 version);
+Frame userLeft(const QString &nickname, quint64 version);
+Frame userList(const QStringList &users);
+// 由预先编码好的昵称片段拼出 user_list 快照，不再逐个转义
+Frame userList(const QByteArrayList &jsonItems, const QByteArrayList &cborItems,
+               quint64 version, quint32 epoch);
+// from 版本之后到 version 为止的净变化，用于重连或补齐缺口
+Frame userListDelta(quint64 from, quint64 version, const QStringList &joined, const QStringList &left);
+// id 为大厅消息在聊天记录中的序号（大于 0 时附带），客户端续连时据此补发；
+// seq 为房间内的消息序号、timestamp 为服务器收到的时刻（毫秒），由 RoomLog 分配，大于 0 时附带
+Frame chatMessage(const QString &sender, const QString &message, const QString &room, qint64 id = 0,
+                  quint64 seq = 0, qint64 timestamp = 0);
+// 回应 chat_sync：房间内 after 之后的一段 chat_message，元素为去掉行尾换行的 JSON 对象与去掉长度前缀的 CBOR map；
+// last 为房间当前的最新序号，complete 为 false 表示缺口的开头已不在服务器缓冲中
+Frame chatRange(const QString &room, quint32 epoch, quint64 after, quint64 last, bool complete,
+                const QByteArrayList &jsonItems, const QByteArrayList &cborItems);
+
+// 私聊：只发给收件人；id 为发件人给这条消息的编号，回执按它对应
+Frame privateMessage(const QString &sender, const QString &message, qint64 id, qint64 timestamp);
+// 私聊回执发回发件人：status 为 delivered（已交给对方连接）、queued（对方不在线，已暂存）或 rejected
+Frame privateAck(qint64 id, const QString &recipient, const QString &status,
+                 const QString &reason = QString());
+
+// 服务器排空连接前发给每个客户端：断开后等 reconnectAfterMs 再重连，错开重连高峰
+Frame serverRestart(int reconnectAfterMs);
+
+// 因刷屏被禁言 seconds 秒
+Frame muted(int seconds);
+
+// 心跳
+Frame ping();
+Frame pong();
+
+// 房间：room_joined 只发给加入者并带上成员列表与房间此刻的最新聊天序号，成员进出通知发给房间内其他成员
+Frame roomJoined(const QString &room, const QStringList &members, quint64 seq = 0);
+Frame roomLeft(const QString &room);
+Frame roomMemberJoined(const QString &room, const QString &nickname);
+Frame roomMemberLeft(const QString &room, const QString &nickname);
+
+// 历史消息：单条记录的 JSON 对象文本与 CBOR map，以及由它们拼出的批量帧
+QByteArray historyItemJson(qint64 id, const QString &sender, const QString &message, qint64 timestamp);
+QByteArray historyItemCbor(qint64 id, const QString &sender, const QString &message, qint64 timestamp);
+Frame history(const QByteArrayList &jsonItems, const QByteArrayList &cborItems);
+
+// 压缩一次，结果存进 frame.deflated 供所有协商了压缩的接收者共用；已压缩过的不再重复
+void compress(Frame &frame, int threshold);
+
+// 把客户端发来的消息原样转发（文件传输等），两种格式各编码一次
+Frame relay(const QCborMap &message);
+
+// 把若干已编码好的帧装进一个 batch 帧：JSON 去掉行尾换行、CBOR 去掉长度前缀后直接拼接
+Frame batch(const QList<Frame> &frames);
+}
+
+#endif // FRAMES_H
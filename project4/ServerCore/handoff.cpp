@@ -0,0 +1,113 @@
+#include "handoff.h"
+#include "chatserver.h"
+#include <QCborMap>
+#include <QCborValue>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QSaveFile>
+#include <QStandardPaths>
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Handoff
+{
+const char InheritListenerOption[] = "inherit-listener";
+const char StateFileOption[] = "handoff";
+
+// 去掉上一次交接留下的选项，其余参数原样传给新进程
+static QStringList forwardedArguments()
+{
+    const QStringList internal = QStringList() << QString("--%1").arg(QLatin1String(InheritListenerOption))
+                                               << QString("--%1").arg(QLatin1String(StateFileOption));
+    const QStringList arguments = QCoreApplication::arguments().mid(1);
+    QStringList forwarded;
+    for (int i = 0; i < arguments.size(); ++i) {
+        const QString &argument = arguments.at(i);
+        if (internal.contains(argument)) {
+            ++i;    // 连同取值一起跳过
+            continue;
+        }
+        if (argument.contains('=') && internal.contains(argument.section('=', 0, 0)))
+            continue;
+        forwarded.append(argument);
+    }
+    return forwarded;
+}
+
+bool restart(ChatServer *server, QString *errorMessage)
+{
+#ifdef Q_OS_UNIX
+    // 运行时目录（XDG_RUNTIME_DIR 或 Qt 代建的 0700 目录）只有本用户可进入
+    const QString runtimeDir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtimeDir.isEmpty()) {
+        *errorMessage = "找不到本用户的运行时目录，无法安全地保存交接状态";
+        return false;
+    }
+
+    // 以下几步失败时还没有交出状态，服务器可以照常继续
+    // Qt 创建的套接字带 FD_CLOEXEC，dup 出来的副本不带，可被新进程继承
+    const int listener = ::dup(static_cast<int>(server->socketDescriptor()));
+    if (listener < 0) {
+        *errorMessage = "无法复制监听套接字";
+        return false;
+    }
+
+    const QString stateFile = QDir(runtimeDir)
+                                  .filePath(QString("chatserver-handoff-%1.cbor").arg(QCoreApplication::applicationPid()));
+    QSaveFile file(stateFile);
+    // 文件从创建起就只有属主可读写，写入令牌之前不存在别人能打开它的窗口
+    const mode_t previousMask = ::umask(S_IRWXG | S_IRWXO);
+    const bool opened = file.open(QIODevice::WriteOnly);
+    ::umask(previousMask);
+    if (!opened || !file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)) {
+        ::close(listener);
+        *errorMessage = QString("无法写入交接状态：%1").arg(file.errorString());
+        return false;
+    }
+
+    // 从这里起状态已交出，失败也只能停机
+    file.write(server->takeHandoffState().toCborValue().toCbor());
+    if (!file.commit()) {
+        ::close(listener);
+        server->close();
+        *errorMessage = QString("无法写入交接状态：%1").arg(file.errorString());
+        return false;
+    }
+
+    const QStringList arguments = forwardedArguments()
+                                  << QString("--%1=%2").arg(QLatin1String(InheritListenerOption)).arg(listener)
+                                  << QString("--%1=%2").arg(QLatin1String(StateFileOption)).arg(stateFile);
+    const bool started = QProcess::startDetached(QCoreApplication::applicationFilePath(), arguments);
+    ::close(listener);
+    server->close();
+    if (!started) {
+        QFile::remove(stateFile);
+        *errorMessage = "无法启动新进程，本进程的记录与集群组件已停止，只能停机";
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(server);
+    *errorMessage = "当前平台不支持继承监听套接字，无法热重启";
+    return false;
+#endif
+}
+
+bool restore(ChatServer *server, const QString &stateFile, QString *errorMessage)
+{
+    QFile file(stateFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorMessage = QString("无法读取交接状态 %1：%2").arg(stateFile).arg(file.errorString());
+        return false;
+    }
+    const QCborMap state = QCborValue::fromCbor(file.readAll()).toMap();
+    file.close();
+    file.remove();
+    server->restoreHandoffState(state);
+    return true;
+}
+}
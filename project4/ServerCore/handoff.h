@@ -0,0 +1,28 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <QString>
+#include <QStringList>
+
+class ChatServer;
+
+// 热重启：旧进程排空连接后把监听套接字与续连会话交给以相同参数启动的新进程。
+// 监听套接字由子进程继承，排空期间到来的连接留在内核队列里由新进程接受；
+// 客户端连接本身不迁移，而是按 server_restart 给的延迟错开重连，凭会话令牌接续，
+// 聊天记录按序号补发，重启既不产生重连高峰也不丢消息
+namespace Handoff
+{
+// 新进程从这两个选项得知继承的监听套接字与交接状态文件
+extern const char InheritListenerOption[];
+extern const char StateFileOption[];
+
+// 须在 ChatServer::drained() 之后调用；成功后旧进程应尽快退出
+// 状态文件含续连令牌，写在只有本用户可访问的运行时目录中，权限为 0600
+// 交出状态会停掉聊天记录写线程、关闭指标端点与集群总线，无法撤回：因此失败时服务器同样已被 close()，
+// 不再接受连接，调用方应当停机退出，不能接着提供服务
+bool restart(ChatServer *server, QString *errorMessage);
+// 新进程启动时调用：读入并删除状态文件
+bool restore(ChatServer *server, const QString &stateFile, QString *errorMessage);
+}
+
+#endif // HANDOFF_H
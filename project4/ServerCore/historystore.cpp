@@ -0,0 +1,192 @@
+#include "historystore.h"
+#include <QCborValue>
+#include <QCborMap>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <algorithm>
+
+// 单个分段文件的大小上限，超过后换新文件；启动时最多只需读取几个分段
+static const qint64 SegmentMaxBytes = 4 * 1024 * 1024;
+
+HistoryStore::HistoryStore(QObject *parent)
+    : QThread(parent)
+    , replayCount(0)
+    , lastId(0)
+    , replayDirty(true)
+    , segmentIndex(0)
+    , stopping(0)
+{
+}
+
+HistoryStore::~HistoryStore()
+{
+    stop();
+    wait();
+}
+
+bool HistoryStore::open(const QString &directory, int replayCount, QString *errorMessage)
+{
+    this->replayCount = qMax(replayCount, 0);
+    dir.setPath(directory);
+    if (!dir.mkpath(".")) {
+        *errorMessage = QString("无法创建历史目录 %1").arg(directory);
+        return false;
+    }
+
+    // 从最后一个分段往前读，够 replayCount 条就停；至少读到一条以接上序号
+    const QStringList names = segmentNames();
+    for (int i = names.size() - 1; i >= 0 && tail.size() < qMax(this->replayCount, 1); --i) {
+        tail = readSegment(names.at(i)) + tail;
+    }
+    if (!tail.isEmpty())
+        lastId = tail.last().id;
+    while (tail.size() > this->replayCount)
+        tail.removeFirst();
+
+    // 上次可能在写到一半时退出，新记录总是写进新分段
+    const int lastIndex = names.isEmpty() ? 0 : names.last().mid(8, 8).toInt();
+    return openSegment(lastIndex + 1, errorMessage);
+}
+
+void HistoryStore::stop()
+{
+    stopping.storeRelease(1);
+    QMutexLocker locker(&mutex);
+    pendingReady.wakeAll();
+}
+
+qint64 HistoryStore::append(const QString &sender, const QString &message, qint64 timestamp)
+{
+    // 分配序号与写入待写缓冲在同一把锁内，磁盘上的记录按序号排列
+    QMutexLocker locker(&mutex);
+    Record record;
+    record.id = ++lastId;
+    record.json = Frames::historyItemJson(record.id, sender, message, timestamp);
+    record.cbor = Frames::historyItemCbor(record.id, sender, message, timestamp);
+    pendingDisk.append(Wire::cborFrame(record.cbor));
+    if (replayCount > 0) {
+        tail.append(record);
+        if (tail.size() > replayCount)
+            tail.removeFirst();
+        replayDirty = true;
+    }
+    pendingReady.wakeOne();
+    return record.id;
+}
+
+Frame HistoryStore::replayFrame(int compressThreshold)
+{
+    QMutexLocker locker(&mutex);
+    if (tail.isEmpty())
+        return Frame();
+    if (replayDirty) {
+        QByteArrayList jsonItems;
+        QByteArrayList cborItems;
+        jsonItems.reserve(tail.size());
+        cborItems.reserve(tail.size());
+        for (const Record &record : qAsConst(tail)) {
+            jsonItems.append(record.json);
+            cborItems.append(record.cbor);
+        }
+        replayCache = Frames::history(jsonItems, cborItems);
+        replayDirty = false;
+    }
+    Frames::compress(replayCache, compressThreshold);
+    return replayCache;
+}
+
+Frame HistoryStore::replaySince(qint64 lastSeen, int compressThreshold)
+{
+    QMutexLocker locker(&mutex);
+    if (tail.isEmpty() || lastSeen >= tail.last().id)
+        return Frame();
+
+    // 序号连续递增，二分找到第一条比 lastSeen 新的记录
+    const auto first = std::upper_bound(tail.cbegin(), tail.cend(), lastSeen,
+                                        [](qint64 id, const Record &record) { return id < record.id; });
+    QByteArrayList jsonItems;
+    QByteArrayList cborItems;
+    for (auto it = first; it != tail.cend(); ++it) {
+        jsonItems.append(it->json);
+        cborItems.append(it->cbor);
+    }
+    Frame frame = Frames::history(jsonItems, cborItems);
+    Frames::compress(frame, compressThreshold);
+    return frame;
+}
+
+void HistoryStore::run()
+{
+    while (!stopping.loadAcquire()) {
+        writeBatch();
+    }
+    // 退出前写完剩余记录
+    writeBatch();
+    segment.close();
+}
+
+void HistoryStore::writeBatch()
+{
+    QByteArray batch;
+    {
+        QMutexLocker locker(&mutex);
+        if (pendingDisk.isEmpty() && !stopping.loadAcquire())
+            pendingReady.wait(&mutex, 500);
+        batch.swap(pendingDisk);
+    }
+    if (batch.isEmpty())
+        return;
+
+    segment.write(batch);
+    segment.flush();
+
+    if (segment.size() >= SegmentMaxBytes) {
+        QString errorMessage;
+        openSegment(segmentIndex + 1, &errorMessage);
+    }
+}
+
+QStringList HistoryStore::segmentNames() const
+{
+    // 文件名中的序号补零到 8 位，按名字排序即按时间排序
+    return dir.entryList(QStringList() << "segment-*.log", QDir::Files, QDir::Name);
+}
+
+QList<HistoryStore::Record> HistoryStore::readSegment(const QString &fileName) const
+{
+    QList<Record> records;
+    QFile file(dir.filePath(fileName));
+    if (!file.open(QIODevice::ReadOnly))
+        return records;
+
+    const QByteArray data = file.readAll();
+    int offset = 0;
+    while (data.size() - offset >= Wire::HeaderSize) {
+        const quint32 length = qFromBigEndian<quint32>(data.constData() + offset);
+        if (length > static_cast<quint32>(data.size() - offset - Wire::HeaderSize))
+            break;  // 末尾不完整的记录，丢弃
+
+        const QByteArray item = data.mid(offset + Wire::HeaderSize, length);
+        offset += Wire::HeaderSize + length;
+
+        const QCborMap map = QCborValue::fromCbor(item).toMap();
+        const qint64 id = map.value(QLatin1String("id")).toInteger();
+        const QString sender = map.value(QLatin1String("sender")).toString();
+        const QString message = map.value(QLatin1String("message")).toString();
+        const qint64 timestamp = map.value(QLatin1String("ts")).toInteger();
+        records.append(Record{id, Frames::historyItemJson(id, sender, message, timestamp), item});
+    }
+    return records;
+}
+
+bool HistoryStore::openSegment(int index, QString *errorMessage)
+{
+    segment.close();
+    segmentIndex = index;
+    segment.setFileName(dir.filePath(QString("segment-%1.log").arg(index, 8, 10, QChar('0'))));
+    if (!segment.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        *errorMessage = segment.errorString();
+        return false;
+    }
+    return true;
+}
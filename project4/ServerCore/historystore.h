@@ -0,0 +1,72 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QByteArrayList>
+#include <QDir>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include "frames.h"
+
+// 聊天记录：磁盘上是分段的只追加日志，内存中保留最近 replayCount 条
+// 追加只在内存里登记，由本线程批量写盘，不占用广播路径；
+// 登录回放直接使用内存尾部拼好的批量帧，启动时也只读取最后几个分段
+// 每条记录带递增的序号（重启后接着上次的最大序号），断线续连按序号补发
+class HistoryStore : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit HistoryStore(QObject *parent = nullptr);
+    ~HistoryStore();
+
+    // 打开（必要时创建）目录并载入尾部记录，新记录写入一个新分段
+    bool open(const QString &directory, int replayCount, QString *errorMessage);
+    void stop();
+
+    // 以下两个函数线程安全
+    // 返回这条记录的序号
+    qint64 append(const QString &sender, const QString &message, qint64 timestamp);
+    // 最近的记录组成的 history 帧；没有记录时返回空帧
+    // compressThreshold 大于 0 时附带压缩结果，随回放帧一起缓存
+    Frame replayFrame(int compressThreshold = 0);
+    // 序号大于 lastSeen 的记录组成的 history 帧，没有新记录时返回空帧；
+    // 只在内存尾部里找，缺口早于尾部时从尾部第一条开始补
+    Frame replaySince(qint64 lastSeen, int compressThreshold = 0);
+
+protected:
+    void run() override;
+
+private:
+    struct Record
+    {
+        qint64 id;
+        QByteArray json;    // historyItemJson
+        QByteArray cbor;    // historyItemCbor，同时也是磁盘上的记录内容
+    };
+
+    QMutex mutex;
+    QWaitCondition pendingReady;
+    QByteArray pendingDisk;
+    QList<Record> tail;
+    int replayCount;
+    qint64 lastId;
+    Frame replayCache;
+    bool replayDirty;
+
+    // 以下只在 open() 与写线程中使用
+    QDir dir;
+    QFile segment;
+    int segmentIndex;
+    QAtomicInt stopping;
+
+    QStringList segmentNames() const;
+    QList<Record> readSegment(const QString &fileName) const;
+    bool openSegment(int index, QString *errorMessage);
+    void writeBatch();
+};
+
+#endif // HISTORYSTORE_H
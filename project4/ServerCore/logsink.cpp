@@ -0,0 +1,71 @@
+#include "logsink.h"
+#include <QDateTime>
+#include <QMutexLocker>
+
+LogSink::LogSink(int capacity)
+    : ring(qMax(capacity, 16))
+    , head(0)
+    , count(0)
+    , dropped(0)
+{
+}
+
+void LogSink::append(const QString &message)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QMutexLocker locker(&mutex);
+    const int capacity = ring.size();
+    int slot;
+    if (count == capacity) {
+        // 满了就覆盖最旧的一行
+        slot = head;
+        head = (head + 1) % capacity;
+        ++dropped;
+    } else {
+        slot = (head + count) % capacity;
+        ++count;
+    }
+    ring[slot].timestamp = now;
+    ring[slot].message = message;
+
+    if (count == 1)
+        notEmpty.wakeOne();
+}
+
+QVector<LogEntry> LogSink::takeAll(unsigned long waitMs)
+{
+    QVector<LogEntry> batch;
+
+    QMutexLocker locker(&mutex);
+    if (count == 0 && waitMs > 0)
+        notEmpty.wait(&mutex, waitMs);
+
+    batch.reserve(count);
+    const int capacity = ring.size();
+    for (int i = 0; i < count; ++i) {
+        LogEntry &entry = ring[(head + i) % capacity];
+        batch.append(LogEntry{entry.timestamp, std::move(entry.message)});
+    }
+    head = 0;
+    count = 0;
+    return batch;
+}
+
+void LogSink::wakeAll()
+{
+    QMutexLocker locker(&mutex);
+    notEmpty.wakeAll();
+}
+
+quint64 LogSink::droppedCount() const
+{
+    QMutexLocker locker(&mutex);
+    return dropped;
+}
+
+QString LogSink::format(const LogEntry &entry)
+{
+    QString timestamp = QDateTime::fromMSecsSinceEpoch(entry.timestamp).toString("hh:mm:ss");
+    return QString("[%1] %2").arg(timestamp).arg(entry.message);
+}
@@ -0,0 +1,40 @@
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+
+struct LogEntry
+{
+    qint64 timestamp = 0;   // 毫秒时间戳，格式化推迟到消费端
+    QString message;
+};
+
+// 固定容量的环形日志缓冲区
+// 生产者（各工作线程）只做一次短暂加锁和拷贝，缓冲区满时丢弃最旧的行而不是等待，
+// 因此日志输出再慢也不会拖住消息投递；消费者批量取走后再格式化、写出
+class LogSink
+{
+public:
+    explicit LogSink(int capacity = 8192);
+
+    void append(const QString &message);
+    // 取走当前全部日志；缓冲区为空时最多等待 waitMs 毫秒
+    QVector<LogEntry> takeAll(unsigned long waitMs = 0);
+    void wakeAll();
+    quint64 droppedCount() const;
+
+    static QString format(const LogEntry &entry);
+
+private:
+    mutable QMutex mutex;
+    QWaitCondition notEmpty;
+    QVector<LogEntry> ring;
+    int head;
+    int count;
+    quint64 dropped;
+};
+
+#endif // LOGSINK_H
@@ -0,0 +1,60 @@
+#include "logwriter.h"
+#include "logsink.h"
+#include <cstdio>
+
+LogWriter::LogWriter(LogSink *sink, QObject *parent)
+    : QThread(parent)
+    , sink(sink)
+    , stopping(0)
+{
+}
+
+LogWriter::~LogWriter()
+{
+    stop();
+    wait();
+}
+
+bool LogWriter::open(const QString &fileName)
+{
+    if (fileName.isEmpty())
+        return file.open(stdout, QIODevice::WriteOnly);
+
+    file.setFileName(fileName);
+    return file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+}
+
+QString LogWriter::errorString() const
+{
+    return file.errorString();
+}
+
+void LogWriter::stop()
+{
+    stopping.storeRelease(1);
+    sink->wakeAll();
+}
+
+void LogWriter::run()
+{
+    while (!stopping.loadAcquire()) {
+        writeBatch();
+    }
+    // 退出前写完剩余日志
+    writeBatch();
+}
+
+void LogWriter::writeBatch()
+{
+    const QVector<LogEntry> batch = sink->takeAll(stopping.loadAcquire() ? 0 : 200);
+    if (batch.isEmpty())
+        return;
+
+    QByteArray buffer;
+    for (const LogEntry &entry : batch) {
+        buffer.append(LogSink::format(entry).toUtf8());
+        buffer.append('\n');
+    }
+    file.write(buffer);
+    file.flush();
+}
@@ -0,0 +1,35 @@
+#ifndef LOGWRITER_H
+#define LOGWRITER_H
+
+#include <QThread>
+#include <QFile>
+#include <QAtomicInt>
+
+class LogSink;
+
+// 后台线程：批量取出 LogSink 中的日志并写入文件或标准输出，每批只 flush 一次
+class LogWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    LogWriter(LogSink *sink, QObject *parent = nullptr);
+    ~LogWriter();
+
+    // fileName 为空时写到标准输出
+    bool open(const QString &fileName);
+    QString errorString() const;
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    LogSink *sink;
+    QFile file;
+    QAtomicInt stopping;
+
+    void writeBatch();
+};
+
+#endif // LOGWRITER_H
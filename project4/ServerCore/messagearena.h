@@ -0,0 +1,53 @@
+#ifndef MESSAGEARENA_H
+#define MESSAGEARENA_H
+
+#include <QtAlgorithms>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+// 一轮事件循环内处理消息用的临时字符串：string() 依次发出上轮留下的 QString，
+// 配合 Message::readString 解码字段时沿用它们已有的容量；本轮处理完调用 reset() 全部收回
+// 处理函数把字符串交给别处保留（写进聊天记录、投递到其他线程）也无妨：
+// 下次发出前发现它仍被共享，就放手换一块新的，保留者手里的内容不受影响
+// 每个 QString 单独分配一次后一直留着，发出的引用在本轮内不会因为扩容而失效
+// 只在所属线程使用
+class MessageArena
+{
+public:
+    MessageArena() = default;
+    ~MessageArena()
+    {
+        qDeleteAll(strings);
+    }
+
+    MessageArena(const MessageArena &) = delete;
+    MessageArena &operator=(const MessageArena &) = delete;
+
+    // 返回一个空串，只在本轮内有效
+    QString &string()
+    {
+        if (used == strings.size())
+            strings.append(new QString);
+        QString &text = *strings.at(used++);
+        if (text.isDetached()) {
+            // 与其他线程释放引用前的读取建立先后关系，之后才能改写
+            std::atomic_thread_fence(std::memory_order_acquire);
+            text.truncate(0);
+        } else {
+            text = QString();
+        }
+        return text;
+    }
+
+    void reset()
+    {
+        used = 0;
+    }
+
+private:
+    QVector<QString*> strings;
+    int used = 0;
+};
+
+#endif // MESSAGEARENA_H
@@ -0,0 +1,134 @@
+#include "metrics.h"
+#include "alloccounter.h"
+#include "chatserver.h"
+#include <chrono>
+#ifdef Q_OS_LINUX
+#include <QFile>
+#include <QList>
+#include <unistd.h>
+#endif
+
+namespace Metrics
+{
+
+qint64 nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+qint64 residentBytes()
+{
+#ifdef Q_OS_LINUX
+    // statm 第二项是常驻页数
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2)
+        return 0;
+    return fields.at(1).toLongLong() * ::sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+const qint64 LatencyBucketBoundsNs[LatencyBucketCount] = {
+    50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000, 1000000000
+};
+
+}
+
+void MetricsShard::observeBroadcastLatency(qint64 ns)
+{
+    int bucket = 0;
+    while (bucket < Metrics::LatencyBucketCount && ns > Metrics::LatencyBucketBoundsNs[bucket])
+        ++bucket;
+    Metrics::bump<quint64>(latencyBuckets[bucket]);
+    Metrics::bump<quint64>(latencyCount);
+    Metrics::bump<quint64>(latencySumNs, static_cast<quint64>(qMax<qint64>(ns, 0)));
+}
+
+void MetricsSnapshot::add(const MetricsShard &shard)
+{
+    connections += shard.connections.loadRelaxed();
+    connectionsTotal += shard.connectionsTotal.loadRelaxed();
+    logins += shard.logins.loadRelaxed();
+    loginFailures += shard.loginFailures.loadRelaxed();
+    messagesIn += shard.messagesIn.loadRelaxed();
+    messagesOut += shard.messagesOut.loadRelaxed();
+    bytesIn += shard.bytesIn.loadRelaxed();
+    bytesOut += shard.bytesOut.loadRelaxed();
+    parseFailures += shard.parseFailures.loadRelaxed();
+    rateLimited += shard.rateLimited.loadRelaxed();
+    globalLimited += shard.globalLimited.loadRelaxed();
+    floodActions += shard.floodActions.loadRelaxed();
+    handlerAllocations += shard.handlerAllocations.loadRelaxed();
+    for (int i = 0; i <= Metrics::LatencyBucketCount; ++i)
+        latencyBuckets[i] += shard.latencyBuckets[i].loadRelaxed();
+    latencyCount += shard.latencyCount.loadRelaxed();
+    latencySumNs += shard.latencySumNs.loadRelaxed();
+}
+
+static void appendMetric(QByteArray &out, const char *name, const char *type, const char *help,
+                         double value)
+{
+    out.append("# HELP ").append(name).append(' ').append(help).append('\n');
+    out.append("# TYPE ").append(name).append(' ').append(type).append('\n');
+    out.append(name).append(' ').append(QByteArray::number(value, 'g', 17)).append('\n');
+}
+
+QByteArray MetricsSnapshot::toPrometheus(const QueueStats &queue) const
+{
+    QByteArray out;
+    out.reserve(4096);
+    appendMetric(out, "chat_connections", "gauge", "Currently open client connections.", connections);
+    appendMetric(out, "chat_connections_total", "counter", "Accepted client connections.", connectionsTotal);
+    appendMetric(out, "chat_logins_total", "counter", "Successful logins.", logins);
+    appendMetric(out, "chat_login_failures_total", "counter", "Rejected logins.", loginFailures);
+    appendMetric(out, "chat_messages_in_total", "counter", "Messages received from clients.", messagesIn);
+    appendMetric(out, "chat_messages_out_total", "counter", "Frames handed to client sockets.", messagesOut);
+    appendMetric(out, "chat_bytes_in_total", "counter", "Bytes received from clients.", bytesIn);
+    appendMetric(out, "chat_bytes_out_total", "counter", "Bytes handed to client sockets.", bytesOut);
+    appendMetric(out, "chat_parse_failures_total", "counter", "Frames that failed to parse.", parseFailures);
+    appendMetric(out, "chat_rate_limited_total", "counter", "Chat messages dropped by per-connection rate limits.",
+                 rateLimited);
+    appendMetric(out, "chat_global_limited_total", "counter", "Chat messages dropped by the global ingress cap.",
+                 globalLimited);
+    appendMetric(out, "chat_flood_actions_total", "counter", "Connections muted or disconnected for flooding.",
+                 floodActions);
+    if (AllocCounter::isEnabled()) {
+        appendMetric(out, "chat_handler_allocations_total", "counter",
+                     "Heap allocations made while receiving, handling and writing messages.", handlerAllocations);
+        appendMetric(out, "chat_heap_allocations_total", "counter", "Heap allocations made by the whole process.",
+                     AllocCounter::totalAllocations());
+    }
+    const qint64 resident = Metrics::residentBytes();
+    if (resident > 0)
+        appendMetric(out, "chat_process_resident_bytes", "gauge", "Resident memory of the server process.", resident);
+    appendMetric(out, "chat_outbound_queue_bytes", "gauge", "Bytes waiting in outbound queues.", queue.queuedBytes);
+    appendMetric(out, "chat_congested_connections", "gauge", "Connections with a non-empty outbound queue.",
+                 queue.congestedConnections);
+    appendMetric(out, "chat_dropped_frames_total", "counter", "Frames dropped or coalesced for slow consumers.",
+                 queue.droppedFrames);
+    appendMetric(out, "chat_evicted_connections_total", "counter", "Slow consumers disconnected.",
+                 queue.evictedConnections);
+
+    const char *name = "chat_broadcast_latency_seconds";
+    out.append("# HELP ").append(name).append(" Time from broadcast to socket write, per recipient.\n");
+    out.append("# TYPE ").append(name).append(" histogram\n");
+    quint64 cumulative = 0;
+    for (int i = 0; i <= Metrics::LatencyBucketCount; ++i) {
+        cumulative += latencyBuckets[i];
+        const QByteArray le = i < Metrics::LatencyBucketCount
+                                  ? QByteArray::number(Metrics::LatencyBucketBoundsNs[i] / 1e9, 'g', 6)
+                                  : QByteArray("+Inf");
+        out.append(name).append("_bucket{le=\"").append(le).append("\"} ")
+            .append(QByteArray::number(cumulative)).append('\n');
+    }
+    out.append(name).append("_sum ").append(QByteArray::number(latencySumNs / 1e9, 'g', 17)).append('\n');
+    out.append(name).append("_count ").append(QByteArray::number(latencyCount)).append('\n');
+    return out;
+}
@@ -0,0 +1,78 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+
+struct QueueStats;
+
+namespace Metrics
+{
+// 单调时钟（纳秒），用于给广播帧打时间戳
+qint64 nowNs();
+// 进程当前的常驻内存（字节），不支持的平台返回 0；用于比较两种后端的每连接内存
+qint64 residentBytes();
+
+// 广播延迟直方图的桶上界（纳秒），最后还有一个 +Inf 桶
+const int LatencyBucketCount = 14;
+extern const qint64 LatencyBucketBoundsNs[LatencyBucketCount];
+
+// 计数器只有所属线程写入，普通的读-改-写即可，不需要带锁前缀的原子加
+template <typename T>
+inline void bump(QAtomicInteger<T> &counter, T value = 1)
+{
+    counter.storeRelaxed(counter.loadRelaxed() + value);
+}
+}
+
+// 每个分片一份的计数器：只由所属线程以 relaxed 原子操作累加，
+// 抓取时再由其他线程读取汇总，热路径上没有锁，也不会与其他分片争抢同一缓存行
+struct alignas(64) MetricsShard
+{
+    QAtomicInteger<qint64> connections{0};
+    QAtomicInteger<quint64> connectionsTotal{0};
+    QAtomicInteger<quint64> logins{0};
+    QAtomicInteger<quint64> loginFailures{0};
+    QAtomicInteger<quint64> messagesIn{0};
+    QAtomicInteger<quint64> messagesOut{0};
+    QAtomicInteger<quint64> bytesIn{0};
+    QAtomicInteger<quint64> bytesOut{0};
+    QAtomicInteger<quint64> parseFailures{0};
+    QAtomicInteger<quint64> rateLimited{0};     // 超出单连接速率被丢弃的消息
+    QAtomicInteger<quint64> globalLimited{0};   // 超出入口总上限被丢弃的消息
+    QAtomicInteger<quint64> floodActions{0};    // 因持续超速被禁言或断开的次数
+    QAtomicInteger<quint64> handlerAllocations{0};  // 收发处理期间的堆分配次数，只在分配计数模式下累计
+
+    QAtomicInteger<quint64> latencyBuckets[Metrics::LatencyBucketCount + 1];
+    QAtomicInteger<quint64> latencyCount{0};
+    QAtomicInteger<quint64> latencySumNs{0};
+
+    void observeBroadcastLatency(qint64 ns);
+};
+
+// 各分片计数的汇总值
+struct MetricsSnapshot
+{
+    qint64 connections = 0;
+    quint64 connectionsTotal = 0;
+    quint64 logins = 0;
+    quint64 loginFailures = 0;
+    quint64 messagesIn = 0;
+    quint64 messagesOut = 0;
+    quint64 bytesIn = 0;
+    quint64 bytesOut = 0;
+    quint64 parseFailures = 0;
+    quint64 rateLimited = 0;
+    quint64 globalLimited = 0;
+    quint64 floodActions = 0;
+    quint64 handlerAllocations = 0;
+    quint64 latencyBuckets[Metrics::LatencyBucketCount + 1] = {};
+    quint64 latencyCount = 0;
+    quint64 latencySumNs = 0;
+
+    void add(const MetricsShard &shard);
+    // Prometheus 文本格式
+    QByteArray toPrometheus(const QueueStats &queue) const;
+};
+
+#endif // METRICS_H
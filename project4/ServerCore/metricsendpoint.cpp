@@ -0,0 +1,46 @@
+#include "metricsendpoint.h"
+#include <QTcpSocket>
+
+// 请求头的长度上限，超过即断开
+static const int MaxRequestBytes = 8192;
+
+MetricsEndpoint::MetricsEndpoint(const std::function<QByteArray()> &render, QObject *parent)
+    : QTcpServer(parent)
+    , render(render)
+{
+    connect(this, &QTcpServer::newConnection, this, &MetricsEndpoint::onNewConnection);
+}
+
+void MetricsEndpoint::onNewConnection()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            if (socket->bytesAvailable() > MaxRequestBytes) {
+                socket->abort();
+                return;
+            }
+            // 等整个请求头到齐再应答
+            if (!socket->peek(MaxRequestBytes).contains("\r\n\r\n"))
+                return;
+
+            const QByteArray requestLine = socket->readLine();
+            socket->readAll();
+
+            QByteArray response;
+            if (requestLine.startsWith("GET ")) {
+                const QByteArray body = render();
+                response = "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" + body;
+            } else {
+                response = "HTTP/1.1 405 Method Not Allowed\r\n"
+                           "Content-Length: 0\r\n"
+                           "Connection: close\r\n\r\n";
+            }
+            socket->write(response);
+            socket->disconnectFromHost();
+        });
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef METRICSENDPOINT_H
+#define METRICSENDPOINT_H
+
+#include <QTcpServer>
+#include <functional>
+
+// 极简的 HTTP 指标端点：任何 GET 请求都返回 Prometheus 文本格式的全部指标
+// 运行在创建它的线程，每次抓取调用 render；Qt 后端与 epoll 后端各自提供指标文本
+class MetricsEndpoint : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsEndpoint(const std::function<QByteArray()> &render, QObject *parent = nullptr);
+
+private slots:
+    void onNewConnection();
+
+private:
+    std::function<QByteArray()> render;
+};
+
+#endif // METRICSENDPOINT_H
@@ -0,0 +1,271 @@
+#include "roomlog.h"
+#include <QCborArray>
+#include <QCborValue>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QPair>
+#include <QRandomGenerator>
+#include <algorithm>
+
+RoomLog::RoomLog(int capacity, int maxRooms, qint64 maxRoomBytes, qint64 maxTotalBytes)
+    : capacity(qMax(1, capacity)),
+      maxRooms(qMax(1, maxRooms)),
+      maxRoomBytes(qMax<qint64>(1, maxRoomBytes)),
+      maxTotalBytes(qMax<qint64>(1, maxTotalBytes)),
+      totalBytes(0),
+      chatEpoch(QRandomGenerator::global()->generate() | 1u)
+{
+}
+
+quint32 RoomLog::epoch() const
+{
+    QMutexLocker locker(&mutex);
+    return chatEpoch;
+}
+
+quint64 RoomLog::lastSeq(const QString &room) const
+{
+    QMutexLocker locker(&mutex);
+    const RoomPtr entry = findRoom(room);
+    // 还没有消息的房间从 seqFloor 起编号，刚进入的客户端也以它为起点
+    const quint64 floor = seqFloor;
+    locker.unlock();
+    if (!entry)
+        return floor;
+    QMutexLocker roomLocker(&entry->mutex);
+    return entry->lastSeq;
+}
+
+const RoomLog::Record &RoomLog::Room::at(int index) const
+{
+    return records.at((head + index) % records.size());
+}
+
+RoomLog::Record &RoomLog::Room::push(int capacity)
+{
+    // 前面丢过最旧的几条：空出来的格子就在有效部分之后
+    if (count < records.size()) {
+        Record &record = records[(head + count) % records.size()];
+        ++count;
+        return record;
+    }
+    if (records.size() < capacity) {
+        if (head != 0) {
+            std::rotate(records.begin(), records.begin() + head, records.end());
+            head = 0;
+        }
+        records.append(Record());
+        ++count;
+        return records.last();
+    }
+    Record &record = records[head];
+    bytes -= record.bytes();
+    head = (head + 1) % records.size();
+    return record;
+}
+
+void RoomLog::Room::popOldest()
+{
+    Record &record = records[head];
+    bytes -= record.bytes();
+    record.json = QByteArray();
+    record.cbor = QByteArray();
+    head = (head + 1) % records.size();
+    --count;
+}
+
+RoomLog::RoomPtr RoomLog::findRoom(const QString &room) const
+{
+    const RoomPtr entry = rooms.value(room);
+    if (entry)
+        entry->touched = ++clock;
+    return entry;
+}
+
+RoomLog::RoomPtr RoomLog::createRoom(const QString &room)
+{
+    if (rooms.size() >= maxRooms)
+        evictIdleRooms(maxRooms * 3 / 4, maxTotalBytes);
+    RoomPtr entry(new Room);
+    entry->lastSeq = seqFloor;
+    entry->touched = ++clock;
+    rooms.insert(room, entry);
+    return entry;
+}
+
+// 一次淘汰到上限的四分之三，房间名不断变化时排序的开销分摊到多次新建上
+void RoomLog::evictIdleRooms(int keepRooms, qint64 keepBytes, const Room *keep)
+{
+    QVector<QPair<quint64, QString>> ages;
+    ages.reserve(rooms.size());
+    for (auto it = rooms.cbegin(); it != rooms.cend(); ++it) {
+        if (it.value().data() != keep)
+            ages.append(qMakePair(it.value()->touched, it.key()));
+    }
+    std::sort(ages.begin(), ages.end());
+
+    for (const auto &age : qAsConst(ages)) {
+        if (rooms.size() <= keepRooms && totalBytes.loadRelaxed() <= keepBytes)
+            break;
+        const RoomPtr entry = rooms.take(age.second);
+        QMutexLocker roomLocker(&entry->mutex);
+        seqFloor = qMax(seqFloor, entry->lastSeq);
+        entry->evicted = true;
+        totalBytes.fetchAndAddRelaxed(-entry->bytes);
+        entry->bytes = 0;
+    }
+}
+
+// 格子只被本类持有：先 reserve 过的 QByteArray 在 resize(0) 后保留容量，覆盖旧消息时不再分配；
+// 放过一条长消息的格子比需要的大出很多时换一块合适的，不让它一直占着
+void RoomLog::store(QByteArray &slot, const char *data, int size)
+{
+    const int wanted = qMax(size, 256);
+    if (slot.capacity() > 4 * wanted)
+        slot = QByteArray();
+    slot.resize(0);
+    if (slot.capacity() < size)
+        slot.reserve(wanted);
+    slot.append(data, size);
+}
+
+void RoomLog::fill(Room &room, quint64 seq, const char *json, int jsonSize, const char *cbor, int cborSize)
+{
+    const qint64 before = room.bytes;
+    Record &record = room.push(capacity);
+    record.seq = seq;
+    store(record.json, json, jsonSize);
+    store(record.cbor, cbor, cborSize);
+    room.bytes += record.bytes();
+    // 至少留下最新的一条
+    while (room.bytes > maxRoomBytes && room.count > 1)
+        room.popOldest();
+    totalBytes.fetchAndAddRelaxed(room.bytes - before);
+}
+
+// 分配序号、编码与放进缓冲在同一房间的锁内完成，缓冲里的序号因此总是连续的；
+// 房间表的锁只在查找与超出总字节数淘汰房间时持有，不同房间的广播可以同时编码
+Frame RoomLog::append(const QString &room, const QString &sender, const QString &message, qint64 historyId)
+{
+    const qint64 timestamp = QDateTime::currentMSecsSinceEpoch();
+    for (;;) {
+        QMutexLocker locker(&mutex);
+        RoomPtr entry = findRoom(room);
+        if (!entry)
+            entry = createRoom(room);
+        locker.unlock();
+
+        QMutexLocker roomLocker(&entry->mutex);
+        // 查找与加锁之间房间被淘汰了：它的序号已计入 seqFloor，换到新建的房间上
+        if (entry->evicted)
+            continue;
+        const quint64 seq = ++entry->lastSeq;
+        const Frame frame = Frames::chatMessage(sender, message, room, historyId, seq, timestamp);
+        fill(*entry, seq, frame.json.constData(), frame.json.size() - 1,
+             frame.cbor.constData() + Wire::HeaderSize, frame.cbor.size() - Wire::HeaderSize);
+        roomLocker.unlock();
+
+        if (totalBytes.loadRelaxed() > maxTotalBytes) {
+            locker.relock();
+            evictIdleRooms(maxRooms, maxTotalBytes * 3 / 4, entry.data());
+        }
+        return frame;
+    }
+}
+
+Frame RoomLog::range(const QString &room, quint64 after, quint64 until, int compressThreshold) const
+{
+    QMutexLocker locker(&mutex);
+    const RoomPtr found = findRoom(room);
+    const quint32 currentEpoch = chatEpoch;
+    Room empty;
+    empty.lastSeq = seqFloor;
+    locker.unlock();
+
+    QMutexLocker roomLocker(found ? &found->mutex : &empty.mutex);
+    const Room &entry = found ? *found : empty;
+
+    const quint64 last = entry.lastSeq;
+    if (until == 0 || until > last)
+        until = last;
+    const quint64 oldest = last + 1 - static_cast<quint64>(entry.count);
+    const bool complete = after >= until || after + 1 >= oldest;
+
+    // 元素直接引用缓冲里的格子，chatRange 拼接时复制，之后才放锁
+    QByteArrayList jsonItems;
+    QByteArrayList cborItems;
+    for (quint64 seq = qMax(after + 1, oldest); seq <= until && jsonItems.size() < MaxRangeMessages; ++seq) {
+        const Record &record = entry.at(static_cast<int>(seq - oldest));
+        jsonItems.append(QByteArray::fromRawData(record.json.constData(), record.json.size()));
+        cborItems.append(QByteArray::fromRawData(record.cbor.constData(), record.cbor.size()));
+    }
+    Frame frame = Frames::chatRange(room, currentEpoch, after, last, complete, jsonItems, cborItems);
+    roomLocker.unlock();
+
+    Frames::compress(frame, compressThreshold);
+    return frame;
+}
+
+QCborMap RoomLog::exportState() const
+{
+    QMutexLocker locker(&mutex);
+    QCborMap exported;
+    for (auto it = rooms.cbegin(); it != rooms.cend(); ++it) {
+        const Room &room = *it.value();
+        QMutexLocker roomLocker(&room.mutex);
+        QCborArray json;
+        QCborArray cbor;
+        for (int i = 0; i < room.count; ++i) {
+            json.append(room.at(i).json);
+            cbor.append(room.at(i).cbor);
+        }
+        exported.insert(it.key(), QCborMap{{QStringLiteral("seq"), static_cast<qint64>(room.lastSeq)},
+                                           {QStringLiteral("json"), json},
+                                           {QStringLiteral("cbor"), cbor}});
+    }
+    return QCborMap{{QStringLiteral("epoch"), static_cast<qint64>(chatEpoch)},
+                    {QStringLiteral("floor"), static_cast<qint64>(seqFloor)},
+                    {QStringLiteral("rooms"), exported}};
+}
+
+void RoomLog::importState(const QCborMap &state)
+{
+    const quint32 epoch = static_cast<quint32>(state.value(QLatin1String("epoch")).toInteger());
+    if (epoch == 0)
+        return;
+
+    QMutexLocker locker(&mutex);
+    chatEpoch = epoch;
+    seqFloor = static_cast<quint64>(state.value(QLatin1String("floor")).toInteger());
+    for (const RoomPtr &entry : qAsConst(rooms)) {
+        QMutexLocker roomLocker(&entry->mutex);
+        entry->evicted = true;
+        totalBytes.fetchAndAddRelaxed(-entry->bytes);
+        entry->bytes = 0;
+    }
+    rooms.clear();
+    const QCborMap exported = state.value(QLatin1String("rooms")).toMap();
+    for (auto it = exported.cbegin(); it != exported.cend(); ++it) {
+        const QCborMap map = it.value().toMap();
+        const QCborArray json = map.value(QLatin1String("json")).toArray();
+        const QCborArray cbor = map.value(QLatin1String("cbor")).toArray();
+        RoomPtr entry(new Room);
+        Room &room = *entry;
+        room.lastSeq = static_cast<quint64>(map.value(QLatin1String("seq")).toInteger());
+        room.touched = ++clock;
+        rooms.insert(it.key().toString(), entry);
+
+        // 缓冲里的序号连续，最后一条就是 lastSeq
+        const int count = static_cast<int>(qMin(qMin(json.size(), cbor.size()),
+                                                static_cast<qsizetype>(room.lastSeq)));
+        QMutexLocker roomLocker(&room.mutex);
+        for (int i = qMax(0, count - capacity); i < count; ++i) {
+            const QByteArray jsonItem = json.at(i).toByteArray();
+            const QByteArray cborItem = cbor.at(i).toByteArray();
+            fill(room, room.lastSeq - static_cast<quint64>(count - 1 - i),
+                 jsonItem.constData(), jsonItem.size(), cborItem.constData(), cborItem.size());
+        }
+    }
+    if (rooms.size() > maxRooms || totalBytes.loadRelaxed() > maxTotalBytes)
+        evictIdleRooms(maxRooms, maxTotalBytes * 3 / 4);
+}
@@ -0,0 +1,104 @@
+#ifndef ROOMLOG_H
+#define ROOMLOG_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QCborMap>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include "frames.h"
+
+// 聊天消息的房间内序号：每条广播前在这里分到该房间严格递增的 seq 与服务器时间戳 ts，
+// 每个房间最近 capacity 条的编码留在内存环形缓冲里
+// 各分片的广播可能交错到达，客户端按 seq 排序显示；序号有缺口且一会儿仍没补上，
+// 就发 chat_sync 只取缺的那一段，短暂断线后续连也只补这一段
+// 序号属于一个纪元（进程启动时随机生成，热重启时交接）；客户端看到纪元变了就丢弃手里的序号
+// 内存按条数和字节数双重限制：每个房间的缓冲超过 maxRoomBytes 时先丢最旧的几条；
+// 房间数超过 maxRooms 或全部缓冲超过 maxTotalBytes 时淘汰最久没有收发的那一批房间。
+// 之后再用到的房间从所有被淘汰房间的最大序号接着编号，同一纪元内房间的序号不会倒退，只会出现补不上的缺口
+// 内部加锁，可在任意线程调用：房间表一把锁只管查找，每个房间另有自己的锁，不同房间的编码互不等待
+class RoomLog
+{
+public:
+    static const int DefaultCapacity = 1024;
+    // 一次 chat_range 最多带这么多条，客户端收到后按最后一条的序号接着要
+    static const int MaxRangeMessages = 256;
+    static const int DefaultMaxRooms = 4096;
+    static const qint64 DefaultMaxRoomBytes = 2 * 1024 * 1024;
+    static const qint64 DefaultMaxTotalBytes = 64 * 1024 * 1024;
+
+    explicit RoomLog(int capacity = DefaultCapacity, int maxRooms = DefaultMaxRooms,
+                     qint64 maxRoomBytes = DefaultMaxRoomBytes, qint64 maxTotalBytes = DefaultMaxTotalBytes);
+
+    RoomLog(const RoomLog &) = delete;
+    RoomLog &operator=(const RoomLog &) = delete;
+
+    quint32 epoch() const;
+    // 房间当前的最新序号，没有消息时为 0（有房间被淘汰过时为 seqFloor）；作为刚进入房间的客户端的起点
+    quint64 lastSeq(const QString &room) const;
+    // 登记一条聊天，返回带 seq/ts 的 chat_message 帧；historyId 为聊天记录中的序号，没有时为 0
+    Frame append(const QString &room, const QString &sender, const QString &message, qint64 historyId = 0);
+    // 房间内 seq 在 (after, until] 之间的消息，until 为 0 表示到最新；
+    // 缺口里有已被环形缓冲淘汰的消息时 complete 为 false，客户端只能拿到还留着的部分
+    Frame range(const QString &room, quint64 after, quint64 until, int compressThreshold = 0) const;
+
+    // 热重启交接：纪元、各房间的序号与缓冲中的消息
+    QCborMap exportState() const;
+    void importState(const QCborMap &state);
+
+private:
+    // 环形缓冲的一格；json 为去掉行尾换行的对象文本，cbor 为去掉长度前缀的 map，
+    // 格子的容量复用，只在放进比原来小得多的消息时收缩
+    struct Record
+    {
+        quint64 seq = 0;
+        QByteArray json;
+        QByteArray cbor;
+
+        qint64 bytes() const { return json.capacity() + cbor.capacity(); }
+    };
+
+    struct Room
+    {
+        mutable QMutex mutex;       // 保护以下各项；持有时不再去拿房间表的锁
+        quint64 lastSeq = 0;
+        QVector<Record> records;    // 环形缓冲的格子，从 head 起 count 条有效
+        int head = 0;
+        int count = 0;
+        qint64 bytes = 0;           // 有效各条的 Record::bytes() 之和
+        bool evicted = false;       // 已从房间表移除，拿到它的 append 须重新查找
+        quint64 touched = 0;        // 最近一次被用到时的 clock，由 RoomLog::mutex 保护
+
+        const Record &at(int index) const;     // 0 为最旧的一条
+        // 取一格写入最新的一条，满了覆盖最旧的；调用方写完后把新的 bytes() 加回 bytes
+        Record &push(int capacity);
+        void popOldest();
+    };
+    typedef QSharedPointer<Room> RoomPtr;
+
+    // 以下须持有 mutex 调用
+    RoomPtr findRoom(const QString &room) const;
+    RoomPtr createRoom(const QString &room);
+    // 按最久未用的顺序淘汰房间，直到房间数不超过 keepRooms、总字节数不超过 keepBytes；keep 不淘汰
+    void evictIdleRooms(int keepRooms, qint64 keepBytes, const Room *keep = nullptr);
+
+    mutable QMutex mutex;       // 保护房间表、各房间的 touched、clock 与 seqFloor
+    int capacity;
+    int maxRooms;
+    qint64 maxRoomBytes;
+    qint64 maxTotalBytes;
+    QAtomicInteger<qint64> totalBytes;      // 各房间 bytes 之和，在房间锁内增减
+    quint32 chatEpoch;
+    QHash<QString, RoomPtr> rooms;
+    mutable quint64 clock = 0;
+    quint64 seqFloor = 0;       // 被淘汰房间的最大序号，新建的房间从这里接着编号
+
+    static void store(QByteArray &slot, const char *data, int size);
+    // 把一条放进房间的缓冲并按 maxRoomBytes 丢掉最旧的，同步更新 totalBytes；须持有房间的锁
+    void fill(Room &room, quint64 seq, const char *json, int jsonSize, const char *cbor, int cborSize);
+};
+
+#endif // ROOMLOG_H
@@ -0,0 +1,53 @@
+# 服务器核心：图形界面版 ServerApp 与无界面版 ServerDaemon 共用
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+include(../Common/common.pri)
+
+SOURCES += \
+    $$PWD/alloccounter.cpp \
+    $$PWD/chatserver.cpp \
+    $$PWD/chatworker.cpp \
+    $$PWD/clientregistry.cpp \
+    $$PWD/clusterbus.cpp \
+    $$PWD/frames.cpp \
+    $$PWD/handoff.cpp \
+    $$PWD/historystore.cpp \
+    $$PWD/logsink.cpp \
+    $$PWD/logwriter.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/metricsendpoint.cpp \
+    $$PWD/roomlog.cpp \
+    $$PWD/serveroptions.cpp
+
+HEADERS += \
+    $$PWD/alloccounter.h \
+    $$PWD/bufferpool.h \
+    $$PWD/chatserver.h \
+    $$PWD/chatworker.h \
+    $$PWD/clientregistry.h \
+    $$PWD/clusterbus.h \
+    $$PWD/frames.h \
+    $$PWD/handoff.h \
+    $$PWD/historystore.h \
+    $$PWD/logsink.h \
+    $$PWD/logwriter.h \
+    $$PWD/messagearena.h \
+    $$PWD/metrics.h \
+    $$PWD/metricsendpoint.h \
+    $$PWD/roomlog.h \
+    $$PWD/serveroptions.h \
+    $$PWD/tokenbucket.h
+
+# 堆分配计数模式：qmake CONFIG+=alloc_counter，接管 glibc 的 malloc 统计每条消息的分配次数
+linux:alloc_counter {
+    DEFINES += CHAT_ALLOC_COUNTER
+}
+
+# epoll 后端只在 Linux 上编译，供 ServerDaemon --backend epoll 使用
+linux {
+    SOURCES += $$PWD/epollserver.cpp
+    HEADERS += \
+        $$PWD/epollserver.h \
+        $$PWD/slaballocator.h
+}
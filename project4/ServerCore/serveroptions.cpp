@@ -0,0 +1,279 @@
+#include "serveroptions.h"
+#include "handoff.h"
+#include <QCommandLineParser>
+#include <QFile>
+#include <QHostAddress>
+#include <QStandardPaths>
+
+void ServerOptions::addOptions(QCommandLineParser &parser)
+{
+    parser.addOption(QCommandLineOption(QStringList() << "w" << "workers",
+                                        "连接分片的工作线程数，0 表示在主线程处理所有连接。",
+                                        "n", "0"));
+    parser.addOption(QCommandLineOption(QStringList() << "p" << "port",
+                                        "监听端口。", "port", "8888"));
+    parser.addOption(QCommandLineOption("max-queue",
+                                        "每个连接出站积压的上限（KB）。", "kb", "1024"));
+    parser.addOption(QCommandLineOption("slow-policy",
+                                        "积压超限时的处理方式：drop-oldest、coalesce 或 disconnect。",
+                                        "policy", "drop-oldest"));
+    parser.addOption(QCommandLineOption("history-dir",
+                                        "聊天记录目录，传入空字符串则不保存。缺省为数据目录下的 history，"
+                                        "指定了 --node-id 或非默认端口时为 history-<节点 id 或端口>，"
+                                        "同一台机器上的多个节点互不干扰。",
+                                        "dir"));
+    parser.addOption(QCommandLineOption("history-replay",
+                                        "登录时回放的最近消息条数。", "n", "50"));
+    parser.addOption(QCommandLineOption("msg-rate",
+                                        "每个连接每秒允许的聊天消息数，0 表示不限。", "n", "5"));
+    parser.addOption(QCommandLineOption("msg-burst",
+                                        "每个连接允许的突发消息数。", "n", "10"));
+    parser.addOption(QCommandLineOption("global-rate",
+                                        "全服务器每秒接受的聊天消息总数，0 表示不限。", "n", "0"));
+    parser.addOption(QCommandLineOption("flood-policy",
+                                        "持续超速的连接如何处理：mute 或 disconnect。", "policy", "mute"));
+    parser.addOption(QCommandLineOption("batch-window",
+                                        "聊天消息合批窗口（毫秒），0 表示不合批。", "ms", "5"));
+    parser.addOption(QCommandLineOption("batch-bytes",
+                                        "单个合批帧的大小上限（字节）。", "bytes", "16384"));
+    parser.addOption(QCommandLineOption("idle-timeout",
+                                        "连接空闲多少秒后回收，0 表示不回收；空闲一半时先发心跳。",
+                                        "s", "60"));
+    parser.addOption(QCommandLineOption("chat-log",
+                                        "是否把每条聊天内容写进日志：on 或 off。", "on|off", "on"));
+    parser.addOption(QCommandLineOption("resume-grace",
+                                        "断线后保留昵称与会话的秒数，期间客户端可凭令牌续连；0 表示关闭。",
+                                        "s", "60"));
+    parser.addOption(QCommandLineOption("drain-spread",
+                                        "停机或热重启排空连接时，客户端重连错开的秒数。", "s", "10"));
+    parser.addOption(QCommandLineOption("compress-threshold",
+                                        "协商了压缩的 CBOR 连接上，负载达到多少字节的帧压缩发送；0 表示不启用压缩。",
+                                        "bytes", QString::number(Wire::DefaultCompressThreshold)));
+    parser.addOption(QCommandLineOption("metrics-port",
+                                        "本机 HTTP 指标端点的端口（常用 9464），缺省为 0 即关闭；"
+                                        "同一台机器上的多个节点须各用不同端口。", "port", "0"));
+    parser.addOption(QCommandLineOption("node-id",
+                                        "集群中本节点的 id；不指定时单机运行。", "id"));
+    parser.addOption(QCommandLineOption("cluster-port",
+                                        "集群节点之间互连的端口。", "port", "0"));
+    parser.addOption(QCommandLineOption("cluster-bind",
+                                        "集群端口监听的地址；应只开放给其他节点所在的内网。",
+                                        "address", "0.0.0.0"));
+    parser.addOption(QCommandLineOption("cluster-secret-file",
+                                        "存放集群共享密钥的文件，所有节点须相同；节点互连时据此互相认证。"
+                                        "不指定时不做认证，集群端口只能放在可信网络中。",
+                                        "file"));
+    parser.addOption(QCommandLineOption("peer",
+                                        "集群中的其他节点，格式为 id@host:port，可重复指定；"
+                                        "所有节点须配置相同的一组节点。",
+                                        "node"));
+
+    // 以下两项由热重启的旧进程传给新进程，不在帮助中列出
+    QCommandLineOption inheritOption(QLatin1String(Handoff::InheritListenerOption),
+                                     "继承的监听套接字描述符。", "fd");
+    QCommandLineOption handoffOption(QLatin1String(Handoff::StateFileOption),
+                                     "上一进程留下的交接状态文件。", "file");
+    inheritOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    handoffOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOption(inheritOption);
+    parser.addOption(handoffOption);
+}
+
+QString ServerOptions::defaultHistoryDir(const QString &nodeId, quint16 port)
+{
+    const QString base = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!nodeId.isEmpty())
+        return base + "/history-" + nodeId;
+    if (port != 8888)
+        return base + "/history-" + QString::number(port);
+    return base + "/history";
+}
+
+bool ServerOptions::parse(const QCommandLineParser &parser, QString *errorMessage)
+{
+    bool ok = false;
+    workerCount = parser.value("workers").toInt(&ok);
+    if (!ok || workerCount < 0) {
+        *errorMessage = QString("无效的工作线程数：%1").arg(parser.value("workers"));
+        return false;
+    }
+
+    port = parser.value("port").toUShort(&ok);
+    if (!ok) {
+        *errorMessage = QString("无效的端口：%1").arg(parser.value("port"));
+        return false;
+    }
+
+    const qint64 maxQueueKb = parser.value("max-queue").toLongLong(&ok);
+    if (!ok || maxQueueKb <= 0) {
+        *errorMessage = QString("无效的积压上限：%1").arg(parser.value("max-queue"));
+        return false;
+    }
+    maxQueuedBytes = maxQueueKb * 1024;
+
+    if (!ChatServer::policyFromName(parser.value("slow-policy"), &slowConsumerPolicy)) {
+        *errorMessage = QString("未知的慢连接策略：%1").arg(parser.value("slow-policy"));
+        return false;
+    }
+
+    historyReplay = parser.value("history-replay").toInt(&ok);
+    if (!ok || historyReplay < 0) {
+        *errorMessage = QString("无效的回放条数：%1").arg(parser.value("history-replay"));
+        return false;
+    }
+
+    messageRate = parser.value("msg-rate").toDouble(&ok);
+    if (!ok || messageRate < 0) {
+        *errorMessage = QString("无效的消息速率：%1").arg(parser.value("msg-rate"));
+        return false;
+    }
+    messageBurst = parser.value("msg-burst").toDouble(&ok);
+    if (!ok || messageBurst < 1) {
+        *errorMessage = QString("无效的突发消息数：%1").arg(parser.value("msg-burst"));
+        return false;
+    }
+    globalRate = parser.value("global-rate").toDouble(&ok);
+    if (!ok || globalRate < 0) {
+        *errorMessage = QString("无效的入口上限：%1").arg(parser.value("global-rate"));
+        return false;
+    }
+    if (!ChatServer::floodPolicyFromName(parser.value("flood-policy"), &floodPolicy)) {
+        *errorMessage = QString("未知的刷屏处理方式：%1").arg(parser.value("flood-policy"));
+        return false;
+    }
+
+    batchWindow = parser.value("batch-window").toInt(&ok);
+    if (!ok || batchWindow < 0) {
+        *errorMessage = QString("无效的合批窗口：%1").arg(parser.value("batch-window"));
+        return false;
+    }
+    batchBytes = parser.value("batch-bytes").toInt(&ok);
+    if (!ok || batchBytes <= 0) {
+        *errorMessage = QString("无效的合批大小：%1").arg(parser.value("batch-bytes"));
+        return false;
+    }
+
+    idleTimeout = parser.value("idle-timeout").toInt(&ok);
+    if (!ok || idleTimeout < 0) {
+        *errorMessage = QString("无效的空闲超时：%1").arg(parser.value("idle-timeout"));
+        return false;
+    }
+
+    const QString chatLogValue = parser.value("chat-log");
+    if (chatLogValue != "on" && chatLogValue != "off") {
+        *errorMessage = QString("无效的聊天日志开关：%1").arg(chatLogValue);
+        return false;
+    }
+    chatLog = chatLogValue == "on";
+
+    resumeGrace = parser.value("resume-grace").toInt(&ok);
+    if (!ok || resumeGrace < 0) {
+        *errorMessage = QString("无效的续连保留期：%1").arg(parser.value("resume-grace"));
+        return false;
+    }
+
+    drainSpread = parser.value("drain-spread").toInt(&ok);
+    if (!ok || drainSpread < 0) {
+        *errorMessage = QString("无效的重连错开时间：%1").arg(parser.value("drain-spread"));
+        return false;
+    }
+
+    compressThreshold = parser.value("compress-threshold").toInt(&ok);
+    if (!ok || compressThreshold < 0) {
+        *errorMessage = QString("无效的压缩阈值：%1").arg(parser.value("compress-threshold"));
+        return false;
+    }
+
+    metricsPort = parser.value("metrics-port").toUShort(&ok);
+    if (!ok) {
+        *errorMessage = QString("无效的指标端口：%1").arg(parser.value("metrics-port"));
+        return false;
+    }
+
+    nodeId = parser.value("node-id");
+    clusterPort = parser.value("cluster-port").toUShort(&ok);
+    if (!ok) {
+        *errorMessage = QString("无效的集群端口：%1").arg(parser.value("cluster-port"));
+        return false;
+    }
+    clusterBind = parser.value("cluster-bind");
+    if (QHostAddress(clusterBind).isNull()) {
+        *errorMessage = QString("无效的集群监听地址：%1").arg(clusterBind);
+        return false;
+    }
+    // 密钥放在文件里而不是命令行上，避免出现在进程列表中
+    const QString secretFile = parser.value("cluster-secret-file");
+    if (!secretFile.isEmpty()) {
+        QFile file(secretFile);
+        if (!file.open(QIODevice::ReadOnly)) {
+            *errorMessage = QString("无法读取集群密钥文件 %1：%2").arg(secretFile).arg(file.errorString());
+            return false;
+        }
+        clusterSecret = file.readAll().trimmed();
+        if (clusterSecret.isEmpty()) {
+            *errorMessage = QString("集群密钥文件为空：%1").arg(secretFile);
+            return false;
+        }
+    }
+    // 缺省目录与节点 id、端口有关，放在它们之后确定
+    historyDir = parser.isSet("history-dir") ? parser.value("history-dir") : defaultHistoryDir(nodeId, port);
+
+    peers = parser.values("peer");
+    if (nodeId.isEmpty() && !peers.isEmpty()) {
+        *errorMessage = "指定了 --peer 但没有指定 --node-id";
+        return false;
+    }
+    if (!nodeId.isEmpty() && clusterPort == 0) {
+        *errorMessage = "集群模式需要指定 --cluster-port";
+        return false;
+    }
+
+    const QString inherited = parser.value(QLatin1String(Handoff::InheritListenerOption));
+    if (!inherited.isEmpty()) {
+        inheritedListener = inherited.toLongLong(&ok);
+        if (!ok || inheritedListener < 0) {
+            *errorMessage = QString("无效的监听套接字描述符：%1").arg(inherited);
+            return false;
+        }
+    }
+    handoffFile = parser.value(QLatin1String(Handoff::StateFileOption));
+    return true;
+}
+
+bool ServerOptions::applyTo(ChatServer *server, QString *errorMessage) const
+{
+    server->setOutboundLimit(maxQueuedBytes, slowConsumerPolicy);
+    server->setIdleTimeout(idleTimeout);
+    server->setChatLogging(chatLog);
+    server->setResumeGrace(resumeGrace);
+    server->setDrainSpread(drainSpread);
+    server->setBatching(batchWindow, batchBytes);
+    server->setRateLimit(messageRate, messageBurst, globalRate, floodPolicy);
+    server->setCompressThreshold(compressThreshold);
+    if (!historyDir.isEmpty() && !server->enableHistory(historyDir, historyReplay, errorMessage))
+        return false;
+    if (metricsPort != 0 && !server->enableMetrics(metricsPort, errorMessage))
+        return false;
+    if (!nodeId.isEmpty() && !server->enableCluster(nodeId, QHostAddress(clusterBind), clusterPort,
+                                                       peers, clusterSecret, errorMessage))
+        return false;
+    if (!handoffFile.isEmpty() && !Handoff::restore(server, handoffFile, errorMessage))
+        return false;
+    return true;
+}
+
+bool ServerOptions::listen(ChatServer *server, QString *errorMessage) const
+{
+    if (inheritedListener >= 0) {
+        if (!server->setSocketDescriptor(inheritedListener)) {
+            *errorMessage = QString("无法接管继承的监听套接字：%1").arg(server->errorString());
+            return false;
+        }
+        return true;
+    }
+    if (!server->listen(QHostAddress::Any, port)) {
+        *errorMessage = server->errorString();
+        return false;
+    }
+    return true;
+}
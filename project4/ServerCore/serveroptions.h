@@ -0,0 +1,55 @@
+#ifndef SERVEROPTIONS_H
+#define SERVEROPTIONS_H
+
+#include <QString>
+#include <QStringList>
+#include "chatserver.h"
+
+QT_BEGIN_NAMESPACE
+class QCommandLineParser;
+QT_END_NAMESPACE
+
+// ServerApp 与 ServerDaemon 共用的命令行选项
+struct ServerOptions
+{
+    int workerCount = 0;
+    quint16 port = 8888;
+    qint64 maxQueuedBytes = 1024 * 1024;
+    ChatServer::SlowConsumerPolicy slowConsumerPolicy = ChatServer::DropOldest;
+    QString historyDir;         // 为空时不保存聊天记录；未指定时见 defaultHistoryDir()
+    int historyReplay = 50;     // 登录时回放的最近消息条数
+    double messageRate = 5;     // 每连接 chat_message 速率（条/秒），0 表示不限
+    double messageBurst = 10;
+    double globalRate = 0;      // 全服务器入口上限（条/秒），0 表示不限
+    ChatServer::FloodPolicy floodPolicy = ChatServer::Mute;
+    int batchWindow = 5;        // 合批窗口（毫秒），0 表示不合批
+    int batchBytes = 16 * 1024;
+    int idleTimeout = 60;       // 空闲回收时间（秒），0 表示关闭
+    bool chatLog = true;        // 每条聊天内容是否写进日志
+    int resumeGrace = 60;       // 断线续连保留期（秒），0 表示关闭
+    int drainSpread = 10;       // 排空时客户端重连错开的时间窗（秒）
+    int compressThreshold = Wire::DefaultCompressThreshold; // 压缩阈值（字节），0 表示不接受压缩协商
+    quint16 metricsPort = 0;    // 本机指标端点，0 表示关闭
+    // 集群模式：nodeId 为空时单机运行
+    QString nodeId;
+    quint16 clusterPort = 0;
+    QString clusterBind = QStringLiteral("0.0.0.0");   // 集群端口监听的地址
+    QByteArray clusterSecret;   // 节点间握手的共享密钥，为空时不认证
+    QStringList peers;          // id@host:port
+    // 热重启时由旧进程传入：继承的监听套接字（-1 表示自行监听 port）与交接状态文件
+    qintptr inheritedListener = -1;
+    QString handoffFile;
+
+    static void addOptions(QCommandLineParser &parser);
+    // 同一台机器上可以跑多个节点，各自的聊天记录不能写进同一个目录：
+    // 单机且用默认端口时为 <数据目录>/history，否则按节点 id（没有时按端口）区分
+    static QString defaultHistoryDir(const QString &nodeId, quint16 port);
+    // 选项取值非法时返回 false，并写入 errorMessage
+    bool parse(const QCommandLineParser &parser, QString *errorMessage);
+    // 须在 listen() 之前调用；失败时返回 false，并写入 errorMessage
+    bool applyTo(ChatServer *server, QString *errorMessage) const;
+    // 监听 port，或接管继承来的监听套接字
+    bool listen(ChatServer *server, QString *errorMessage) const;
+};
+
+#endif // SERVEROPTIONS_H
@@ -0,0 +1,44 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <QtGlobal>
+
+// 令牌桶：按 rate 每秒匀速补充，最多攒 burst 个；rate 为 0 表示不限
+// 只在所属线程使用，不加锁
+class TokenBucket
+{
+public:
+    TokenBucket()
+        : rate(0), burst(0), tokens(0), lastNs(0)
+    {
+    }
+
+    void configure(double rate, double burst)
+    {
+        this->rate = rate;
+        this->burst = qMax(burst, 1.0);
+        tokens = this->burst;
+        lastNs = 0;
+    }
+
+    bool tryTake(qint64 nowNs)
+    {
+        if (rate <= 0)
+            return true;
+        if (lastNs != 0)
+            tokens = qMin(burst, tokens + rate * (nowNs - lastNs) / 1e9);
+        lastNs = nowNs;
+        if (tokens < 1.0)
+            return false;
+        tokens -= 1.0;
+        return true;
+    }
+
+private:
+    double rate;
+    double burst;
+    double tokens;
+    qint64 lastNs;
+};
+
+#endif // TOKENBUCKET_H
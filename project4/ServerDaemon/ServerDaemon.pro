@@ -0,0 +1,13 @@
+QT       += core network
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = ServerDaemon
+TEMPLATE = app
+
+include(../ServerCore/servercore.pri)
+
+SOURCES += \
+    main.cpp
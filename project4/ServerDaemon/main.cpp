@@ -0,0 +1,192 @@
+#include "chatserver.h"
+#ifdef Q_OS_LINUX
+#include "epollserver.h"
+#endif
+#include "handoff.h"
+#include "logwriter.h"
+#include "serveroptions.h"
+
+#include <QAtomicPointer>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <csignal>
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 信号处理函数里只能做异步信号安全的调用，QCoreApplication::quit() 不在其列：
+// 处理函数只往管道写一个字节（SIGHUP 写 'H'，SIGINT/SIGTERM 写 'Q'），由事件循环读出后再退出或排空、交接
+static int signalPipe[2] = {-1, -1};
+
+static void signalToPipe(int signal)
+{
+    const char byte = signal == SIGHUP ? 'H' : 'Q';
+    (void)!::write(signalPipe[1], &byte, 1);
+}
+#endif
+
+#ifdef Q_OS_LINUX
+// epoll 后端运行期间指向它；SIGINT/SIGTERM 的处理函数调用 stop()，那里只有原子写与 write(2)
+static QAtomicPointer<EpollServer> runningEpoll;
+
+static void stopEpoll(int)
+{
+    if (EpollServer *server = runningEpoll.loadAcquire())
+        server->stop();
+}
+#endif
+
+#ifdef Q_OS_LINUX
+// epoll 后端：只用到与 JSON 行协议有关的选项，其余选项只对 Qt 后端有效
+static int runEpoll(QCoreApplication &a, const ServerOptions &options, const QString &logFile)
+{
+    EpollServer server;
+    server.setOutboundLimit(options.maxQueuedBytes);
+    server.setRateLimit(options.messageRate, options.messageBurst);
+    server.setChatLogging(options.chatLog);
+    QString errorMessage;
+    if (!options.historyDir.isEmpty()
+        && !server.enableHistory(options.historyDir, options.historyReplay, &errorMessage)) {
+        qCritical("%s", qPrintable(errorMessage));
+        return 1;
+    }
+    if (options.metricsPort != 0 && !server.enableMetrics(options.metricsPort, &errorMessage)) {
+        qCritical("%s", qPrintable(errorMessage));
+        return 1;
+    }
+
+    LogWriter logWriter(server.logSink());
+    if (!logWriter.open(logFile)) {
+        qCritical("无法打开日志文件: %s", qPrintable(logWriter.errorString()));
+        return 1;
+    }
+    logWriter.start();
+
+    // 收到终止信号时由处理函数置停止标志并写 eventfd 唤醒事件循环线程，线程结束后再退出主循环
+    QObject::connect(&server, &QThread::finished, &a, &QCoreApplication::quit, Qt::QueuedConnection);
+    runningEpoll.storeRelease(&server);
+    std::signal(SIGINT, stopEpoll);
+    std::signal(SIGTERM, stopEpoll);
+
+    if (!server.listen(options.port, &errorMessage)) {
+        runningEpoll.storeRelease(nullptr);
+        server.logSink()->append(QString("【错误】服务器启动失败：%1").arg(errorMessage));
+        return 1;
+    }
+    server.logSink()->append(QString("【信息】服务器已启动（epoll 后端），监听端口 %1").arg(server.serverPort()));
+    server.logSink()->append("【信息】epoll 后端只提供 JSON 行协议；房间、续连、集群与热重启请使用 qt 后端");
+
+    const int result = a.exec();
+    // 先让事件循环线程关完连接，日志线程再写完剩余内容
+    server.stop();
+    server.wait();
+    runningEpoll.storeRelease(nullptr);
+    return result;
+}
+#endif
+
+// 无界面的聊天室服务器：日志由后台线程批量写入文件或标准输出
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("聊天室服务器（无界面）");
+    parser.addHelpOption();
+    ServerOptions::addOptions(parser);
+    QCommandLineOption logFileOption(QStringList() << "l" << "log-file",
+                                     "日志文件路径，缺省时写到标准输出。", "file");
+    parser.addOption(logFileOption);
+    QCommandLineOption backendOption("backend",
+                                     "网络后端：qt（QTcpSocket，功能完整）或 epoll（仅 Linux，边沿触发的原始套接字）。",
+                                     "backend", "qt");
+    parser.addOption(backendOption);
+    parser.process(a);
+
+    ServerOptions options;
+    QString errorMessage;
+    if (!options.parse(parser, &errorMessage)) {
+        qCritical("%s", qPrintable(errorMessage));
+        return 1;
+    }
+
+    const QString backend = parser.value(backendOption);
+    if (backend == "epoll") {
+#ifdef Q_OS_LINUX
+        return runEpoll(a, options, parser.value(logFileOption));
+#else
+        qCritical("epoll 后端只在 Linux 上提供");
+        return 1;
+#endif
+    }
+    if (backend != "qt") {
+        qCritical("未知的网络后端：%s", qPrintable(backend));
+        return 1;
+    }
+
+    ChatServer server(options.workerCount);
+    if (!options.applyTo(&server, &errorMessage)) {
+        qCritical("%s", qPrintable(errorMessage));
+        return 1;
+    }
+
+    LogWriter logWriter(server.logSink());
+    if (!logWriter.open(parser.value(logFileOption))) {
+        qCritical("无法打开日志文件: %s", qPrintable(logWriter.errorString()));
+        return 1;
+    }
+    logWriter.start();
+
+    // 收到终止信号时正常退出事件循环，让日志线程写完剩余内容
+#ifdef Q_OS_UNIX
+    if (::pipe(signalPipe) == 0) {
+        // 管道不传给热重启启动的新进程
+        ::fcntl(signalPipe[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(signalPipe[1], F_SETFD, FD_CLOEXEC);
+        QSocketNotifier *signalNotifier = new QSocketNotifier(signalPipe[0], QSocketNotifier::Read, &a);
+        QObject::connect(signalNotifier, &QSocketNotifier::activated, &server, [&server]() {
+            char byte;
+            if (::read(signalPipe[0], &byte, 1) != 1)
+                return;
+            if (byte == 'Q') {
+                QCoreApplication::quit();
+            } else if (!server.isDraining()) {
+                server.logSink()->append("【提示】收到 SIGHUP，开始热重启...");
+                server.drain();
+            }
+        });
+        QObject::connect(&server, &ChatServer::drained, &server, [&server]() {
+            QString error;
+            if (Handoff::restart(&server, &error)) {
+                server.logSink()->append("【提示】新进程已接管监听端口，本进程退出。");
+            } else {
+                server.logSink()->append(QString("【错误】热重启失败：%1").arg(error));
+                server.close();
+            }
+            QCoreApplication::quit();
+        });
+        std::signal(SIGINT, signalToPipe);
+        std::signal(SIGTERM, signalToPipe);
+        std::signal(SIGHUP, signalToPipe);
+    } else {
+        qWarning("无法创建信号管道，SIGINT/SIGTERM/SIGHUP 保持默认处理");
+    }
+#else
+    // Windows 的控制台信号在另一个线程上回调，不受异步信号安全的限制
+    auto quitHandler = [](int) { QCoreApplication::quit(); };
+    std::signal(SIGINT, quitHandler);
+    std::signal(SIGTERM, quitHandler);
+#endif
+
+    if (!options.listen(&server, &errorMessage)) {
+        server.logSink()->append(QString("【错误】服务器启动失败：%1").arg(errorMessage));
+        return 1;
+    }
+    server.logSink()->append(QString("【信息】服务器已启动，监听端口 %1").arg(server.serverPort()));
+    if (server.workerCount() > 0)
+        server.logSink()->append(QString("【信息】连接分布在 %1 个工作线程上").arg(server.workerCount()));
+
+    return a.exec();
+}
@@ -0,0 +1,14 @@
+QT       += core network testlib
+QT       -= gui
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_wire
+TEMPLATE = app
+
+# 用到 ServerCore 的 RoomLog、Frames 与 MessageArena，连同 Common 的线路协议代码一起编译
+include(../ServerCore/servercore.pri)
+
+SOURCES += \
+    tst_wire.cpp
@@ -0,0 +1,476 @@
+#include "frames.h"
+#include "jsonview.h"
+#include "messagearena.h"
+#include "roomlog.h"
+#include "wirecompression.h"
+#include "wireformat.h"
+
+#include <QBuffer>
+#include <QCborArray>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+#include <QtTest>
+
+// 线路协议与房间消息缓冲的单元测试：JsonView 就地解析、Wire::Reader 分帧、
+// 预置字典压缩与 RoomLog 的序号和内存上限
+class TestWire : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void escapes_data();
+    void escapes();
+    void invalidUtf8();
+    void truncated_data();
+    void truncated();
+    void nesting();
+    void numbers_data();
+    void numbers();
+    void duplicateKeys();
+    void arenaReuse();
+
+    void readerJsonSplit();
+    void readerCbor();
+    void readerSwitchToCbor();
+    void compression();
+
+    void roomLogSequence();
+    void roomLogRing();
+    void roomLogRoomBytes();
+    void roomLogTotalBytes();
+    void roomLogEviction();
+    void roomLogHandoff();
+};
+
+// 把 bytes 当作这次从套接字读到的数据交给 reader
+static Wire::Reader::Status feed(Wire::Reader &reader, const QByteArray &bytes, Wire::Message *message)
+{
+    QBuffer device;
+    device.setData(bytes);
+    device.open(QIODevice::ReadOnly);
+    return reader.next(&device, message);
+}
+
+static qint64 seqOf(const Frame &frame)
+{
+    return QJsonDocument::fromJson(frame.json).object().value(QLatin1String("seq")).toVariant().toLongLong();
+}
+
+// chat_range 帧两种编码中各条消息的序号
+struct RangeSeqs
+{
+    QList<qint64> json;
+    QList<qint64> cbor;
+    bool complete = false;
+    qint64 last = 0;
+};
+
+static RangeSeqs rangeSeqs(const Frame &frame)
+{
+    RangeSeqs seqs;
+    const QJsonObject json = QJsonDocument::fromJson(frame.json).object();
+    for (const QJsonValue &value : json.value(QLatin1String("messages")).toArray())
+        seqs.json.append(value.toObject().value(QLatin1String("seq")).toVariant().toLongLong());
+    const QCborMap cbor = QCborValue::fromCbor(frame.cbor.mid(Wire::HeaderSize)).toMap();
+    for (const QCborValue &value : cbor.value(QLatin1String("messages")).toArray())
+        seqs.cbor.append(value.toMap().value(QLatin1String("seq")).toInteger());
+    seqs.complete = json.value(QLatin1String("complete")).toBool();
+    seqs.last = json.value(QLatin1String("last")).toVariant().toLongLong();
+    return seqs;
+}
+
+static QList<qint64> sequence(qint64 first, qint64 last)
+{
+    QList<qint64> seqs;
+    for (qint64 seq = first; seq <= last; ++seq)
+        seqs.append(seq);
+    return seqs;
+}
+
+void TestWire::escapes_data()
+{
+    QTest::addColumn<QByteArray>("json");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("plain") << QByteArray(R"({"s":"abc"})") << QStringLiteral("abc");
+    QTest::newRow("quote and slashes") << QByteArray(R"({"s":"a\"b\\c\/d"})") << QStringLiteral("a\"b\\c/d");
+    QTest::newRow("control") << QByteArray(R"({"s":"\b\f\n\r\t"})") << QStringLiteral("\b\f\n\r\t");
+    QTest::newRow("bmp") << QByteArray(R"({"s":"\u00e9\u4e2d"})") << (QString(QChar(0x00E9)) + QChar(0x4E2D));
+    QTest::newRow("surrogate pair") << QByteArray(R"({"s":"\ud83d\ude00!"})")
+                                    << (QString(QChar(0xD83D)) + QChar(0xDE00) + QLatin1Char('!'));
+    QTest::newRow("lone high surrogate") << QByteArray(R"({"s":"\ud83dx"})")
+                                         << (QString(QChar(QChar::ReplacementCharacter)) + QLatin1Char('x'));
+    QTest::newRow("lone low surrogate") << QByteArray(R"({"s":"\ude00"})")
+                                        << QString(QChar(QChar::ReplacementCharacter));
+    QTest::newRow("high surrogate before non-low") << QByteArray(R"({"s":"\ud83d\u0041"})")
+                                                   << (QString(QChar(QChar::ReplacementCharacter)) + QLatin1Char('A'));
+    QTest::newRow("bad hex") << QByteArray(R"({"s":"\uZZZZ"})")
+                             << (QString(QChar(QChar::ReplacementCharacter)) + QStringLiteral("ZZZZ"));
+    QTest::newRow("raw utf-8") << QByteArray("{\"s\":\"\xe4\xb8\xad\xe6\x96\x87\"}")
+                               << QString::fromUtf8("\xe4\xb8\xad\xe6\x96\x87");
+    QTest::newRow("escaped key") << QByteArray(R"({"\u0073":"v"})") << QStringLiteral("v");
+}
+
+// string()、readString() 与 value() 三条取值路径的结果须一致
+void TestWire::escapes()
+{
+    QFETCH(QByteArray, json);
+    QFETCH(QString, expected);
+
+    Wire::JsonView view;
+    QVERIFY2(view.parse(json.constData(), json.size()), qPrintable(view.errorString()));
+    QCOMPARE(view.kind(QLatin1String("s")), Wire::JsonView::String);
+    QCOMPARE(view.string(QLatin1String("s")), expected);
+    QString out = QStringLiteral("stale content that must not survive");
+    QVERIFY(view.readString(QLatin1String("s"), &out));
+    QCOMPARE(out, expected);
+    QCOMPARE(view.value(QLatin1String("s")).toString(), expected);
+}
+
+void TestWire::invalidUtf8()
+{
+    const QByteArray json("{\"s\":\"a\xff" "b\"}");
+    Wire::JsonView view;
+    QVERIFY(view.parse(json.constData(), json.size()));
+    QString out;
+    QVERIFY(view.readString(QLatin1String("s"), &out));
+    QCOMPARE(out, QString(QLatin1Char('a')) + QChar(QChar::ReplacementCharacter) + QLatin1Char('b'));
+}
+
+void TestWire::truncated_data()
+{
+    QTest::addColumn<QByteArray>("json");
+
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("not an object") << QByteArray("[1]");
+    QTest::newRow("open brace") << QByteArray("{");
+    QTest::newRow("key only") << QByteArray(R"({"a")");
+    QTest::newRow("no value") << QByteArray(R"({"a":)");
+    QTest::newRow("unterminated string") << QByteArray(R"({"a":"x)");
+    QTest::newRow("escape at end") << QByteArray(R"({"a":"x\)");
+    QTest::newRow("raw newline in string") << QByteArray("{\"a\":\"x\ny\"}");
+    QTest::newRow("partial literal") << QByteArray(R"({"a":tru)");
+    QTest::newRow("bare minus") << QByteArray(R"({"a":-})");
+    QTest::newRow("no closing brace") << QByteArray(R"({"a":1)");
+    QTest::newRow("trailing comma") << QByteArray(R"({"a":1,)");
+    QTest::newRow("unquoted key") << QByteArray("{a:1}");
+    QTest::newRow("unterminated object") << QByteArray(R"({"a":{"b":1})");
+    QTest::newRow("unterminated array") << QByteArray(R"({"a":[1,2)");
+    QTest::newRow("trailing content") << QByteArray(R"({"a":1}})");
+}
+
+void TestWire::truncated()
+{
+    QFETCH(QByteArray, json);
+
+    Wire::JsonView view;
+    QVERIFY(!view.parse(json.constData(), json.size()));
+    QVERIFY(!view.errorString().isEmpty());
+}
+
+// 嵌套的对象与数组只做括号匹配，字符串里的括号不算
+void TestWire::nesting()
+{
+    const QByteArray json(R"(  {"a":{"b":[1,{"c":"}]"}]},"d":2,"e":[]}  )");
+    Wire::JsonView view;
+    QVERIFY2(view.parse(json.constData(), json.size()), qPrintable(view.errorString()));
+    QCOMPARE(view.kind(QLatin1String("a")), Wire::JsonView::Object);
+    QCOMPARE(view.kind(QLatin1String("e")), Wire::JsonView::Array);
+    QCOMPARE(view.integer(QLatin1String("d")), qint64(2));
+
+    const QCborArray b = view.value(QLatin1String("a")).toMap().value(QLatin1String("b")).toArray();
+    QCOMPARE(b.size(), 2);
+    QCOMPARE(b.at(1).toMap().value(QLatin1String("c")).toString(), QStringLiteral("}]"));
+    QVERIFY(view.value(QLatin1String("e")).toArray().isEmpty());
+
+    const QByteArray empty("{}");
+    QVERIFY(view.parse(empty.constData(), empty.size()));
+    QCOMPARE(view.kind(QLatin1String("a")), Wire::JsonView::Missing);
+}
+
+void TestWire::numbers_data()
+{
+    QTest::addColumn<QByteArray>("number");
+    QTest::addColumn<qint64>("expected");
+
+    // 取不出整数时 integer() 返回默认值 -1
+    QTest::newRow("zero") << QByteArray("0") << qint64(0);
+    QTest::newRow("negative") << QByteArray("-42") << qint64(-42);
+    QTest::newRow("max") << QByteArray("9223372036854775807") << std::numeric_limits<qint64>::max();
+    QTest::newRow("-max") << QByteArray("-9223372036854775807") << -std::numeric_limits<qint64>::max();
+    QTest::newRow("max + 1") << QByteArray("9223372036854775808") << qint64(-1);
+    QTest::newRow("-max - 2") << QByteArray("-9223372036854775809") << qint64(-1);
+    QTest::newRow("twenty digits") << QByteArray("99999999999999999999") << qint64(-1);
+    QTest::newRow("very long") << QByteArray("12345678901234567890123") << qint64(-1);
+    QTest::newRow("exponent") << QByteArray("1e3") << qint64(1000);
+    QTest::newRow("integral fraction") << QByteArray("2.0") << qint64(2);
+    QTest::newRow("fraction") << QByteArray("1.5") << qint64(-1);
+}
+
+void TestWire::numbers()
+{
+    QFETCH(QByteArray, number);
+    QFETCH(qint64, expected);
+
+    const QByteArray json = "{\"n\":" + number + "}";
+    Wire::JsonView view;
+    QVERIFY2(view.parse(json.constData(), json.size()), qPrintable(view.errorString()));
+    QCOMPARE(view.kind(QLatin1String("n")), Wire::JsonView::Number);
+    QCOMPARE(view.integer(QLatin1String("n"), -1), expected);
+}
+
+// 重复的键以最后一个为准，转义写法的键也算同一个
+void TestWire::duplicateKeys()
+{
+    const QByteArray json(R"({"a":1,"b":"x","a":2})");
+    Wire::JsonView view;
+    QVERIFY(view.parse(json.constData(), json.size()));
+    QCOMPARE(view.integer(QLatin1String("a")), qint64(2));
+    QCOMPARE(view.toMap().value(QLatin1String("a")).toInteger(), qint64(2));
+    QCOMPARE(view.toMap().size(), 2);
+
+    const QByteArray escaped(R"({"a":"first","a":"second"})");
+    QVERIFY(view.parse(escaped.constData(), escaped.size()));
+    QCOMPARE(view.string(QLatin1String("a")), QStringLiteral("second"));
+    QCOMPARE(view.toMap().value(QLatin1String("a")).toString(), QStringLiteral("second"));
+}
+
+// readString 解码进 MessageArena 复用的字符串：独占时沿用原来的存储，
+// 被别处留着时换一块新的，留着的内容不变
+void TestWire::arenaReuse()
+{
+    const QByteArray json(R"({"long":"hello world, this value is long","short":"hi","escaped":"a\nb","n":1})");
+    Wire::JsonView view;
+    QVERIFY(view.parse(json.constData(), json.size()));
+
+    MessageArena arena;
+    QString &first = arena.string();
+    QVERIFY(view.readString(QLatin1String("long"), &first));
+    QCOMPARE(first, QStringLiteral("hello world, this value is long"));
+    const QChar *storage = first.constData();
+
+    arena.reset();
+    QString &second = arena.string();
+    QCOMPARE(&second, &first);
+    QVERIFY(second.isEmpty());
+    QVERIFY(view.readString(QLatin1String("short"), &second));
+    QCOMPARE(second, QStringLiteral("hi"));
+    QCOMPARE(second.constData(), storage);
+
+    QVERIFY(view.readString(QLatin1String("escaped"), &second));
+    QCOMPARE(second, QStringLiteral("a\nb"));
+    const QString kept = second;
+
+    arena.reset();
+    QString &third = arena.string();
+    QVERIFY(third.isEmpty());
+    QVERIFY(view.readString(QLatin1String("long"), &third));
+    QCOMPARE(third, QStringLiteral("hello world, this value is long"));
+    QCOMPARE(kept, QStringLiteral("a\nb"));
+
+    // 缺失或不是字符串的字段：返回 false 并清空
+    QVERIFY(!view.readString(QLatin1String("missing"), &third));
+    QVERIFY(third.isEmpty());
+    QVERIFY(view.readString(QLatin1String("short"), &third));
+    QVERIFY(!view.readString(QLatin1String("n"), &third));
+    QVERIFY(third.isEmpty());
+
+    // Cbor 线路上的消息走同一个接口
+    const Wire::Message message(QCborMap{{QStringLiteral("type"), QStringLiteral("chat_message")},
+                                         {QStringLiteral("message"), QStringLiteral("cbor")}});
+    QVERIFY(message.readString(QLatin1String("message"), &third));
+    QCOMPARE(third, QStringLiteral("cbor"));
+}
+
+// 一行分两次到达，一次到达多行
+void TestWire::readerJsonSplit()
+{
+    Wire::Reader reader;
+    Wire::Message message;
+    QCOMPARE(feed(reader, R"({"type":"ping","n":)", &message), Wire::Reader::NeedMore);
+    QCOMPARE(feed(reader, "42}\n{oops}\n{\"type\":\"pong\"}\n", &message), Wire::Reader::Message);
+    QCOMPARE(QString(message.type()), QStringLiteral("ping"));
+    QCOMPARE(message.integer(QLatin1String("n")), qint64(42));
+
+    QCOMPARE(feed(reader, QByteArray(), &message), Wire::Reader::Malformed);
+    QVERIFY(!reader.errorString().isEmpty());
+    QCOMPARE(reader.rawFrame(), QByteArray("{oops}"));
+
+    // 出错的一行已被消费，后面的照常解析
+    QCOMPARE(feed(reader, QByteArray(), &message), Wire::Reader::Message);
+    QCOMPARE(QString(message.type()), QStringLiteral("pong"));
+    QCOMPARE(feed(reader, QByteArray(), &message), Wire::Reader::NeedMore);
+}
+
+void TestWire::readerCbor()
+{
+    const QCborMap map{{QStringLiteral("type"), QStringLiteral("chat_message")},
+                       {QStringLiteral("message"), QStringLiteral("hello")}};
+    const QByteArray frame = Wire::encode(map, Wire::Cbor);
+
+    Wire::Reader reader(Wire::Cbor);
+    Wire::Message message;
+    QCOMPARE(feed(reader, frame.left(3), &message), Wire::Reader::NeedMore);
+    QCOMPARE(feed(reader, frame.mid(3, 4), &message), Wire::Reader::NeedMore);
+    QCOMPARE(feed(reader, frame.mid(7), &message), Wire::Reader::Message);
+    QCOMPARE(QString(message.type()), QStringLiteral("chat_message"));
+    QCOMPARE(message.string(QLatin1String("message")), QStringLiteral("hello"));
+
+    // 帧头给出的长度超过上限：流已无法继续
+    QByteArray oversized(Wire::HeaderSize, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(Wire::MaxFrameSize) + 1, oversized.data());
+    Wire::Reader fatal(Wire::Cbor);
+    QCOMPARE(feed(fatal, oversized, &message), Wire::Reader::Fatal);
+}
+
+// 协商 CBOR 后，与 login 同一批到达的后续帧照常解析
+void TestWire::readerSwitchToCbor()
+{
+    const QByteArray login("{\"type\":\"login\",\"wire\":\"cbor\"}\n");
+    const QByteArray frame = Wire::encode(QCborMap{{QStringLiteral("type"), QStringLiteral("ping")}}, Wire::Cbor);
+
+    Wire::Reader reader;
+    Wire::Message message;
+    QCOMPARE(feed(reader, login + frame, &message), Wire::Reader::Message);
+    QCOMPARE(QString(message.type()), QStringLiteral("login"));
+    reader.setFormat(Wire::Cbor);
+    QCOMPARE(feed(reader, QByteArray(), &message), Wire::Reader::Message);
+    QCOMPARE(QString(message.type()), QStringLiteral("ping"));
+}
+
+void TestWire::compression()
+{
+    const QCborMap map{{QStringLiteral("type"), QStringLiteral("chat_message")},
+                       {QStringLiteral("sender"), QStringLiteral("alice")},
+                       {QStringLiteral("message"), QString(200, QLatin1Char('x'))},
+                       {QStringLiteral("room"), QStringLiteral("lobby")}};
+    const QByteArray frame = Wire::encode(map, Wire::Cbor);
+
+    QVERIFY(Wire::compressFrame(frame, frame.size()).isEmpty());
+    const QByteArray compressed = Wire::compressFrame(frame, 64);
+    QVERIFY(!compressed.isEmpty());
+    QVERIFY(compressed.size() < frame.size());
+    const quint32 prefix = qFromBigEndian<quint32>(compressed.constData());
+    QVERIFY(prefix & Wire::CompressedFlag);
+    QCOMPARE(static_cast<int>(prefix & ~Wire::CompressedFlag), compressed.size() - Wire::HeaderSize);
+
+    const QByteArray payload = compressed.mid(Wire::HeaderSize);
+    QByteArray plain;
+    QVERIFY(Wire::decompressPayload(payload, &plain));
+    QCOMPARE(plain, frame.mid(Wire::HeaderSize));
+
+    QVERIFY(!Wire::decompressPayload(payload.left(payload.size() / 2), &plain));
+    QVERIFY(!Wire::decompressPayload(QByteArray("ab"), &plain));
+    QByteArray oversized = payload;
+    qToBigEndian<quint32>(static_cast<quint32>(Wire::MaxFrameSize) + 1, oversized.data());
+    QVERIFY(!Wire::decompressPayload(oversized, &plain));
+
+    // 未协商压缩的连接收到压缩帧是协议错误
+    Wire::Reader plainReader(Wire::Cbor);
+    Wire::Message message;
+    QCOMPARE(feed(plainReader, compressed, &message), Wire::Reader::Fatal);
+    Wire::Reader reader(Wire::Cbor);
+    reader.setCompression(true);
+    QCOMPARE(feed(reader, compressed, &message), Wire::Reader::Message);
+    QCOMPARE(message.string(QLatin1String("message")), QString(200, QLatin1Char('x')));
+}
+
+void TestWire::roomLogSequence()
+{
+    RoomLog log;
+    QCOMPARE(log.lastSeq(QStringLiteral("a")), quint64(0));
+    QCOMPARE(seqOf(log.append(QStringLiteral("a"), QStringLiteral("alice"), QStringLiteral("1"))), qint64(1));
+    QCOMPARE(seqOf(log.append(QStringLiteral("a"), QStringLiteral("alice"), QStringLiteral("2"))), qint64(2));
+    QCOMPARE(seqOf(log.append(QStringLiteral("b"), QStringLiteral("bob"), QStringLiteral("1"))), qint64(1));
+    QCOMPARE(log.lastSeq(QStringLiteral("a")), quint64(2));
+
+    const RangeSeqs all = rangeSeqs(log.range(QStringLiteral("a"), 0, 0));
+    QCOMPARE(all.json, sequence(1, 2));
+    QCOMPARE(all.cbor, all.json);
+    QVERIFY(all.complete);
+    QCOMPARE(all.last, qint64(2));
+
+    const RangeSeqs tail = rangeSeqs(log.range(QStringLiteral("a"), 1, 0));
+    QCOMPARE(tail.json, sequence(2, 2));
+}
+
+// 环形缓冲满了覆盖最旧的，缺口开头已不在缓冲里时 complete 为 false
+void TestWire::roomLogRing()
+{
+    RoomLog log(4);
+    for (int i = 0; i < 6; ++i)
+        log.append(QStringLiteral("a"), QStringLiteral("alice"), QString::number(i));
+
+    const RangeSeqs all = rangeSeqs(log.range(QStringLiteral("a"), 0, 0));
+    QCOMPARE(all.json, sequence(3, 6));
+    QCOMPARE(all.cbor, all.json);
+    QVERIFY(!all.complete);
+    QVERIFY(rangeSeqs(log.range(QStringLiteral("a"), 2, 0)).complete);
+}
+
+// 单个房间超过字节上限时丢掉最旧的几条，留下的序号仍连续
+void TestWire::roomLogRoomBytes()
+{
+    RoomLog log(RoomLog::DefaultCapacity, RoomLog::DefaultMaxRooms, 16 * 1024, 1 << 30);
+    const QString message(1000, QLatin1Char('x'));
+    for (int i = 0; i < 40; ++i)
+        log.append(QStringLiteral("a"), QStringLiteral("alice"), message);
+
+    const RangeSeqs kept = rangeSeqs(log.range(QStringLiteral("a"), 0, 0));
+    QVERIFY(!kept.json.isEmpty());
+    QVERIFY(kept.json.size() < 40);
+    QCOMPARE(kept.json, sequence(41 - kept.json.size(), 40));
+    QCOMPARE(kept.cbor, kept.json);
+    QVERIFY(!kept.complete);
+}
+
+// 全部房间超过字节上限时淘汰最久未用的房间；之后的序号从被淘汰房间的最大序号接着编
+void TestWire::roomLogTotalBytes()
+{
+    RoomLog log(RoomLog::DefaultCapacity, RoomLog::DefaultMaxRooms, 1 << 20, 32 * 1024);
+    const QString message(1000, QLatin1Char('x'));
+    for (int i = 0; i < 10; ++i)
+        log.append(QStringLiteral("a"), QStringLiteral("alice"), message);
+    for (int i = 0; i < 10; ++i)
+        log.append(QStringLiteral("b"), QStringLiteral("bob"), message);
+
+    QCOMPARE(rangeSeqs(log.range(QStringLiteral("b"), 0, 0)).json, sequence(1, 10));
+    QVERIFY(rangeSeqs(log.range(QStringLiteral("a"), 0, 0)).json.isEmpty());
+    QCOMPARE(seqOf(log.append(QStringLiteral("a"), QStringLiteral("alice"), message)), qint64(11));
+}
+
+void TestWire::roomLogEviction()
+{
+    RoomLog log(16, 2);
+    log.append(QStringLiteral("a"), QStringLiteral("alice"), QStringLiteral("1"));
+    log.append(QStringLiteral("a"), QStringLiteral("alice"), QStringLiteral("2"));
+    log.append(QStringLiteral("b"), QStringLiteral("bob"), QStringLiteral("1"));
+    // 第三个房间挤掉最久未用的 a，c 从 a 的最大序号之后编号
+    QCOMPARE(seqOf(log.append(QStringLiteral("c"), QStringLiteral("carol"), QStringLiteral("1"))), qint64(3));
+    QCOMPARE(log.lastSeq(QStringLiteral("b")), quint64(1));
+    QCOMPARE(log.lastSeq(QStringLiteral("a")), quint64(2));
+    QVERIFY(seqOf(log.append(QStringLiteral("a"), QStringLiteral("alice"), QStringLiteral("3"))) > 2);
+}
+
+void TestWire::roomLogHandoff()
+{
+    RoomLog log;
+    for (int i = 0; i < 3; ++i)
+        log.append(QStringLiteral("a"), QStringLiteral("alice"), QString::number(i));
+
+    RoomLog restored;
+    restored.importState(log.exportState());
+    QCOMPARE(restored.epoch(), log.epoch());
+    QCOMPARE(restored.lastSeq(QStringLiteral("a")), quint64(3));
+    const Frame before = log.range(QStringLiteral("a"), 0, 0);
+    const Frame after = restored.range(QStringLiteral("a"), 0, 0);
+    QCOMPARE(after.json, before.json);
+    QCOMPARE(after.cbor, before.cbor);
+    QCOMPARE(seqOf(restored.append(QStringLiteral("a"), QStringLiteral("alice"), QStringLiteral("3"))), qint64(4));
+}
+
+QTEST_GUILESS_MAIN(TestWire)
+
+#include "tst_wire.moc"
@@ -3,6 +3,9 @@ TEMPLATE = subdirs
 SUBDIRS += \
     ClientApp \
     ServerApp \
+    ServerDaemon \
+    LoadGen \
+    Tests \
 
 client.depends = common
 server.depends = common